@@ -1,6 +1,7 @@
 #pragma once
 
 #include <boost/beast/core/detail/base64.hpp>
+#include <boost/beast/version.hpp>
 #include "namespaces.h"
 #include "generic_stream.h"
 #include "http_util.h"
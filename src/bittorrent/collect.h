@@ -1,12 +1,26 @@
 #pragma once
 
 #include <iostream>
+#include <type_traits>
 #include "../util/scheduler.h"
 #include "../util/watch_dog.h"
 #include "../util/async_queue.h"
 
 namespace ouinet { namespace bittorrent {
 
+/*
+ * Evaluate candidates closest to some target first, adding the closer
+ * candidates they report, until there are no candidates left.
+ *
+ * The number of candidates evaluated in parallel (alpha) adapts to how
+ * responsive they are: each candidate which is dismissed by its watch dog
+ * (see `send_query_await_reply`) allows one more, and each one evaluated
+ * in time allows one less, within `[min_alpha, max_alpha]`.
+ *
+ * If `evaluate` returns a `bool` telling whether the candidate replied,
+ * the lookup also ends as soon as the `k` closest candidates
+ * which did not fail have replied, since any candidates left are farther.
+ */
 template<class CandidateSet, class Evaluate>
 void collect(
     DebugCtx dbg,
@@ -14,14 +28,25 @@ void collect(
     CandidateSet first_candidates,
     Evaluate&& evaluate,
     Cancel& cancel_signal_,
-    asio::yield_context yield
+    asio::yield_context yield,
+    size_t k = 8
 ) {
     Cancel cancel_signal(cancel_signal_);
 
     using namespace std;
     using dht::NodeContact;
 
-    enum Progress { unused, used };
+    const size_t min_alpha = 3;
+    const size_t max_alpha = 16;
+
+    using EvalResult = decltype(evaluate( std::declval<const Contact&>()
+                                        , std::declval<WatchDog&>()
+                                        , std::declval<util::AsyncQueue<NodeContact>&>()
+                                        , std::declval<Cancel&>()
+                                        , std::declval<asio::yield_context>()));
+    constexpr bool reports_replies = std::is_same<EvalResult, bool>::value;
+
+    enum Progress { unused, used, replied, failed };
 
     using Candidates = std::map< Contact
                                , Progress
@@ -40,7 +65,25 @@ void collect(
     WaitCondition all_done(exec);
     util::AsyncQueue<dht::NodeContact> new_candidates(exec);
 
-    Scheduler scheduler(exec, 8);
+    size_t alpha = min_alpha;
+    Scheduler scheduler(exec, alpha);
+
+    auto adapt_alpha = [&] (bool in_time) {
+        if (in_time && alpha > min_alpha) alpha--;
+        if (!in_time && alpha < max_alpha) alpha++;
+        scheduler.set_max_running_jobs(alpha);
+    };
+
+    // Whether the `k` closest candidates which did not fail have replied.
+    auto closest_replied = [&] {
+        size_t count = 0;
+        for (auto& c : candidates) {
+            if (c.second == failed) continue;
+            if (c.second != replied) return false;
+            if (++count == k) return true;
+        }
+        return false;
+    };
 
     auto pick_candidate = [&] {
         // Pick the closest untried candidate...
@@ -67,7 +110,7 @@ void collect(
         if (dbg) cerr << dbg << " Done waiting for job (job count:" << scheduler.slot_count() << ")\n";
 
         assert(!local_cancel || ec == asio::error::operation_aborted);
-        if (ec) break;
+        if (ec || local_cancel) break;
 
         auto candidate_i = pick_candidate();
 
@@ -83,14 +126,11 @@ void collect(
             if (dbg) cerr << dbg << " Start waiting for candidate (active jobs:"
                           << active_jobs.size() << " new_candidates:" << new_candidates.size() << ")\n";
 
-            assert(!local_cancel);
             new_candidates.async_flush(cs, local_cancel, yield[ec2]);
 
             if (dbg) cerr << dbg << " End waiting for candidate "
                           << ec2.message() << " " << cs.size() << "\n";
 
-            assert(!local_cancel || ec2 == asio::error::operation_aborted);
-
             if (ec2 == asio::error::eof) {
                 continue;
             }
@@ -107,14 +147,12 @@ void collect(
             candidate_i = pick_candidate();
         }
 
-        if (candidate_i == candidates.end()) break;
-
-        assert(!local_cancel);
+        if (candidate_i == candidates.end() || local_cancel) break;
 
         auto job_id = next_job_id++;
         active_jobs.insert(job_id);
 
-        asio::spawn(exec, [ &
+        util::spawn(exec, [ &
                           , candidate = candidate_i->first
                           , job_id
                           , lock = all_done.lock()
@@ -141,27 +179,30 @@ void collect(
                                          , yield);
             };
 
-            bool is_first_round = first_candidates.count(candidate);
-
-            if (is_first_round) {
-                WatchDog wd(exec, std::chrono::seconds(5), [&] () mutable {
-                        if (dbg) cerr << dbg << "dismiss " << candidate << "\n";
-                        on_finish();
-                    });
-
-                WatchDog dummy_wd;
-
-                evaluate( candidate
-                        , dummy_wd
-                        , new_candidates
-                        , local_cancel
-                        , yield[ec]);
+            // Queries extend this to their reply timeout once sent.
+            WatchDog wd(exec, std::chrono::milliseconds(200), [&] () mutable {
+                    if (dbg) cerr << dbg << "dismiss " << candidate << "\n";
+                    if (!local_cancel) adapt_alpha(false);
+                    on_finish();
+                });
+
+            if constexpr (reports_replies) {
+                bool ok = evaluate( candidate
+                                  , wd
+                                  , new_candidates
+                                  , local_cancel
+                                  , yield[ec]);
+
+                if (!local_cancel) {
+                    auto i = candidates.find(candidate);
+                    if (i != candidates.end()) i->second = ok ? replied : failed;
+
+                    if (closest_replied()) {
+                        if (dbg) cerr << dbg << "closest " << k << " candidates replied\n";
+                        local_cancel();
+                    }
+                }
             } else {
-                WatchDog wd(exec, std::chrono::milliseconds(200), [&] () mutable {
-                        if (dbg) cerr << dbg << "dismiss " << candidate << "\n";
-                        on_finish();
-                    });
-
                 evaluate( candidate
                         , wd
                         , new_candidates
@@ -169,6 +210,7 @@ void collect(
                         , yield[ec]);
             }
 
+            if (!on_finish_called && !local_cancel) adapt_alpha(true);
             on_finish();
         });
     }
@@ -24,6 +24,7 @@
 #include "../util/success_condition.h"
 #include "../util/wait_condition.h"
 #include "../util/file_io.h"
+#include "../util/metrics.h"
 #include "../util/variant.h"
 #include "../logger.h"
 
@@ -228,7 +229,14 @@ void dht::DhtNode::start(udp::endpoint local_ep, asio::yield_context yield)
 
 void dht::DhtNode::start(asio_utp::udp_multiplexer m, asio::yield_context yield)
 {
-    _multiplexer = std::make_unique<UdpMultiplexer>(move(m));
+    return start(std::make_unique<UdpMultiplexer>(move(m)), yield);
+}
+
+void dht::DhtNode::start( std::unique_ptr<UdpMultiplexer> m
+                        , asio::yield_context yield)
+{
+    _multiplexer = move(m);
+    _local_endpoint = _multiplexer->local_endpoint();
 
     _tracker = std::make_unique<Tracker>(_exec);
     _data_store = std::make_unique<DataStore>(_exec);
@@ -1025,6 +1033,28 @@ void dht::DhtNode::send_query(
     );
 }
 
+/*
+ * How long to wait for a reply to a query before sending it again:
+ * from the round trip times of the node if it is in the routing table,
+ * otherwise from the reply times of all nodes to queries of that type.
+ */
+Clock::duration dht::DhtNode::reply_timeout(
+    const Contact& dst,
+    const std::string& query_type
+) {
+    using namespace std::chrono_literals;
+
+    boost::optional<Clock::duration> rto;
+
+    if (dst.id && _routing_table) {
+        rto = _routing_table->retransmission_timeout({ .id = *dst.id, .endpoint = dst.endpoint });
+    }
+
+    if (!rto) rto = _stats->max_reply_wait_time(query_type);
+
+    return std::min(std::max(*rto, Clock::duration(250ms)), Stat::default_max_reply_wait_time());
+}
+
 /*
  * Send a query message to a destination, and wait for either a reply, an error
  * reply, or a timeout.
@@ -1047,14 +1077,12 @@ BencodedMap dht::DhtNode::send_query_await_reply(
 
     sys::error_code ec;
 
-    //auto timeout = _stats->max_reply_wait_time(query_type);
-    auto timeout = std::chrono::seconds(10);
+    auto rto = reply_timeout(dst, query_type);
 
     if (dms) {
-        auto d1 = dms->time_to_finish();
-        auto d2 = _stats->max_reply_wait_time(query_type);
-
-        dms->expires_after(std::max(d1,d2));
+        // Let lookups move on to other nodes if this one is being slow,
+        // its reply will still be used if it arrives later.
+        dms->expires_after(std::max(dms->time_to_finish(), rto));
     }
 
     auto start = Clock::now();
@@ -1065,17 +1093,6 @@ BencodedMap dht::DhtNode::send_query_await_reply(
     boost::optional<sys::error_code> first_error_code;
 
     asio::steady_timer timeout_timer(_exec);
-    timeout_timer.expires_from_now(timeout);
-
-    bool timer_handler_executed = false;
-
-    timeout_timer.async_wait([&] (const sys::error_code&) {
-        timer_handler_executed = true;
-        if (!first_error_code) {
-            first_error_code = asio::error::timed_out;
-        }
-        reply_and_timeout_condition.notify();
-    });
 
     auto cancelled = cancel_signal.connect([&] {
         first_error_code = asio::error::operation_aborted;
@@ -1105,22 +1122,44 @@ BencodedMap dht::DhtNode::send_query_await_reply(
         }
     };
 
-    send_query(
-        dst.endpoint,
-        transaction,
-        std::move(query_type),
-        std::move(query_arguments),
-        cancel_signal,
-        yield[ec]
-    );
+    /*
+     * If no reply arrives in time, send the query again (with the same
+     * transaction) and wait twice as long, as the query or its reply
+     * may have been lost.
+     */
+    unsigned attempts = 0;
 
-    if (ec) {
-        first_error_code = ec;
-        timeout_timer.cancel();
-    }
+    while (!first_error_code) {
+        send_query(
+            dst.endpoint,
+            transaction,
+            query_type,
+            query_arguments,
+            cancel_signal,
+            yield[ec]
+        );
+        attempts++;
+
+        if (ec && !first_error_code) {
+            first_error_code = ec;
+        }
+
+        if (first_error_code) break;
 
-    if (!timer_handler_executed) {
+        timeout_timer.expires_after(rto);
+        timeout_timer.async_wait([&] (const sys::error_code&) {
+            reply_and_timeout_condition.notify();
+        });
         reply_and_timeout_condition.wait(yield);
+
+        if (first_error_code) break;
+
+        if (attempts >= MAX_QUERY_ATTEMPTS) {
+            first_error_code = asio::error::timed_out;
+            break;
+        }
+
+        rto *= 2;
     }
 
     if (terminated) {
@@ -1139,10 +1178,24 @@ BencodedMap dht::DhtNode::send_query_await_reply(
         return or_throw<BencodedMap>(yield, asio::error::operation_aborted);
     }
 
-    if (!*first_error_code) {
+    // Replies to queries sent more than once may not be to the last one,
+    // so their times are not used (as in Karn's algorithm).
+    if (!*first_error_code && attempts == 1) {
         _stats->add_reply_time(query_type, Clock::now() - start);
     }
 
+    {
+        auto& r = metrics::registry();
+        const char* result = *first_error_code == asio::error::timed_out ? "timeout"
+                           : (*first_error_code || response["y"] != "r") ? "error"
+                           : "ok";
+        r.counter( "ouinet_dht_queries_total", "DHT queries sent"
+                 , {{"type", query_type}, {"result", result}}).inc();
+        if (!*first_error_code)
+            r.histogram( "ouinet_dht_query_duration_seconds", "Time to get DHT replies"
+                       , {{"type", query_type}}).observe(Clock::now() - start);
+    }
+
     if (dst.id) {
         NodeContact contact{ .id = *dst.id, .endpoint = dst.endpoint };
 
@@ -1156,6 +1209,10 @@ BencodedMap dht::DhtNode::send_query_await_reply(
              * Add the node to the routing table, subject to space limitations.
              */
             _routing_table->try_add_node(contact, true);
+
+            if (attempts == 1) {
+                _routing_table->add_rtt_sample(contact, Clock::now() - start);
+            }
         }
     }
 
@@ -1189,12 +1246,13 @@ void dht::DhtNode::handle_query(udp::endpoint sender, BencodedMap& query)
         send_datagram(
             sender,
             BencodedMap {
-                // TODO: Send version "v" and sender endpoint "ip" (same in
-                // above error reply).
+                // TODO: Send version "v" (same in above error reply).
                 // https://wiki.theory.org/BitTorrentSpecification
                 // http://www.bittorrent.org/beps/bep_0020.html
                 { "y", "r" },
                 { "t", transaction.to_string() },
+                // Sender endpoint, as used by bootstrapping nodes (BEP 42).
+                { "ip", encode_endpoint(sender) },
                 { "r", std::move(reply) }
             }
         );
@@ -1708,7 +1766,7 @@ void dht::DhtNode::bootstrap(asio::yield_context yield)
     sys::error_code ec;
     sys::error_code ignored_ec;
 
-    vector<bootstrap::Address> bootstraps {
+    vector<bootstrap::Address> default_bootstraps {
                                "router.bittorrent.com"
                                , "router.utorrent.com"
                                // Alternative bootstrap servers from the Ouinet project.
@@ -1721,6 +1779,12 @@ void dht::DhtNode::bootstrap(asio::yield_context yield)
                                , "dht.transmissionbt.com"
                                , "dht.vuze.com" };
 
+    vector<bootstrap::Address> bootstraps;
+
+    if (_use_default_bootstraps) {
+        bootstraps = std::move(default_bootstraps);
+    }
+
     for (auto& bootstrap : _extra_bs) {
         bootstraps.push_back(bootstrap);
     }
@@ -1949,7 +2013,8 @@ void dht::DhtNode::collect(
         std::move(seed_candidates),
         std::forward<Evaluate>(evaluate),
         cancel_signal,
-        yield
+        yield,
+        RESPONSIBLE_TRACKERS_PER_SWARM
     );
     if (terminated) {
         or_throw(yield, asio::error::operation_aborted);
@@ -1975,11 +2040,11 @@ std::vector<dht::NodeContact> dht::DhtNode::find_closest_nodes(
         asio::yield_context yield
     ) {
         if (!candidate.id && out.full()) {
-            return;
+            return false;
         }
 
         if (candidate.id && !out.would_insert(*candidate.id)) {
-            return;
+            return false;
         }
 
         bool accepted = query_find_node2( target_id
@@ -1992,9 +2057,10 @@ std::vector<dht::NodeContact> dht::DhtNode::find_closest_nodes(
 
         if (accepted && candidate.id) {
             out.insert({ *candidate.id, candidate.endpoint });
+            return true;
         }
 
-        return;
+        return false;
     }
     , cancel_signal, yield[ec]);
 
@@ -2480,10 +2546,10 @@ void dht::DhtNode::tracker_do_search_peers(
         asio::yield_context yield
     ) {
         if (!candidate.id && responsible_nodes_full.full()) {
-            return;
+            return false;
         }
         if (candidate.id && !responsible_nodes_full.would_insert(*candidate.id)) {
-            return;
+            return false;
         }
 
         boost::optional<BencodedMap> response_ = query_get_peers(
@@ -2496,30 +2562,29 @@ void dht::DhtNode::tracker_do_search_peers(
             yield
         );
 
-        if (!response_) return;
+        if (!response_) return false;
 
         BencodedMap& response = *response_;
 
         boost::optional<std::string> announce_token = response["token"].as_string();
 
-        if (!announce_token) return;
+        if (!announce_token || !candidate.id) return false;
 
-        if (candidate.id) {
-            ResponsibleNode node{ candidate.endpoint, {}, std::move(*announce_token) };
-            BencodedList* encoded_peers = response["values"].as_list();
-            if (encoded_peers) {
-                for (auto& peer : *encoded_peers) {
-                    auto peer_string = peer.as_string_view();
-                    if (!peer_string) continue;
+        ResponsibleNode node{ candidate.endpoint, {}, std::move(*announce_token) };
+        BencodedList* encoded_peers = response["values"].as_list();
+        if (encoded_peers) {
+            for (auto& peer : *encoded_peers) {
+                auto peer_string = peer.as_string_view();
+                if (!peer_string) continue;
 
-                    boost::optional<udp::endpoint> endpoint = decode_endpoint(*peer_string);
-                    if (!endpoint) continue;
+                boost::optional<udp::endpoint> endpoint = decode_endpoint(*peer_string);
+                if (!endpoint) continue;
 
-                    node.peers.push_back(*endpoint);
-                }
+                node.peers.push_back(*endpoint);
             }
-            responsible_nodes_full.insert({ *candidate.id, std::move(node) });
         }
+        responsible_nodes_full.insert({ *candidate.id, std::move(node) });
+        return true;
     }, cancel_signal, yield[ec]);
 
     peers.clear();
@@ -73,6 +73,8 @@ namespace dht {
 class DhtNode {
     public:
     const size_t RESPONSIBLE_TRACKERS_PER_SWARM = 8;
+    // Times a query is sent to a node before giving up on its reply.
+    static constexpr unsigned MAX_QUERY_ATTEMPTS = 2;
 
     public:
     DhtNode( const asio::executor&
@@ -87,8 +89,17 @@ class DhtNode {
 
     void start(udp::endpoint, asio::yield_context yield);
     void start(asio_utp::udp_multiplexer, asio::yield_context yield);
+    // E.g. for nodes in a simulated network.
+    void start(std::unique_ptr<UdpMultiplexer>, asio::yield_context yield);
     void stop();
 
+    /**
+     * Whether to bootstrap off the well-known public routers
+     * (besides the extra bootstrap addresses given on construction).
+     * It must be called before start().
+     */
+    void use_default_bootstraps(bool v) { _use_default_bootstraps = v; }
+
     /**
      * True iff this DhtNode knows enough about the structure of the DHT to
      * reliably submit queries to it. The DHT operations below may be called
@@ -176,6 +187,15 @@ class DhtNode {
         asio::yield_context
     );
 
+    /**
+     * Look up the nodes closest to $target_id which reply to queries.
+     */
+    std::vector<NodeContact> find_closest_nodes(
+        NodeID target_id,
+        Cancel&,
+        asio::yield_context
+    );
+
     // http://bittorrent.org/beps/bep_0005.html#ping
     BencodedMap send_ping(
         NodeContact contact,
@@ -251,6 +271,11 @@ class DhtNode {
         asio::yield_context
     );
 
+    std::chrono::steady_clock::duration reply_timeout(
+        const Contact&,
+        const std::string& query_type
+    );
+
     BencodedMap send_query_await_reply(
         Contact,
         const std::string& query_type,
@@ -273,12 +298,6 @@ class DhtNode {
     BootstrapResult
     bootstrap_single(bootstrap::Address, Cancel, asio::yield_context);
 
-    std::vector<NodeContact> find_closest_nodes(
-        NodeID target_id,
-        Cancel&,
-        asio::yield_context
-    );
-
     std::string new_transaction_string();
 
     void send_write_query(
@@ -377,6 +396,7 @@ class DhtNode {
     std::unique_ptr<Stats> _stats;
     boost::filesystem::path _storage_dir;
     std::set<bootstrap::Address> _extra_bs;
+    bool _use_default_bootstraps = true;
 };
 
 } // dht namespace
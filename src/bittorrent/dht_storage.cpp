@@ -4,9 +4,12 @@
 #include "../util/bytes.h"
 #include "../util/crypto.h"
 #include "../util/random.h"
+#include "../util/spawn.h"
 #include "../util/hash.h"
 
 #include <cstdlib>
+#include <string_view>
+#include <unordered_set>
 
 namespace ouinet {
 namespace bittorrent {
@@ -58,76 +61,159 @@ void detail::DhtWriteTokenStorage::expire()
 
 
 
-void detail::Swarm::add(tcp::endpoint endpoint)
+detail::PackedEndpoint::PackedEndpoint(const tcp::endpoint& ep)
 {
-    auto now = std::chrono::steady_clock::now();
-    auto it = _peer_indices.find(endpoint);
-
-    if (it == _peer_indices.end()) {
-        Peer peer;
-        peer.endpoint = endpoint;
-        peer.last_seen = now;
-        _peer_indices[endpoint] = _peers.size();
-        _peers.push_back(peer);
-    } else {
-        size_t index = it->second;
-        assert(_peers[index].endpoint == endpoint);
-        _peers[index].last_seen = now;
+    auto addr = ep.address();
+    auto addr6 = addr.is_v4()
+               ? asio::ip::make_address_v6(asio::ip::v4_mapped, addr.to_v4())
+               : addr.to_v6();
+    auto bytes = addr6.to_bytes();
+    std::copy(bytes.begin(), bytes.end(), _data.begin());
+    _data[16] = ep.port() >> 8;
+    _data[17] = ep.port() & 0xff;
+}
+
+tcp::endpoint detail::PackedEndpoint::unpack() const
+{
+    asio::ip::address_v6::bytes_type bytes;
+    std::copy(_data.begin(), _data.begin() + bytes.size(), bytes.begin());
+    asio::ip::address_v6 addr6(bytes);
+    uint16_t port = (_data[16] << 8) | _data[17];
+
+    if (addr6.is_v4_mapped()) {
+        return {asio::ip::make_address_v4(asio::ip::v4_mapped, addr6), port};
+    }
+    return {addr6, port};
+}
+
+size_t detail::PackedEndpoint::Hash::operator()(const PackedEndpoint& ep) const
+{
+    return std::hash<std::string_view>()
+        (std::string_view((const char*) ep._data.data(), ep._data.size()));
+}
+
+
+
+void detail::Swarm::link_last(uint32_t i)
+{
+    auto& peer = _peers[i];
+    peer.prev = _newest;
+    peer.next = none;
+    if (_newest != none) _peers[_newest].next = i;
+    else                 _oldest = i;
+    _newest = i;
+}
+
+void detail::Swarm::unlink(uint32_t i)
+{
+    auto& peer = _peers[i];
+    if (peer.prev != none) _peers[peer.prev].next = peer.next;
+    else                   _oldest = peer.next;
+    if (peer.next != none) _peers[peer.next].prev = peer.prev;
+    else                   _newest = peer.prev;
+}
+
+void detail::Swarm::remove_oldest()
+{
+    uint32_t i = _oldest;
+    assert(i != none);
+
+    unlink(i);
+    _peer_indices.erase(_peers[i].endpoint);
+
+    // Move the last peer into the freed slot.
+    uint32_t last = _peers.size() - 1;
+    if (i != last) {
+        auto& peer = _peers[i] = _peers[last];
+        if (peer.prev != none) _peers[peer.prev].next = i;
+        else                   _oldest = i;
+        if (peer.next != none) _peers[peer.next].prev = i;
+        else                   _newest = i;
+        _peer_indices[peer.endpoint] = i;
+    }
+    _peers.pop_back();
+}
+
+bool detail::Swarm::add(tcp::endpoint endpoint, Time now, bool can_grow)
+{
+    PackedEndpoint packed(endpoint);
+    auto it = _peer_indices.find(packed);
+
+    if (it != _peer_indices.end()) {
+        uint32_t i = it->second;
+        unlink(i);
+        _peers[i].last_seen = now;
+        link_last(i);
+        return false;
     }
+
+    bool grow = can_grow && _peers.size() < _max_peers;
+
+    if (!grow) {
+        if (_peers.empty()) return false;
+        remove_oldest();
+    }
+
+    uint32_t i = _peers.size();
+    _peers.push_back(Peer{packed, now, none, none});
+    _peer_indices[packed] = i;
+    link_last(i);
+    return grow;
 }
 
 /*
  * This function must return a _random_ selection of endpoints.
- * Which is why Swarm needs this complicated data structure.
  */
-std::vector<tcp::endpoint> detail::Swarm::list(unsigned int count)
+std::vector<tcp::endpoint> detail::Swarm::list(unsigned int count) const
 {
     std::vector<tcp::endpoint> output;
-    for (size_t i = 0; i < count && i < _peers.size(); i++) {
-        /*
-         * (1) select a peer outside the range [0..i);
-         * (2) swap it with _peers[i];
-         * (3) update the peer index accordingly.
-         */
-        size_t target = i + std::rand() % (_peers.size() - i);
-        output.push_back(_peers[target].endpoint);
-        if (target != i) {
-            std::swap(_peer_indices[_peers[target].endpoint], _peer_indices[_peers[i].endpoint]);
-            std::swap(_peers[target], _peers[i]);
+
+    if (count >= _peers.size()) {
+        for (auto& peer : _peers) output.push_back(peer.endpoint.unpack());
+        return output;
+    }
+
+    // Robert Floyd's sampling algorithm.
+    std::unordered_set<size_t> chosen;
+    for (size_t j = _peers.size() - count; j < _peers.size(); j++) {
+        size_t target = std::rand() % (j + 1);
+        if (!chosen.insert(target).second) {
+            target = j;
+            chosen.insert(target);
         }
+        output.push_back(_peers[target].endpoint.unpack());
     }
     return output;
 }
 
-void detail::Swarm::expire()
+size_t detail::Swarm::expire(Time oldest_valid)
 {
-    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-
-    size_t i = 0;
-    while (i < _peers.size()) {
-        if (_peers[i].last_seen + std::chrono::seconds(ANNOUNCE_VALIDITY_SECONDS) < now) {
-            size_t replacement = _peers.size() - 1;
-            if (replacement != i) {
-                std::swap(_peer_indices[_peers[replacement].endpoint], _peer_indices[_peers[i].endpoint]);
-                std::swap(_peers[replacement], _peers[i]);
-            }
-            _peer_indices.erase(_peers[replacement].endpoint);
-            _peers.pop_back();
-        } else {
-            i++;
-        }
+    size_t removed = 0;
+    while (_oldest != none && _peers[_oldest].last_seen < oldest_valid) {
+        remove_oldest();
+        removed++;
     }
+    return removed;
+}
+
+boost::optional<detail::Swarm::Time> detail::Swarm::oldest() const
+{
+    if (_oldest == none) return boost::none;
+    return _peers[_oldest].last_seen;
 }
 
 
 
-Tracker::Tracker(const asio::executor& exec):
-    _exec(exec)
+Tracker::Tracker(const asio::executor& exec, Config config):
+    _exec(exec),
+    _config(std::move(config)),
+    _origin(std::chrono::steady_clock::now()),
+    _expiration(std::chrono::seconds(60), _origin)
 {
     /*
      * Every so often, remove expired peers from swarms.
      */
-    asio::spawn(_exec, [this] (asio::yield_context yield) {
+    util::spawn(_exec, [this] (asio::yield_context yield) {
         auto terminated = _terminate_signal.connect([]{});
 
         while (true) {
@@ -136,15 +222,7 @@ Tracker::Tracker(const asio::executor& exec):
                 break;
             }
 
-            auto it = _swarms.begin();
-            while (it != _swarms.end()) {
-                it->second->expire();
-                if (it->second->empty()) {
-                    it = _swarms.erase(it);
-                } else {
-                    ++it;
-                }
-            }
+            expire(std::chrono::steady_clock::now());
         }
     });
 }
@@ -154,32 +232,79 @@ Tracker::~Tracker()
     _terminate_signal();
 }
 
+detail::Swarm::Time Tracker::to_time(std::chrono::steady_clock::time_point t) const
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(t - _origin).count();
+}
+
+std::chrono::steady_clock::time_point Tracker::from_time(detail::Swarm::Time t) const
+{
+    return _origin + std::chrono::seconds(t);
+}
+
 void Tracker::add_peer(NodeID swarm, tcp::endpoint endpoint)
 {
-    if (!_swarms.count(swarm)) {
-        _swarms[swarm] = std::make_unique<detail::Swarm>();
+    auto now = std::chrono::steady_clock::now();
+    auto it = _swarms.find(swarm);
+
+    if (it == _swarms.end()) {
+        if (_swarms.size() >= _config.max_swarms || _peer_count >= _config.max_peers) {
+            return;
+        }
+        it = _swarms.emplace(swarm, detail::Swarm(_config.max_peers_per_swarm)).first;
+        _expiration.schedule(swarm, now + std::chrono::seconds(ANNOUNCE_VALIDITY_SECONDS));
+    }
+
+    if (it->second.add(endpoint, to_time(now), _peer_count < _config.max_peers)) {
+        _peer_count++;
     }
-    _swarms[swarm]->add(endpoint);
 }
 
 std::vector<tcp::endpoint> Tracker::list_peers(NodeID swarm, unsigned int count)
 {
-    if (_swarms.count(swarm)) {
-        return _swarms[swarm]->list(count);
-    } else {
+    auto it = _swarms.find(swarm);
+    if (it == _swarms.end()) {
         return std::vector<tcp::endpoint>();
     }
+    return it->second.list(count);
 }
 
+void Tracker::expire(std::chrono::steady_clock::time_point now)
+{
+    auto now_t = to_time(now);
+    detail::Swarm::Time oldest_valid = now_t > ANNOUNCE_VALIDITY_SECONDS
+                                     ? now_t - ANNOUNCE_VALIDITY_SECONDS
+                                     : 0;
+
+    for (auto& id : _expiration.expire(now)) {
+        auto it = _swarms.find(id);
+        if (it == _swarms.end()) continue;
 
+        auto& swarm = it->second;
+        _peer_count -= swarm.expire(oldest_valid);
+
+        if (swarm.empty()) {
+            _swarms.erase(it);
+        } else {
+            // Check again when the least recently seen peer expires.
+            _expiration.schedule(id, from_time(*swarm.oldest() + 1)
+                                   + std::chrono::seconds(ANNOUNCE_VALIDITY_SECONDS));
+        }
+    }
+}
 
-DataStore::DataStore(const asio::executor& exec):
-    _exec(exec)
+
+
+DataStore::DataStore(const asio::executor& exec, Config config):
+    _exec(exec),
+    _config(std::move(config)),
+    _immutable_expiration(std::chrono::seconds(60)),
+    _mutable_expiration(std::chrono::seconds(60))
 {
     /*
      * Every so often, remove expired data items.
      */
-    asio::spawn(_exec, [this] (asio::yield_context yield) {
+    util::spawn(_exec, [this] (asio::yield_context yield) {
         auto terminated = _terminate_signal.connect([]{});
 
         while (true) {
@@ -188,25 +313,7 @@ DataStore::DataStore(const asio::executor& exec):
                 break;
             }
 
-            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-
-            auto it = _immutable_data.begin();
-            while (it != _immutable_data.end()) {
-                if (it->second.last_seen + std::chrono::seconds(PUT_VALIDITY_SECONDS) < now) {
-                    it = _immutable_data.erase(it);
-                } else {
-                    ++it;
-                }
-            }
-
-            auto i = _mutable_data.begin();
-            while (i != _mutable_data.end()) {
-                if (i->second.last_seen + std::chrono::seconds(PUT_VALIDITY_SECONDS) < now) {
-                    i = _mutable_data.erase(i);
-                } else {
-                    ++i;
-                }
-            }
+            expire(std::chrono::steady_clock::now());
         }
     });
 }
@@ -216,6 +323,37 @@ DataStore::~DataStore()
     _terminate_signal();
 }
 
+void DataStore::expire(std::chrono::steady_clock::time_point now)
+{
+    for (auto& id : _immutable_expiration.expire(now)) {
+        _immutable_data.erase(id);
+    }
+    for (auto& id : _mutable_expiration.expire(now)) {
+        _mutable_data.erase(id);
+    }
+}
+
+template<class Items, class Item>
+void DataStore::put( Items& items
+                   , util::TimingWheel<NodeID, NodeID::Hash>& expiration
+                   , NodeID id
+                   , Item item)
+{
+    auto it = items.find(id);
+
+    if (it == items.end()) {
+        if (items.size() >= _config.max_items) {
+            return;
+        }
+        items.emplace(id, std::move(item));
+    } else {
+        it->second = std::move(item);
+    }
+
+    expiration.schedule(id, std::chrono::steady_clock::now()
+                          + std::chrono::seconds(PUT_VALIDITY_SECONDS));
+}
+
 NodeID DataStore::immutable_get_id(BencodedValue value)
 {
     return util::sha1_digest(bencoding_encode(value));
@@ -223,10 +361,8 @@ NodeID DataStore::immutable_get_id(BencodedValue value)
 
 void DataStore::put_immutable(BencodedValue value)
 {
-    _immutable_data[immutable_get_id(value)] = ImmutableStoredItem {
-        value,
-        std::chrono::steady_clock::now()
-    };
+    auto id = immutable_get_id(value);
+    put(_immutable_data, _immutable_expiration, id, std::move(value));
 }
 
 boost::optional<BencodedValue> DataStore::get_immutable(NodeID id)
@@ -235,7 +371,7 @@ boost::optional<BencodedValue> DataStore::get_immutable(NodeID id)
     if (it == _immutable_data.end()) {
         return boost::none;
     }
-    return it->second.value;
+    return it->second;
 }
 
 NodeID DataStore::mutable_get_id( util::Ed25519PublicKey public_key
@@ -246,10 +382,8 @@ NodeID DataStore::mutable_get_id( util::Ed25519PublicKey public_key
 
 void DataStore::put_mutable(MutableDataItem item)
 {
-    _mutable_data[mutable_get_id(item.public_key, item.salt)] = MutableStoredItem {
-        item,
-        std::chrono::steady_clock::now()
-    };
+    auto id = mutable_get_id(item.public_key, item.salt);
+    put(_mutable_data, _mutable_expiration, id, std::move(item));
 }
 
 boost::optional<MutableDataItem> DataStore::get_mutable(NodeID id)
@@ -258,7 +392,7 @@ boost::optional<MutableDataItem> DataStore::get_mutable(NodeID id)
     if (it == _mutable_data.end()) {
         return boost::none;
     }
-    return it->second.item;
+    return it->second;
 }
 
 } // dht namespace
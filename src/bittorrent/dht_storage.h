@@ -3,9 +3,11 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/spawn.hpp>
 
+#include <array>
 #include <chrono>
 #include <deque>
 #include <string>
+#include <unordered_map>
 
 #include "bencoding.h"
 #include "mutable_data.h"
@@ -13,6 +15,7 @@
 
 #include "../util/crypto.h"
 #include "../util/signal.h"
+#include "../util/timing_wheel.h"
 
 namespace ouinet {
 namespace bittorrent {
@@ -46,35 +49,104 @@ class DhtWriteTokenStorage {
     std::chrono::steady_clock::time_point _last_generated;
 };
 
+// A TCP endpoint packed in 18 bytes,
+// with IPv4 addresses stored as IPv4-mapped IPv6 addresses.
+class PackedEndpoint {
+    public:
+    PackedEndpoint() = default;
+    PackedEndpoint(const tcp::endpoint&);
+
+    tcp::endpoint unpack() const;
+
+    bool operator==(const PackedEndpoint& other) const { return _data == other._data; }
+
+    struct Hash {
+        size_t operator()(const PackedEndpoint&) const;
+    };
+
+    private:
+    std::array<uint8_t, 18> _data;
+};
+
+/*
+ * Peers are kept in a vector so that random ones can be picked quickly,
+ * and linked in the order they were last seen so that the least recently
+ * seen one can be expired or replaced in constant time.
+ */
 class Swarm {
     public:
-    /*
-     * This number based on vague hints. I could not find any proper
-     * specification on recommended validity times, and this could be
-     * completely wrong.
-     */
-    const int ANNOUNCE_VALIDITY_SECONDS = 3600 * 2;
+    // Seconds since some origin set by the tracker.
+    using Time = uint32_t;
 
     public:
-    void add(tcp::endpoint endpoint);
-    std::vector<tcp::endpoint> list(unsigned int count);
-    void expire();
+    Swarm(size_t max_peers) : _max_peers(max_peers) {}
+
+    // If the swarm is full or `can_grow` is false,
+    // a new peer replaces the least recently seen one.
+    // Return true if the number of peers grew.
+    bool add(tcp::endpoint endpoint, Time now, bool can_grow);
+    std::vector<tcp::endpoint> list(unsigned int count) const;
+    // Remove peers last seen before the given time,
+    // return the number of peers removed.
+    size_t expire(Time oldest_valid);
     bool empty() const { return _peers.empty(); }
+    size_t size() const { return _peers.size(); }
+    // When the least recently seen peer was seen.
+    boost::optional<Time> oldest() const;
 
     private:
+    static const uint32_t none = uint32_t(-1);
+
     struct Peer {
-        tcp::endpoint endpoint;
-        std::chrono::steady_clock::time_point last_seen;
+        PackedEndpoint endpoint;
+        Time last_seen;
+        // Indices of neighbours in the list by `last_seen`.
+        uint32_t prev;
+        uint32_t next;
     };
+
+    void link_last(uint32_t);
+    void unlink(uint32_t);
+    void remove_oldest();
+
+    size_t _max_peers;
     std::vector<Peer> _peers;
-    std::map<tcp::endpoint, size_t> _peer_indices;
+    std::unordered_map<PackedEndpoint, uint32_t, PackedEndpoint::Hash> _peer_indices;
+    uint32_t _oldest = none;
+    uint32_t _newest = none;
 };
 
 } // namespace detail
 
+/*
+ * Swarms are expired with a timing wheel which fires around the time
+ * their least recently seen peer expires, so no scanning is needed,
+ * and they are stored in a hash table, so that handling queries
+ * takes constant time regardless of the number of swarms.
+ *
+ * Memory is bounded by the limits in `Config`: peers announced
+ * to a full swarm replace its least recently seen peer,
+ * and peers announced to new swarms are ignored
+ * if there are too many swarms or peers already.
+ */
 class Tracker {
     public:
-    Tracker(const asio::executor&);
+    struct Config {
+        size_t max_swarms = 1 << 16;
+        size_t max_peers_per_swarm = 1024;
+        size_t max_peers = 1 << 20;
+    };
+
+    /*
+     * This number based on vague hints. I could not find any proper
+     * specification on recommended validity times, and this could be
+     * completely wrong.
+     */
+    static constexpr int ANNOUNCE_VALIDITY_SECONDS = 3600 * 2;
+
+    public:
+    Tracker(const asio::executor& exec) : Tracker(exec, Config()) {}
+    Tracker(const asio::executor&, Config);
     ~Tracker();
 
     std::string generate_token(asio::ip::address address, NodeID id)
@@ -90,23 +162,47 @@ class Tracker {
     void add_peer(NodeID swarm, tcp::endpoint endpoint);
     std::vector<tcp::endpoint> list_peers(NodeID swarm, unsigned int count);
 
+    size_t swarm_count() const { return _swarms.size(); }
+    size_t peer_count() const { return _peer_count; }
+
+    // Remove peers which have not been announced for long.
+    void expire(std::chrono::steady_clock::time_point now);
+
+    private:
+    detail::Swarm::Time to_time(std::chrono::steady_clock::time_point) const;
+    std::chrono::steady_clock::time_point from_time(detail::Swarm::Time) const;
+
     private:
     asio::executor _exec;
+    Config _config;
+    std::chrono::steady_clock::time_point _origin;
     detail::DhtWriteTokenStorage _token_storage;
-    std::map<NodeID, std::unique_ptr<detail::Swarm>> _swarms;
+    std::unordered_map<NodeID, detail::Swarm, NodeID::Hash> _swarms;
+    util::TimingWheel<NodeID, NodeID::Hash> _expiration;
+    size_t _peer_count = 0;
     Signal<void()> _terminate_signal;
 };
 
+/*
+ * Items are stored in hash tables and expired with timing wheels.
+ * New items are ignored once there are `max_items` of each kind,
+ * while existing ones can still be updated.
+ */
 class DataStore {
     public:
+    struct Config {
+        size_t max_items = 1 << 14;
+    };
+
     /*
      * Validity specified at
      * http://www.bittorrent.org/beps/bep_0044.html#expiration
      */
-    const int PUT_VALIDITY_SECONDS = 3600 * 2;
+    static constexpr int PUT_VALIDITY_SECONDS = 3600 * 2;
 
     public:
-    DataStore(const asio::executor&);
+    DataStore(const asio::executor& exec) : DataStore(exec, Config()) {}
+    DataStore(const asio::executor&, Config);
     ~DataStore();
 
     std::string generate_token(asio::ip::address address, NodeID id)
@@ -127,20 +223,24 @@ class DataStore {
     void put_mutable(MutableDataItem item);
     boost::optional<MutableDataItem> get_mutable(NodeID id);
 
+    size_t immutable_count() const { return _immutable_data.size(); }
+    size_t mutable_count() const { return _mutable_data.size(); }
+
+    // Remove items which have not been put for long.
+    void expire(std::chrono::steady_clock::time_point now);
+
     private:
-    struct ImmutableStoredItem {
-        BencodedValue value;
-        std::chrono::steady_clock::time_point last_seen;
-    };
-    struct MutableStoredItem {
-        MutableDataItem item;
-        std::chrono::steady_clock::time_point last_seen;
-    };
+    template<class Items, class Item>
+    void put(Items&, util::TimingWheel<NodeID, NodeID::Hash>&, NodeID, Item);
 
+    private:
     asio::executor _exec;
+    Config _config;
     detail::DhtWriteTokenStorage _token_storage;
-    std::map<NodeID, ImmutableStoredItem> _immutable_data;
-    std::map<NodeID, MutableStoredItem> _mutable_data;
+    std::unordered_map<NodeID, BencodedValue, NodeID::Hash> _immutable_data;
+    std::unordered_map<NodeID, MutableDataItem, NodeID::Hash> _mutable_data;
+    util::TimingWheel<NodeID, NodeID::Hash> _immutable_expiration;
+    util::TimingWheel<NodeID, NodeID::Hash> _mutable_expiration;
     Signal<void()> _terminate_signal;
 };
 
@@ -1,4 +1,5 @@
 #include <boost/crc.hpp>
+#include <random>
 #include "node_id.h"
 
 using namespace ouinet::bittorrent;
@@ -21,6 +22,54 @@ static const NodeID::Buffer& zero_buffer() {
     return buf;
 }
 
+static uint64_t rotl(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+static void sip_round(uint64_t (&v)[4]) {
+    v[0] += v[1]; v[1] = rotl(v[1], 13); v[1] ^= v[0]; v[0] = rotl(v[0], 32);
+    v[2] += v[3]; v[3] = rotl(v[3], 16); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = rotl(v[3], 21); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = rotl(v[1], 17); v[1] ^= v[2]; v[2] = rotl(v[2], 32);
+}
+
+// SipHash-1-3 (as used e.g. by Rust's `HashMap`) of a whole ID.
+static uint64_t siphash13(const std::array<uint64_t, 2>& key, const NodeID::Buffer& in) {
+    uint64_t v[4] = { key[0] ^ 0x736f6d6570736575ULL
+                    , key[1] ^ 0x646f72616e646f6dULL
+                    , key[0] ^ 0x6c7967656e657261ULL
+                    , key[1] ^ 0x7465646279746573ULL };
+
+    auto word = [&] (size_t i, size_t len) {
+        uint64_t m = 0;
+        for (size_t j = 0; j < len; ++j) m |= uint64_t(in[i + j]) << (8 * j);
+        return m;
+    };
+
+    size_t i = 0;
+    for (; i + 8 <= in.size(); i += 8) {
+        auto m = word(i, 8);
+        v[3] ^= m; sip_round(v); v[0] ^= m;
+    }
+
+    auto m = word(i, in.size() - i) | (uint64_t(in.size()) << 56);
+    v[3] ^= m; sip_round(v); v[0] ^= m;
+
+    v[2] ^= 0xff;
+    sip_round(v); sip_round(v); sip_round(v);
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+size_t NodeID::Hash::operator()(const NodeID& id) const
+{
+    static const auto key = [] {
+        std::random_device rd;
+        std::uniform_int_distribution<uint64_t> dist;
+        return std::array<uint64_t, 2>{dist(rd), dist(rd)};
+    }();
+    return siphash13(key, id.buffer);
+}
+
 bool NodeID::bit(int n) const
 {
     return get_rbit(buffer, n);
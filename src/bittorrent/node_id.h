@@ -73,6 +73,14 @@ struct NodeID {
     bool operator>(const NodeID& other) const { return other.buffer < buffer; }
     NodeID operator^(const NodeID& other) const;
 
+    // For unordered containers.
+    // IDs (e.g. infohashes) may be chosen by remote nodes,
+    // so they are hashed with a random per-process key (SipHash-1-3)
+    // to avoid them being crafted to collide.
+    struct Hash {
+        size_t operator()(const NodeID& id) const;
+    };
+
     // Return true if `left` is closer to `this` than `right` is in the XOR
     // metrics.
     bool closer_to(const NodeID& left, const NodeID& right) const;
@@ -378,7 +378,9 @@ void RoutingTable::fail_node(NodeContact contact)
             .recv_time      = c.recv_time,
             .reply_time     = c.reply_time,
             .queries_failed = 0,
-            .ping_ongoing   = false
+            .ping_ongoing   = false,
+            .srtt           = c.srtt,
+            .rttvar         = c.rttvar
         };
 
         for (size_t i = 0; i < bucket->nodes.size(); i++) {
@@ -415,6 +417,44 @@ void RoutingTable::fail_node(NodeContact contact)
     }
 }
 
+const RoutingTable::RoutingNode*
+RoutingTable::find_node(const NodeContact& contact) const
+{
+    auto& bucket = _buckets[find_bucket_id(contact.id)];
+
+    for (auto& n : bucket.nodes) {
+        if (n.contact == contact) return &n;
+    }
+    for (auto& n : bucket.verified_candidates) {
+        if (n.contact == contact) return &n;
+    }
+    return nullptr;
+}
+
+void RoutingTable::add_rtt_sample(const NodeContact& contact, Clock::duration rtt)
+{
+    auto node = const_cast<RoutingNode*>(find_node(contact));
+    if (!node) return;
+
+    if (node->srtt == Clock::duration::zero()) {
+        node->srtt   = rtt;
+        node->rttvar = rtt / 2;
+        return;
+    }
+
+    auto delta = node->srtt > rtt ? node->srtt - rtt : rtt - node->srtt;
+    node->rttvar = (3 * node->rttvar + delta) / 4;
+    node->srtt   = (7 * node->srtt + rtt) / 8;
+}
+
+boost::optional<RoutingTable::Clock::duration>
+RoutingTable::retransmission_timeout(const NodeContact& contact) const
+{
+    auto node = find_node(contact);
+    if (!node || node->srtt == Clock::duration::zero()) return boost::none;
+    return node->srtt + 4 * node->rttvar;
+}
+
 set<NodeContact> RoutingTable::dump_contacts() const
 {
     using asio::ip::udp;
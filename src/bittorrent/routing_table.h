@@ -1,6 +1,7 @@
 #pragma once
 
 #include <boost/asio/ip/udp.hpp>
+#include <boost/optional.hpp>
 
 #include <chrono>
 #include <deque>
@@ -16,8 +17,10 @@ class RoutingTable {
 public:
     static constexpr size_t BUCKET_SIZE = 8;
 
-private:
+public:
     using Clock = std::chrono::steady_clock;
+
+private:
     using SendPing = std::function<void(const NodeContact&)>;
 
     struct RoutingNode {
@@ -29,6 +32,11 @@ private:
         int queries_failed;
         bool ping_ongoing;
 
+        // Smoothed round trip time of replies and its variation,
+        // zero if unknown.
+        Clock::duration srtt = {};
+        Clock::duration rttvar = {};
+
         inline bool is_good() const {
             using namespace std::chrono_literals;
 
@@ -70,6 +78,15 @@ public:
 
     void try_add_node(NodeContact, bool is_verified);
 
+    // Record the time the node took to reply to a query.
+    // Nothing is done if it is not in the table.
+    void add_rtt_sample(const NodeContact&, Clock::duration);
+
+    // How long to wait for a reply from the node before sending the query
+    // again, from its round trip times (as the TCP retransmission timeout
+    // in RFC 6298), or none if it is unknown.
+    boost::optional<Clock::duration> retransmission_timeout(const NodeContact&) const;
+
     NodeID max_distance(size_t bucket_id) const;
 
     NodeID node_id() const { return _node_id; }
@@ -78,6 +95,7 @@ public:
 
 private:
     RoutingTable::Bucket* find_bucket(NodeID id);
+    const RoutingNode* find_node(const NodeContact&) const;
     size_t find_bucket_id(const NodeID&) const;
     bool would_split_bucket(size_t bucket_id, const NodeID& new_id) const;
     void split_bucket(size_t bucket_id);
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <list>
+#include <memory>
 #include <iostream>
 #include <boost/asio/buffer.hpp>
+#include <boost/asio/spawn.hpp>
 #include <boost/utility/string_view.hpp>
 #include "../logger.h"
 #include "../namespaces.h"
@@ -11,6 +13,7 @@
 #include "../async_sleep.h"
 #include "rate_counter.h"
 #include "../util/handler_tracker.h"
+#include "../util/metrics.h"
 
 namespace ouinet { namespace bittorrent {
 
@@ -40,8 +43,53 @@ private:
         )> handler;
     };
 
+    // Type-erased datagram socket, so that other transports than
+    // `asio_utp::udp_multiplexer` (e.g. a simulated network) can be used.
+    struct AbstractSocket {
+        virtual ~AbstractSocket() = default;
+        virtual asio::executor get_executor() = 0;
+        virtual udp::endpoint local_endpoint() const = 0;
+        virtual bool is_open() const = 0;
+        virtual void close(sys::error_code&) = 0;
+        virtual size_t async_send_to( asio::const_buffer
+                                    , const udp::endpoint&
+                                    , asio::yield_context) = 0;
+        virtual size_t async_receive_from( asio::mutable_buffer
+                                         , udp::endpoint&
+                                         , asio::yield_context) = 0;
+    };
+
+    template<class Socket>
+    struct SocketImpl : AbstractSocket {
+        Socket s;
+
+        SocketImpl(Socket s) : s(std::move(s)) {}
+
+        asio::executor get_executor() override { return s.get_executor(); }
+        udp::endpoint local_endpoint() const override { return s.local_endpoint(); }
+        bool is_open() const override { return s.is_open(); }
+        void close(sys::error_code& ec) override { s.close(ec); }
+
+        size_t async_send_to( asio::const_buffer b
+                            , const udp::endpoint& to
+                            , asio::yield_context yield) override
+        { return s.async_send_to(b, to, yield); }
+
+        size_t async_receive_from( asio::mutable_buffer b
+                                 , udp::endpoint& from
+                                 , asio::yield_context yield) override
+        { return s.async_receive_from(b, from, yield); }
+    };
+
 public:
-    UdpMultiplexer(asio_utp::udp_multiplexer&&);
+    // `Socket` is `asio_utp::udp_multiplexer` or any other type
+    // with the same `get_executor`, `local_endpoint`, `is_open`, `close`,
+    // `async_send_to` and `async_receive_from` members.
+    template<class Socket>
+    explicit UdpMultiplexer(Socket s)
+        : UdpMultiplexer(std::unique_ptr<AbstractSocket>
+                            (new SocketImpl<Socket>(std::move(s))))
+    {}
 
     asio::executor get_executor();
 
@@ -53,25 +101,27 @@ public:
     // the coroutine that runs this function exits (whichever comes first).
     const boost::string_view receive(udp::endpoint& from, Cancel&, asio::yield_context);
 
-    udp::endpoint local_endpoint() const { return _socket.local_endpoint(); }
+    udp::endpoint local_endpoint() const { return _socket->local_endpoint(); }
 
     ~UdpMultiplexer();
 
-    bool is_v4() const { return _socket.local_endpoint().address().is_v4(); }
-    bool is_v6() const { return _socket.local_endpoint().address().is_v6(); }
+    bool is_v4() const { return _socket->local_endpoint().address().is_v4(); }
+    bool is_v6() const { return _socket->local_endpoint().address().is_v6(); }
 
 private:
+    UdpMultiplexer(std::unique_ptr<AbstractSocket>);
+
     void maintain_max_rate_bytes_per_sec( float current_rate
                                         , float max_rate
                                         , asio::yield_context);
 
     static
-    boost::asio::const_buffers_1 buffer(const std::string& s) {
-        return boost::asio::buffer(const_cast<const char*>(s.data()), s.size());
+    boost::asio::const_buffer buffer(const std::string& s) {
+        return boost::asio::const_buffer(s.data(), s.size());
     }
 
 private:
-    asio_utp::udp_multiplexer _socket;
+    std::unique_ptr<AbstractSocket> _socket;
     std::list<SendEntry> _send_queue;
     ConditionVariable _send_queue_nonempty;
     IntrusiveList<RecvEntry> _receive_queue;
@@ -81,20 +131,47 @@ private:
     RateCounter _rc_tx;
     float sent = 0;
     float recv = 0;
+    uint64_t _rx_bytes = 0;
+    uint64_t _tx_bytes = 0;
+    metrics::CallbackGauges _metrics;
 };
 
 inline
-UdpMultiplexer::UdpMultiplexer(asio_utp::udp_multiplexer&& s):
+UdpMultiplexer::UdpMultiplexer(std::unique_ptr<AbstractSocket> s):
     _socket(std::move(s)),
-    _send_queue_nonempty(_socket.get_executor()),
-    _rate_limiting_timer(_socket.get_executor())
+    _send_queue_nonempty(_socket->get_executor()),
+    _rate_limiting_timer(_socket->get_executor())
 {
-    assert(_socket.is_open());
-
-    LOG_INFO("BT is operating on endpoint: UDP:", _socket.local_endpoint());
+    assert(_socket->is_open());
+
+    LOG_INFO("BT is operating on endpoint: UDP:", _socket->local_endpoint());
+
+    {
+        std::ostringstream ep;
+        ep << _socket->local_endpoint();
+        metrics::Labels labels{{"endpoint", ep.str()}};
+
+        auto& r = metrics::registry();
+        // Series are labelled per endpoint, so they go away with the multiplexer.
+        _metrics.push_back(r.callback_counter
+            ( "ouinet_udp_rx_bytes_total", "Bytes received over UDP", labels
+            , [this] { return _rx_bytes; }));
+        _metrics.push_back(r.callback_counter
+            ( "ouinet_udp_tx_bytes_total", "Bytes sent over UDP", labels
+            , [this] { return _tx_bytes; }));
+        _metrics.push_back(r.callback_gauge
+            ( "ouinet_udp_rx_bytes_per_second", "Current UDP receive rate", labels
+            , [this] { return _rc_rx.rate(); }));
+        _metrics.push_back(r.callback_gauge
+            ( "ouinet_udp_tx_bytes_per_second", "Current UDP send rate", labels
+            , [this] { return _rc_tx.rate(); }));
+        _metrics.push_back(r.callback_gauge
+            ( "ouinet_udp_send_queue_length", "Datagrams waiting to be sent", labels
+            , [this] { return _send_queue.size(); }));
+    }
 
 #if 0
-    asio::spawn(get_executor(), [this] (asio::yield_context yield) {
+    util::spawn(get_executor(), [this] (asio::yield_context yield) {
             using namespace std::chrono;
             using std::cerr;
 
@@ -148,13 +225,14 @@ UdpMultiplexer::UdpMultiplexer(asio_utp::udp_multiplexer&& s):
             sys::error_code ec;
 
             if (!ec) {
-                _socket.async_send_to(buffer(entry.message), entry.to, yield[ec]);
+                _socket->async_send_to(buffer(entry.message), entry.to, yield[ec]);
             }
 
             if (terminated) break;
 
             if (!ec) {
                 sent += entry.message.size();
+                _tx_bytes += entry.message.size();
                 _rc_tx.update(entry.message.size());
                 maintain_max_rate_bytes_per_sec(_rc_tx.rate(), max_rate, yield[ec]);
                 if (terminated) break;
@@ -163,7 +241,7 @@ UdpMultiplexer::UdpMultiplexer(asio_utp::udp_multiplexer&& s):
             _send_queue.front().sent_signal(ec);
             _send_queue.pop_front();
         }
-    });
+    }, util::StackSize::small);
 
     TRACK_SPAWN(get_executor(), [this] (asio::yield_context yield) {
         auto terminated = _terminate_signal.connect([]{});
@@ -177,11 +255,12 @@ UdpMultiplexer::UdpMultiplexer(asio_utp::udp_multiplexer&& s):
             sys::error_code ec;
 
 
-            size_t size = _socket.async_receive_from(asio::buffer(buf), from, yield[ec]);
+            size_t size = _socket->async_receive_from(asio::buffer(buf), from, yield[ec]);
             if (terminated) return;
 
             _rc_rx.update(size);
             recv += size;
+            _rx_bytes += size;
 
             for (auto& entry : std::move(_receive_queue)) {
                 entry.handler(ec, boost::string_view((char*)&buf[0], size), from);
@@ -210,7 +289,7 @@ UdpMultiplexer::~UdpMultiplexer()
     _terminate_signal();
 
     sys::error_code ec;
-    _socket.close(ec);
+    _socket->close(ec);
 }
 
 inline
@@ -306,7 +385,7 @@ UdpMultiplexer::receive(udp::endpoint& from, Cancel& cancel, asio::yield_context
 inline
 asio::executor UdpMultiplexer::get_executor()
 {
-    return _socket.get_executor();
+    return _socket->get_executor();
 }
 
 }} // namespaces
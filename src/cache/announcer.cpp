@@ -1,11 +1,14 @@
-#include <list>
 #include <sstream>
+#include <unordered_map>
 #include "announcer.h"
-#include "../../util/async_queue.h"
 #include "../../logger.h"
 #include "../../async_sleep.h"
+#include "../../defer.h"
 #include "../../bittorrent/node_id.h"
 #include "../../util/handler_tracker.h"
+#include "../../util/metrics.h"
+#include "../../util/scheduler.h"
+#include "../../util/timing_wheel.h"
 #include <boost/utility/string_view.hpp>
 
 #define _LOGPFX "Announcer: "
@@ -30,6 +33,9 @@ struct Entry {
     Clock::time_point successful_update;
     Clock::time_point failed_update;
 
+    // Consecutive failed attempts since the last success or retry period.
+    unsigned failures = 0;
+    bool in_flight = false;
     bool to_remove = false;
 
     Entry() = default;
@@ -38,103 +44,87 @@ struct Entry {
         : key(move(key))
         , infohash(util::sha1_digest(this->key))
     { }
-
-    bool attempted_update() const {
-        return successful_update != Clock::time_point()
-            || failed_update     != Clock::time_point();
-    }
 };
 
 //--------------------------------------------------------------------
 // Loop
+//
+// Entries are kept in a timing wheel keyed by their next update time,
+// so finding the due ones does not need going over all of them.
+// Due entries are announced by jobs running concurrently (up to a limit).
 struct Announcer::Loop {
-    using Entries = util::AsyncQueue<Entry, std::list>;
+    using Entries = unordered_map<Key, Entry>;
 
     asio::executor ex;
     shared_ptr<bt::MainlineDht> dht;
     Entries entries;
+    util::TimingWheel<Key> schedule;
+    Scheduler scheduler;
     Cancel _cancel;
-    Cancel _timer_cancel;
+    Cancel* _wake = nullptr;
+    metrics::CallbackGauges _gauges;
 
     static Clock::duration success_reannounce_period() { return 20min; }
     static Clock::duration failure_reannounce_period() { return 5min;  }
+    // Attempts before waiting for `failure_reannounce_period`.
+    static const unsigned max_attempts = 3;
+    static const size_t max_concurrent_announces = 32;
 
     Loop(shared_ptr<bt::MainlineDht> dht)
         : ex(dht->get_executor())
         , dht(move(dht))
-        , entries(ex)
-    { }
+        , schedule(1s)
+        , scheduler(ex, max_concurrent_announces)
+    {
+        _gauges.push_back(metrics::registry().callback_gauge
+            ( "ouinet_cache_announcer_entries"
+            , "Keys being announced to the DHT", {}
+            , [this] { return entries.size(); }));
+    }
 
     inline static bool debug() { return logger.get_threshold() <= DEBUG; }
 
-    Entries::iterator find_entry_by_key(const Key& key) {
-        for (auto i = entries.begin(); i != entries.end(); ++i) {
-            if (i->first.key == key) return i;
-        }
-        return entries.end();
+    static metrics::Counter& announces_counter(const char* result)
+    {
+        return metrics::registry().counter
+            ( "ouinet_cache_announces_total"
+            , "Announcements of cached groups to the DHT"
+            , {{"result", result}});
     }
 
+    void wake() { if (_wake) (*_wake)(); }
+
     bool add(Key key) {
-        auto entry_i = find_entry_by_key(key);
-        bool already_has_key = (entry_i != entries.end());
+        auto entry_i = entries.find(key);
 
-        if (already_has_key) {
+        if (entry_i != entries.end()) {
             _DEBUG("Adding ", key, " (already exists)");
-            entry_i->first.to_remove = false;
-        } else {
-            _DEBUG("Adding ", key);
+            entry_i->second.to_remove = false;
+            return false;
         }
 
-        if (already_has_key) return false;
-
-        // To preserve the order in which entries are added and updated we put
-        // this new entry _after_ all entries that have not yet been updated.
-        Entries::iterator i = entries.begin();
-
-        for (; i != entries.end(); ++i) {
-            const auto& e = i->first;
-            if (e.attempted_update()) break;
-        }
-
-        entries.insert(i, Entry(move(key)));
-        _timer_cancel();
-        _timer_cancel = Cancel();
+        _DEBUG("Adding ", key);
+        schedule.schedule(key, Clock::now());
+        entries.emplace(key, Entry(move(key)));
+        wake();
         return true;
     }
 
     bool remove(const Key& key) {
-        Entries::iterator i = entries.begin();
-
-        for (; i != entries.end(); ++i)
-            if (i->first.key == key) break;  // found
+        auto i = entries.find(key);
         if (i == entries.end()) return false;  // not found
 
-        _DEBUG("Marking ", key, " for removal");
-        // The actual removal is not done here but in the main loop.
-        i->first.to_remove = true;
-        // No new entries, so no `_timer_cancel` reset.
-        return true;
-    }
-
-    Clock::duration next_update_after(const Entry& e) const
-    {
-        if (e.successful_update == Clock::time_point()
-             && e.failed_update == Clock::time_point()) {
-            return 0s;
+        if (!i->second.in_flight) {
+            _DEBUG("Removing ", key);
+            schedule.cancel(key);
+            entries.erase(i);
+            return true;
         }
 
-        auto now = Clock::now();
-
-        if (e.successful_update >= e.failed_update) {
-            auto p = success_reannounce_period();
-            if (e.successful_update + p <= now) return 0s;
-            return e.successful_update + p - now;
-        }
-        else {
-            auto p = failure_reannounce_period();
-            if (e.failed_update + p < now) return 0s;
-            return e.failed_update + p - now;
-        }
+        _DEBUG("Marking ", key, " for removal");
+        // The actual removal is done once its announcement finishes.
+        i->second.to_remove = true;
+        return true;
     }
 
     void print_entries() const {
@@ -165,7 +155,7 @@ struct Announcer::Loop {
 
         _DEBUG("Entries:");
         for (auto& ep : entries) {
-            auto& e = ep.first;
+            auto& e = ep.second;
             ss << " " << e.infohash << " | successful_update=";
             print(e.successful_update);
             ss << " | failed_update=";
@@ -177,37 +167,34 @@ struct Announcer::Loop {
         }
     }
 
-    Entries::iterator pick_entry(Cancel& cancel, asio::yield_context yield)
-    {        auto end = entries.end();
-
+    // Return the keys which are due for announcement,
+    // waiting until there is some.
+    vector<Key> wait_for_due(Cancel& cancel, asio::yield_context yield)
+    {
         while (!cancel) {
-            if (entries.empty()) {
+            auto due = schedule.expire(Clock::now());
+
+            // Entries are only in the wheel when not being announced,
+            // and removed from it when their entry is erased.
+            if (!due.empty()) return due;
+
+            Cancel wake_cancel(cancel);
+            _wake = &wake_cancel;
+            auto reset_wake = defer([&] { if (!cancel) _wake = nullptr; });
+
+            if (auto next = schedule.next_event()) {
+                auto now = Clock::now();
+                if (*next > now) async_sleep(ex, *next - now, wake_cancel, yield);
+            } else {
                 // XXX: Temporary handler tracking as this coroutine sometimes
                 // fails to exit.
                 TRACK_HANDLER();
-                sys::error_code ec;
                 _DEBUG("No entries to update, waiting...");
-                entries.async_wait_for_push(cancel, yield[ec]);
-                return_or_throw_on_error(yield, cancel, ec, end);
+                async_sleep(ex, chrono::hours(24), wake_cancel, yield);
             }
-
-            assert(!entries.empty());
-
-            auto i = entries.begin();
-
-            auto d = next_update_after(i->first);
-
-            _DEBUG( "Found entry to update. It'll be updated in "
-                  , chrono::duration_cast<chrono::seconds>(d).count()
-                  , " seconds: ", i->first.key);
-
-            if (d == 0s) return i;
-
-            auto cc = cancel.connect([&] { _timer_cancel(); });
-            async_sleep(ex, d, _timer_cancel, yield);
         }
 
-        return or_throw(yield, asio::error::operation_aborted, end);
+        return or_throw<vector<Key>>(yield, asio::error::operation_aborted);
     }
 
     void start()
@@ -236,61 +223,81 @@ struct Announcer::Loop {
 
         while (!cancel) {
             sys::error_code ec;
-            _DEBUG("Picking entry to update");
-            auto ei = pick_entry(cancel, yield[ec]);
-
+            auto due = wait_for_due(cancel, yield[ec]);
             if (cancel) return;
             assert(!ec);
-            ec = {};
 
-            if (ei->first.to_remove) {
-                // Marked for removal, drop the entry and get another one.
-                entries.erase(ei);
-                continue;
-            }
+            for (auto& key : due) entries.at(key).in_flight = true;
 
-            // Try inserting three times before moving to the next entry
-            bool success = false;
-            for (int i = 0; i != 3; ++i) {
-                // XXX: Temporary handler tracking as this coroutine sometimes
-                // fails to exit.
-                TRACK_HANDLER();
-                announce(ei->first, cancel, yield[ec]);
-                if (cancel) return;
-                if (!ec) { success = true; break; }
-                async_sleep(ex, chrono::seconds(1+i), cancel, yield[ec]);
+            for (auto& key : due) {
+                auto slot = scheduler.wait_for_slot(cancel, yield[ec]);
                 if (cancel) return;
-                ec = {};
+                assert(!ec);
+
+                // Created here so that it is fired if the loop goes away
+                // before the job starts.
+                Cancel job_cancel(_cancel);
+
+                TRACK_SPAWN(ex, ([ this
+                                 , key = move(key)
+                                 , slot = move(slot)
+                                 , job_cancel = move(job_cancel)
+                                 ] (asio::yield_context yield) mutable {
+                    announce(key, job_cancel, yield);
+                }));
             }
+        }
 
-            if (success) {
-                ei->first.failed_update     = {};
-                ei->first.successful_update = Clock::now();
-            } else  {
-                ei->first.failed_update     = Clock::now();
-            }
+        return or_throw(yield, asio::error::operation_aborted);
+    }
 
-            Entry e = move(ei->first);
-            entries.erase(ei);
-            if (!e.to_remove) entries.push_back(move(e));
+    void announce(const Key& key, Cancel& cancel, asio::yield_context yield)
+    {
+        if (cancel) return;
+        sys::error_code ec;
 
-            if (debug()) { print_entries(); }
-        }
+        _DEBUG("Announcing: ", key, "...");
+        dht->tracker_announce(entries.at(key).infohash, boost::none, cancel, yield[ec]);
+        if (cancel) return;
+        _DEBUG("Announcing: ", key, ": done; ec=", ec);
 
-        return or_throw(yield, asio::error::operation_aborted);
+        finish(key, !ec);
+
+        if (debug()) { print_entries(); }
     }
 
-    void announce(Entry& e, Cancel& cancel, asio::yield_context yield)
+    void finish(const Key& key, bool success)
     {
-        _DEBUG("Announcing: ", e.key, "...");
+        auto i = entries.find(key);
+        assert(i != entries.end());
+        if (i == entries.end()) return;
 
-        sys::error_code ec;
-        auto e_key{debug() ? e.key : ""};  // cancellation trashes the key
-        dht->tracker_announce(e.infohash, boost::none, cancel, yield[ec]);
+        auto& e = i->second;
+        e.in_flight = false;
 
-        _DEBUG("Announcing: ", e_key, ": done; ec=", ec);
+        if (e.to_remove) {
+            entries.erase(i);
+            return;
+        }
+
+        auto now = Clock::now();
+
+        announces_counter(success ? "success" : "failure").inc();
+
+        if (success) {
+            e.failures = 0;
+            e.failed_update     = {};
+            e.successful_update = now;
+            schedule.schedule(key, now + success_reannounce_period());
+        } else if (++e.failures < max_attempts) {
+            schedule.schedule(key, now + chrono::seconds(e.failures));
+        } else {
+            e.failures = 0;
+            e.failed_update = now;
+            schedule.schedule(key, now + failure_reannounce_period());
+        }
 
-        return or_throw(yield, ec);
+        wake();
     }
 
     ~Loop() { _cancel(); }
@@ -2,13 +2,16 @@
 #include "announcer.h"
 #include "dht_lookup.h"
 #include "local_peer_discovery.h"
+#include "peer_lookup_refresher.h"
 #include "http_sign.h"
 #include "http_store.h"
+#include "exact_range_reader.h"
 #include "../default_timeout.h"
 #include "../http_util.h"
 #include "../parse/number.h"
 #include "../util/set_io.h"
 #include "../util/lru_cache.h"
+#include "../util/metrics.h"
 #include "../util/handler_tracker.h"
 #include "../ouiservice/utp.h"
 #include "../logger.h"
@@ -55,7 +58,7 @@ struct GarbageCollector {
 
     void start()
     {
-        asio::spawn(_executor, [&] (asio::yield_context yield) {
+        util::spawn(_executor, [&] (asio::yield_context yield) {
             TRACK_HANDLER();
             Cancel cancel(_cancel);
 
@@ -66,19 +69,35 @@ struct GarbageCollector {
                 if (cancel || ec) break;
 
                 _DEBUG("Collecting garbage...");
+                auto start = chrono::steady_clock::now();
+                size_t kept = 0;
                 http_store.for_each([&] (auto rr, auto y) {
                     sys::error_code e;
                     auto k = keep(std::move(rr), y[e]);
                     ec = compute_error_code(ec, cancel);
+                    if (!e && k) ++kept;
                     return or_throw(y, e, k);
                 }, cancel, yield[ec]);
                 if (ec) _WARN("Collecting garbage: failed;"
                               " ec=", ec);
+                else record_metrics(chrono::steady_clock::now() - start, kept);
                 _DEBUG("Collecting garbage: done");
             }
             _DEBUG("Garbage collector stopped");
         });
     }
+
+private:
+    static void record_metrics(chrono::steady_clock::duration duration, size_t kept)
+    {
+        auto& r = metrics::registry();
+        r.histogram( "ouinet_cache_gc_duration_seconds"
+                   , "Time taken by cache garbage collection passes")
+            .observe(duration);
+        r.gauge( "ouinet_cache_store_entries"
+               , "Entries in the local cache after the last garbage collection")
+            .set(kept);
+    }
 };
 
 struct Client::Impl {
@@ -105,6 +124,7 @@ struct Client::Impl {
     GarbageCollector _gc;
     map<string, udp::endpoint> _peer_cache;
     util::LruCache<std::string, shared_ptr<PeerLookup>> _peer_lookups;
+    unique_ptr<PeerLookupRefresher<PeerLookup>> _peer_lookup_refresher;
     LocalPeerDiscovery _local_peer_discovery;
     std::unique_ptr<Groups> _groups;
 
@@ -144,6 +164,8 @@ struct Client::Impl {
 
         _dht = move(dht);
         _announcer = std::make_unique<Announcer>(_dht);
+        _peer_lookup_refresher = std::make_unique<PeerLookupRefresher<PeerLookup>>(_ex);
+        _peer_lookup_refresher->start();
 
         // Announce all groups.
         for (auto& group_name : _groups->groups())
@@ -348,13 +370,91 @@ struct Client::Impl {
         auto* lookup = _peer_lookups.get(swarm_name);
 
         if (!lookup) {
-            lookup = _peer_lookups.put( swarm_name
-                                      , make_shared<PeerLookup>(_dht, swarm_name));
+            // Popular groups may still be kept fresh by the refresher.
+            auto l = _peer_lookup_refresher->find(swarm_name);
+            if (!l) l = make_shared<PeerLookup>(_dht, swarm_name);
+            lookup = _peer_lookups.put(swarm_name, move(l));
         }
 
+        _peer_lookup_refresher->requested(*lookup);
         return *lookup;
     }
 
+    // Hits from peers are labelled by where the peer providing the response
+    // was found (`lan` or `dht`), misses from peers just as `peers`.
+    static void count_lookup(const char* source, bool hit)
+    {
+        metrics::registry().counter
+            ( "ouinet_cache_lookups_total", "Lookups of cached responses"
+            , {{"source", source}, {"result", hit ? "hit" : "miss"}}).inc();
+    }
+
+    std::unique_ptr<MultiPeerReader>
+    multi_peer_reader(const std::string& key, const GroupName& group, Yield& yield)
+    {
+        string debug_tag;
+        if (logger.get_threshold() <= DEBUG) {
+            debug_tag = yield.tag() + "/multi_peer_reader";
+        };
+
+        if (_dht) {
+            auto peer_lookup_ = peer_lookup(compute_swarm_name(group));
+
+            if (!debug_tag.empty()) {
+                LOG_DEBUG(debug_tag, " DHT peer lookup:");
+                LOG_DEBUG(debug_tag, "    key=        ", key);
+                LOG_DEBUG(debug_tag, "    group=      ", group);
+                LOG_DEBUG(debug_tag, "    swarm_name= ", peer_lookup_->swarm_name());
+                LOG_DEBUG(debug_tag, "    infohash=   ", peer_lookup_->infohash());
+            };
+
+            return std::make_unique<MultiPeerReader>
+                ( _ex
+                , key
+                , _cache_pk
+                , _local_peer_discovery.found_peers()
+                , _dht->local_endpoints()
+                , _dht->wan_endpoints()
+                , move(peer_lookup_)
+                , _newest_proto_seen
+                , debug_tag);
+        }
+
+        return std::make_unique<MultiPeerReader>
+            ( _ex
+            , key
+            , _cache_pk
+            , _local_peer_discovery.found_peers()
+            , _lan_my_endpoints
+            , _newest_proto_seen
+            , debug_tag);
+    }
+
+    // Let the multi-peer download take the data blocks
+    // already stored in the incomplete local copy,
+    // so that only the missing ones are fetched from peers.
+    // The complete response replaces the local copy when stored.
+    void resume_from_local( const std::string& key
+                          , MultiPeerReader& reader
+                          , Cancel& cancel
+                          , Yield& yield)
+    {
+        sys::error_code ec;
+
+        auto hl = _http_store->load_hash_list
+            (key, cancel, static_cast<asio::yield_context>(yield[ec]));
+        if (ec) return;  // no usable stored blocks
+
+        auto bs = hl.signed_head.block_size();
+        if (!bs) return;
+
+        auto rr = _http_store->range_reader(key, 0, hl.blocks.size() * bs - 1, ec);
+        if (ec) return;
+
+        _YDEBUG(yield, "Resuming incomplete local copy; stored_blocks=", hl.blocks.size());
+        reader.set_local_prefix(move(hl), move(rr));
+    }
+
     Session load( const std::string& key
                 , const GroupName& group
                 , bool is_head_request
@@ -375,60 +475,124 @@ struct Client::Impl {
         if (!ec) {
             // TODO: Check its age, store it if it's too old but keep trying
             // other peers.
-            if (is_head_request) return rs;  // do not care about body size
+            if (is_head_request) {
+                count_lookup("local", true);
+                return rs;  // do not care about body size
+            }
 
             auto data_size_sv = rs.response_header()[http_::response_data_size_hdr];
             auto data_size_o = parse::number<std::size_t>(data_size_sv);
-            if (data_size_o && rs_sz == *data_size_o)
+            if (data_size_o && rs_sz == *data_size_o) {
+                count_lookup("local", true);
                 return rs;  // local copy available and complete, use it
+            }
             rs_available = true;  // available but incomplete
-            // TODO: Ideally, an incomplete or stale local cache entry
-            // could be reused in the multi-peer download below.
+            // TODO: Ideally, a stale local cache entry
+            // could also be reused in the multi-peer download below.
         }
+        count_lookup("local", false);
         ec = {};  // try distributed cache
 
-        string debug_tag;
-        if (logger.get_threshold() <= DEBUG) {
-            debug_tag = yield.tag() + "/multi_peer_reader";
-        };
+        auto reader = multi_peer_reader(key, group, yield);
+        if (rs_available) resume_from_local(key, *reader, cancel, yield);
 
-        std::unique_ptr<MultiPeerReader> reader;
-        if (_dht) {
-            auto peer_lookup_ = peer_lookup(compute_swarm_name(group));
+        return load_from_peers( move(reader), is_head_request
+                              , move(rs), rs_available, cancel, yield);
+    }
 
-            if (!debug_tag.empty()) {
-                LOG_DEBUG(debug_tag, " DHT peer lookup:");
-                LOG_DEBUG(debug_tag, "    key=        ", key);
-                LOG_DEBUG(debug_tag, "    group=      ", group);
-                LOG_DEBUG(debug_tag, "    swarm_name= ", peer_lookup_->swarm_name());
-                LOG_DEBUG(debug_tag, "    infohash=   ", peer_lookup_->infohash());
-            };
+    Session load_range( const std::string& key
+                      , const GroupName& group
+                      , std::size_t first
+                      , std::size_t last
+                      , Cancel cancel
+                      , Yield yield)
+    {
+        sys::error_code ec;
 
-            reader = std::make_unique<MultiPeerReader>
-                ( _ex
-                , key
-                , _cache_pk
-                , _local_peer_discovery.found_peers()
-                , _dht->local_endpoints()
-                , _dht->wan_endpoints()
-                , move(peer_lookup_)
-                , _newest_proto_seen
-                , debug_tag);
-        } else {
-            reader = std::make_unique<MultiPeerReader>
-                ( _ex
-                , key
-                , _cache_pk
-                , _local_peer_discovery.found_peers()
-                , _lan_my_endpoints
-                , _newest_proto_seen
-                , debug_tag);
+        auto s = load_range_blocks(key, group, first, last, cancel, yield[ec]);
+        return_or_throw_on_error(yield, cancel, ec, move(s));
+
+        // Ranges only apply to `200 OK` responses (RFC7233#4.1),
+        // so send the whole response otherwise.
+        if (s.response_header()[http_::response_original_http_status] != "200") {
+            _YDEBUG(yield, "Not a range of an OK response, loading it whole: ", key);
+            s.close();
+            return load(key, group, false, cancel, yield);
         }
 
+        auto rr = std::make_unique<ExactRangeReader>
+            (std::make_unique<Session>(move(s)), first, last);
+        return yield.tag("read_hdr").run([&] (auto y) {
+            return Session::create(move(rr), false, cancel, y);
+        });
+    }
+
+    // Get the data blocks covering the range, in the format produced by
+    // `http_store_range_reader` (with the same rules for `first` and `last`).
+    Session load_range_blocks( const std::string& key
+                             , const GroupName& group
+                             , std::size_t first
+                             , std::size_t last
+                             , Cancel cancel
+                             , Yield yield)
+    {
+        namespace err = asio::error;
+
+        sys::error_code ec;
+
+        _YDEBUG(yield, "Requesting range from the cache: ", key
+               , " first=", first, " last=", last);
+
+        Session rs;
+        bool rs_available = false;
+        auto rs_sz = _http_store->body_size(key, ec);
+        if (!ec && first < rs_sz) {
+            rs = load_range_from_local(key, first, last, cancel, yield[ec]);
+            _YDEBUG(yield, "Looking up local cache; ec=", ec);
+            if (ec == err::operation_aborted) return or_throw<Session>(yield, ec);
+            if (!ec) {
+                if (covers_range(rs.response_header(), last)) {
+                    count_lookup("local", true);
+                    return rs;  // local copy has all the range, use it
+                }
+                rs_available = true;  // available but incomplete
+            }
+        }
+        count_lookup("local", false);
+        ec = {};  // try distributed cache
+
+        // Only blocks covering the range are fetched from peers,
+        // so there is no need to wait for preceding data.
+        auto reader = multi_peer_reader(key, group, yield);
+        reader->set_range(first, last);
+
+        return load_from_peers( move(reader), false
+                              , move(rs), rs_available, cancel, yield);
+    }
+
+    // If reading the response head from peers fails,
+    // fall back to the incomplete local copy `rs` (if available).
+    Session load_from_peers( std::unique_ptr<MultiPeerReader> reader
+                           , bool is_head_request
+                           , Session rs
+                           , bool rs_available
+                           , Cancel& cancel
+                           , Yield& yield)
+    {
+        namespace err = asio::error;
+
+        sys::error_code ec;
+
+        // The session owns the reader.
+        auto reader_p = reader.get();
         auto s = yield[ec].tag("read_hdr").run([&] (auto y) {
             return Session::create(std::move(reader), is_head_request, cancel, y);
         });
 
+        if (ec != err::operation_aborted)
+            count_lookup( ec ? "peers" : (reader_p->is_from_lan_peer() ? "lan" : "dht")
+                        , !ec);
+
         if (!ec) {
             s.response_header().set( http_::response_source_hdr  // for agent
                                    , http_::response_source_hdr_dist_cache);
@@ -468,6 +632,35 @@ struct Client::Impl {
         return rs;
     }
 
+    // Whether the partial response has data up to the `last` byte requested
+    // (or the end of data).
+    static
+    bool covers_range(const http_response::Head& rsh, std::size_t last)
+    {
+        auto br = util::HttpResponseByteRange::parse(rsh[http::field::content_range]);
+        if (!br || !br->length || *br->length == 0) return false;
+        return br->last >= std::min(last, *br->length - 1);
+    }
+
+    Session load_range_from_local( const std::string& key
+                                 , std::size_t first
+                                 , std::size_t last
+                                 , Cancel cancel
+                                 , Yield yield)
+    {
+        sys::error_code ec;
+        auto rr = _http_store->range_reader(key, first, last, ec);
+        if (ec) return or_throw<Session>(yield, ec);
+        auto rs = yield[ec].tag("read_hdr").run([&] (auto y) {
+            return Session::create(move(rr), false, cancel, y);
+        });
+        return_or_throw_on_error(yield, cancel, ec, move(rs));
+
+        rs.response_header().set( http_::response_source_hdr  // for agent
+                                , http_::response_source_hdr_local_cache);
+        return rs;
+    }
+
     void store( const std::string& key
               , const GroupName& group
               , http_response::AbstractReader& r
@@ -630,6 +823,7 @@ struct Client::Impl {
 
     void stop() {
         _lifetime_cancel();
+        if (_peer_lookup_refresher) _peer_lookup_refresher->stop();
         _local_peer_discovery.stop();
     }
 
@@ -733,6 +927,15 @@ Session Client::load( const std::string& key
     return _impl->load(key, group, is_head_request, cancel, yield);
 }
 
+Session Client::load_range( const std::string& key
+                          , const GroupName& group
+                          , std::size_t first
+                          , std::size_t last
+                          , Cancel cancel, Yield yield)
+{
+    return _impl->load_range(key, group, first, last, cancel, yield);
+}
+
 void Client::store( const std::string& key
                   , const GroupName& group
                   , http_response::AbstractReader& r
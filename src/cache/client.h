@@ -89,6 +89,18 @@ public:
                 , Cancel
                 , Yield);
 
+    // Like `load`, but only get the given byte range of the response body
+    // as a partial response ready for the user agent (see `ExactRangeReader`).
+    // Local data is used if it covers the whole range,
+    // otherwise just the data blocks covering it are fetched from peers.
+    // Responses other than `200 OK` are loaded whole.
+    Session load_range( const std::string& key
+                      , const GroupName& group
+                      , std::size_t first
+                      , std::size_t last
+                      , Cancel
+                      , Yield);
+
     void store( const std::string& key
               , const GroupName& group
               , http_response::AbstractReader&
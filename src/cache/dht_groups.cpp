@@ -1,11 +1,16 @@
 #include "dht_groups.h"
 #include "../logger.h"
+#include "../util/atomic_file.h"
 #include "../util/file_io.h"
 #include "../util/bytes.h"
 #include "../util/hash.h"
+#include "../util/str.h"
+#include "../parse/number.h"
 
 #include <algorithm>
 #include <map>
+#include <boost/asio/write.hpp>
+#include <boost/utility/string_view.hpp>
 
 using namespace ouinet;
 
@@ -21,6 +26,28 @@ using sys::errc::make_error_code;
 // https://stackoverflow.com/a/417184/273348
 #define MAX_URL_SIZE 2000
 
+// Group membership is stored in a single log file in the root directory.
+// Each change appends a record to it (with a single write),
+// and the log is rewritten with just the current membership
+// once it grows much bigger than that.
+//
+// The log starts with `LOG_HEADER`, followed by records like:
+//
+//     A <group name size> <item name size>\n<group name><item name>\n
+//     R <item name size>\n<item name>\n
+//     G <group name size>\n<group name>\n
+//
+// to add an item to a group, remove an item from all groups,
+// and remove a group, respectively.
+//
+// Previous versions stored each group as a directory
+// (see `load_group`); these are still loaded, and moved into the log
+// when trusted.
+#define LOG_NAME "groups.log"
+#define LOG_HEADER "OUINET-DHT-GROUPS 1\n"
+// Do not compact logs with less records than this.
+#define LOG_MIN_COMPACT_RECORDS 1024
+
 class DhtGroupsImpl {
 public:
     using GroupName = BaseDhtGroups::GroupName;
@@ -63,14 +90,35 @@ private:
     Group load_group( const fs::path dir, bool trusted
                     , asio::executor, Cancel&, asio::yield_context);
 
-    fs::path group_path(const GroupName&);
-    fs::path items_path(const GroupName&);
-    fs::path item_path(const GroupName&, const ItemName&);
+    // Return false if the log is not complete or has malformed records,
+    // in which case records before that are still applied.
+    static
+    bool parse_log(boost::string_view, Groups&, size_t& records);
+
+    static void apply_add(Groups&, const GroupName&, const ItemName&);
+    static std::set<GroupName> apply_remove(Groups&, const ItemName&);
+    static void apply_remove_group(Groups&, const GroupName&);
+
+    static std::string add_record(const GroupName&, const ItemName&);
+    static std::string remove_record(const ItemName&);
+    static std::string remove_group_record(const GroupName&);
+
+    fs::path log_path() const { return _root_dir / LOG_NAME; }
+
+    void append(const std::string& record, sys::error_code&);
+    // Rewrite the log with the current groups only.
+    void compact(sys::error_code&);
+    void compact_if_needed();
 
 private:
     asio::executor _ex;
     fs::path _root_dir;
     Groups _groups;
+    // Only open for trusted groups.
+    boost::optional<asio::posix::stream_descriptor> _log;
+    size_t _log_size = 0;
+    size_t _log_records = 0;
+    size_t _compact_threshold = LOG_MIN_COMPACT_RECORDS;
     Cancel _lifetime_cancel;
 };
 
@@ -92,7 +140,8 @@ try_remove(const fs::path& path)
     // The parent directory may be left empty.
 }
 
-static std::string read_file(fs::path p, asio::executor ex, Cancel& c, yield_context y)
+static std::string read_file( fs::path p, size_t max_size
+                            , asio::executor ex, Cancel& c, yield_context y)
 {
     sys::error_code ec;
 
@@ -107,7 +156,7 @@ static std::string read_file(fs::path p, asio::executor ex, Cancel& c, yield_con
     size_t size = file_io::file_size(f, ec);
     if (ec) return or_throw<std::string>(y, ec);
 
-    if (size > MAX_URL_SIZE)
+    if (size > max_size)
         return or_throw<std::string>(y, make_error_code(sys::errc::value_too_large));
 
     std::string ret(size, '\0');
@@ -131,7 +180,7 @@ DhtGroupsImpl::load_group( const fs::path dir
     assert(fs::is_directory(dir));
     sys::error_code ec;
 
-    std::string group_name = read_file(dir/"group_name", ex, cancel, yield[ec]);
+    std::string group_name = read_file(dir/"group_name", MAX_URL_SIZE, ex, cancel, yield[ec]);
     if (ec) return or_throw<Group>(yield, ec);
 
     if (!trusted && dir.filename() != sha1_hex_digest(group_name)) {
@@ -153,7 +202,7 @@ DhtGroupsImpl::load_group( const fs::path dir
     Group::second_type items;
 
     for (auto f : fs::directory_iterator(items_dir)) {
-        std::string name = read_file(f, ex, cancel, yield[ec]);
+        std::string name = read_file(f, MAX_URL_SIZE, ex, cancel, yield[ec]);
 
         if (cancel) {
             return or_throw<Group>(yield, asio::error::operation_aborted);
@@ -200,6 +249,120 @@ std::set<DhtGroups::ItemName> DhtGroupsImpl::items(const GroupName& gn) const
     return ret;
 }
 
+/* static */
+void DhtGroupsImpl::apply_add( Groups& groups
+                             , const GroupName& group_name
+                             , const ItemName& item_name)
+{
+    groups[group_name].insert(item_name);
+}
+
+/* static */
+std::set<DhtGroups::GroupName>
+DhtGroupsImpl::apply_remove(Groups& groups, const ItemName& item_name)
+{
+    std::set<GroupName> erased_groups;
+
+    for (auto j = groups.begin(); j != groups.end();) {
+        auto gi = j; ++j;
+
+        auto& items = gi->second;
+        items.erase(item_name);
+
+        // Also sanitize groups which were empty already.
+        if (items.empty()) {
+            erased_groups.insert(gi->first);
+            groups.erase(gi);
+        }
+    }
+
+    return erased_groups;
+}
+
+/* static */
+void DhtGroupsImpl::apply_remove_group(Groups& groups, const GroupName& group_name)
+{
+    groups.erase(group_name);
+}
+
+/* static */
+std::string DhtGroupsImpl::add_record( const GroupName& group_name
+                                     , const ItemName& item_name)
+{
+    return util::str( "A ", group_name.size(), ' ', item_name.size(), '\n'
+                    , group_name, item_name, '\n');
+}
+
+/* static */
+std::string DhtGroupsImpl::remove_record(const ItemName& item_name)
+{
+    return util::str("R ", item_name.size(), '\n', item_name, '\n');
+}
+
+/* static */
+std::string DhtGroupsImpl::remove_group_record(const GroupName& group_name)
+{
+    return util::str("G ", group_name.size(), '\n', group_name, '\n');
+}
+
+static
+boost::optional<size_t> parse_size(boost::string_view& s)
+{
+    auto n = parse::number<size_t>(s);
+    if (!n || *n > MAX_URL_SIZE) return boost::none;
+    return n;
+}
+
+/* static */
+bool DhtGroupsImpl::parse_log(boost::string_view log, Groups& groups, size_t& records)
+{
+    records = 0;
+
+    if (!log.starts_with(LOG_HEADER)) return false;
+    log.remove_prefix(sizeof(LOG_HEADER) - 1);
+
+    while (!log.empty()) {
+        auto eol = log.find('\n');
+        if (eol == log.npos) return false;
+
+        auto head = log.substr(0, eol);
+        log.remove_prefix(eol + 1);
+
+        if (head.size() < 2 || head[1] != ' ') return false;
+        char op = head[0];
+        head.remove_prefix(2);
+
+        auto size1 = parse_size(head);
+        if (!size1) return false;
+
+        boost::optional<size_t> size2;
+        if (op == 'A') {
+            if (!head.starts_with(' ')) return false;
+            head.remove_prefix(1);
+            size2 = parse_size(head);
+            if (!size2) return false;
+        }
+        if (!head.empty()) return false;
+
+        auto payload_size = *size1 + size2.value_or(0);
+        if (log.size() < payload_size + 1 || log[payload_size] != '\n') return false;
+
+        std::string name1(log.substr(0, *size1));
+
+        switch (op) {
+            case 'A': apply_add(groups, name1, log.substr(*size1, *size2).to_string()); break;
+            case 'R': apply_remove(groups, name1); break;
+            case 'G': apply_remove_group(groups, name1); break;
+            default: return false;
+        }
+
+        log.remove_prefix(payload_size + 1);
+        ++records;
+    }
+
+    return true;
+}
+
 /* static */
 std::unique_ptr<DhtGroupsImpl>
 DhtGroupsImpl::load( fs::path root_dir
@@ -230,165 +393,188 @@ DhtGroupsImpl::load( fs::path root_dir
         return or_throw<Ret>(yield, make_error_code(sys::errc::no_such_file_or_directory));
     }
 
+    // Load the whole log in a single read.
+    bool log_ok = false;
+    size_t log_records = 0;
+    fs::path log_p = root_dir / LOG_NAME;
+
+    if (fs::exists(log_p)) {
+        sys::error_code ec;
+        auto log = read_file(log_p, size_t(-1), ex, cancel, yield[ec]);
+        if (cancel) return or_throw<Ret>(yield, asio::error::operation_aborted);
+
+        if (ec) {
+            // Do not compact the log below with nothing loaded,
+            // since that would lose all groups on a transient error.
+            _ERROR("Failed to read groups log: ", log_p, "; ec=", ec);
+            return or_throw<Ret>(yield, ec);
+        }
+
+        if (!(log_ok = parse_log(log, groups, log_records))) {
+            _WARN("Groups log is truncated or malformed, loaded ", log_records, " records: ", log_p);
+        }
+    }
+
+    // Load groups stored as directories by previous versions.
+    std::vector<fs::path> old_dirs;
+
     for (auto f : fs::directory_iterator(root_dir)) {
         sys::error_code ec;
 
         if (!fs::is_directory(f)) {
-            _ERROR("Non directory found in '", root_dir, "': '", f, "'");
+            if (f.path().filename() != LOG_NAME)
+                _ERROR("Non directory found in '", root_dir, "': '", f, "'");
             continue;
         }
 
         auto group = load_group(f, trusted, ex, cancel, yield[ec]);
 
         if (cancel) return or_throw<Ret>(yield, asio::error::operation_aborted);
+        old_dirs.push_back(f);
         if (ec || group.second.empty()) {
             _WARN("Not loading empty group: ", group.first);
-            if (trusted) try_remove(f);
             continue;
         }
 
-        groups.insert(std::move(group));
+        auto& items = groups[group.first];
+        items.insert(group.second.begin(), group.second.end());
     }
 
-    return std::unique_ptr<DhtGroupsImpl>
-        (new DhtGroupsImpl(ex, std::move(root_dir), std::move(groups)));
-}
+    auto ret = Ret(new DhtGroupsImpl(ex, std::move(root_dir), std::move(groups)));
+    if (!trusted) return ret;
 
-fs::path
-DhtGroupsImpl::group_path(const GroupName& group_name)
-{
-    return _root_dir / sha1_hex_digest(group_name);
-}
+    sys::error_code ec;
+    ret->_log_records = log_records;
 
-fs::path
-DhtGroupsImpl::items_path(const GroupName& group_name)
-{
-    return group_path(group_name) / "items";
-}
+    if (log_ok && old_dirs.empty() && log_records < ret->_compact_threshold) {
+        auto log = file_io::open_or_create(ex, log_p, ec);
+        if (!ec) ret->_log_size = file_io::file_size(log, ec);
+        if (!ec) file_io::fseek(log, ret->_log_size, ec);
+        if (!ec) ret->_log = std::move(log);
+    } else {
+        // This also drops any malformed tail.
+        ret->compact(ec);
+    }
 
-fs::path
-DhtGroupsImpl::item_path(const GroupName& group_name, const ItemName& item_name)
-{
-    return items_path(group_name) / sha1_hex_digest(item_name);
+    if (ec) {
+        _ERROR("Failed to open groups log: ", log_p, "; ec=", ec);
+        return or_throw<Ret>(yield, ec);
+    }
+
+    // Their groups are in the log now.
+    for (auto& dir : old_dirs) try_remove(dir);
+
+    return ret;
 }
 
-void DhtGroupsImpl::add( const GroupName& group_name
-                   , const ItemName& item_name
-                   , Cancel& cancel
-                   , yield_context yield)
+void DhtGroupsImpl::append(const std::string& record, sys::error_code& ec)
 {
-    _DEBUG("Adding: ", group_name, " -> ", item_name);
-    fs::path group_p = group_path(group_name);
+    if (!_log) {
+        ec = asio::error::bad_descriptor;
+        return;
+    }
 
-    // Create the storage representation of the item in the group.
-    if (fs::exists(group_p)) {
-        if (!fs::is_directory(group_p)) {
-            return or_throw(yield, make_error_code(sys::errc::not_a_directory));
-        }
-    } else {
-        sys::error_code ec;
-        fs::create_directories(group_p, ec);
-        if (ec) {
-            _ERROR("Failed to create directory for group: ", group_name, "; ec=", ec);
-            return or_throw(yield, ec);
-        }
+    asio::write(*_log, asio::buffer(record), ec);
 
-        auto group_name_f = file_io::open_or_create(_ex, group_p/"group_name", ec);
-        if (ec) {
-            _ERROR("Failed to create group name file for group: ", group_name, "; ec=", ec);
-            try_remove(group_p);
-            return or_throw(yield, ec);
-        }
+    if (ec) {
+        // Do not leave a partial record which would hide later ones.
+        sys::error_code ec_;
+        file_io::truncate(*_log, _log_size, ec_);
+        file_io::fseek(*_log, _log_size, ec_);
+        return;
+    }
 
-        file_io::write(group_name_f, asio::buffer(group_name), cancel, yield[ec]);
+    _log_size += record.size();
+    ++_log_records;
+}
 
-        if (ec) {
-            if (!cancel) {
-                _ERROR("Failed write group name: ", group_name, "; ec=", ec);
-            }
-            try_remove(group_p);
-            return or_throw(yield, ec);
+void DhtGroupsImpl::compact(sys::error_code& ec)
+{
+    std::string log = LOG_HEADER;
+    size_t records = 0;
+
+    for (auto& group : _groups) {
+        for (auto& item : group.second) {
+            log += add_record(group.first, item);
+            ++records;
         }
     }
 
-    auto items_p = items_path(group_name);
+    auto file = util::atomic_file::make(_ex, log_path(), ec);
+    if (!ec) asio::write(file->lowest_layer(), asio::buffer(log), ec);
+    if (!ec) file->commit(ec);
 
-    sys::error_code ec;
-    if (!fs::is_directory(items_p)) {
-        fs::create_directories(items_p, ec);
-        if (ec) {
-            _ERROR("Failed to create items path: ", items_p, "; ec=", ec);
-            try_remove(group_p);
-            return or_throw(yield, ec);
-        }
+    if (!ec) {
+        // The previous file was replaced, so the log needs reopening.
+        _log = boost::none;
+        auto f = file_io::open_or_create(_ex, log_path(), ec);
+        if (!ec) file_io::fseek(f, log.size(), ec);
+        if (!ec) _log = std::move(f);
     }
 
-    auto item_f = file_io::open_or_create(_ex, item_path(group_name, item_name), ec);
-
     if (ec) {
-        _ERROR("Failed to create group item; ec=", ec);
-        if (fs::is_empty(items_p)) try_remove(group_p);
-        return or_throw(yield, ec);
+        // Avoid retrying on every change.
+        _compact_threshold = 2 * _log_records + LOG_MIN_COMPACT_RECORDS;
+        return;
     }
 
-    file_io::truncate(item_f, 0, ec);
+    _DEBUG("Compacted groups log from ", _log_records, " to ", records, " records");
 
-    if (ec) {
-        _ERROR("Failed to truncate group item file; ec=", ec);
-        if (fs::is_empty(items_p)) try_remove(group_p);
-        return or_throw(yield, ec);
+    _log_size = log.size();
+    _log_records = records;
+    _compact_threshold = std::max<size_t>(2 * records, LOG_MIN_COMPACT_RECORDS);
+}
+
+void DhtGroupsImpl::compact_if_needed()
+{
+    if (_log_records < _compact_threshold) return;
+
+    sys::error_code ec;
+    compact(ec);
+    if (ec) _WARN("Failed to compact groups log; ec=", ec);
+}
+
+void DhtGroupsImpl::add( const GroupName& group_name
+                       , const ItemName& item_name
+                       , Cancel& cancel
+                       , yield_context yield)
+{
+    if (cancel) return or_throw(yield, asio::error::operation_aborted);
+
+    _DEBUG("Adding: ", group_name, " -> ", item_name);
+
+    if (group_name.size() > MAX_URL_SIZE || item_name.size() > MAX_URL_SIZE) {
+        return or_throw(yield, make_error_code(sys::errc::value_too_large));
     }
 
-    file_io::write(item_f, asio::buffer(item_name), cancel, yield[ec]);
+    auto gi = _groups.find(group_name);
+    if (gi != _groups.end() && gi->second.count(item_name)) return;  // already there
+
+    sys::error_code ec;
+    append(add_record(group_name, item_name), ec);
 
     if (ec) {
-        if (!cancel) {
-            _ERROR("Failed write to group item; ec=", ec);
-        }
-        if (fs::is_empty(items_p)) try_remove(group_p);
+        _ERROR("Failed to store group item; ec=", ec);
         return or_throw(yield, ec);
     }
 
-    // Add the item to the group in memory.
-    const auto& group_it = _groups.find(group_name);
-    if (group_it == _groups.end()) {
-        _groups[group_name] = {item_name};  // new group
-        return;
-    }
-    group_it->second.emplace(item_name);  // add item to existing group
+    apply_add(_groups, group_name, item_name);
+    compact_if_needed();
 }
 
 std::set<DhtGroups::GroupName> DhtGroupsImpl::remove(const ItemName& item_name)
 {
-    std::set<GroupName> erased_groups;
-
-    for (auto j = _groups.begin(); j != _groups.end();) {
-        auto gi = j; ++j;
-
-        auto& group_name = gi->first;
-        auto& items      = gi->second;
+    bool found = std::any_of( _groups.begin(), _groups.end()
+                            , [&] (auto& g) { return g.second.count(item_name); });
 
-        if (items.empty()) {
-            // This case shouldn't happen, but let's sanitize it anyway.
-            erased_groups.insert(group_name);
-            try_remove(group_path(group_name));
-            _groups.erase(gi);
-            continue;
-        }
+    auto erased_groups = apply_remove(_groups, item_name);
+    if (!found) return erased_groups;
 
-        auto i = items.find(item_name);
-        if (i == items.end()) continue;
-
-        items.erase(i);
-        try_remove(item_path(group_name, item_name));
-
-        if (items.empty()) {
-            erased_groups.insert(group_name);
-            try_remove(group_path(group_name));
-            _groups.erase(gi);
-        }
-    }
+    sys::error_code ec;
+    append(remove_record(item_name), ec);
+    if (ec) _WARN("Failed to store removal of group item; ec=", ec);
 
+    compact_if_needed();
     return erased_groups;
 }
 
@@ -397,8 +583,13 @@ void DhtGroupsImpl::remove_group(const GroupName& gn)
     auto gi = _groups.find(gn);
     if (gi == _groups.end()) return;
 
-    try_remove(group_path(gn));
     _groups.erase(gi);
+
+    sys::error_code ec;
+    append(remove_group_record(gn), ec);
+    if (ec) _WARN("Failed to store removal of group; ec=", ec);
+
+    compact_if_needed();
 }
 
 DhtGroupsImpl::~DhtGroupsImpl() {
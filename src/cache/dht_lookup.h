@@ -17,8 +17,10 @@ namespace std {
 namespace ouinet { namespace cache {
 
 class DhtLookup {
-private:
+public:
     using Clock = std::chrono::steady_clock;
+
+private:
     using udp = asio::ip::udp;
     using tcp = asio::ip::tcp;
     using Ret = std::set<udp::endpoint>;
@@ -30,13 +32,24 @@ private:
         Ret               value;
         Clock::time_point time;
 
-        bool is_fresh() const {
+        Clock::time_point fresh_until() const {
             using namespace std::chrono_literals;
-            if (ec) return false;
-            return time + 5min >= Clock::now();
+            if (ec) return Clock::time_point();
+            return time + 5min;
+        }
+
+        bool is_fresh() const {
+            return fresh_until() >= Clock::now();
         }
     };
 
+    // Start a new lookup in the background
+    // when the last result is about to stop being fresh,
+    // so that requests do not need to wait for it.
+    static Clock::duration revalidate_ahead() {
+        return std::chrono::minutes(2);
+    }
+
     static Clock::duration timeout() {
 #ifndef NDEBUG // debug
         return std::chrono::minutes(1);
@@ -58,13 +71,14 @@ public:
 
     Ret get(Cancel c, asio::yield_context y) {
         // * Start a new job if one isn't already running
+        //   and the previous result is about to expire
         // * Use previously returned result if it's not older than 5mins
         // * Otherwise wait for the running job to finish
 
         auto cancel_con = _lifetime_cancel.connect([&] { c(); });
 
-        if (!_job) {
-            _job = make_job();
+        if (_last_result.fresh_until() < Clock::now() + revalidate_ahead()) {
+            refresh();
         }
 
         if (_last_result.is_fresh()) {
@@ -88,6 +102,21 @@ public:
         return or_throw(y, _last_result.ec, _last_result.value);
     }
 
+    // Start a new lookup in the background unless one is already running.
+    void refresh() {
+        if (!_job) _job = make_job();
+    }
+
+    bool is_running() const {
+        return bool(_job);
+    }
+
+    // The last result is used without a new lookup until this time,
+    // which is in the past if there is no usable result.
+    Clock::time_point fresh_until() const {
+        return _last_result.fresh_until();
+    }
+
     ~DhtLookup() { _lifetime_cancel(); }
 
     NodeID infohash() const {
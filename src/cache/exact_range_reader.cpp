@@ -0,0 +1,90 @@
+#include "exact_range_reader.h"
+#include "http_sign.h"
+#include "../http_util.h"
+#include "../or_throw.h"
+
+using namespace ouinet;
+using namespace ouinet::cache;
+
+using OptPart = boost::optional<http_response::Part>;
+
+OptPart
+ExactRangeReader::async_read_part(Cancel cancel, asio::yield_context yield)
+{
+    if (_next_chunk_body) {
+        auto cb = std::move(*_next_chunk_body);
+        _next_chunk_body = boost::none;
+        return Part{std::move(cb)};
+    }
+
+    sys::error_code ec;
+
+    while (true) {
+        auto part = _reader->async_read_part(cancel, yield[ec]);
+        return_or_throw_on_error(yield, cancel, ec, OptPart{});
+        if (!part) return boost::none;
+
+        if (!_head_sent) {
+            auto head = part->as_head();
+            if (!head) return or_throw<OptPart>(yield, http::error::unexpected_body);
+            _head_sent = true;
+            auto exact = exact_head(std::move(*head), ec);
+            if (ec) return or_throw<OptPart>(yield, ec);
+            return Part{std::move(exact)};
+        }
+
+        // Partial responses are always chunked.
+        // Data is sent as it comes, each piece in its own chunk.
+        if (auto ch = part->as_chunk_hdr()) {
+            if (ch->size > 0) continue;
+            return Part{http_response::ChunkHdr()};  // last chunk
+        }
+
+        if (auto cb = part->as_chunk_body()) {
+            auto data = trim(*cb);
+            if (!data) continue;
+            auto size = data->size();
+            _next_chunk_body = http_response::ChunkBody(std::move(*data), 0);
+            return Part{http_response::ChunkHdr(size, "")};
+        }
+
+        if (part->is_trailer())
+            // Signatures in the trailer do not apply to the trimmed data.
+            return Part{http_response::Trailer()};
+
+        return or_throw<OptPart>(yield, sys::errc::make_error_code(sys::errc::bad_message));
+    }
+}
+
+http_response::Head
+ExactRangeReader::exact_head(http_response::Head head, sys::error_code& ec)
+{
+    auto br = util::HttpResponseByteRange::parse(head[http::field::content_range]);
+    if ( head.result() != http::status::partial_content || !br
+       || _first < br->first || _first > br->last) {
+        ec = sys::errc::make_error_code(sys::errc::bad_message);
+        return {};
+    }
+
+    _offset = br->first;
+    _last = std::min(_last, br->last);
+
+    head.erase(http_::response_original_http_status);
+    head.set( http::field::content_range
+            , util::HttpResponseByteRange{_first, _last, br->length});
+    return head;
+}
+
+boost::optional<std::vector<uint8_t>>
+ExactRangeReader::trim(const std::vector<uint8_t>& data)
+{
+    auto data_first = _offset;
+    _offset += data.size();
+
+    auto first = std::max(_first, data_first);
+    auto end = std::min(_last + 1, _offset);
+    if (first >= end) return boost::none;
+
+    return std::vector<uint8_t>( data.begin() + (first - data_first)
+                               , data.begin() + (end - data_first));
+}
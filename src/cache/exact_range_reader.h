@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+
+#include "../response_reader.h"
+
+namespace ouinet { namespace cache {
+
+// Turns a partial response in the format produced by `http_store_range_reader`
+// or `MultiPeerReader::set_range` into the response to be sent to the user agent
+// for a request of the byte range `[first, last]`.
+//
+// Those partial responses cover whole data blocks,
+// carry the original HTTP status code in `X-Ouinet-HTTP-Status`,
+// and use chunk extensions and trailers to verify the blocks.
+// This reader removes all of these,
+// so that body data and `Content-Range` match the requested range
+// (with `last` clipped to the data in the partial response).
+//
+// The original response should have a `200 OK` status,
+// since only then a range is meaningful (RFC7233#4.1).
+class ExactRangeReader : public http_response::AbstractReader {
+public:
+    using Part = http_response::Part;
+
+    ExactRangeReader( std::unique_ptr<http_response::AbstractReader> reader
+                    , std::size_t first
+                    , std::size_t last)
+        : _reader(std::move(reader))
+        , _first(first)
+        , _last(last)
+    {}
+
+    ~ExactRangeReader() override {}
+
+    boost::optional<Part> async_read_part(Cancel, asio::yield_context) override;
+
+    bool is_done() const override { return _reader->is_done(); }
+    void close() override { _reader->close(); }
+
+    asio::executor get_executor() override
+    {
+        return _reader->get_executor();
+    }
+
+private:
+    http_response::Head exact_head(http_response::Head, sys::error_code&);
+    boost::optional<std::vector<uint8_t>> trim(const std::vector<uint8_t>&);
+
+private:
+    std::unique_ptr<http_response::AbstractReader> _reader;
+    std::size_t _first;
+    std::size_t _last;
+
+    bool _head_sent = false;
+    // Offset in the response body of the next data to be read.
+    std::size_t _offset = 0;
+    boost::optional<http_response::ChunkBody> _next_chunk_body;
+};
+
+}} // namespaces
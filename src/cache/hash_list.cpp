@@ -1,6 +1,7 @@
 #include "hash_list.h"
 #include "http_sign.h"
 #include "chain_hasher.h"
+#include "../parse/number.h"
 
 using namespace std;
 using namespace ouinet;
@@ -35,6 +36,48 @@ bool HashList::verify() const {
                             , signed_head.injection_id());
 }
 
+std::pair<size_t, size_t>
+HashList::blocks_for_range(size_t first, size_t last, sys::error_code& ec) const
+{
+    auto bs = signed_head.block_size();
+    auto data_size_hdr = signed_head[http_::response_data_size_hdr];
+    auto data_size = parse::number<size_t>(data_size_hdr);
+    if (!bs || !data_size) {
+        ec = sys::errc::make_error_code(sys::errc::bad_message);
+        return {};
+    }
+
+    if (first > last || first >= *data_size) {
+        ec = sys::errc::make_error_code(sys::errc::invalid_seek);
+        return {};
+    }
+
+    last = std::min(last, *data_size - 1);
+    auto range_blocks = std::make_pair(first / bs, last / bs + 1);
+
+    if (range_blocks.second > blocks.size()) {
+        ec = sys::errc::make_error_code(sys::errc::bad_message);
+        return {};
+    }
+
+    return range_blocks;
+}
+
+boost::optional<Digest> HashList::prev_chained_digest(size_t block_id) const
+{
+    if (block_id == 0 || block_id > blocks.size()) return boost::none;
+
+    size_t block_size = signed_head.block_size();
+
+    ChainHasher chain_hasher;
+
+    for (size_t b = 0; b < block_id; ++b)
+        chain_hasher.calculate_block( block_size, blocks[b].data_hash
+                                    , blocks[b].chained_hash_signature);
+
+    return chain_hasher.prev_chained_digest();
+}
+
 struct Parser {
     using Data = std::vector<uint8_t>;
 
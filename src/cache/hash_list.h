@@ -38,6 +38,21 @@ struct HashList {
         return blocks[block_id];
     }
 
+    // Data blocks `[first_block, end_block)` covering
+    // the byte range `[first, last]` of the response body,
+    // with `last` clipped to the response data size (RFC7233#2.1).
+    //
+    // `boost::system::errc::invalid_seek` is reported
+    // if the range is beyond response data,
+    // and `boost::system::errc::bad_message`
+    // if the block size, data size or some block is missing.
+    std::pair<size_t, size_t>
+    blocks_for_range(size_t first, size_t last, sys::error_code&) const;
+
+    // Chain hash of the data block before `block_id`
+    // (none for the first block).
+    boost::optional<Digest> prev_chained_digest(size_t block_id) const;
+
 };
 
 }}
@@ -793,7 +793,7 @@ _http_store_reader( const fs::path& dirp, boost::optional<const fs::path&> cdirp
         // Check and convert range.
         assert(range_last);
         size_t begin = *range_first;
-        size_t end   = *range_last + 1;
+        size_t end   = std::max(*range_last, *range_last + 1);  // open ranges
         if (begin > end) {
             _WARN("Inverted range boundaries: ", *range_first, " > ", *range_last);
             ec = sys::errc::make_error_code(sys::errc::invalid_seek);
@@ -114,7 +114,8 @@ http_store_reader( const fs::path& dirp, const fs::path& cdirp
 // `first` and `last` follow RFC7233#2.1 notation:
 // `first` must be strictly less than total data size;
 // `last` must be at least `first` and strictly less than total data size.
-// Open ranges ("N-" and "-N") are not supported.
+// Use the maximum `size_t` value as `last` for open ranges ("N-"),
+// suffix ranges ("-N") are not supported.
 //
 // If the range would cover data which is not stored,
 // a `boost::system::errc::invalid_seek` error is reported
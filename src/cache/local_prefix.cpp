@@ -0,0 +1,76 @@
+#include "local_prefix.h"
+#include "http_sign.h"
+#include "multi_peer_reader_error.h"
+#include "../constants.h"
+#include "../or_throw.h"
+#include "../util/crypto.h"
+
+using namespace ouinet;
+using namespace ouinet::cache;
+
+using Errc = MultiPeerReaderErrc;
+
+std::size_t
+LocalPrefix::matching_blocks(const HashList& reference) const
+{
+    if (_hash_list.signed_head.block_size() != reference.signed_head.block_size())
+        return 0;
+
+    auto n = std::min(_hash_list.blocks.size(), reference.blocks.size());
+    for (std::size_t b = 0; b < n; ++b)
+        if (_hash_list.blocks[b].data_hash != reference.blocks[b].data_hash)
+            return b;
+    return n;
+}
+
+LocalPrefix::Block
+LocalPrefix::read_block( std::size_t block_id, const HashList& reference
+                       , Cancel& c, asio::yield_context yield)
+{
+    sys::error_code ec;
+
+    // Blocks can only be read in order.
+    if (block_id != _next_block_id || block_id >= block_count
+       || block_id >= reference.blocks.size())
+        return or_throw<Block>(yield, asio::error::invalid_argument);
+
+    if (!_head_read) {
+        auto p = _reader->async_read_part(c, yield[ec]);
+        if (!ec && (!p || !p->is_head())) ec = Errc::expected_head;
+        return_or_throw_on_error(yield, c, ec, Block{});
+        _head_read = true;
+    }
+
+    auto p = _reader->async_read_part(c, yield[ec]);
+    if (!ec && (!p || !p->as_chunk_hdr())) ec = Errc::expected_chunk_hdr;
+    return_or_throw_on_error(yield, c, ec, Block{});
+
+    auto size = p->as_chunk_hdr()->size;
+    if (size > http_::response_data_block_max) ec = Errc::block_is_too_big;
+    return_or_throw_on_error(yield, c, ec, Block{});
+
+    Block block;
+
+    while (block.chunk_body.size() < size) {
+        p = _reader->async_read_part(c, yield[ec]);
+        if (!ec && (!p || !p->as_chunk_body())) ec = Errc::expected_chunk_body;
+        return_or_throw_on_error(yield, c, ec, Block{});
+
+        auto chunk_body = p->as_chunk_body();
+        block.chunk_body.insert(block.chunk_body.end(),
+            chunk_body->begin(), chunk_body->end());
+
+        if (chunk_body->remain == 0) break;
+    }
+
+    // Stored data may have been corrupted.
+    auto& ref_block = reference.blocks[block_id];
+    if (util::sha512_digest(block.chunk_body) != ref_block.data_hash)
+        return or_throw<Block>(yield, Errc::inconsistent_hash);
+
+    block.chunk_hdr = http_response::ChunkHdr( block.chunk_body.size()
+                                             , block_chunk_ext(ref_block.chained_hash_signature));
+
+    ++_next_block_id;
+    return block;
+}
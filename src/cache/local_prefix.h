@@ -0,0 +1,59 @@
+#pragma once
+
+#include <memory>
+
+#include "hash_list.h"
+#include "../response_reader.h"
+
+namespace ouinet { namespace cache {
+
+// Data blocks of an incomplete response stored locally,
+// read in order from the first one.
+//
+// Only the first `block_count` blocks are read,
+// which should be set to the blocks having the same data
+// as the response chosen from peers (see `matching_blocks`).
+class LocalPrefix {
+public:
+    struct Block {
+        http_response::ChunkHdr chunk_hdr;
+        http_response::ChunkBody chunk_body{{}, 0};
+    };
+
+public:
+    // `hash_list` has the data blocks that were stored,
+    // and `reader` provides the stored response from its first block
+    // (e.g. `http_store_range_reader` up to the last stored block).
+    LocalPrefix(HashList hash_list, std::unique_ptr<http_response::AbstractReader> reader)
+        : _hash_list(std::move(hash_list))
+        , _reader(std::move(reader))
+    {}
+
+    // How many of the first stored blocks have the same data
+    // as those in the given (verified) hash list.
+    std::size_t matching_blocks(const HashList& reference) const;
+
+    // Read the next stored block, with the chunk extension
+    // carrying its signature from the `reference` hash list.
+    //
+    // Fails with `inconsistent_hash` if the stored data does not match `reference`,
+    // and with `invalid_argument` if `block_id` is not the next one to read
+    // or beyond `block_count`.
+    Block read_block(std::size_t block_id, const HashList& reference, Cancel&, asio::yield_context);
+
+    // Whether all blocks to be used have been read,
+    // so that remaining ones need to be fetched from peers.
+    bool exhausted() const { return _next_block_id >= block_count; }
+
+private:
+    HashList _hash_list;
+    std::unique_ptr<http_response::AbstractReader> _reader;
+    bool _head_read = false;
+    std::size_t _next_block_id = 0;
+
+public:
+    // Stored blocks to use, set when the reference hash list is chosen.
+    std::size_t block_count = 0;
+};
+
+}} // namespaces
@@ -1,6 +1,7 @@
 #include <asio_utp.hpp>
 
 #include "multi_peer_reader.h"
+#include "local_prefix.h"
 #include "multi_peer_reader_error.h"
 #include "cache_entry.h"
 #include "http_sign.h"
@@ -15,6 +16,7 @@
 #include "../util/part_io.h"
 #include "../util/async_job.h"
 #include "../util/condition_variable.h"
+#include "../parse/number.h"
 #include "signed_head.h"
 
 #include <random>
@@ -97,6 +99,8 @@ public:
     std::unique_ptr<http_response::Reader> _reader;
     HashList _hash_list;
     Cancel _lifetime_cancel;
+    // Found in the local network rather than in the DHT.
+    bool _is_lan = false;
 
     Peer(asio::executor exec, const string& key, util::Ed25519PublicKey cache_pk) :
         _exec(exec),
@@ -340,7 +344,7 @@ public:
             return;
         }
 
-        asio::spawn(_exec, [=, dbg_tag = _dbg_tag, c = _lifetime_cancel] (auto y) mutable {
+        util::spawn(_exec, [=, dbg_tag = _dbg_tag, c = _lifetime_cancel] (auto y) mutable {
             TRACK_HANDLER();
             sys::error_code ec;
 
@@ -384,10 +388,11 @@ public:
 
         ip.first->second = make_unique<Peer>(_exec, _key, _cache_pk);
         Peer* p = ip.first->second.get();
+        p->_is_lan = _lan_peer_eps.count(ep);
 
         _candidate_peers.push_back(*p);
 
-        asio::spawn(_exec, [=, dbg_tag = _dbg_tag, c = _lifetime_cancel] (auto y) mutable {
+        util::spawn(_exec, [=, dbg_tag = _dbg_tag, c = _lifetime_cancel] (auto y) mutable {
             TRACK_HANDLER();
             sys::error_code ec;
 
@@ -437,12 +442,12 @@ public:
         return or_throw(yield, ec);
     }
 
-    HashList choose_reference_hash_list(Cancel c, asio::yield_context yield)
+    const Peer* choose_reference_peer(Cancel c, asio::yield_context yield)
     {
         sys::error_code ec;
 
         wait_for_some_peers_to_respond(c, yield[ec]);
-        return_or_throw_on_error(yield, c, ec, HashList{});
+        return_or_throw_on_error(yield, c, ec, nullptr);
 
         Peer* best_peer = nullptr;;
 
@@ -452,9 +457,9 @@ public:
             }
         }
 
-        if (!best_peer) return or_throw<HashList>(yield, Errc::no_peers);
+        if (!best_peer) return or_throw<const Peer*>(yield, Errc::no_peers, nullptr);
 
-        return best_peer->_hash_list;
+        return best_peer;
     }
 
     Peer* choose_peer_for_block(
@@ -651,7 +656,7 @@ MultiPeerReader::new_fetch_job(size_t block_id, Peer* last_peer, Cancel& cancel,
 {
     using R = std::unique_ptr<MultiPeerReader::PreFetch>;
 
-    if (block_id >= _reference_hash_list->blocks.size())
+    if (block_id >= _block_end)
         return nullptr;
 
     sys::error_code ec;
@@ -681,6 +686,35 @@ MultiPeerReader::fetch_block(size_t block_id, Cancel& cancel, asio::yield_contex
 
     sys::error_code ec;
 
+    if (_local_prefix && block_id < _local_prefix->block_count) {
+        auto block = _local_prefix->read_block(block_id, *_reference_hash_list, cancel, yield[ec]);
+
+        if (cancel) {
+            return or_throw<OptBlock>(yield, asio::error::operation_aborted);
+        }
+
+        if (!ec) {
+            if (_local_prefix->exhausted()) {
+                // Done with stored blocks, get the first missing one ready
+                // while this one is being sent.
+                _local_prefix = nullptr;
+                sys::error_code pf_ec;
+                if (!_pre_fetch)
+                    _pre_fetch = new_fetch_job(block_id + 1, nullptr, cancel, yield[pf_ec]);
+            }
+            return Block{std::move(block.chunk_body), std::move(block.chunk_hdr), boost::none};
+        }
+
+        if (!_dbg_tag.empty()) {
+            LOG_DEBUG(_dbg_tag, " Failed to read stored block, fetching it from peers; block=", block_id
+                     , " ec=", ec);
+        }
+
+        // Fetch this and the remaining blocks from peers.
+        _local_prefix = nullptr;
+        ec = {};
+    }
+
     if (!_pre_fetch) {
         _pre_fetch = new_fetch_job(block_id, nullptr, cancel, yield[ec]);
         return_or_throw_on_error(yield, cancel, ec, OptBlock{});
@@ -754,14 +788,31 @@ MultiPeerReader::async_read_part_impl(Cancel& cancel, asio::yield_context yield)
     sys::error_code ec;
 
     if (!_reference_hash_list) {
-        auto hl = _peers->choose_reference_hash_list(cancel, yield[ec]);
+        auto ref_peer = _peers->choose_reference_peer(cancel, yield[ec]);
         return_or_throw_on_error(yield, cancel, ec, OptPart{});
-        _reference_hash_list = std::move(hl);
+        _reference_hash_list = ref_peer->_hash_list;
+        _from_lan_peer = ref_peer->_is_lan;
+        _block_end = _reference_hash_list->blocks.size();
+
+        if (_local_prefix) {
+            auto n = _local_prefix->matching_blocks(*_reference_hash_list);
+
+            if (!_dbg_tag.empty()) {
+                LOG_DEBUG(_dbg_tag, " Resuming from stored blocks: ", n
+                         , "/", _reference_hash_list->blocks.size());
+            }
+
+            if (n > 0) _local_prefix->block_count = n;
+            else _local_prefix = nullptr;
+        }
     }
 
     if (!_head_sent) {
         _head_sent = true;
-        return Part{_reference_hash_list->signed_head};
+        if (!_range) return Part{_reference_hash_list->signed_head};
+        auto head = range_head(ec);
+        if (ec) return or_throw<OptPart>(yield, ec);
+        return Part{std::move(head)};
     }
 
     if (_next_chunk_body) {
@@ -781,7 +832,7 @@ MultiPeerReader::async_read_part_impl(Cancel& cancel, asio::yield_context yield)
         return {{std::move(p)}};
     }
 
-    if (_block_id >= _reference_hash_list->blocks.size()) {
+    if (_block_id >= _block_end) {
         mark_done();
         if (!_last_chunk_hdr_sent) {
             _last_chunk_hdr_sent = true;
@@ -794,6 +845,15 @@ MultiPeerReader::async_read_part_impl(Cancel& cancel, asio::yield_context yield)
         auto block = fetch_block(_block_id, cancel, yield[ec]);
         return_or_throw_on_error(yield, cancel, ec, OptPart{});
 
+        if (block && _range_prev_digest) {
+            // First block of the range, the receiving end cannot compute
+            // the chain hash of the previous block by itself.
+            block->chunk_hdr.exts = cache::block_chunk_ext
+                ( _reference_hash_list->blocks[_block_id].chained_hash_signature
+                , _range_prev_digest);
+            _range_prev_digest = boost::none;
+        }
+
         ++_block_id;
 
         if (!block) {
@@ -821,6 +881,46 @@ MultiPeerReader::async_read_part_impl(Cancel& cancel, asio::yield_context yield)
     return boost::none;
 }
 
+void MultiPeerReader::set_range(std::size_t first, std::size_t last)
+{
+    assert(!_head_sent && !_local_prefix);
+    _range = Range{first, last};
+}
+
+void MultiPeerReader::set_local_prefix( HashList hash_list
+                                      , std::unique_ptr<AbstractReader> reader)
+{
+    assert(!_head_sent && !_range);
+    _local_prefix = std::make_unique<LocalPrefix>(std::move(hash_list), std::move(reader));
+}
+
+http_response::Head
+MultiPeerReader::range_head(sys::error_code& ec)
+{
+    assert(_range && _reference_hash_list);
+    auto& hl = *_reference_hash_list;
+
+    std::tie(_block_id, _block_end) = hl.blocks_for_range(_range->first, _range->last, ec);
+    if (ec) return {};
+
+    _range_prev_digest = hl.prev_chained_digest(_block_id);
+
+    auto bs = hl.signed_head.block_size();
+    auto data_size_hdr = hl.signed_head[http_::response_data_size_hdr];
+    auto data_size = *parse::number<size_t>(data_size_hdr);  // checked above
+
+    http_response::Head head = hl.signed_head;
+    auto orig_status = head.result_int();
+    head.reason("");
+    head.result(http::status::partial_content);
+    head.set(http_::response_original_http_status, orig_status);
+    head.set( http::field::content_range
+            , util::HttpResponseByteRange{ _block_id * bs
+                                         , std::min(_block_end * bs, data_size) - 1
+                                         , data_size});
+    return head;
+}
+
 void MultiPeerReader::close()
 {
     _state = State::closed;
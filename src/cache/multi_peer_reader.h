@@ -11,6 +11,8 @@
 
 namespace ouinet { namespace cache {
 
+class LocalPrefix;
+
 class MultiPeerReader : public http_response::AbstractReader {
 private:
     class Peer;
@@ -49,8 +51,46 @@ public:
     MultiPeerReader(MultiPeerReader&&) = delete;
     MultiPeerReader(const MultiPeerReader&) = delete;
 
+    // Only get the data blocks covering the given byte range
+    // instead of the whole response.
+    //
+    // The partial response has the same format as the one produced by
+    // `http_store_range_reader` (with `first` and `last` following the same rules),
+    // and the chunk header after its first data block also carries
+    // the chain hash of the previous block (if any) for its verification.
+    //
+    // If the range is beyond response data,
+    // a `boost::system::errc::invalid_seek` error is reported
+    // when reading the head.
+    //
+    // This must be called before reading any part.
+    void set_range(std::size_t first, std::size_t last);
+
+    // Resume an incomplete response stored locally.
+    //
+    // `hash_list` has the data blocks that were stored,
+    // and `reader` provides the stored response from its first block
+    // (e.g. `http_store_range_reader` up to the last stored block).
+    // The first stored blocks with the same data as the response chosen from peers
+    // are read from `reader` (and checked against their hash),
+    // so only the remaining blocks are fetched from peers.
+    //
+    // This must be called before reading any part,
+    // and it cannot be combined with `set_range`.
+    void set_local_prefix( HashList hash_list
+                         , std::unique_ptr<http_response::AbstractReader> reader);
+
     boost::optional<http_response::Part> async_read_part(Cancel, asio::yield_context) override;
 
+    // Whether the response was chosen from a peer found in the local network
+    // (as opposed to one found in the DHT).
+    //
+    // This is only meaningful once the head has been read.
+    bool is_from_lan_peer() const
+    {
+        return _from_lan_peer;
+    }
+
     bool is_done() const override
     {
         return _state == State::done;
@@ -68,6 +108,7 @@ public:
 private:
     boost::optional<http_response::Part> async_read_part_impl(Cancel&, asio::yield_context);
     boost::optional<Block> fetch_block(size_t block_id, Cancel&, asio::yield_context);
+    http_response::Head range_head(sys::error_code&);
     void unmark_as_good(Peer& peer);
 
     void mark_done();
@@ -75,15 +116,28 @@ private:
     std::unique_ptr<PreFetch>
     new_fetch_job(size_t block_id, Peer* last_peer, Cancel&, asio::yield_context);
 
+private:
+    struct Range {
+        std::size_t first, last;
+    };
+
 private:
     asio::executor _executor;
     Cancel _lifetime_cancel;
 
     boost::optional<HashList> _reference_hash_list;
+    bool _from_lan_peer = false;
     std::unique_ptr<Peers> _peers;
     std::string _dbg_tag;
     bool _head_sent = false;
     size_t _block_id = 0;
+    size_t _block_end = 0;
+
+    boost::optional<Range> _range;
+    // Chain hash of the block before the range (if any).
+    boost::optional<HashList::Digest> _range_prev_digest;
+
+    std::unique_ptr<LocalPrefix> _local_prefix;
 
     std::string _next_chunk_hdr_ext;
     boost::optional<http_response::ChunkBody> _next_chunk_body;
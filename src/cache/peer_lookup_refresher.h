@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../async_sleep.h"
+#include "../logger.h"
+#include "../util/handler_tracker.h"
+#include "../util/metrics.h"
+#include "../util/signal.h"
+
+namespace ouinet { namespace cache {
+
+// Keeps the peer lookups of the most requested groups fresh in the background,
+// so that requests for content in those groups seldom need to wait
+// for a DHT search to complete.
+//
+// Requests for each group are counted with an exponential decay,
+// and only the groups with most requests are refreshed
+// while the rate of refreshes is kept under a budget
+// (using a token bucket) to avoid flooding the DHT.
+//
+// `Lookup` is usually `DhtLookup`.
+template<class Lookup>
+class PeerLookupRefresher {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        // How many of the most requested groups to keep fresh.
+        size_t max_refreshed = 16;
+        // Groups with less (decayed) requests than this are not refreshed.
+        float min_requests = 2;
+        // Requests count half as much after this time.
+        Clock::duration half_life = std::chrono::minutes(10);
+        // How often to look for lookups to refresh.
+        Clock::duration period = std::chrono::seconds(30);
+        // Refresh lookups which would stop being fresh before this time passes.
+        Clock::duration ahead = std::chrono::minutes(2);
+        // Average rate of refreshes and maximum burst.
+        float refreshes_per_minute = 6;
+        float max_burst = 6;
+        // Groups whose requests are counted.
+        size_t max_tracked = 1024;
+    };
+
+private:
+    struct Entry {
+        std::shared_ptr<Lookup> lookup;
+        float requests;
+        Clock::time_point last_request;
+    };
+
+public:
+    PeerLookupRefresher(const asio::executor& ex)
+        : PeerLookupRefresher(ex, Config())
+    {}
+
+    PeerLookupRefresher(const asio::executor& ex, Config config)
+        : _ex(ex)
+        , _config(std::move(config))
+        , _tokens(_config.max_burst)
+        , _last_refill(Clock::now())
+    {}
+
+    PeerLookupRefresher(const PeerLookupRefresher&) = delete;
+
+    ~PeerLookupRefresher() { stop(); }
+
+    void start()
+    {
+        TRACK_SPAWN(_ex, [&] (asio::yield_context yield) {
+            Cancel cancel(_lifetime_cancel);
+            while (!cancel) {
+                if (!async_sleep(_ex, _config.period, cancel, yield)) break;
+                refresh_due();
+            }
+        });
+    }
+
+    void stop() { _lifetime_cancel(); }
+
+    // Take note of a request which needs the given lookup.
+    void requested( std::shared_ptr<Lookup> lookup
+                  , Clock::time_point now = Clock::now())
+    {
+        auto i = _entries.find(lookup->swarm_name());
+
+        if (i == _entries.end()) {
+            if (_entries.size() >= _config.max_tracked) forget_least_requested(now);
+            i = _entries.emplace(lookup->swarm_name(), Entry{nullptr, 0, now}).first;
+        }
+
+        auto& e = i->second;
+        e.requests = requests(e, now) + 1;
+        e.last_request = now;
+        e.lookup = std::move(lookup);
+    }
+
+    // The lookup for the given swarm if its requests are being counted.
+    std::shared_ptr<Lookup> find(const std::string& swarm_name) const
+    {
+        auto i = _entries.find(swarm_name);
+        if (i == _entries.end()) return nullptr;
+        return i->second.lookup;
+    }
+
+    size_t size() const { return _entries.size(); }
+
+    // Start refreshing the lookups of the most requested groups
+    // which are about to stop being fresh, as the budget allows.
+    // Return how many were started.
+    size_t refresh_due(Clock::time_point now = Clock::now())
+    {
+        using minutes = std::chrono::duration<float, std::ratio<60>>;
+
+        _tokens = std::min( _config.max_burst
+                          , _tokens + minutes(now - _last_refill).count()
+                                    * _config.refreshes_per_minute);
+        _last_refill = now;
+
+        std::vector<std::pair<float, Entry*>> popular;
+
+        for (auto i = _entries.begin(); i != _entries.end();) {
+            auto r = requests(i->second, now);
+            // Not requested for many half lives.
+            if (r < 0.01) { i = _entries.erase(i); continue; }
+            if (r >= _config.min_requests) popular.emplace_back(r, &i->second);
+            ++i;
+        }
+
+        auto n = std::min(_config.max_refreshed, popular.size());
+        std::partial_sort( popular.begin(), popular.begin() + n, popular.end()
+                         , [] (auto& a, auto& b) { return a.first > b.first; });
+
+        size_t started = 0;
+
+        for (size_t i = 0; i < n; ++i) {
+            auto& lookup = *popular[i].second->lookup;
+
+            if (lookup.is_running()) continue;
+            if (lookup.fresh_until() > now + _config.ahead) continue;
+
+            if (_tokens < 1) {
+                refreshes_counter("over_budget").inc();
+                LOG_DEBUG("cache/client: Peer lookup refresh over budget: ", lookup.swarm_name());
+                break;
+            }
+
+            _tokens -= 1;
+            lookup.refresh();
+            refreshes_counter("started").inc();
+            ++started;
+        }
+
+        return started;
+    }
+
+private:
+    float requests(const Entry& e, Clock::time_point now) const
+    {
+        using fsecs = std::chrono::duration<float>;
+        auto half_lives = fsecs(now - e.last_request) / fsecs(_config.half_life);
+        return e.requests * std::exp2(-half_lives);
+    }
+
+    void forget_least_requested(Clock::time_point now)
+    {
+        auto least = std::min_element( _entries.begin(), _entries.end()
+                                     , [&] (auto& a, auto& b) {
+                                           return requests(a.second, now) < requests(b.second, now);
+                                       });
+        if (least != _entries.end()) _entries.erase(least);
+    }
+
+    static metrics::Counter& refreshes_counter(const char* result)
+    {
+        return metrics::registry().counter
+            ( "ouinet_cache_peer_lookup_refreshes_total"
+            , "Background refreshes of peer lookups for popular groups"
+            , {{"result", result}});
+    }
+
+private:
+    asio::executor _ex;
+    Config _config;
+    std::map<std::string, Entry> _entries;
+    float _tokens;
+    Clock::time_point _last_refill;
+    Cancel _lifetime_cancel;
+};
+
+}} // namespaces
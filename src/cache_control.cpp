@@ -142,6 +142,92 @@ bool CacheControl::is_expired( const http::response_header<>& response
     return now() > time_stamp + posix_time::seconds(*max_age);
 }
 
+// Get the value of a numeric directive which extends
+// the period a stale response may be used for (RFC 5861).
+static
+boost::optional<unsigned> get_stale_extension( const beast::string_view& cache_control_value
+                                             , const beast::string_view& directive)
+{
+    for (auto kv : SplitString(cache_control_value, ',')) {
+        beast::string_view key, val;
+        std::tie(key, val) = split_string_pair(kv, '=');
+
+        if (!boost::iequals(key, directive)) continue;
+
+        trim_quotes(val);
+        return parse::number<unsigned>(val);
+    }
+
+    return boost::none;
+}
+
+// When the response stops being fresh,
+// or none if it does not say so explicitly.
+static
+boost::optional<posix_time::ptime>
+get_expiration( const http::response_header<>& response
+              , boost::posix_time::ptime time_stamp)
+{
+    auto cache_control_value = get(response, http::field::cache_control);
+
+    if (cache_control_value) {
+        auto max_age = get_max_age(*cache_control_value);
+        if (max_age) return time_stamp + posix_time::seconds(*max_age);
+    }
+
+    auto expires = get(response, http::field::expires);
+    if (!expires) return boost::none;
+
+    auto exp_date = util::parse_date(*expires);
+    if (exp_date == posix_time::ptime()) return boost::none;
+    return exp_date;
+}
+
+static
+bool is_within_stale_extension( const http::response_header<>& response
+                              , boost::posix_time::ptime time_stamp
+                              , const beast::string_view& directive)
+{
+    auto cache_control_value = get(response, http::field::cache_control);
+    if (!cache_control_value) return false;
+
+    auto extension = get_stale_extension(*cache_control_value, directive);
+    if (!extension) return false;
+
+    auto expiration = get_expiration(response, time_stamp);
+    if (!expiration) return false;
+
+    auto now = posix_time::second_clock::universal_time();
+    return now <= *expiration + posix_time::seconds(*extension);
+}
+
+/* static */
+bool CacheControl::is_stale_while_revalidate( const http::response_header<>& response
+                                            , boost::posix_time::ptime time_stamp)
+{
+    return is_expired(response, time_stamp)
+        && is_within_stale_extension(response, time_stamp, "stale-while-revalidate");
+}
+
+/* static */
+bool CacheControl::is_stale_if_error( const http::response_header<>& response
+                                    , boost::posix_time::ptime time_stamp)
+{
+    return is_expired(response, time_stamp)
+        && is_within_stale_extension(response, time_stamp, "stale-if-error");
+}
+
+bool
+CacheControl::can_serve_stale(const CacheEntry& entry) const
+{
+    if (!revalidate_in_background) return false;
+
+    auto& hdr = entry.response.response_header();
+
+    if (is_stale_while_revalidate(hdr, entry.time_stamp)) return true;
+    return _serve_stale && is_stale_if_error(hdr, entry.time_stamp);
+}
+
 bool
 CacheControl::is_older_than_max_cache_age(const posix_time::ptime& time_stamp) const
 {
@@ -391,6 +477,21 @@ CacheControl::do_fetch(
     auto cache_etag  = get(cache_entry.response, http::field::etag);
     auto rq_etag = get(request, http::field::if_none_match);
 
+    if (can_serve_stale(cache_entry)) {
+        auto syield = yield.tag("cache_stale");
+        _YDEBUG(syield, "Response was served from cache: stale, revalidating in background");
+
+        auto rq = request; // Make a copy because `request` is const&.
+
+        if (cache_etag && !rq_etag)
+            rq.set(http::field::if_none_match, *cache_etag);
+
+        revalidate_in_background(move(rq), *dht_group);
+
+        fresh_ec = err::operation_aborted;
+        return add_stale_warning(move(cache_entry.response));
+    }
+
     if (cache_etag && !rq_etag) {
         auto ryield = yield.tag("cache_reval");
         _YDEBUG(ryield, "Attempting to revalidate cached response");
@@ -445,6 +546,18 @@ posix_time::time_duration CacheControl::max_cached_age() const
     return _max_cached_age;
 }
 
+//------------------------------------------------------------------------------
+void CacheControl::serve_stale(bool v)
+{
+    _serve_stale = v;
+}
+
+//------------------------------------------------------------------------------
+bool CacheControl::serve_stale() const
+{
+    return _serve_stale;
+}
+
 //------------------------------------------------------------------------------
 auto CacheControl::make_fetch_fresh_job( const Request& rq
                                        , const CacheEntry* cached
@@ -31,6 +31,12 @@ public:
     // When fetching stored (which may be slow), a parallel request to fetch fresh is started
     // only if this is not null and it returns true.
     using ParallelFresh = std::function<bool(const Request&, const boost::optional<DhtGroup>&)>;
+    // If not null, stale cached responses which may still be used
+    // are returned right away, and this is called to revalidate them
+    // (and store the result) in the background.
+    // It must return immediately, and it gets a request ready for revalidation
+    // (e.g. with "If-None-Match" if the cached response has an entity tag).
+    using RevalidateInBackground = std::function<void(Request, const DhtGroup&)>;
 
 public:
     CacheControl(const asio::executor& ex, std::string server_name)
@@ -53,10 +59,19 @@ public:
     FetchStored  fetch_stored;
     FetchFresh   fetch_fresh;
     ParallelFresh parallel_fresh;
+    RevalidateInBackground revalidate_in_background;
 
     void max_cached_age(const boost::posix_time::time_duration&);
     boost::posix_time::time_duration max_cached_age() const;
 
+    // Stale responses within their "stale-while-revalidate" period
+    // are always used while revalidating in the background (RFC 5861#3).
+    // If this is enabled, responses within their "stale-if-error" period
+    // (RFC 5861#4) are used in the same way,
+    // instead of blocking on a revalidation which may be slow.
+    void serve_stale(bool);
+    bool serve_stale() const;
+
     // Private caching allows storing a response regardless of
     // being private or the result of an authorized request
     // (in spite of Section 3 of RFC 7234).
@@ -72,6 +87,18 @@ public:
     static
     bool is_expired(const CacheEntry&);
 
+    // Whether the response is stale but still within the period
+    // given by the "stale-while-revalidate" directive (RFC 5861#3).
+    static
+    bool is_stale_while_revalidate( const http::response_header<>&
+                                  , boost::posix_time::ptime time_stamp);
+
+    // Whether the response is stale but still within the period
+    // given by the "stale-if-error" directive (RFC 5861#4).
+    static
+    bool is_stale_if_error( const http::response_header<>&
+                          , boost::posix_time::ptime time_stamp);
+
 private:
     Session do_fetch(
             const Request&,
@@ -97,12 +124,16 @@ private:
 
     bool has_temporary_result(const Session&) const;
 
+    bool can_serve_stale(const CacheEntry&) const;
+
 private:
     asio::executor _ex;
     std::string _server_name;
 
     boost::posix_time::time_duration _max_cached_age
         = default_max_cached_age;
+
+    bool _serve_stale = false;
 };
 
 } // ouinet namespace
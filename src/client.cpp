@@ -6,6 +6,7 @@
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/format.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/asio/ssl/stream.hpp>
@@ -18,12 +19,14 @@
 #include <iterator>
 #include <iostream>
 #include <cstdlib>  // for atexit()
+#include <limits>
 
 #include "cache/client.h"
 
 #include "namespaces.h"
 #include "origin_pools.h"
 #include "doh.h"
+#include "resolver_cache.h"
 #include "http_util.h"
 #include "client_front_end.h"
 #include "connect_to_host.h"
@@ -44,7 +47,7 @@
 #include "session.h"
 #include "create_udp_multiplexer.h"
 #include "ssl/ca_certificate.h"
-#include "ssl/dummy_certificate.h"
+#include "ssl/server_context_cache.h"
 #include "ssl/util.h"
 #include "bittorrent/dht.h"
 #include "bittorrent/mutable_data.h"
@@ -70,6 +73,7 @@
 #include "util/signal.h"
 #include "util/crypto.h"
 #include "util/lru_cache.h"
+#include "util/metrics.h"
 #include "util/scheduler.h"
 #include "util/reachability.h"
 #include "util/async_job.h"
@@ -98,9 +102,6 @@ static const fs::path OUINET_CA_CERT_FILE = "ssl-ca-cert.pem";
 static const fs::path OUINET_CA_KEY_FILE = "ssl-ca-key.pem";
 static const fs::path OUINET_CA_DH_FILE = "ssl-ca-dh.pem";
 
-// Flags for normal, case-insensitive regular expression.
-static const auto rx_icase = boost::regex::normal | boost::regex::icase;
-
 //------------------------------------------------------------------------------
 struct UserAgentMetaData {
     boost::optional<bool> is_private;
@@ -149,13 +150,11 @@ public:
     State(asio::io_context& ctx, ClientConfig cfg)
         : _ctx(ctx)
         , _config(move(cfg))
-        // A certificate chain with OUINET_CA + SUBJECT_CERT
-        // can be around 2 KiB, so this would be around 2 MiB.
-        // TODO: Fine tune if necessary.
-        , _ssl_certificate_cache(1000)
+        , _resolver_cache(get_executor())
         , _injector_starting{get_executor()}
         , _cache_starting{get_executor()}
         , _front_end(_config)
+        , _request_router(make_request_router())
         , ssl_ctx{asio::ssl::context::tls_client}
         , inj_ctx{asio::ssl::context::tls_client}
         , _bt_dht_wc(_ctx)
@@ -170,6 +169,17 @@ public:
         // would be accepted if presented by an injector.
         //inj_ctx.set_default_verify_paths();
         inj_ctx.set_verify_mode(asio::ssl::verify_peer);
+
+        ssl::util::SessionCache::enable(ssl_ctx);
+        ssl::util::SessionCache::enable(inj_ctx);
+
+        _metrics = _origin_pools.export_metrics();
+        for (auto& g : _resolver_cache.export_metrics())
+            _metrics.push_back(move(g));
+        for (auto& g : ssl::util::SessionCache::get(ssl_ctx)->export_metrics("origin"))
+            _metrics.push_back(move(g));
+        for (auto& g : ssl::util::SessionCache::get(inj_ctx)->export_metrics("injector"))
+            _metrics.push_back(move(g));
     }
 
     void start();
@@ -194,6 +204,8 @@ public:
 
         _cache = nullptr;
         _upnps.clear();
+        _resolver_cache.stop();
+        if (_ssl_server_contexts) _ssl_server_contexts->stop();
         _shutdown_signal();
         if (_injector) _injector->stop();
         if (_bt_dht) {
@@ -321,6 +333,10 @@ private:
                                     , const Request&
                                     , asio::yield_context);
 
+    void maybe_prefetch_ssl_server_context( const Request&
+                                          , const request_route::Config&);
+
+    request_route::Router make_request_router() const;
     void serve_request(GenericStream&& con, asio::yield_context yield);
 
     // All `fetch_*` functions below take care of keeping or dropping
@@ -350,6 +366,10 @@ private:
                                             , Cancel& cancel
                                             , Yield);
 
+    // Fetch a fresh version of a stale cached response
+    // and store it in the cache, without blocking the caller.
+    void revalidate_in_background(Request, std::string dht_group);
+
     template<class Resp>
     void maybe_add_proto_version_warning(Resp& res) const {
         auto newest = newest_proto_seen;
@@ -415,6 +435,10 @@ private:
                              , const UserAgentMetaData&
                              , const doh::Endpoint&
                              , Cancel&, Yield);
+    ResolverCache::Answer query_doh( const std::string&
+                                   , const UserAgentMetaData&
+                                   , const doh::Endpoint&
+                                   , Cancel&, Yield);
 
     GenericStream connect_to_origin( const Request&
                                    , const UserAgentMetaData&
@@ -506,13 +530,17 @@ private:
     asio::io_context& _ctx;
     ClientConfig _config;
     std::unique_ptr<CACertificate> _ca_certificate;
-    util::LruCache<string, string> _ssl_certificate_cache;
+    std::unique_ptr<ServerContextCache> _ssl_server_contexts;
+
+    // Shared by DNS and DoH resolutions of origin names.
+    ResolverCache _resolver_cache;
     std::unique_ptr<OuiServiceClient> _injector;
     std::unique_ptr<cache::Client> _cache;
     boost::optional<ConditionVariable> _injector_starting, _cache_starting;
     sys::error_code _injector_start_ec, _cache_start_ec;
 
     ClientFrontEnd _front_end;
+    request_route::Router _request_router;
     Signal<void()> _shutdown_signal;
 
     // For debugging
@@ -524,6 +552,9 @@ private:
     asio::ssl::context ssl_ctx;
     asio::ssl::context inj_ctx;
 
+    // Statistics of the members above exported as metrics.
+    metrics::CallbackGauges _metrics;
+
     boost::optional<asio::ip::udp::endpoint> _local_utp_endpoint;
     boost::optional<asio_utp::udp_multiplexer> _udp_multiplexer;
     unique_ptr<util::UdpServerReachabilityAnalysis> _udp_reachability;
@@ -537,6 +568,9 @@ private:
     shared_ptr<ouiservice::Bep5Client> _bep5_client;
 
     std::map<asio::ip::udp::endpoint, unique_ptr<UPnPUpdater>> _upnps;
+
+    // Keys of cached responses being revalidated in the background.
+    std::set<std::string> _background_revalidations;
 };
 
 //------------------------------------------------------------------------------
@@ -701,7 +735,19 @@ Client::State::fetch_stored_in_dcache( const Request& request
 
     auto key = key_from_http_req(request);
     if (!key) return or_throw<CacheEntry>(yield, asio::error::invalid_argument);
-    auto s = c->load( move(*key), dht_group, request.method() == http::verb::head
+    // Seeking in a cached video should not need to wait for preceding data,
+    // so only the data blocks covering a single range are retrieved.
+    // Conditional ranges are not supported, so the whole response is retrieved then.
+    boost::optional<util::HttpRequestByteRange> range;
+    if (request.method() == http::verb::get && request[http::field::if_range].empty()) {
+        auto rs = util::HttpRequestByteRange::parse(request[http::field::range]);
+        if (rs && rs->size() == 1) range = (*rs)[0];
+    }
+
+    auto s = range
+           ? c->load_range( move(*key), dht_group, range->first, range->last
+                          , timeout_cancel, yield[ec].tag("load"))
+           : c->load( move(*key), dht_group, request.method() == http::verb::head
                     , timeout_cancel, yield[ec].tag("load"));
     fail_on_error_or_timeout(yield, cancel, ec, watch_dog, CacheEntry{});
 
@@ -788,40 +834,6 @@ Client::State::fetch_via_self( Rq request, const UserAgentMetaData& meta
     });
 }
 
-// Transforms addresses to endpoints with the given port.
-template<class Addrs, class Endpoint>
-class AddrsAsEndpoints {
-public:
-    using value_type = Endpoint;
-    using addrs_iterator = typename Addrs::const_iterator;
-
-    AddrsAsEndpoints(const Addrs& addrs, unsigned short port)
-        : _addrs(addrs), _port(port)
-    {}
-
-    class const_iterator : public std::iterator<std::input_iterator_tag, value_type> {
-    public:
-        const_iterator(const addrs_iterator& it, unsigned short port)
-            : _it(it), _port(port)
-        {}
-
-        value_type operator*() const { return {*_it, _port}; }
-        const_iterator& operator++() { ++_it; return *this; }
-        bool operator==(const const_iterator& other) const { return _it == other._it; }
-        bool operator!=(const const_iterator& other) const { return _it != other._it; }
-    private:
-        addrs_iterator _it;
-        unsigned short _port;
-    };
-
-    const_iterator begin() const { return {_addrs.begin(), _port}; };
-    const_iterator end() const { return {_addrs.end(), _port}; };
-
-private:
-    const Addrs& _addrs;
-    unsigned short _port;
-};
-
 TcpLookup
 Client::State::resolve_tcp_doh( const std::string& host
                               , const std::string& port
@@ -830,23 +842,30 @@ Client::State::resolve_tcp_doh( const std::string& host
                               , Cancel& cancel
                               , Yield yield)
 {
-    using TcpEndpoint = typename TcpLookup::endpoint_type;
+    // The query may be shared with other lookups or outlive this one,
+    // so it holds its own copies of metadata and endpoint.
+    auto query = [ this, self = shared_from_this(), meta, ep ]
+                 (const std::string& h, Cancel& c, asio::yield_context y) {
+        return query_doh(h, meta, ep, c, Yield(_ctx, y, "doh"));
+    };
 
-    boost::string_view portsv(port);
-    auto portn_o = parse::number<unsigned short>(portsv);
-    if (!portn_o) return or_throw<TcpLookup>(yield, asio::error::invalid_argument);
+    return _resolver_cache.resolve( "doh " + ep, host, port, query
+                                  , cancel, static_cast<asio::yield_context>(yield));
+}
 
-    // Build and return lookup if `host` is already a network address.
-    {
-        sys::error_code e;
-        auto addr = asio::ip::make_address(host, e);
-        if (!e) return TcpLookup::create(TcpEndpoint{move(addr), *portn_o}, host, port);
-    }
+ResolverCache::Answer
+Client::State::query_doh( const std::string& host
+                        , const UserAgentMetaData& meta
+                        , const doh::Endpoint& ep
+                        , Cancel& cancel
+                        , Yield yield)
+{
+    using Answer = ResolverCache::Answer;
 
     // TODO: When to disable queries for IPv4 or IPv6 addresses?
     auto rq4_o = doh::build_request_ipv4(host, ep);
     auto rq6_o = doh::build_request_ipv6(host, ep);
-    if (!rq4_o || !rq6_o) return or_throw<TcpLookup>(yield, asio::error::invalid_argument);
+    if (!rq4_o || !rq6_o) return or_throw<Answer>(yield, asio::error::invalid_argument);
 
     sys::error_code ec4, ec6;
     doh::Response rs4, rs6;
@@ -882,20 +901,27 @@ Client::State::resolve_tcp_doh( const std::string& host
     });
 
     _YDEBUG(yield, "DoH query; ip4_ec=", ec4, " ip6_ec=", ec6);
-    if (ec4 && ec6) return or_throw<TcpLookup>(yield, ec4 /* arbitrary */);
+    if (ec4 && ec6) return or_throw<Answer>(yield, ec4 /* arbitrary */);
 
     doh::Answers answers4, answers6;
-    if (!ec4) answers4 = doh::parse_response(rs4, host, ec4);
-    if (!ec6) answers6 = doh::parse_response(rs6, host, ec6);
+    static const auto no_ttl = std::numeric_limits<uint32_t>::max();
+    uint32_t ttl4 = no_ttl, ttl6 = no_ttl;
+    if (!ec4) answers4 = doh::parse_response(rs4, host, ttl4, ec4);
+    if (!ec6) answers6 = doh::parse_response(rs6, host, ttl6, ec6);
 
     _YDEBUG(yield, "DoH parse; ip4_ec=", ec4, " ip6_ec=", ec6);
-    if (ec4 && ec6) return or_throw<TcpLookup>(yield, ec4 /* arbitrary */);
-
-    answers4.insert( answers4.end()
-                   , std::make_move_iterator(answers6.begin())
-                   , std::make_move_iterator(answers6.end()));
-    AddrsAsEndpoints<doh::Answers, TcpEndpoint> eps{answers4, *portn_o};
-    return TcpLookup::create(eps.begin(), eps.end(), host, port);
+    if (ec4 && ec6) return or_throw<Answer>(yield, ec4 /* arbitrary */);
+
+    Answer answer;
+    // Keep the answer no longer than the shortest TTL of both queries.
+    auto ttl = std::min(ttl4, ttl6);
+    if (ttl != no_ttl) answer.ttl = std::chrono::seconds(ttl);
+
+    answer.addresses = move(answers4);
+    answer.addresses.insert( answer.addresses.end()
+                           , std::make_move_iterator(answers6.begin())
+                           , std::make_move_iterator(answers6.end()));
+    return answer;
 }
 
 TcpLookup
@@ -904,8 +930,8 @@ Client::State::resolve_tcp_dns( const std::string& host
                               , Cancel& cancel
                               , Yield yield)
 {
-    return util::tcp_async_resolve( host, port
-                                  , _ctx.get_executor()
+    return _resolver_cache.resolve( "system", host, port
+                                  , ResolverCache::system_query(get_executor())
                                   , cancel
                                   , static_cast<asio::yield_context>(yield));
 }
@@ -1273,6 +1299,66 @@ Session Client::State::fetch_fresh_through_simple_proxy
     return session;
 }
 
+//------------------------------------------------------------------------------
+void Client::State::revalidate_in_background(Request rq, std::string dht_group)
+{
+    auto key = key_from_http_req(rq);
+    if (!key) return;
+
+    // Avoid piling up revalidations of the same response.
+    if (!_background_revalidations.insert(*key).second) return;
+
+    TRACK_SPAWN(_ctx, ([
+        this,
+        self = shared_from_this(),
+        rq = move(rq),
+        dht_group = move(dht_group),
+        key = move(*key)
+    ] (asio::yield_context yield_) {
+        auto on_exit = defer([&] { _background_revalidations.erase(key); });
+
+        if (was_stopped()) return;
+
+        Cancel cancel(_shutdown_signal);
+        Yield yield(_ctx, yield_, "bg_reval");
+
+        _YDEBUG(yield, "Start; key=", key);
+
+        sys::error_code ec;
+        auto session = fetch_fresh_through_simple_proxy
+            (rq, nullptr, true, cancel, yield[ec]);
+
+        if (ec) {
+            _YDEBUG(yield, "Failed to fetch fresh response; ec=", ec);
+            return;
+        }
+
+        auto& rsh = session.response_header();
+
+        if (rsh.result() == http::status::not_modified) {
+            _YDEBUG(yield, "Cached response not modified");
+            return;
+        }
+
+        auto cache = get_cache();
+
+        if (!cache || !rsh[http_::response_error_hdr].empty()
+            || !CacheControl::ok_to_cache(rq, rsh, _config.do_cache_private())) {
+            _YDEBUG(yield, "Not ok to cache fresh response");
+            return;
+        }
+
+        yield[ec].tag("store").run([&] (auto y) {
+            cache->store(key, dht_group, session, cancel, y);
+        });
+
+        if (ec && ec != asio::error::operation_aborted)
+            _YERROR(yield, "Failed to store fresh response; ec=", ec);
+
+        _YDEBUG(yield, "Finish; ec=", ec);
+    }));
+}
+
 class Transaction {
 public:
     Transaction(GenericStream& ua_con, const Request& rq, UserAgentMetaData meta)
@@ -1298,7 +1384,11 @@ public:
         sys::error_code ec;
 
         _ua_was_written_to = true;
-        session.flush_response(_ua_con, cancel, yield[ec]);
+        session.flush_response(cancel, yield[ec], [&] (auto&& part, auto& c, auto y) {
+            if      (auto b = part.as_body())       _body_bytes_written += b->size();
+            else if (auto b = part.as_chunk_body()) _body_bytes_written += b->size();
+            part.async_write(_ua_con, c, y);
+        });
 
         bool keep_alive = !ec && _request.keep_alive() && session.keep_alive();
 
@@ -1348,6 +1438,9 @@ public:
     }
 
     const UserAgentMetaData& meta() const { return _meta; }
+
+    // Bytes of response body sent to the user agent from a session.
+    size_t body_bytes_written() const { return _body_bytes_written; }
 private:
     /*
      * Connection to the user agent
@@ -1355,6 +1448,7 @@ private:
     GenericStream& _ua_con;
     const Request& _request;
     bool _ua_was_written_to = false;
+    size_t _body_bytes_written = 0;
     UserAgentMetaData _meta;
 };
 
@@ -1421,8 +1515,17 @@ public:
         // when missing connectivity.
         cc.parallel_fresh = [&] (auto, auto) { return !client_state._injector_starting; };
 
+        //------------------------------------------------------------
+        // This outlives the current connection, so only use the client state.
+        if (client_state._config.is_injector_access_enabled()) {
+            cc.revalidate_in_background = [&cs = client_state] (Request rq, const std::string& dht_group) {
+                cs.revalidate_in_background(move(rq), dht_group);
+            };
+        }
+
         //------------------------------------------------------------
         cc.max_cached_age(client_state._config.max_cached_age());
+        cc.serve_stale(client_state._config.do_serve_stale());
     }
 
     void front_end_job_func(Transaction& tnx, Cancel& cancel, Yield yield) {
@@ -1537,6 +1640,7 @@ public:
             ( cache
             && meta.dht_group
             && rq.method() == http::verb::get  // TODO: storing HEAD response not yet supported
+            && rsh.result() != http::status::partial_content  // TODO: storing partial response not yet supported
             && rsh[http_::response_source_hdr] != http_::response_source_hdr_local_cache
             && CacheControl::ok_to_cache( rq, rsh, client_state._config.do_cache_private()
                                         , (logger.get_threshold() <= DEBUG ? &no_cache_reason : nullptr)));
@@ -1757,6 +1861,7 @@ public:
     // (please check `tnx.user_agent_was_written_to()`).
     void mixed_fetch(Transaction& tnx, Yield yield)
     {
+        auto start = chrono::steady_clock::now();
         Cancel cancel(client_state._shutdown_signal);
 
         namespace err = asio::error;
@@ -1895,9 +2000,30 @@ public:
         _YDEBUG( yield, "Done; final_job=", final_job, " final_ec=", *final_ec
                , " target=", short_target);
 
+        record_metrics(final_job, *final_ec, chrono::steady_clock::now() - start, tnx);
+
         return or_throw(yield, *final_ec);
     }
 
+private:
+    static void record_metrics( const char* job, const sys::error_code& ec
+                              , chrono::steady_clock::duration duration
+                              , const Transaction& tnx)
+    {
+        auto& r = metrics::registry();
+        r.counter( "ouinet_client_requests_total", "Requests served by the client"
+                 , {{"job", job}, {"result", ec ? "error" : "ok"}}).inc();
+
+        if (ec) return;
+
+        r.histogram( "ouinet_client_request_duration_seconds"
+                   , "Time to serve successful requests", {{"job", job}})
+            .observe(duration);
+        r.counter( "ouinet_client_served_bytes_total"
+                 , "Response body bytes sent to user agents", {{"job", job}})
+            .inc(tnx.body_bytes_written());
+    }
+
 private:
     Client::State& client_state;
     const request_route::Config& request_config;
@@ -1917,6 +2043,32 @@ string base_domain_from_target(const beast::string_view& target)
     return full_host.substr(dot1).to_string();
 }
 
+//------------------------------------------------------------------------------
+// Only for remote hosts with names, since local ones and addresses
+// are not worth (or able) to get a certificate for their base domain.
+void Client::State::maybe_prefetch_ssl_server_context( const Request& req
+                                                     , const request_route::Config& config)
+{
+    auto& channels = config.fresh_channels;
+    if (find( channels.begin(), channels.end()
+            , request_route::fresh_channel::_front_end) != channels.end())
+        return;
+
+    auto host = util::split_ep(req[http::field::host]).first.to_string();
+    if (host.empty()) return;
+
+    sys::error_code ec;
+    asio::ip::make_address(host, ec);
+    if (!ec) return;  // IP address
+
+    if (boost::regex_match(host, util::localhost_rx)) return;
+
+    auto local_suffix = "." + _config.local_domain();
+    if (boost::iends_with(host, local_suffix)) return;
+
+    _ssl_server_contexts->prefetch(base_domain_from_target(host));
+}
+
 //------------------------------------------------------------------------------
 GenericStream Client::State::ssl_mitm_handshake( GenericStream&& con
                                                , const Request& con_req
@@ -1931,21 +2083,11 @@ GenericStream Client::State::ssl_mitm_handshake( GenericStream&& con
     // a host name instead of an IP address or its reverse resolution.
     auto base_domain = base_domain_from_target(con_req.target());
 
-    const string* crt_chain = _ssl_certificate_cache.get(base_domain);
-
-    if (!crt_chain) {
-        DummyCertificate dummy_crt(*_ca_certificate, base_domain);
-
-        crt_chain
-            = _ssl_certificate_cache.put(move(base_domain)
-                                        , dummy_crt.pem_certificate()
-                                          + _ca_certificate->pem_certificate());
-    }
+    sys::error_code ec;
 
-    auto ssl_context = ssl::util::get_server_context
-        ( *crt_chain
-        , _ca_certificate->pem_private_key()
-        , _ca_certificate->pem_dh_param());
+    Cancel cancel(_shutdown_signal);
+    auto ssl_context = _ssl_server_contexts->get(base_domain, cancel, yield[ec]);
+    if (ec) return or_throw<GenericStream>(yield, ec);
 
     // Send back OK to let the UA know we have the "tunnel"
     http::response<http::string_body> res{http::status::ok, con_req.version()};
@@ -1953,13 +2095,13 @@ GenericStream Client::State::ssl_mitm_handshake( GenericStream&& con
     // <https://tools.ietf.org/html/rfc7231#section-6.3.1>.
     http::async_write(con, res, yield);
 
-    sys::error_code ec;
-
-    auto ssl_sock = make_unique<asio::ssl::stream<GenericStream>>(move(con), ssl_context);
+    auto ssl_sock = make_unique<asio::ssl::stream<GenericStream>>(move(con), *ssl_context);
     ssl_sock->async_handshake(asio::ssl::stream_base::server, yield[ec]);
     if (ec) return or_throw<GenericStream>(yield, ec);
 
-    static const auto ssl_shutter = [](asio::ssl::stream<GenericStream>& s) {
+    // Keep the context alive along with the connection,
+    // even if it is dropped from the cache.
+    auto ssl_shutter = [ssl_context](asio::ssl::stream<GenericStream>& s) {
         // Just close the underlying connection
         // (TLS has no message exchange for shutdown).
         s.next_layer().close();
@@ -2055,6 +2197,89 @@ Client::State::retrieval_failure_response(const Request& req)
     return res;
 }
 
+//------------------------------------------------------------------------------
+request_route::Router Client::State::make_request_router() const
+{
+    // Uncacheable requests use the matching configuration
+    // for the default one in `serve_request`, i.e. "origin proxy".
+    //
+    // Please keep host-specific rules at a bare minimum
+    // as they require curation and they may have undesired side-effects;
+    // instead, use user agent-side mechanisms like browser settings and extensions when possible,
+    // and only leave those that really break things and cannot be otherwise disabled.
+    //
+    // Also note that using the normal mechanisms for these may help users
+    // keep their browsers up-to-date (by retrieving via the injector in case of interference),
+    // and they may still not pollute the cache unless
+    // the requests are explicitly marked for caching and announcement.
+    //
+    // Users may add their own rules from files, which are checked after these.
+    // Some examples of rules which were used at some point:
+    //
+    //     # Disable cache and always go to origin for this site.
+    //     domain=ident.me => origin
+    //
+    //     # Firefox telemetry (better disabled in browser preferences).
+    //     domain=.telemetry.mozilla.net => origin
+    //     domain=.telemetry.mozilla.org => origin
+    //
+    //     # Ads and tracking (better handled by an ad blocker), not requested at all.
+    //     domain=google-analytics.com =>
+    //     domain=doubleclick.net =>
+    //
+    //     # Disable cache and always go to proxy for this site.
+    //     domain=ifconfig.co => proxy
+    //
+    //     # Force cache and particular channels for this site.
+    //     host=example.net host=www.example.net => injector
+    vector<string> rules{
+        // Handle requests to <http://localhost/> internally.
+        "header:Host=localhost => _front_end",
+        util::str("header:Host=", _config.front_end_endpoint(), " => _front_end"),
+
+        // Other requests to the local host should not use the network
+        // to avoid leaking internal services accessed through the client.
+        util::str("host~", util::_localhost_re, " => origin"),
+
+        // Access to sites under the local TLD are always accessible
+        // with good connectivity, so always use the Origin channel
+        // and never cache them.
+        util::str("domain=.", _config.local_domain(), " => origin"),
+
+        // Do not use caching for requests tagged as private with Ouinet headers.
+        util::str("header:", http_::request_private_hdr, "=", http_::request_private_true, " => origin proxy"),
+
+        // When to try to cache or not, depending on the request method:
+        //
+        //   - Unsafe methods (CONNECT, DELETE, PATCH, POST, PUT): do not cache
+        //   - Safe but uncacheable methods (OPTIONS, TRACE): do not cache
+        //   - Safe and cacheable (GET, HEAD): cache
+        //
+        // Thus the only remaining method that implies caching is GET.
+        "!method=GET,HEAD => origin proxy",
+        // Requests declaring a method override are checked by that method.
+        // This is not a standard header,
+        // but for instance Firefox uses it for Safe Browsing requests,
+        // which according to this standard should actually be POST requests
+        // (probably in the hopes of having more chances that requests get through,
+        // in spite of using HTTPS).
+        // The method name is case-sensitive (RFC7230#3.1.1).
+        "!header:X-HTTP-Method-Override~~(|GET) => origin proxy",
+    };
+
+    request_route::Router router;
+    for (auto& r : rules) router.add_rule(r);
+
+    for (auto& path : _config.request_routing_rules()) {
+        fs::ifstream f(path);
+        if (!f) throw runtime_error(util::str("Failed to open routing rules: ", path));
+        router.add_rules(f, path.string());
+    }
+
+    LOG_INFO("Request routing rules: ", router.size());
+    return router;
+}
+
 //------------------------------------------------------------------------------
 void Client::State::serve_request( GenericStream&& con
                                  , asio::yield_context yield_)
@@ -2090,12 +2315,6 @@ void Client::State::serve_request( GenericStream&& con
         { deque<fresh_channel>({ fresh_channel::origin
                                , fresh_channel::injector_or_dcache})};
 
-    // This is the matching configuration for the one above,
-    // but for uncacheable requests.
-    const rr::Config nocache_request_config
-        { deque<fresh_channel>({ fresh_channel::origin
-                               , fresh_channel::proxy})};
-
     // The currently effective request router configuration.
     rr::Config request_config;
 
@@ -2103,175 +2322,6 @@ void Client::State::serve_request( GenericStream&& con
 
     sys::error_code ec;
 
-    // Expressions to test the request against and configurations to be used.
-    // TODO: Create once and reuse.
-    using Match = pair<const ouinet::reqexpr::reqex, const rr::Config>;
-
-    auto method_override_getter([](const Request& r) {return r["X-HTTP-Method-Override"];});
-    auto method_getter([](const Request& r) {return r.method_string();});
-    auto host_getter([](const Request& r) {return r[http::field::host];});
-    auto hostname_getter([](const Request& r) {return util::split_ep(r[http::field::host]).first;});
-    auto x_private_getter([](const Request& r) {return r[http_::request_private_hdr];});
-    auto target_getter([](const Request& r) {return r.target();});
-
-    auto local_rx = util::str("https?://[^:/]+\\.", _config.local_domain(), "(:[0-9]+)?/.*");
-
-#ifdef NDEBUG // release
-    const rr::Config unrequested{deque<fresh_channel>({fresh_channel::origin})};
-#else // debug
-    // Don't request these in debug mode as they bring a lot of noise into the log
-    const rr::Config unrequested{deque<fresh_channel>()};
-#endif
-
-    static const boost::regex localhost_exact_rx{"localhost", rx_icase};
-
-    const vector<Match> matches({
-        // Please keep host-specific matches at a bare minimum
-        // as they require curation and they may have undesired side-effects;
-        // instead, use user agent-side mechanisms like browser settings and extensions when possible,
-        // and only leave those that really break things and cannot be otherwise disabled.
-        //
-        // Also note that using the normal mechanisms for these may help users
-        // keep their browsers up-to-date (by retrieving via the injector in case of interference),
-        // and they may still not pollute the cache unless
-        // the requests are explicitly marked for caching and announcement.
-
-        // Disable cache and always go to origin for this site.
-        //Match( reqexpr::from_regex(target_getter, "https?://ident\\.me/.*")
-        //     , {deque<fresh_channel>({fresh_channel::origin})} ),
-
-        /* Requests which may be considered public but too noisy and of little value for caching
-         * should be processed by something like browser extensions.
-        // Google Search completion
-        Match( reqexpr::from_regex(target_getter, "https?://(www\\.)?google\\.com/complete/.*")
-             , unrequested ),
-        */
-
-        /* To stop these requests in Firefox,
-         * uncheck "Preferences / Privacy & Security / Deceptive Content and Dangerous Software Protection".
-        // Safe Browsing API <https://developers.google.com/safe-browsing/>.
-        // These should not be very frequent after start,
-        // plus they use POST requests, so there is no risk of accidental injection.
-        Match( reqexpr::from_regex(target_getter, "https://safebrowsing\\.googleapis\\.com/.*")
-             , unrequested ),
-        */
-
-        /* These are used to retrieve add-ons and all kinds of minor security updates from Mozilla,
-         * and they mostly happen on browser start only.
-        // Disable cache and always go to origin for these mozilla sites.
-        Match( reqexpr::from_regex(target_getter, "https?://content-signature\\.cdn\\.mozilla\\.net/.*")
-             , unrequested ),
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*services\\.mozilla\\.com/.*")
-             , unrequested ),
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*cdn\\.mozilla\\.net/.*")
-             , unrequested ),
-        */
-
-        /* To stop these requests,
-         * uncheck "Preferences / Add-ons / (gear icon) / Update Add-ons Automatically".
-        // Firefox add-ons hotfix (auto-update)
-        Match( reqexpr::from_regex(target_getter, "https?://services\\.addons\\.mozilla\\.org/.*")
-             , unrequested ),
-        Match( reqexpr::from_regex(target_getter, "https?://versioncheck-bg\\.addons\\.mozilla\\.org/.*")
-             , unrequested ),
-        */
-
-        /* To stop these requests,
-         * uncheck all options from "Preferences / Privacy & Security / Firefox Data Collection and Use",
-         * maybe clear `toolkit.telemetry.server` in `about:config`.
-        // Firefox telemetry
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*telemetry\\.mozilla\\.net/.*")
-             , unrequested ),
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*telemetry\\.mozilla\\.org/.*")
-             , unrequested ),
-        */
-
-        /* This should work as expected as long as Origin is enabled.
-         * To stop these requests, set `network.captive-portal-service.enabled` to false in `about:config`.
-        // Firefox' captive portal detection
-        Match( reqexpr::from_regex(target_getter, "https?://detectportal\\.firefox\\.com/.*")
-             , unrequested ),
-        */
-
-        /* To avoid these at the client, use some kind of ad blocker (like uBlock Origin).
-        // Ads and tracking
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*google-analytics\\.com/.*")
-             , unrequested ),
-
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*googlesyndication\\.com/.*")
-             , unrequested ),
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*googletagservices\\.com/.*")
-             , unrequested ),
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*moatads\\.com/.*")
-             , unrequested ),
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*amazon-adsystem\\.com/.*")
-             , unrequested ),
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*adsafeprotected\\.com/.*")
-             , unrequested ),
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*ads-twitter\\.com/.*")
-             , unrequested ),
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*doubleclick\\.net/.*")
-             , unrequested ),
-
-        Match( reqexpr::from_regex(target_getter, "https?://([^/\\.]+\\.)*summerhamster\\.com/.*")
-             , unrequested ),
-
-        Match( reqexpr::from_regex(target_getter, "https?://ping.chartbeat.net/.*")
-             , unrequested ),
-        */
-
-        // Handle requests to <http://localhost/> internally.
-        Match( reqexpr::from_regex(host_getter, localhost_exact_rx)
-             , {deque<fresh_channel>({fresh_channel::_front_end})} ),
-
-        Match( reqexpr::from_regex(host_getter, util::str(_config.front_end_endpoint()))
-             , {deque<fresh_channel>({fresh_channel::_front_end})} ),
-
-        // Other requests to the local host should not use the network
-        // to avoid leaking internal services accessed through the client.
-        Match( reqexpr::from_regex(hostname_getter, util::localhost_rx)
-             , {deque<fresh_channel>({fresh_channel::origin})} ),
-
-        // Access to sites under the local TLD are always accessible
-        // with good connectivity, so always use the Origin channel
-        // and never cache them.
-        Match( reqexpr::from_regex(target_getter, local_rx)
-             , {deque<fresh_channel>({fresh_channel::origin})} ),
-
-        // Do not use caching for requests tagged as private with Ouinet headers.
-        Match( reqexpr::from_regex( x_private_getter
-                                  , boost::regex(http_::request_private_true, rx_icase))
-             , nocache_request_config),
-
-        // When to try to cache or not, depending on the request method:
-        //
-        //   - Unsafe methods (CONNECT, DELETE, PATCH, POST, PUT): do not cache
-        //   - Safe but uncacheable methods (OPTIONS, TRACE): do not cache
-        //   - Safe and cacheable (GET, HEAD): cache
-        //
-        // Thus the only remaining method that implies caching is GET.
-        Match( !reqexpr::from_regex(method_getter, "(GET|HEAD)")
-             , nocache_request_config),
-        // Requests declaring a method override are checked by that method.
-        // This is not a standard header,
-        // but for instance Firefox uses it for Safe Browsing requests,
-        // which according to this standard should actually be POST requests
-        // (probably in the hopes of having more chances that requests get through,
-        // in spite of using HTTPS).
-        Match( !reqexpr::from_regex(method_override_getter, "(|GET)")
-             , nocache_request_config),
-
-        // Disable cache and always go to proxy for this site.
-        //Match( reqexpr::from_regex(target_getter, "https?://ifconfig\\.co/.*")
-        //     , {deque<fresh_channel>({fresh_channel::proxy})} ),
-        // Force cache and default channels for this site.
-        //Match( reqexpr::from_regex(target_getter, "https?://(www\\.)?example\\.com/.*")
-        //     , {deque<fresh_channel>()} ),
-        // Force cache and particular channels for this site.
-        //Match( reqexpr::from_regex(target_getter, "https?://(www\\.)?example\\.net/.*")
-        //     , {deque<fresh_channel>({fresh_channel::injector})} ),
-    });
-
     auto connection_id = _next_connection_id++;
     auto connection_idstr = util::str('C', connection_id);
 
@@ -2392,7 +2442,9 @@ void Client::State::serve_request( GenericStream&& con
             else break;
         }
 
-        request_config = route_choose_config(req, matches, default_request_config);
+        yield.start_trace(util::str(req.method_string(), ' ', req.target()));
+
+        request_config = _request_router.choose(req, default_request_config);
 
         auto meta = UserAgentMetaData::extract(req);
         Transaction tnx(con, req, std::move(meta));
@@ -2406,6 +2458,11 @@ void Client::State::serve_request( GenericStream&& con
             continue;
         }
 
+        // Plain HTTP sites often redirect to HTTPS,
+        // so have the context for intercepting that ready.
+        if (!mitm && req.target().starts_with("http://"))
+            maybe_prefetch_ssl_server_context(req, request_config);
+
         cache_control.mixed_fetch(tnx, yield[ec].tag("mixed_fetch"));
 
         if (ec) {
@@ -2563,12 +2620,9 @@ void Client::State::listen_tcp
 
             GenericStream connection(move(socket) , move(tcp_shutter));
 
-            // Increase the size of the coroutine stack.
+            // Use a larger coroutine stack.
             // Some interesing info:
             // https://lists.ceph.io/hyperkitty/list/dev@ceph.io/thread/6LBFZIFUPTJQ3SNTLVKSQMVITJWVWTZ6/
-            boost::coroutines::attributes attribs;
-            attribs.size *= 2;
-
             TRACK_SPAWN( _ctx, ([
                 this,
                 self = shared_from_this(),
@@ -2578,7 +2632,7 @@ void Client::State::listen_tcp
             ](asio::yield_context yield) mutable {
                 if (was_stopped()) return;
                 handler(move(c), yield);
-            }), attribs);
+            }), util::StackSize::large);
         }
     }
 
@@ -2608,6 +2662,11 @@ void Client::State::start()
         ( "Your own local Ouinet client"
         , ca_cert_path(), ca_key_path(), ca_dh_path());
 
+    _ssl_server_contexts = make_unique<ServerContextCache>
+        (get_executor(), *_ca_certificate, _config.repo_root() / "mitm-certs");
+    for (auto& g : _ssl_server_contexts->export_metrics())
+        _metrics.push_back(move(g));
+
     if (!_config.tls_injector_cert_path().empty()) {
         if (fs::exists(fs::path(_config.tls_injector_cert_path()))) {
             LOG_DEBUG("Loading injector certificate file...");
@@ -2785,7 +2844,8 @@ void Client::State::setup_injector(asio::yield_context yield)
             ( dht
             , injector_ep->endpoint_string
             , *bridge_swarm_name
-            , &inj_ctx);
+            , &inj_ctx
+            , _config.repo_root() / "bep5_peer_stats.txt");
 
         client = make_unique<ouiservice::WeakOuiServiceClient>(_bep5_client);
 
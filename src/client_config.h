@@ -18,6 +18,7 @@
 #include "increase_open_file_limit.h"
 #include "endpoint.h"
 #include "logger.h"
+#include "util/tracing.h"
 #include "constants.h"
 #include "bep5_swarms.h"
 #include "bittorrent/bootstrap.h"
@@ -73,6 +74,10 @@ public:
         return _cache_private;
     }
 
+    bool do_serve_stale() const {
+        return _serve_stale;
+    }
+
     const fs::path& cache_static_path() const {
         return _cache_static_path;
     }
@@ -106,6 +111,10 @@ public:
 
     std::string local_domain() const { return _local_domain; }
 
+    const std::vector<fs::path>& request_routing_rules() const {
+        return _request_routing_rules;
+    }
+
     boost::optional<std::string> origin_doh_endpoint() const {
         return _origin_doh_endpoint;
     }
@@ -132,6 +141,15 @@ private:
            ("log-level", po::value<string>()->default_value(util::str(default_log_level()))
             , "Set log level: silly, debug, verbose, info, warn, error, abort. "
               "This option is persistent.")
+           ("log-async", po::bool_switch()->default_value(false)
+            , "Write log messages from a separate thread "
+              "(messages may be dropped if too many are pending)")
+           ("trace-requests", po::value<size_t>()->default_value(0)
+            , "Keep timings of the operations of up to this number of recent requests "
+              "for the \"/traces.json\" front-end page (0 disables it)")
+           ("trace-min-duration", po::value<unsigned>()->default_value(0)
+            , "Only keep timings of requests which took at least "
+              "this number of milliseconds")
            ("enable-log-file", po::bool_switch()->default_value(false)
             , "Enable writing log messages to "
               "log file \"" _LOG_FILE_NAME "\" under the repository root. "
@@ -196,6 +214,12 @@ private:
              "Sensitive headers are still removed from Injector requests. "
              "May need special injector configuration. "
              "USE WITH CAUTION.")
+          ("cache-serve-stale"
+           , po::bool_switch(&_serve_stale)->default_value(false)
+           , "Serve stale cached responses which can be used on errors "
+             "(i.e. within their \"stale-if-error\" period) right away "
+             "while revalidating them in the background, "
+             "as done within their \"stale-while-revalidate\" period (RFC 5861).")
           ("cache-static-repo"
            , po::value<string>()
            , "Repository for internal files of the static cache "
@@ -225,6 +249,13 @@ private:
            ("local-domain"
             , po::value<string>()->default_value("local")
             , "Always use origin access and never use cache for this TLD")
+           ("request-routing-rules", po::value<vector<string>>()->composing()
+            , "File with extra rules to choose how to fetch requests "
+              "(can be used several times); "
+              "each line has the format \"<CONDITION>... => [<CHANNEL>...]\" "
+              "with <CHANNEL> being \"origin\", \"proxy\" or \"injector\", "
+              "see \"src/request_routing.h\" for conditions. "
+              "Built-in rules for local hosts, private and non-GET requests go first.")
            ("origin-doh-base", po::value<string>()
             , "If given, enable DNS over HTTPS for origin access using the given base URL; "
               "the \"dns=...\" query argument will be added for the GET request.")
@@ -364,6 +395,7 @@ private:
     boost::posix_time::time_duration _max_cached_age
         = default_max_cached_age;
     bool _cache_private = false;
+    bool _serve_stale = false;
 
     std::string _client_credentials;
     std::map<Endpoint, std::string> _injector_credentials;
@@ -373,6 +405,7 @@ private:
     boost::optional<util::Ed25519PublicKey> _cache_http_pubkey;
     CacheType _cache_type = CacheType::None;
     std::string _local_domain;
+    std::vector<fs::path> _request_routing_rules;
     boost::optional<doh::Endpoint> _origin_doh_endpoint;
 };
 
@@ -450,6 +483,15 @@ ClientConfig::ClientConfig(int argc, char* argv[])
         LOG_INFO("Log level set to: ", level);
     }
 
+    if (vm["log-async"].as<bool>()) {
+        logger.enable_async();
+    }
+
+    if (auto n = vm["trace-requests"].as<size_t>()) {
+        tracing::tracer().enable
+            (n, std::chrono::milliseconds(vm["trace-min-duration"].as<unsigned>()));
+    }
+
     if (vm["enable-log-file"].as<bool>()) {
         _is_log_file_enabled(true);
     }
@@ -636,6 +678,14 @@ ClientConfig::ClientConfig(int argc, char* argv[])
         _local_domain = boost::algorithm::to_lower_copy(local_domain);
     }
 
+    if (vm.count("request-routing-rules")) {
+        for (const auto& path : vm["request-routing-rules"].as<vector<string>>()) {
+            if (!fs::is_regular_file(path))
+                throw std::runtime_error(util::str("No such file: ", path));
+            _request_routing_rules.push_back(path);
+        }
+    }
+
     if (vm.count("origin-doh-base")) {
         auto doh_base = vm["origin-doh-base"].as<string>();
         _origin_doh_endpoint = doh::endpoint_from_base(doh_base);
@@ -7,6 +7,9 @@
 #include "version.h"
 #include "upnp.h"
 #include "split_string.h"
+#include "util/handler_tracker.h"
+#include "util/metrics.h"
+#include "util/tracing.h"
 
 #include "bittorrent/dht.h"
 #include "cache/client.h"
@@ -217,13 +220,8 @@ void ClientFrontEnd::disable_log_to_file(ClientConfig& config) {
 
 static void load_log_file(ClientConfig& config, ostringstream& out_ss) {
     if (!config.is_log_file_enabled()) return;
-    std::fstream* logfile = logger.get_log_file();
-    assert(logfile && "No log file in spite of configuration saying so");
-    logfile->flush();
-    logfile->seekg(0);
-    std::copy( istreambuf_iterator<char>(*logfile)
-             , istreambuf_iterator<char>()
-             , ostreambuf_iterator<char>(out_ss));
+    assert(logger.get_log_file() && "No log file in spite of configuration saying so");
+    logger.copy_log_file(out_ss);
 }
 
 template<class EndPoint>
@@ -502,6 +500,12 @@ void ClientFrontEnd::handle_portal( ClientConfig& config
         ss << "Logging debug output to file: " << as_safe_html(logger.current_log_file())
            << " <a href=\"" << log_file_apath << "\" class=\"download\" download=\"ouinet-logfile.txt\">"
            << "Download log file" << "</a><br>\n";
+    if (tracing::tracer().is_enabled())
+        ss << "Keeping timings of " << tracing::tracer().size() << " recent requests:"
+           << " <a href=\"" << traces_apath << "\" class=\"download\" download=\"ouinet-traces.json\">"
+           << "Download request traces" << "</a>"
+           << " (open with <code>chrome://tracing</code> or <code>ui.perfetto.dev</code>)<br>\n";
+    ss << "<a href=\"" << handlers_apath << "\">See running handlers and coroutines</a><br>\n";
 
     ss << "<h2>Ouinet client</h2>\n";
     ss << "State: " << client_state(cstate)  << "<br>\n";
@@ -694,6 +698,15 @@ Response ClientFrontEnd::serve( ClientConfig& config
         load_log_file(config, ss);
     } else if (path == group_list_apath) {
         handle_group_list(req, res, ss, cache_client);
+    } else if (path == traces_apath) {
+        res.set(http::field::content_type, "application/json");
+        tracing::tracer().write_chrome_trace(ss);
+    } else if (path == handlers_apath) {
+        res.set(http::field::content_type, "text/plain");
+        HandlerTracker::write_census(ss);
+    } else if (path == "/metrics") {
+        res.set(http::field::content_type, "text/plain; version=0.0.4");
+        metrics::registry().write(ss);
     } else if (path == "/api/status") {
         sys::error_code e;
         handle_status( config, client_state, local_ep, upnps, dht, reachability
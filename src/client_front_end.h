@@ -44,6 +44,8 @@ public:
     // Absolute paths of allowed URLs.
     static constexpr const char* log_file_apath = "/logfile.txt";
     static constexpr const char* group_list_apath = "/groups.txt";
+    static constexpr const char* traces_apath = "/traces.json";
+    static constexpr const char* handlers_apath = "/handlers.txt";
 
 public:
     using Request = http::request<http::string_body>;
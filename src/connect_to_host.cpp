@@ -2,7 +2,15 @@
 
 #include "util.h"
 #include "http_util.h"
+#include "logger.h"
+#include "util/condition_variable.h"
+#include "util/handler_tracker.h"
 #include "util/timeout.h"
+#include "util/wait_condition.h"
+#include "util/watch_dog.h"
+
+#include <algorithm>
+#include <atomic>
 
 #include <boost/asio/connect.hpp>
 #include <boost/asio/spawn.hpp>
@@ -13,6 +21,10 @@ using tcp = asio::ip::tcp;
 
 using TcpLookup = asio::ip::tcp::resolver::results_type;
 
+// Delay before starting the next connection attempt
+// if the previous one has not finished yet (RFC8305#5).
+static const auto connection_attempt_delay = chrono::milliseconds(250);
+
 
 tcp::socket
 ouinet::connect_to_host( const asio::executor& ex
@@ -31,26 +43,122 @@ ouinet::connect_to_host( const asio::executor& ex
     return connect_to_host(lookup, ex, cancel_signal, yield);
 }
 
+// Address family of the last successful connection with several candidates,
+// to try it first next time (RFC8305#4).
+static std::atomic<bool> prefer_ipv4{false};
+
+// Sort endpoints for connection attempts, interleaving address families
+// and starting with the preferred one (RFC8305#4).
+static
+vector<tcp::endpoint> sort_endpoints(const TcpLookup& lookup)
+{
+    vector<tcp::endpoint> v4, v6;
+    for (auto& r : lookup) {
+        auto ep = r.endpoint();
+        auto& eps = ep.address().is_v4() ? v4 : v6;
+        if (find(eps.begin(), eps.end(), ep) == eps.end())
+            eps.push_back(move(ep));
+    }
+
+    auto& first  = prefer_ipv4 ? v4 : v6;
+    auto& second = prefer_ipv4 ? v6 : v4;
+
+    vector<tcp::endpoint> eps;
+    eps.reserve(v4.size() + v6.size());
+    for (size_t i = 0; i < max(first.size(), second.size()); ++i) {
+        if (i < first.size())  eps.push_back(first[i]);
+        if (i < second.size()) eps.push_back(second[i]);
+    }
+    return eps;
+}
+
 tcp::socket
 ouinet::connect_to_host( const TcpLookup& lookup
                        , const asio::executor& ex
                        , Signal<void()>& cancel_signal
                        , asio::yield_context yield)
 {
-    sys::error_code ec;
-    tcp::socket socket(ex);
+    auto eps = sort_endpoints(lookup);
+
+    if (eps.empty())
+        return or_throw(yield, asio::error::host_not_found, tcp::socket(ex));
+
+    // Attempts to connect to the different endpoints are started in order,
+    // each one when the previous one fails or after a short delay,
+    // and the first one to succeed cancels the rest (RFC8305#5).
+    Cancel attempts_cancel(cancel_signal);
+    ConditionVariable attempt_done(ex);
+    WaitCondition attempts_wc(ex);
 
-    auto disconnect_slot = cancel_signal.connect([&socket] {
+    boost::optional<tcp::socket> winner;
+    sys::error_code last_ec = asio::error::host_unreachable;
+    size_t next = 0, running = 0;
+
+    auto start_attempt = [&] (const tcp::endpoint& ep) {
+        ++running;
+        TRACK_SPAWN(ex, ([
+            &, ep, lock = attempts_wc.lock()
+        ] (asio::yield_context y) {
+            tcp::socket socket(ex);
+            auto disconnect_slot = attempts_cancel.connect([&socket] {
+                sys::error_code ec;
+                socket.close(ec);
+            });
+
+            sys::error_code ec;
+            socket.async_connect(ep, y[ec]);
+            if (attempts_cancel) ec = asio::error::operation_aborted;
+            --running;
+
+            if (!ec && !winner) {
+                LOG_DEBUG("Connected to ", ep);
+                winner.emplace(move(socket));
+                attempts_cancel();
+            }
+            else if (ec && ec != asio::error::operation_aborted) {
+                last_ec = ec;
+            }
+
+            attempt_done.notify();
+        }));
+    };
+
+    while (!winner && !cancel_signal) {
+        if (next < eps.size()) start_attempt(eps[next++]);
+        else if (running == 0) break;  // all attempts failed
+
+        if (winner || running == 0) continue;
+
+        // Wait for some attempt to finish
+        // (or for the delay to start the next one, if any is left).
         sys::error_code ec;
-        socket.shutdown(tcp::socket::shutdown_both, ec);
-        socket.close(ec);
-    });
+        if (next < eps.size()) {
+            auto wd = watch_dog(ex, connection_attempt_delay, [&] {
+                attempt_done.notify();
+            });
+            attempt_done.wait(yield[ec]);
+        }
+        else {
+            attempt_done.wait(yield[ec]);
+        }
+    }
 
-    // Make the connection on the IP address we get from a lookup
-    asio::async_connect(socket, lookup, yield[ec]);
-    return_or_throw_on_error(yield, cancel_signal, ec, tcp::socket(ex));
+    // Do not leave attempts behind, they refer to local variables.
+    attempts_cancel();
+    attempts_wc.wait(yield);
+
+    if (cancel_signal)
+        return or_throw(yield, asio::error::operation_aborted, tcp::socket(ex));
+    if (!winner)
+        return or_throw(yield, last_ec, tcp::socket(ex));
+
+    if (eps.size() > 1) {
+        sys::error_code ec;
+        auto ep = winner->remote_endpoint(ec);
+        if (!ec) prefer_ipv4 = ep.address().is_v4();
+    }
 
-    return socket;
+    return move(*winner);
 }
 
 tcp::socket
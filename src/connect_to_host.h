@@ -20,6 +20,10 @@ connect_to_host( const asio::executor&
                , Signal<void()>& cancel_signal
                , asio::yield_context yield);
 
+// Connection attempts to the endpoints in the lookup are staggered
+// and alternate between IPv6 and IPv4 (starting with the family
+// which worked last time), and the first one to succeed is used
+// ("Happy Eyeballs", RFC 8305).
 asio::ip::tcp::socket
 connect_to_host( const asio::ip::tcp::resolver::results_type& lookup
                , const asio::executor&
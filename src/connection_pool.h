@@ -1,6 +1,13 @@
 #pragma once
 
+#include <chrono>
+#include <limits>
+#include <list>
+#include <memory>
+
 #include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/optional.hpp>
 #include "generic_stream.h"
 #include "util/unique_function.h"
 
@@ -283,10 +290,75 @@ class IdleConnection {
 template<class StoredValue>
 class ConnectionPool {
     public:
+    using Clock = std::chrono::steady_clock;
+
     class Connection;
 
     using Connections = std::list<Connection>;
 
+    private:
+    struct Idle;
+
+    public:
+    /*
+     * Idle connections of several pools, from the one which has been idle for longer,
+     * to keep at most some number of them among all those pools.
+     */
+    class SharedIdle {
+        public:
+        SharedIdle(size_t max_size = std::numeric_limits<size_t>::max())
+            : _max_size(max_size)
+        {}
+
+        size_t size() const
+        {
+            return _entries.size();
+        }
+
+        private:
+        friend class ConnectionPool;
+
+        struct Entry {
+            Idle* idle;
+            typename Connections::iterator connection;
+        };
+
+        void enforce_max_size()
+        {
+            while (_entries.size() > _max_size) {
+                auto oldest = _entries.front();
+                ++oldest.idle->evicted;
+                erase(*oldest.idle, oldest.connection);
+            }
+        }
+
+        size_t _max_size;
+        std::list<Entry> _entries;
+    };
+
+    private:
+    /*
+     * Idle connections and the limits on them, shared with connections taken from the pool
+     * so that they can get back into it on destruction.
+     */
+    struct Idle {
+        Connections connections;
+        size_t max_size = std::numeric_limits<size_t>::max();
+        boost::optional<Clock::duration> timeout;
+        std::shared_ptr<SharedIdle> shared;
+
+        size_t expired = 0;  // closed after being idle for too long
+        size_t evicted = 0;  // closed to make room for other connections
+
+        ~Idle()
+        {
+            if (!shared) return;
+            for (auto& c : connections) shared->_entries.erase(c._shared_entry);
+        }
+    };
+
+    public:
+
     class Connection : public IdleConnection<GenericStream> {
         public:
 
@@ -306,10 +378,10 @@ class ConnectionPool {
             if (!_auto_add_back_to_pool) return;
             if (!IdleConnection::is_open()) return;
 
-            if (auto cs = _connections.lock()) {
+            if (auto idle = _idle.lock()) {
                 Connection c((IdleConnection<GenericStream>&&) *this);
                 c._value = std::move(_value);
-                push_back(*cs, std::move(c));
+                push_back(idle, std::move(c));
             }
         }
 
@@ -330,63 +402,171 @@ class ConnectionPool {
         private:
         friend class ConnectionPool;
         StoredValue _value;
-        std::weak_ptr<Connections> _connections;
+        std::weak_ptr<Idle> _idle;
         bool _auto_add_back_to_pool = true;
+
+        /*
+         * Only used while the connection is in the pool.
+         * The flag is cleared when the connection leaves the pool.
+         */
+        Clock::time_point _idle_since;
+        std::shared_ptr<bool> _in_pool;
+        std::unique_ptr<asio::steady_timer> _idle_timer;
+        typename std::list<typename SharedIdle::Entry>::iterator _shared_entry;
     };
 
     ConnectionPool()
-        : _connections(std::make_shared<Connections>())
+        : _idle(std::make_shared<Idle>())
     {}
 
     Connection wrap(GenericStream connection)
     {
         auto c = Connection(std::move(connection));
-        c._connections = _connections;
+        c._idle = _idle;
         return c;
     }
 
     void push_back(Connection connection)
     {
-        connection._connections.reset();
-        push_back(*_connections, std::move(connection));
+        connection._idle.reset();
+        push_back(_idle, std::move(connection));
     }
 
     Connection pop_front()
     {
-        assert(!_connections->empty());
+        assert(!_idle->connections.empty());
 
-        Connection connection = std::move(_connections->front());
-        _connections->pop_front();
+        Connection connection = std::move(_idle->connections.front());
+        _idle->connections.pop_front();
+        leave_pool(*_idle, connection);
         connection.make_not_idle();
-        connection._connections = _connections;
+        connection._idle = _idle;
 
         return connection;
     }
 
     bool empty() const
     {
-        return _connections->empty();
+        return _idle->connections.empty();
+    }
+
+    size_t size() const
+    {
+        return _idle->connections.size();
     }
 
+    /*
+     * Keep at most this many idle connections,
+     * closing the ones which have been idle for longer when exceeded.
+     */
+    void max_size(size_t n)
+    {
+        _idle->max_size = n;
+        while (_idle->connections.size() > n) evict_oldest();
+    }
+
+    /*
+     * Close connections which are idle for longer than this.
+     * Only applies to connections put in the pool afterwards.
+     */
+    void idle_timeout(Clock::duration d)
+    {
+        _idle->timeout = d;
+    }
+
+    /*
+     * Also limit idle connections together with other pools using the same `shared` object,
+     * closing the ones which have been idle for longer among all of them when exceeded.
+     * This must be set while the pool is empty.
+     */
+    void shared_idle(std::shared_ptr<SharedIdle> shared)
+    {
+        assert(_idle->connections.empty());
+        _idle->shared = std::move(shared);
+    }
+
+    /*
+     * When the oldest idle connection in the pool was put in it.
+     */
+    boost::optional<Clock::time_point> oldest_idle_since() const
+    {
+        if (_idle->connections.empty()) return boost::none;
+        return _idle->connections.front()._idle_since;
+    }
+
+    void evict_oldest()
+    {
+        assert(!_idle->connections.empty());
+        ++_idle->evicted;
+        erase(*_idle, _idle->connections.begin());
+    }
+
+    size_t expired_count() const { return _idle->expired; }
+    size_t evicted_count() const { return _idle->evicted; }
+
     private:
-    static void push_back(Connections& connections, Connection connection)
+    static void leave_pool(Idle& idle, Connection& connection)
     {
+        if (idle.shared) idle.shared->_entries.erase(connection._shared_entry);
+        *connection._in_pool = false;
+        connection._in_pool.reset();
+        connection._idle_timer.reset();
+    }
+
+    static void erase(Idle& idle, typename Connections::iterator it)
+    {
+        leave_pool(idle, *it);
+        it->close();
+        idle.connections.erase(it);
+    }
+
+    static void push_back(const std::shared_ptr<Idle>& idle, Connection connection)
+    {
+        auto& connections = idle->connections;
+
+        connection._idle_since = Clock::now();
+        connection._in_pool = std::make_shared<bool>(true);
         connections.push_back(std::move(connection));
 
         typename Connections::iterator it = connections.end();
         --it;
+
+        if (idle->shared) {
+            auto& entries = idle->shared->_entries;
+            it->_shared_entry = entries.insert(entries.end(), {idle.get(), it});
+        }
+
+        if (idle->timeout) {
+            it->_idle_timer = std::make_unique<asio::steady_timer>(it->get_executor());
+            it->_idle_timer->expires_after(*idle->timeout);
+            it->_idle_timer->async_wait([
+                weak_idle = std::weak_ptr<Idle>(idle), it, in_pool = it->_in_pool
+            ] (const sys::error_code&) {
+                auto idle = weak_idle.lock();
+                if (!idle || !*in_pool) return;
+                ++idle->expired;
+                erase(*idle, it);
+            });
+        }
+
         /*
          * Callback may be called during make_idle().
          * This is important, for the connection might be disqualified immediately.
          */
-        it->make_idle([&connections, it] {
-            it->close();
-            connections.erase(it);
+        it->make_idle([&idle = *idle, it] {
+            erase(idle, it);
         });
+
+        while (connections.size() > idle->max_size) {
+            ++idle->evicted;
+            erase(*idle, connections.begin());
+        }
+
+        if (idle->shared) idle->shared->enforce_max_size();
     }
 
     private:
-    std::shared_ptr<Connections> _connections;
+    std::shared_ptr<Idle> _idle;
 };
 
 } // namespace
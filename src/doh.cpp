@@ -220,6 +220,80 @@ parse_response( const Response& rs
     return answers;
 }
 
+// Skip a possibly compressed domain name (RFC1035#4.1.4) at `pos`.
+// Return false if the message is truncated.
+static
+bool skip_dns_name(const std::string& msg, size_t& pos)
+{
+    while (pos < msg.size()) {
+        uint8_t llen = msg[pos];
+        if ((llen & 0xc0) == 0xc0) {  // pointer, ends the name
+            pos += 2;
+            return pos <= msg.size();
+        }
+        pos += 1 + llen;
+        if (llen == 0) return true;  // root label
+    }
+    return false;
+}
+
+static
+uint32_t read_uint(const std::string& msg, size_t pos, size_t len)
+{
+    uint32_t v = 0;
+    for (size_t i = 0; i < len; ++i)
+        v = (v << 8) | uint8_t(msg[pos + i]);
+    return v;
+}
+
+// Get the lowest TTL of records in the answer section
+// of the given DNS message (RFC1035#4.1),
+// or none if there are no answers or the message is malformed.
+static
+boost::optional<uint32_t> min_answer_ttl(const std::string& msg)
+{
+    static const size_t header_size = 12;
+    if (msg.size() < header_size) return boost::none;
+
+    auto qdcount = read_uint(msg, 4, 2);
+    auto ancount = read_uint(msg, 6, 2);
+
+    size_t pos = header_size;
+    for (uint32_t i = 0; i < qdcount; ++i) {
+        if (!skip_dns_name(msg, pos)) return boost::none;
+        pos += 4;  // type and class
+    }
+
+    boost::optional<uint32_t> min_ttl;
+    for (uint32_t i = 0; i < ancount; ++i) {
+        if (!skip_dns_name(msg, pos)) return boost::none;
+        // type (2), class (2), TTL (4), data length (2)
+        if (pos + 10 > msg.size()) return boost::none;
+        auto ttl = read_uint(msg, pos + 4, 4);
+        auto rdlength = read_uint(msg, pos + 8, 2);
+        pos += 10 + rdlength;
+        if (pos > msg.size()) return boost::none;
+        if (!min_ttl || ttl < *min_ttl) min_ttl = ttl;
+    }
+
+    return min_ttl;
+}
+
+Answers
+parse_response( const Response& rs
+              , const std::string& host
+              , uint32_t& ttl
+              , sys::error_code& ec)
+{
+    auto answers = parse_response(rs, host, ec);
+    if (ec || answers.empty()) return answers;
+
+    // The answers are still good even if TTLs cannot be found,
+    // just leave them to the default TTL of the caller.
+    if (auto ttl_o = min_answer_ttl(rs.body())) ttl = *ttl_o;
+    return answers;
+}
+
 boost::optional<Request>
 build_request_ipv4( const std::string& name
                   , const Endpoint& ep)
@@ -56,4 +56,13 @@ Answers parse_response( const Response&
                       , const std::string& host
                       , sys::error_code&);
 
+// Same as above, also setting `ttl` to the lowest time to live (in seconds)
+// of the records in the answer section of the response.
+// `ttl` is left untouched if there are no answers
+// or their TTLs cannot be parsed.
+Answers parse_response( const Response&
+                      , const std::string& host
+                      , uint32_t& ttl
+                      , sys::error_code&);
+
 }} // ouinet::doh namespace
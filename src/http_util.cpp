@@ -1,5 +1,7 @@
 #include "http_util.h"
 
+#include <limits>
+
 #include <boost/asio/error.hpp>
 #include <boost/regex.hpp>
 #include <network/uri.hpp>
@@ -119,7 +121,10 @@ ouinet::util::HttpRequestByteRange::parse(boost::string_view s)
         trim_ws(s);
         if (!consume(s, "-")) return boost::none;
         trim_ws(s);
-        auto last = parse::number<size_t>(s);
+        // Open range "N-" (RFC7233#2.1), only the first byte is known.
+        auto last = ( (s.empty() || s[0] == ',')
+                    ? std::numeric_limits<size_t>::max()
+                    : parse::number<size_t>(s));
         if (!last) return boost::none;
         ranges.push_back({*first, *last});
         trim_ws(s);
@@ -53,6 +53,7 @@ operator<<(std::ostream&, const HttpResponseByteRange&);
 
 struct HttpRequestByteRange {
     size_t first;
+    // The maximum `size_t` value for open ranges ("N-").
     size_t last;
 
     // Returns boost::none on parse error
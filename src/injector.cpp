@@ -26,11 +26,13 @@
 #include "async_sleep.h"
 #include "increase_open_file_limit.h"
 #include "full_duplex_forward.h"
+#include "injector_api.h"
 #include "injector_config.h"
 #include "authenticate.h"
 #include "force_exit_on_signal.h"
 #include "http_util.h"
 #include "origin_pools.h"
+#include "resolver_cache.h"
 #include "session.h"
 
 #include "ouiservice.h"
@@ -52,6 +54,9 @@
 #include "util/bytes.h"
 #include "util/file_io.h"
 #include "util/file_posix_with_offset.h"
+#include "util/handler_tracker.h"
+#include "util/metrics.h"
+#include "util/spawn.h"
 #include "util/yield.h"
 
 #include "logger.h"
@@ -134,6 +139,7 @@ void handle_no_proxy( GenericStream& con
 static
 TcpLookup
 resolve_target( const Request& req
+              , ResolverCache& resolver_cache
               , asio::executor exec
               , Cancel& cancel
               , Yield yield)
@@ -149,10 +155,10 @@ resolve_target( const Request& req
 
     // Resolve address and also use result for more sophisticaded checking.
     if (!local)
-        lookup = util::tcp_async_resolve( host, port
-                                        , exec
-                                        , cancel
-                                        , static_cast<asio::yield_context>(yield[ec]));
+        lookup = resolver_cache.resolve( "system", host, port
+                                       , ResolverCache::system_query(exec)
+                                       , cancel
+                                       , static_cast<asio::yield_context>(yield[ec]));
 
     if (ec) return or_throw<TcpLookup>(yield, ec);
 
@@ -181,6 +187,7 @@ static
 void handle_connect_request( GenericStream client_c
                            , beast::flat_buffer client_c_rbuf
                            , const Request& req
+                           , ResolverCache& resolver_cache
                            , Cancel& cancel
                            , Yield yield)
 {
@@ -192,7 +199,7 @@ void handle_connect_request( GenericStream client_c
         client_c.close();
     });
 
-    TcpLookup lookup = resolve_target(req, exec, cancel, yield[ec].tag("resolve"));
+    TcpLookup lookup = resolve_target(req, resolver_cache, exec, cancel, yield[ec].tag("resolve"));
 
     if (ec) {
         sys::error_code he_ec;
@@ -299,7 +306,7 @@ class InjectorCacheControl {
         sys::error_code ec;
 
         // Resolve target endpoint and check its validity.
-        TcpLookup lookup = resolve_target(rq, executor, cancel, yield[ec]);
+        TcpLookup lookup = resolve_target(rq, resolver_cache, executor, cancel, yield[ec]);
 
         if (ec) return or_throw<GenericStream>(yield, ec);
 
@@ -329,6 +336,7 @@ public:
     InjectorCacheControl( asio::executor executor
                         , asio::ssl::context& ssl_ctx
                         , OriginPools& origin_pools
+                        , ResolverCache& resolver_cache
                         , const InjectorConfig& config
                         , uuid_generator& genuuid)
         : executor(move(executor))
@@ -336,6 +344,7 @@ public:
         , config(config)
         , genuuid(genuuid)
         , origin_pools(origin_pools)
+        , resolver_cache(resolver_cache)
     {
     }
 
@@ -489,37 +498,16 @@ private:
     const InjectorConfig& config;
     uuid_generator& genuuid;
     OriginPools& origin_pools;
+    ResolverCache& resolver_cache;
 };
 
 //------------------------------------------------------------------------------
-bool is_request_to_this(const Request& rq) {
-    if (rq.method() == http::verb::connect) return false;
-    // TODO: Check this one
-    if (rq.method() == http::verb::options) return true;
-    // Check that the request is *not* in 'origin-form'
-    // https://tools.ietf.org/html/rfc7230#section-5.3
-    return rq.target().starts_with('/');
-}
-
-//------------------------------------------------------------------------------
-void handle_request_to_this(Request& rq, GenericStream& con, Yield yield)
+static
+void count_request(const char* mode, const sys::error_code& ec)
 {
-    if (rq.target() == "/api/ok") {
-        http::response<http::empty_body> rs{http::status::ok, rq.version()};
-
-        rs.set(http::field::server, OUINET_INJECTOR_SERVER_STRING);
-        rs.set(http::field::content_type, "text/plain");
-        rs.keep_alive(rq.keep_alive());
-        rs.prepare_payload();
-
-        yield.tag("write_res").run([&] (auto y) {
-            util::http_reply(con, rs, y);
-        });
-        return;
-    }
-
-    handle_error( con, rq, http::status::not_found, "Unknown injector request"
-                , yield.tag("handle_req_error"));
+    metrics::registry().counter
+        ( "ouinet_injector_requests_total", "Requests served by the injector"
+        , {{"mode", mode}, {"result", ec ? "error" : "ok"}}).inc();
 }
 
 //------------------------------------------------------------------------------
@@ -529,6 +517,7 @@ void serve( InjectorConfig& config
           , GenericStream con
           , asio::ssl::context& ssl_ctx
           , OriginPools& origin_pools
+          , ResolverCache& resolver_cache
           , uuid_generator& genuuid
           , Cancel& cancel
           , asio::yield_context yield_)
@@ -540,6 +529,7 @@ void serve( InjectorConfig& config
     InjectorCacheControl cc( con.get_executor()
                            , ssl_ctx
                            , origin_pools
+                           , resolver_cache
                            , config
                            , genuuid);
 
@@ -581,8 +571,9 @@ void serve( InjectorConfig& config
 
         bool req_keep_alive = req.keep_alive();
 
-        if (is_request_to_this(req)) {
-            handle_request_to_this(req, con, yield[ec].tag("this"));
+        if (injector_api::is_request_to_this(req)) {
+            injector_api::handle_request_to_this( req, con, config.credentials()
+                                                , yield[ec].tag("this"));
             if (ec || !req_keep_alive) break;
             continue;
         }
@@ -603,10 +594,12 @@ void serve( InjectorConfig& config
                 if (ec || !req_keep_alive) break;
                 continue;
             }
-            return handle_connect_request( move(con), move(con_rbuf)
-                                         , req
-                                         , cancel  // do not propagate error
-                                         , yield[ec].tag("proxy/connect/handle_connect"));
+            handle_connect_request( move(con), move(con_rbuf)
+                                  , req
+                                  , resolver_cache
+                                  , cancel  // do not propagate error
+                                  , yield[ec].tag("proxy/connect/handle_connect"));
+            return count_request("connect", ec);
         }
 
         auto version_hdr_i = req.find(http_::protocol_version_hdr);
@@ -644,6 +637,11 @@ void serve( InjectorConfig& config
             size_t fwd_bytes = 0;
             auto log_result = defer([&] {
                 pyield.log("END; ec=", ec, " fwd_bytes=", fwd_bytes);
+                count_request("proxy", ec);
+                metrics::registry().counter
+                    ( "ouinet_injector_served_bytes_total"
+                    , "Response body bytes sent to clients", {{"mode", "proxy"}})
+                    .inc(fwd_bytes);
             });
 
             auto orig_con = cc.get_connection(req, cancel, pyield[ec].tag("get_connection"));
@@ -720,9 +718,11 @@ void serve( InjectorConfig& config
                             , http_::response_error_hdr_target_not_allowed
                             , "Target not allowed"
                             , yield[ec].tag("inject/handle_restricted"));
-            else
+            else {
                 cc.fetch( con, move(req)
                         , cancel, yield[ec].tag("inject/fetch"));
+                count_request("inject", ec);
+            }
         }
 
         if (ec || !req_keep_alive) break;
@@ -756,12 +756,24 @@ void listen( InjectorConfig& config
     uint64_t next_connection_id = 0;
 
     OriginPools origin_pools;
+    ResolverCache resolver_cache(exec);
+
+    auto stop_resolver_slot = cancel.connect([&resolver_cache] {
+        resolver_cache.stop();
+    });
 
     asio::ssl::context ssl_ctx{asio::ssl::context::tls_client};
     ssl_ctx.set_default_verify_paths();
     ssl_ctx.set_verify_mode(asio::ssl::verify_peer);
 
     ssl::util::load_tls_ca_certificates(ssl_ctx, config.tls_ca_cert_store_path());
+    ssl::util::SessionCache::enable(ssl_ctx);
+
+    auto exported_metrics = origin_pools.export_metrics();
+    for (auto& g : resolver_cache.export_metrics())
+        exported_metrics.push_back(move(g));
+    for (auto& g : ssl::util::SessionCache::get(ssl_ctx)->export_metrics("origin"))
+        exported_metrics.push_back(move(g));
 
     while (true) {
         GenericStream connection = proxy_server.accept(yield[ec]);
@@ -777,19 +789,17 @@ void listen( InjectorConfig& config
 
         uint64_t connection_id = next_connection_id++;
 
-        // Increase the size of the coroutine stack (we do same in client).
+        // Use a larger coroutine stack (we do same in client).
         // Some interesing info:
         // https://lists.ceph.io/hyperkitty/list/dev@ceph.io/thread/6LBFZIFUPTJQ3SNTLVKSQMVITJWVWTZ6/
-        boost::coroutines::attributes attribs;
-        attribs.size *= 2;
-
-        asio::spawn(exec, [
+        util::spawn(exec, [
             connection = std::move(connection),
             &ssl_ctx,
             &cancel,
             &config,
             &genuuid,
             &origin_pools,
+            &resolver_cache,
             connection_id,
             lock = shutdown_connections.lock()
         ] (boost::asio::yield_context yield) mutable {
@@ -799,6 +809,7 @@ void listen( InjectorConfig& config
                  , std::move(connection)
                  , ssl_ctx
                  , origin_pools
+                 , resolver_cache
                  , genuuid
                  , cancel
                  , yield[leaked_ec]);
@@ -808,7 +819,7 @@ void listen( InjectorConfig& config
                 LOG_ERROR("Connection serve leaked an error; ec=", leaked_ec);
                 assert(0);
             }
-        }, attribs);
+        }, util::StackSize::large);
     }
 }
 
@@ -982,7 +993,7 @@ int main(int argc, const char* argv[])
 
         unique_ptr<ouiservice::Obfs4OuiServiceServer> server =
             make_unique<ouiservice::Obfs4OuiServiceServer>(ioc, endpoint, config.repo_root()/"obfs4-server");
-        asio::spawn(ex, [
+        util::spawn(ex, [
             obfs4 = server.get(),
             endpoint
         ] (asio::yield_context yield) {
@@ -1010,7 +1021,7 @@ int main(int argc, const char* argv[])
 
     Cancel cancel;
 
-    asio::spawn(ex, [
+    util::spawn(ex, [
         &ex,
         &proxy_server,
         &config,
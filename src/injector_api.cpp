@@ -0,0 +1,82 @@
+#include <sstream>
+
+#include "injector_api.h"
+#include "authenticate.h"
+#include "constants.h"
+#include "http_util.h"
+#include "or_throw.h"
+#include "util/handler_tracker.h"
+#include "util/metrics.h"
+
+namespace ouinet { namespace injector_api {
+
+bool is_request_to_this(const Request& rq) {
+    if (rq.method() == http::verb::connect) return false;
+    // TODO: Check this one
+    if (rq.method() == http::verb::options) return true;
+    // Check that the request is *not* in 'origin-form'
+    // https://tools.ietf.org/html/rfc7230#section-5.3
+    return rq.target().starts_with('/');
+}
+
+template<class Res>
+static
+void reply(GenericStream& con, Res& rs, Yield yield)
+{
+    rs.set(http::field::server, OUINET_INJECTOR_SERVER_STRING);
+    rs.prepare_payload();
+
+    yield.tag("write_res").run([&] (auto y) {
+        util::http_reply(con, rs, y);
+    });
+}
+
+void handle_request_to_this( Request& rq
+                           , GenericStream& con
+                           , beast::string_view credentials
+                           , Yield yield)
+{
+    if (rq.target() == "/api/ok") {
+        http::response<http::empty_body> rs{http::status::ok, rq.version()};
+        rs.set(http::field::content_type, "text/plain");
+        rs.keep_alive(rq.keep_alive());
+        return reply(con, rs, yield);
+    }
+
+    if (rq.target() == "/metrics" || rq.target() == "/handlers.txt") {
+        sys::error_code ec;
+        bool auth = yield[ec].tag("auth").run([&] (auto y) {
+            return authenticate(rq, con, credentials, y);
+        });
+        if (!auth) {
+            yield.log("Proxy authentication failed");
+            return or_throw(yield, ec);
+        }
+
+        http::response<http::string_body> rs{http::status::ok, rq.version()};
+
+        std::ostringstream ss;
+        if (rq.target() == "/metrics") {
+            metrics::registry().write(ss);
+            rs.set(http::field::content_type, "text/plain; version=0.0.4");
+        } else {
+            HandlerTracker::write_census(ss);
+            rs.set(http::field::content_type, "text/plain");
+        }
+
+        rs.keep_alive(rq.keep_alive());
+        rs.body() = ss.str();
+        return reply(con, rs, yield);
+    }
+
+    auto rs = util::http_error( rq, http::status::not_found
+                              , OUINET_INJECTOR_SERVER_STRING, ""
+                              , "Unknown injector request");
+    yield.log("=== Sending back response ===");
+    yield.log(rs);
+    yield.tag("handle_req_error").run([&] (auto y) {
+        util::http_reply(con, rs, y);
+    });
+}
+
+}} // namespaces
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <boost/beast/http.hpp>
+
+#include "generic_stream.h"
+#include "namespaces.h"
+#include "util/yield.h"
+
+namespace ouinet { namespace injector_api {
+
+using Request = http::request<http::string_body>;
+
+// Whether the request is addressed to the injector itself
+// instead of being one to be proxied or injected.
+bool is_request_to_this(const Request&);
+
+// Answer a request addressed to the injector itself.
+//
+// `/api/ok` is served to anybody,
+// but diagnostics (`/metrics`, `/handlers.txt`) reveal internal state and load,
+// so they are only served to requests with the injector `credentials`
+// (a `407 Proxy Authentication Required` response is sent otherwise).
+void handle_request_to_this( Request&
+                           , GenericStream&
+                           , beast::string_view credentials
+                           , Yield);
+
+}} // namespaces
@@ -137,6 +137,9 @@ InjectorConfig::options_description()
         ("repo", po::value<string>(), "Path to the repository root")
         ("log-level", po::value<string>()->default_value(util::str(default_log_level()))
          , "Set log level: silly, debug, verbose, info, warn, error, abort")
+        ("log-async", po::bool_switch()->default_value(false)
+         , "Write log messages from a separate thread "
+           "(messages may be dropped if too many are pending)")
         ("bt-bootstrap-extra", po::value<std::vector<string>>()->composing()
          , "Extra BitTorrent bootstrap server (in <HOST> or <HOST>:<PORT> format) "
            "to start the DHT (can be used several times). "
@@ -237,6 +240,10 @@ InjectorConfig::InjectorConfig(int argc, const char**argv)
         LOG_INFO("Log level set to: ", level);
     }
 
+    if (vm["log-async"].as<bool>()) {
+        logger.enable_async();
+    }
+
     if (vm.count("bt-bootstrap-extra")) {
         for (const auto& btbsx : vm["bt-bootstrap-extra"].as<std::vector<string>>()) {
             // Better processing will take place later on, just very basic checking here.
@@ -22,11 +22,17 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip> // std::setprecision
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+#include <vector>
 
 #include <boost/system/error_code.hpp>
 #include <boost/filesystem.hpp>
 #include "namespaces.h"
 #include "logger.h"
+#include "util/mpmc_ring.h"
 
 static const long LOG_FILE_MAX_SIZE = 15 * 1024 * 1024;
 
@@ -92,10 +98,17 @@ Logger::Logger(log_level_t threshold)
     log_ts_base = {0, 0};
 }
 
+Logger::~Logger()
+{
+    disable_async();
+}
+
 void Logger::log_to_file(std::string fname)
 {
     using std::ios;
 
+    std::lock_guard<std::mutex> lock(_output_mutex);
+
     if (fname.empty()) {
         if (!log_filename.empty()) {
             ouinet::sys::error_code ignored_ec;
@@ -133,6 +146,21 @@ std::fstream* Logger::get_log_file() {
     return &*log_file;
 }
 
+void Logger::copy_log_file(std::ostream& os) {
+    std::lock_guard<std::mutex> lock(_output_mutex);
+
+    if (!log_file) return;
+
+    auto pos = log_file->tellp();
+    log_file->flush();
+    log_file->seekg(0);
+    std::copy( std::istreambuf_iterator<char>(*log_file)
+             , std::istreambuf_iterator<char>()
+             , std::ostreambuf_iterator<char>(os));
+    log_file->clear();
+    log_file->seekp(pos);
+}
+
 // Update the logger's threshold.
 // If an invalid level is provided, do not update.
 void Logger::set_threshold(log_level_t level)
@@ -201,13 +229,123 @@ namespace {
     };
 }
 
-// Standard log function. Prints nice colors for each level.
-void Logger::log(log_level_t level, const std::string& msg, boost::string_view function_name)
-{
-    if (level < SILLY || level > ABORT || level < threshold) {
-        return;
+struct Logger::Record {
+    log_level_t level;
+    boost::optional<double> ts;
+    std::string msg;
+    std::string fun;
+};
+
+// Pops records from the queue and writes them in batches
+// from a separate thread.
+class Logger::AsyncWriter {
+public:
+    AsyncWriter(Logger& logger, size_t capacity)
+        : _logger(logger)
+        , _queue(capacity)
+        , _thread([this] { run(); })
+    {}
+
+    ~AsyncWriter() {
+        _stopping = true;
+        wake_up();
+        _thread.join();
+    }
+
+    void push(Record&& r) {
+        if (!_queue.try_push(std::move(r)))
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+
+        // Pair with the check in `run` so that the pushed record
+        // is either seen there or the writer is woken up.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_waiting.load()) wake_up();
+    }
+
+    uint64_t dropped() const {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    void wake_up() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _wake_up.notify_one();
+    }
+
+    void run() {
+        static const size_t max_batch = 256;
+
+        std::vector<Record> batch(max_batch);
+        uint64_t reported_dropped = 0;
+
+        while (true) {
+            // Check before popping so that nothing is left behind on stop.
+            bool stopping = _stopping;
+
+            size_t n = 0;
+            for (; n < max_batch; ++n) {
+                auto r = _queue.try_pop();
+                if (!r) break;
+                batch[n] = std::move(*r);
+            }
+
+            auto dropped = this->dropped();
+            if (dropped != reported_dropped && n < max_batch) {
+                batch[n++] = Record{ WARN, log_get_timestamp()
+                                   , ouinet::util::str( "Dropped ", dropped - reported_dropped
+                                                      , " log messages")
+                                   , "" };
+                reported_dropped = dropped;
+            }
+
+            if (n > 0) {
+                _logger.write(batch.data(), n);
+                continue;
+            }
+
+            if (stopping) break;
+
+            // Only loggers seeing this wake the writer up,
+            // so that they need not lock the mutex otherwise.
+            std::unique_lock<std::mutex> lock(_mutex);
+            _waiting = true;
+            _wake_up.wait(lock, [&] {
+                return _stopping || _queue.can_pop() || this->dropped() != reported_dropped;
+            });
+            _waiting = false;
+        }
     }
 
+private:
+    Logger& _logger;
+    ouinet::util::MpmcRing<Record> _queue;
+    std::atomic<bool> _stopping{false};
+    std::atomic<uint64_t> _dropped{0};
+    std::atomic<bool> _waiting{false};
+    std::mutex _mutex;
+    std::condition_variable _wake_up;
+    std::thread _thread;
+};
+
+void Logger::enable_async(size_t capacity)
+{
+    if (_async) return;
+    _async = std::make_unique<AsyncWriter>(*this, capacity);
+}
+
+void Logger::disable_async()
+{
+    _async = nullptr;  // writes pending messages
+}
+
+uint64_t Logger::dropped_count() const
+{
+    return _async ? _async->dropped() : 0;
+}
+
+template<class Print>
+void Logger::write(const Print& print)
+{
 #ifdef __ANDROID__
     const bool android = true;
 #else
@@ -216,19 +354,19 @@ void Logger::log(log_level_t level, const std::string& msg, boost::string_view f
 
     bool with_color = !android;
 
-    boost::optional<double> ts;
-
-    if (_stamp_with_time || log_file) ts = log_get_timestamp();
+    std::lock_guard<std::mutex> lock(_output_mutex);
 
+    // Write each output in a single operation.
     if (log_to_stderr) {
-        if (_stamp_with_time)
-            std::cerr << Printer(level, with_color, ts, msg, function_name) << "\n";
-        else
-            std::cerr << Printer(level, with_color, boost::none, msg, function_name) << "\n";
+        std::ostringstream ss;
+        print(ss, with_color, _stamp_with_time);
+        std::cerr << ss.str();
     }
 
     if (log_file && log_file->is_open()) {
-        *log_file << Printer(level, false, ts, msg, function_name) << "\n";
+        std::ostringstream ss;
+        print(ss, false, true);
+        *log_file << ss.str();
 
         if (log_file->tellp() > LOG_FILE_MAX_SIZE) {
             log_file->seekp(0);
@@ -236,41 +374,75 @@ void Logger::log(log_level_t level, const std::string& msg, boost::string_view f
     }
 }
 
+void Logger::write(const Record* records, size_t count)
+{
+    write([&] (std::ostream& os, bool with_color, bool with_ts) {
+        for (size_t i = 0; i < count; ++i) {
+            auto& r = records[i];
+            os << Printer( r.level, with_color, with_ts ? r.ts : boost::none
+                         , r.msg, r.fun) << "\n";
+        }
+    });
+}
+
+// Standard log function. Prints nice colors for each level.
+void Logger::log(log_level_t level, std::string msg, boost::string_view function_name)
+{
+    if (level < SILLY || level > ABORT || level < threshold) {
+        return;
+    }
+
+    boost::optional<double> ts;
+    if (_stamp_with_time || log_file || _async) ts = log_get_timestamp();
+
+    if (_async) {
+        // The function name is only copied when the record outlives this call.
+        _async->push(Record{level, ts, std::move(msg), function_name.to_string()});
+        return;
+    }
+
+    write([&] (std::ostream& os, bool with_color, bool with_ts) {
+        os << Printer( level, with_color, with_ts ? ts : boost::none
+                     , msg, function_name) << "\n";
+    });
+}
+
 // Convenience methods
 
-void Logger::silly(const std::string& msg, boost::string_view function_name)
+void Logger::silly(std::string msg, boost::string_view function_name)
 {
-    log(SILLY, msg, function_name);
+    log(SILLY, std::move(msg), function_name);
 }
 
-void Logger::debug(const std::string& msg, boost::string_view function_name)
+void Logger::debug(std::string msg, boost::string_view function_name)
 {
-    log(DEBUG, msg, function_name);
+    log(DEBUG, std::move(msg), function_name);
 }
 
-void Logger::verbose(const std::string& msg, boost::string_view function_name)
+void Logger::verbose(std::string msg, boost::string_view function_name)
 {
-    log(VERBOSE, msg, function_name);
+    log(VERBOSE, std::move(msg), function_name);
 }
 
-void Logger::info(const std::string& msg, boost::string_view function_name)
+void Logger::info(std::string msg, boost::string_view function_name)
 {
-    log(INFO, msg, function_name);
+    log(INFO, std::move(msg), function_name);
 }
 
-void Logger::warn(const std::string& msg, boost::string_view function_name)
+void Logger::warn(std::string msg, boost::string_view function_name)
 {
-    log(WARN, msg, function_name);
+    log(WARN, std::move(msg), function_name);
 }
 
-void Logger::error(const std::string& msg, boost::string_view function_name)
+void Logger::error(std::string msg, boost::string_view function_name)
 {
-    log(ERROR, msg, function_name);
+    log(ERROR, std::move(msg), function_name);
 }
 
-void Logger::abort(const std::string& msg, boost::string_view function_name)
+void Logger::abort(std::string msg, boost::string_view function_name)
 {
-    log(ABORT, msg, function_name);
+    log(ABORT, std::move(msg), function_name);
+    disable_async();
     exit(1);
 }
 
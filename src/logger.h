@@ -15,8 +15,12 @@
 #ifndef SRC_LOGGER_H_
 #define SRC_LOGGER_H_
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <mutex>
 
 #include "namespaces.h"
 #include "util/str.h"
@@ -72,6 +76,12 @@ class Logger
     std::string log_filename;
     boost::optional<std::fstream> log_file;
 
+    // Protects output to stderr and `log_file`.
+    std::mutex _output_mutex;
+
+    class AsyncWriter;
+    std::unique_ptr<AsyncWriter> _async;
+
   public:
     std::string state_to_text[0xFF]; // TOTAL_NO_OF_STATES
     std::string message_type_to_text[0xFF]; // TOTAL_NO_OF_MESSAGE_TYPE];
@@ -80,10 +90,27 @@ class Logger
 
     // Constructor sets an initial threshold
     Logger(log_level_t threshold);
+    ~Logger();
+
+    static const size_t default_async_capacity = 8192;
+
+    // Write messages from a separate thread instead of the logging one.
+    // Messages are kept in a bounded buffer of the given capacity
+    // until written, and they are dropped if it is full.
+    // Not to be called while other threads are logging.
+    void enable_async(size_t capacity = default_async_capacity);
+    // Write pending messages and go back to writing them synchronously.
+    // Not to be called while other threads are logging.
+    void disable_async();
+    bool is_async() const { return bool(_async); }
+    // Number of messages dropped in asynchronous mode.
+    uint64_t dropped_count() const;
 
     // Get the current log file name
     std::string current_log_file() { return log_filename; }
     std::fstream* get_log_file();
+    // Copy the current content of the log file (if any) to the given stream.
+    void copy_log_file(std::ostream&);
 
     // Get the current threshold
     log_level_t get_threshold() const { return threshold;}
@@ -94,17 +121,24 @@ class Logger
 
     void set_threshold(log_level_t level);
 
-    void log(log_level_t level, const std::string& msg, boost::string_view function_name = "");
+    void log(log_level_t level, std::string msg, boost::string_view function_name = "");
 
-    void silly  (const std::string& msg, boost::string_view function_name = "");
-    void debug  (const std::string& msg, boost::string_view function_name = "");
-    void verbose(const std::string& msg, boost::string_view function_name = "");
-    void info   (const std::string& msg, boost::string_view function_name = "");
-    void warn   (const std::string& msg, boost::string_view function_name = "");
-    void error  (const std::string& msg, boost::string_view function_name = "");
-    void abort  (const std::string& msg, boost::string_view function_name = "");
+    void silly  (std::string msg, boost::string_view function_name = "");
+    void debug  (std::string msg, boost::string_view function_name = "");
+    void verbose(std::string msg, boost::string_view function_name = "");
+    void info   (std::string msg, boost::string_view function_name = "");
+    void warn   (std::string msg, boost::string_view function_name = "");
+    void error  (std::string msg, boost::string_view function_name = "");
+    void abort  (std::string msg, boost::string_view function_name = "");
 
     void assert_or_die(bool expr, std::string failure_message, std::string function_name = "");
+
+  private:
+    struct Record;
+    // Write to stderr and the log file (if enabled) what
+    // `print(std::ostream&, bool with_color, bool with_timestamp)` prints.
+    template<class Print> void write(const Print& print);
+    void write(const Record*, size_t count);
 };
 
 extern Logger logger;
@@ -1,15 +1,24 @@
 #pragma once
 
 #include "connection_pool.h"
+#include "util/metrics.h"
 #include <boost/optional.hpp>
 
 namespace ouinet {
 
+// Idle connections to origins, grouped by host.
+//
+// The number of idle connections is limited both per host and overall.
+// When exceeded, the connections which have been idle for longer are closed.
+// Idle connections are also closed after some time.
 class OriginPools {
 private:
-    using RequestHdr = beast::http::header<true>; 
+    using RequestHdr = beast::http::header<true>;
+    using Pool = ConnectionPool<bool>;
 
 public:
+    using Clock = Pool::Clock;
+
     struct PoolId {
         bool is_ssl;
         std::string host;
@@ -19,20 +28,64 @@ public:
         }
     };
 
-    using Connection = ConnectionPool<bool>::Connection;
+    using Connection = Pool::Connection;
+
+    struct Stats {
+        size_t hits = 0;  // idle connection reused
+        size_t misses = 0;  // no idle connection available
+        size_t evicted = 0;  // closed because of limits
+        size_t expired = 0;  // closed because of idle timeout
+        size_t idle = 0;  // currently idle connections
+        size_t pools = 0;  // current pools (i.e. hosts)
+    };
+
+    static const size_t default_max_idle = 256;
+    static const size_t default_max_idle_per_host = 8;
+    static Clock::duration default_idle_timeout() { return std::chrono::seconds(60); }
 
 public:
+    OriginPools( size_t max_idle = default_max_idle
+               , size_t max_idle_per_host = default_max_idle_per_host
+               , Clock::duration idle_timeout = default_idle_timeout())
+        : _max_idle(max_idle)
+        , _max_idle_per_host(max_idle_per_host)
+        , _idle_timeout(idle_timeout)
+        , _idle(std::make_shared<Pool::SharedIdle>(max_idle))
+    {}
+
     Connection wrap(const RequestHdr&, GenericStream);
 
     boost::optional<Connection> get_connection(const RequestHdr& rq);
 
     void insert_connection(const RequestHdr& rq, Connection);
 
+    Stats stats() const;
+
+    // Export statistics as metrics for as long as the result is kept.
+    metrics::CallbackGauges export_metrics() const;
+
 private:
     boost::optional<PoolId> make_pool_id(const RequestHdr& hdr);
 
+    Pool& get_pool(const PoolId&);
+
+    // Forget empty pools if there are too many of them.
+    void forget_empty_pools();
+
+    void forget_pool(std::map<PoolId, Pool>::iterator);
+
 private:
-    std::map<PoolId, ConnectionPool<bool>> _pools;
+    size_t _max_idle;
+    size_t _max_idle_per_host;
+    Clock::duration _idle_timeout;
+
+    // Idle connections in all pools, for the overall limit.
+    std::shared_ptr<Pool::SharedIdle> _idle;
+
+    std::map<PoolId, Pool> _pools;
+
+    // Counters of pools already forgotten, plus hits and misses.
+    Stats _stats;
 };
 
 inline
@@ -47,20 +100,16 @@ OriginPools::get_connection(const RequestHdr& rq)
 
     auto pool_i = _pools.find(*opt_pool_id);
 
-    if (pool_i == _pools.end()) return boost::none;
-
-    if (pool_i->second.empty()) {
-        _pools.erase(pool_i);
+    if (pool_i == _pools.end() || pool_i->second.empty()) {
+        ++_stats.misses;
         return boost::none;
     }
 
-    auto ret = pool_i->second.pop_front();
-
-    if (pool_i->second.empty()) {
-        _pools.erase(pool_i);
-    }
+    ++_stats.hits;
 
-    return ret;
+    // Keep the pool even if empty,
+    // so that the connection can go back to it when done.
+    return pool_i->second.pop_front();
 }
 
 inline
@@ -72,7 +121,7 @@ OriginPools::wrap(const RequestHdr& rq, GenericStream connection)
     assert(opt_pool_id);
     if (!opt_pool_id) return Connection();
 
-    return _pools[*opt_pool_id].wrap(std::move(connection));
+    return get_pool(*opt_pool_id).wrap(std::move(connection));
 }
 
 inline
@@ -85,7 +134,90 @@ OriginPools::insert_connection(const RequestHdr& rq, Connection con)
 
     if (!opt_pool_id) return;
 
-    _pools[*opt_pool_id].push_back(std::move(con));
+    get_pool(*opt_pool_id).push_back(std::move(con));
+}
+
+inline
+OriginPools::Stats
+OriginPools::stats() const
+{
+    Stats s = _stats;
+    for (auto& p : _pools) {
+        s.evicted += p.second.evicted_count();
+        s.expired += p.second.expired_count();
+    }
+    s.idle = _idle->size();
+    s.pools = _pools.size();
+    return s;
+}
+
+inline
+metrics::CallbackGauges
+OriginPools::export_metrics() const
+{
+    auto& r = metrics::registry();
+    metrics::CallbackGauges gs;
+    gs.push_back(r.callback_counter( "ouinet_origin_pool_hits_total"
+                                   , "Requests which reused an idle origin connection", {}
+                                   , [this] { return stats().hits; }));
+    gs.push_back(r.callback_counter( "ouinet_origin_pool_misses_total"
+                                   , "Requests which found no idle origin connection", {}
+                                   , [this] { return stats().misses; }));
+    gs.push_back(r.callback_counter( "ouinet_origin_pool_closed_total"
+                                   , "Idle origin connections closed", {{"reason", "evicted"}}
+                                   , [this] { return stats().evicted; }));
+    gs.push_back(r.callback_counter( "ouinet_origin_pool_closed_total"
+                                   , "Idle origin connections closed", {{"reason", "expired"}}
+                                   , [this] { return stats().expired; }));
+    gs.push_back(r.callback_gauge( "ouinet_origin_pool_idle_connections"
+                                 , "Idle origin connections", {}
+                                 , [this] { return stats().idle; }));
+    gs.push_back(r.callback_gauge( "ouinet_origin_pool_hosts"
+                                 , "Hosts with origin connection pools", {}
+                                 , [this] { return stats().pools; }));
+    return gs;
+}
+
+inline
+OriginPools::Pool&
+OriginPools::get_pool(const PoolId& pool_id)
+{
+    auto pool_i = _pools.find(pool_id);
+    if (pool_i != _pools.end()) return pool_i->second;
+
+    forget_empty_pools();
+
+    auto& pool = _pools[pool_id];
+    pool.max_size(_max_idle_per_host);
+    pool.idle_timeout(_idle_timeout);
+    pool.shared_idle(_idle);
+    return pool;
+}
+
+inline
+void
+OriginPools::forget_pool(std::map<PoolId, Pool>::iterator pool_i)
+{
+    _stats.evicted += pool_i->second.evicted_count();
+    _stats.expired += pool_i->second.expired_count();
+    _pools.erase(pool_i);
+}
+
+inline
+void
+OriginPools::forget_empty_pools()
+{
+    // Empty pools are kept so that connections in use can go back to them,
+    // but do not let them pile up.
+    // Non-empty pools are no more than idle connections,
+    // so after a sweep many new pools are needed to trigger the next one.
+    if (_pools.size() < 2 * _max_idle + 1) return;
+
+    for (auto i = _pools.begin(); i != _pools.end();) {
+        auto next = std::next(i);
+        if (i->second.empty()) forget_pool(i);
+        i = next;
+    }
 }
 
 inline
@@ -1,6 +1,8 @@
 #include <boost/functional/hash.hpp>
+#include <numeric>
 
 #include "client.h"
+#include "peer_stats.h"
 #include "../utp.h"
 #include "../connect_proxy.h"
 #include "../tls.h"
@@ -9,8 +11,11 @@
 #include "../../bittorrent/bep5_announcer.h"
 #include "../../bittorrent/is_martian.h"
 #include "../../logger.h"
+#include "../../util/atomic_file.h"
+#include "../../util/file_io.h"
 #include "../../util/hash.h"
 #include "../../util/lru_cache.h"
+#include "../../util/str.h"
 #include "../../ssl/util.h"
 #include "../../util/handler_tracker.h"
 
@@ -35,6 +40,13 @@ static const std::size_t injectors_to_ping = 30;
 static const auto injector_ping_period = std::chrono::minutes(10);
 static const auto injector_ping_period_debug = std::chrono::minutes(2);
 static const auto injector_pong_timeout = std::chrono::seconds(60);
+// When connecting, peers not known to work reliably are tried in parallel
+// in groups of this size, then separated by a short delay.
+static const uint32_t unranked_peers_in_parallel = 11;
+static const auto unranked_peer_delay = std::chrono::milliseconds(100);
+// Peers known to work reliably are given some time to connect
+// before trying the next ones, but this long at most in total.
+static const auto max_ranked_peers_delay = std::chrono::seconds(1);
 
 using namespace std;
 using namespace ouinet;
@@ -274,9 +286,11 @@ public:
     InjectorPinger( shared_ptr<Bep5Client::Swarm> injector_swarm
                   , string helper_swarm_name
                   , shared_ptr<bt::MainlineDht> dht
+                  , shared_ptr<bep5::PeerStats> peer_stats
                   , Cancel& cancel)
         : _lifetime_cancel(cancel)
         , _injector_swarm(move(injector_swarm))
+        , _peer_stats(move(peer_stats))
         , _random_generator(std::random_device()())
         , _helper_announcer(new bt::Bep5ManualAnnouncer(util::sha1_digest(helper_swarm_name), dht))
     {
@@ -289,6 +303,8 @@ public:
 
     ~InjectorPinger() { _lifetime_cancel(); }
 
+    using Injector = pair<udp::endpoint, shared_ptr<AbstractClient>>;
+
     // Let this pinger known that injector was directly seen from somewhere else so that
     // it can postpone pinging.
     void injector_was_seen_now()
@@ -338,17 +354,19 @@ private:
         }
     }
 
-    bool ping_one_injector( shared_ptr<AbstractClient> injector
+    bool ping_one_injector( const Injector& injector
                           , Cancel& cancel
                           , asio::yield_context yield)
     {
         sys::error_code ec;
-        auto con = injector->connect(yield[ec], cancel);
+        auto start = Clock::now();
+        auto con = injector.second->connect(yield[ec], cancel);
         return_or_throw_on_error(yield, cancel, ec, false);
+        _peer_stats->on_success(injector.first, Clock::now() - start);
         return true;
     }
 
-    bool ping_injectors( const std::vector<shared_ptr<AbstractClient>>& injectors
+    bool ping_injectors( const std::vector<Injector>& injectors
                        , Cancel cancel
                        , asio::yield_context yield)
     {
@@ -365,9 +383,13 @@ private:
                 auto sc = success_cancel.connect([&] { c(); });
 
                 sys::error_code ec;
-                auto wd = watch_dog(ex, injector_pong_timeout, [&] { c(); });
+                bool timed_out = false;
+                auto wd = watch_dog(ex, injector_pong_timeout, [&] { timed_out = true; c(); });
                 if (ping_one_injector(inj, c, yield[ec])) {
                     success_cancel();
+                } else if (timed_out || !c) {
+                    // Not just stopped because another injector replied.
+                    _peer_stats->on_failure(inj.first);
                 }
             }));
         }
@@ -379,13 +401,13 @@ private:
         return bool(success_cancel);
     }
 
-    std::vector<shared_ptr<AbstractClient>> select_injectors_to_ping() {
+    std::vector<Injector> select_injectors_to_ping() {
         // Select the first (at most) `injectors_to_ping` injectors after shuffling them.
         auto injector_map = _injector_swarm->peers();
-        std::vector<shared_ptr<AbstractClient>> injectors;
+        std::vector<Injector> injectors;
         injectors.reserve(injector_map.size());
         for (auto& p : injector_map)
-            injectors.push_back(p.second);
+            injectors.emplace_back(p.first, p.second);
 
         std::shuffle(injectors.begin(), injectors.end(), _random_generator);
         if (injectors.size() > injectors_to_ping)
@@ -400,6 +422,7 @@ private:
     static const bool _debug = false;  // for development testing only
     Cancel _lifetime_cancel;
     shared_ptr<Bep5Client::Swarm> _injector_swarm;
+    shared_ptr<bep5::PeerStats> _peer_stats;
     bool _injector_was_seen = false;
     const Clock::duration _ping_frequency = (_debug ? injector_ping_period_debug : injector_ping_period);
     std::mt19937 _random_generator;
@@ -409,11 +432,14 @@ private:
 Bep5Client::Bep5Client( shared_ptr<bt::MainlineDht> dht
                       , string injector_swarm_name
                       , asio::ssl::context* injector_tls_ctx
+                      , fs::path peer_stats_path
                       , Target targets)
     : _dht(dht)
     , _injector_swarm_name(move(injector_swarm_name))
     , _injector_tls_ctx(injector_tls_ctx)
     , _random_generator(std::random_device()())
+    , _peer_stats(make_shared<bep5::PeerStats>())
+    , _peer_stats_path(move(peer_stats_path))
     , _default_targets(targets)
 {
     if (_dht->local_endpoints().empty()) {
@@ -425,12 +451,15 @@ Bep5Client::Bep5Client( shared_ptr<bt::MainlineDht> dht
                       , string injector_swarm_name
                       , string helpers_swarm_name
                       , asio::ssl::context* injector_tls_ctx
+                      , fs::path peer_stats_path
                       , Target targets)
     : _dht(dht)
     , _injector_swarm_name(move(injector_swarm_name))
     , _helpers_swarm_name(move(helpers_swarm_name))
     , _injector_tls_ctx(injector_tls_ctx)
     , _random_generator(std::random_device()())
+    , _peer_stats(make_shared<bep5::PeerStats>())
+    , _peer_stats_path(move(peer_stats_path))
     , _default_targets(targets)
 {
     if (_dht->local_endpoints().empty()) {
@@ -440,8 +469,17 @@ Bep5Client::Bep5Client( shared_ptr<bt::MainlineDht> dht
     assert(_helpers_swarm_name.size());
 }
 
-void Bep5Client::start(asio::yield_context)
+void Bep5Client::start(asio::yield_context yield)
 {
+    {
+        Cancel cancel(_cancel);
+        sys::error_code ec;
+        load_peer_stats(cancel, yield[ec]);
+        if (cancel) return or_throw(yield, asio::error::operation_aborted);
+        if (ec && ec != sys::errc::no_such_file_or_directory)
+            _ERROR("Failed to load peer statistics; ec=", ec);
+    }
+
     {
         bt::NodeID infohash = util::sha1_digest(_injector_swarm_name);
 
@@ -459,7 +497,8 @@ void Bep5Client::start(asio::yield_context)
         _helpers_swarm.reset(new Swarm(this, infohash, _dht, helper_swarm_capacity, _cancel, true));
         _helpers_swarm->start();
 
-        _injector_pinger.reset(new InjectorPinger(_injector_swarm, _helpers_swarm_name, _dht, _cancel));
+        _injector_pinger.reset(new InjectorPinger( _injector_swarm, _helpers_swarm_name
+                                                 , _dht, _peer_stats, _cancel));
     }
 
     TRACK_SPAWN(get_executor(),
@@ -471,6 +510,7 @@ void Bep5Client::start(asio::yield_context)
 
 void Bep5Client::stop()
 {
+    store_peer_stats();
     _cancel();
     _injector_swarm = nullptr;
     _helpers_swarm  = nullptr;
@@ -499,7 +539,11 @@ void Bep5Client::status_loop(asio::yield_context yield)
         ec = {};
         async_sleep(get_executor(), 1min, cancel, yield[ec]);
 
-        if (ec || cancel || logger.get_threshold() > DEBUG)
+        if (ec || cancel) continue;
+
+        store_peer_stats();
+
+        if (logger.get_threshold() > DEBUG)
             continue;
 
         auto inj_n = _injector_swarm->peers().size();
@@ -507,7 +551,8 @@ void Bep5Client::status_loop(asio::yield_context yield)
         logger.debug(util::str(
             "Bep5Client: Swarm status;",
             " injectors=", inj_n, (inj_n == injector_swarm_capacity ? " (max)" : ""),
-            " bridges=", hlp_n, (hlp_n == helper_swarm_capacity ? " (max)" : "")));
+            " bridges=", hlp_n, (hlp_n == helper_swarm_capacity ? " (max)" : ""),
+            " known_peers=", _peer_stats->size()));
     }
 }
 
@@ -529,6 +574,8 @@ std::vector<Bep5Client::Candidate> Bep5Client::get_peers(Target target)
         for (auto p : *hlp_m) hlp.push_back({p.first, p.second, Target::helpers});
     }
 
+    // Shuffle so that peers with equal costs (e.g. unknown ones)
+    // are tried in a different order every time.
     std::shuffle(inj.begin(), inj.end(), _random_generator);
     std::shuffle(hlp.begin(), hlp.end(), _random_generator);
 
@@ -538,6 +585,22 @@ std::vector<Bep5Client::Candidate> Bep5Client::get_peers(Target target)
     for (auto& p : inj) { ret.push_back(p); }
     for (auto& p : hlp) { ret.push_back(p); }
 
+    // Try first the peers which are expected to yield a connection sooner,
+    // and injectors before helpers if equal.
+    std::vector<float> costs;
+    costs.reserve(ret.size());
+    for (auto& p : ret) costs.push_back(_peer_stats->cost(p.endpoint));
+
+    std::vector<size_t> order(ret.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&] (size_t a, size_t b) {
+        return costs[a] < costs[b];
+    });
+
+    std::vector<Candidate> ranked;
+    ranked.reserve(ret.size());
+    for (auto i : order) ranked.push_back(move(ret[i]));
+
     //auto wan_eps = _dht->wan_endpoints();
     //auto lan_eps = _dht->local_endpoints();
     //cerr << "wan: "; for (auto& i : wan_eps) cerr << i << ","; cerr << "\n";
@@ -545,19 +608,7 @@ std::vector<Bep5Client::Candidate> Bep5Client::get_peers(Target target)
     //cerr << "inj: "; for (auto& i : inj) cerr << i.endpoint << ","; cerr << "\n";
     //cerr << "hlp: "; for (auto& i : hlp) cerr << i.endpoint << ","; cerr << "\n";
 
-    // If there is a peer that has woked recently then use that one
-    if (_last_working_ep) {
-        for (auto i = ret.begin(); i != ret.end(); ++i) {
-            if (i->endpoint == *_last_working_ep) {
-                if (i != ret.begin()) {
-                    std::swap(*i, ret.front());
-                }
-                break;
-            }
-        }
-    }
-
-    return ret;
+    return ranked;
 }
 
 GenericStream Bep5Client::connect(asio::yield_context yield, Cancel& cancel)
@@ -597,14 +648,25 @@ GenericStream Bep5Client::connect( asio::yield_context yield
     GenericStream ret_con;
 
     uint32_t i = 0;
+    uint32_t unranked = 0;
+    Clock::duration delay(0);
+    Clock::duration ranked_delay(0);  // part of `delay` due to ranked peers
 
     auto exec = get_executor();
 
     for (auto peer : get_peers(target)) {
-        auto j = i++;
-
-        const uint32_t k = 10;
-        uint32_t delay_ms = (j <= k) ? 0 : ((j-k) * 100);
+        i++;
+
+        // Wait for peers known to work about as long as they usually take
+        // before trying the next one, otherwise just stagger attempts.
+        auto start_delay = delay;
+        if (auto patience = _peer_stats->patience(peer.endpoint)) {
+            auto d = std::min<Clock::duration>(*patience, max_ranked_peers_delay - ranked_delay);
+            ranked_delay += d;
+            delay += d;
+        } else if (++unranked >= unranked_peers_in_parallel) {
+            delay += unranked_peer_delay;
+        }
 
         TRACK_SPAWN(exec, ([
             =,
@@ -616,12 +678,12 @@ GenericStream Bep5Client::connect( asio::yield_context yield
         ] (asio::yield_context y) mutable {
             sys::error_code ec;
 
-            if (delay_ms) {
-                async_sleep(exec, chrono::milliseconds(delay_ms), spawn_cancel, y);
+            if (start_delay != Clock::duration(0)) {
+                async_sleep(exec, start_delay, spawn_cancel, y);
                 if (spawn_cancel) return;
             }
 
-            auto con = connect_single(*peer.client, tls, spawn_cancel, y[ec]);
+            auto con = connect_single(peer, tls, spawn_cancel, y[ec]);
             assert(!spawn_cancel || ec == asio::error::operation_aborted);
             if (spawn_cancel || ec) return;
             ret_target = peer.target;
@@ -645,12 +707,10 @@ GenericStream Bep5Client::connect( asio::yield_context yield
     }
 
     if (ec) {
-        _last_working_ep = boost::none;
         _DEBUG( "Did not connect to any peer;"
               , " peers=", i
               , " ec=", ec);
     } else {
-        _last_working_ep = ret_ep;
         if (ret_target == Target::injectors) {
             if (_injector_pinger)
                 _injector_pinger->injector_was_seen_now();
@@ -665,16 +725,26 @@ GenericStream Bep5Client::connect( asio::yield_context yield
 }
 
 GenericStream
-Bep5Client::connect_single( AbstractClient& cli
+Bep5Client::connect_single( const Candidate& peer
                           , bool tls
                           , Cancel& cancel
                           , asio::yield_context yield)
 {
+    // Attempts cancelled because another peer won the race are not recorded.
+    auto peer_stats = _peer_stats;
+    auto start = Clock::now();
+
     sys::error_code ec;
-    auto con = cli.connect(yield[ec], cancel);
+    auto con = peer.client->connect(yield[ec], cancel);
+    if (ec && !cancel) peer_stats->on_failure(peer.endpoint);
     return_or_throw_on_error(yield, cancel, ec, GenericStream{});
 
-    if (!tls) return con;
+    auto connected = Clock::now();
+
+    if (!tls) {
+        peer_stats->on_success(peer.endpoint, connected - start);
+        return con;
+    }
 
     assert(_injector_tls_ctx);
 
@@ -682,10 +752,65 @@ Bep5Client::connect_single( AbstractClient& cli
         return or_throw<GenericStream>(yield, asio::error::bad_descriptor);
     }
 
-    return ssl::util::client_handshake( std::move(con)
-                                      , *_injector_tls_ctx, ""
-                                      , cancel
-                                      , yield);
+    // Injectors have no host name, so keep their TLS sessions per endpoint.
+    auto tls_con = ssl::util::client_handshake( std::move(con)
+                                              , *_injector_tls_ctx, ""
+                                              , util::str(peer.endpoint)
+                                              , cancel
+                                              , yield[ec]);
+    if (ec && !cancel) peer_stats->on_failure(peer.endpoint);
+    return_or_throw_on_error(yield, cancel, ec, GenericStream{});
+
+    peer_stats->on_success(peer.endpoint, connected - start, Clock::now() - connected);
+    return tls_con;
+}
+
+void Bep5Client::load_peer_stats(Cancel& cancel, asio::yield_context yield)
+{
+    if (_peer_stats_path.empty()) return;
+
+    auto exec = get_executor();
+
+    sys::error_code ec;
+    auto file = util::file_io::open_readonly(exec, _peer_stats_path, ec);
+    if (ec) return or_throw(yield, ec);
+
+    size_t filesize = util::file_io::file_size(file, ec);
+    if (ec) return or_throw(yield, ec);
+
+    std::string data(filesize, '\0');
+    util::file_io::read(file, asio::buffer(data), cancel, yield[ec]);
+    return_or_throw_on_error(yield, cancel, ec);
+
+    _peer_stats->load(data);
+    _stored_peer_stats_version = _peer_stats->version();
+    _DEBUG("Loaded peer statistics; peers=", _peer_stats->size());
+}
+
+void Bep5Client::store_peer_stats()
+{
+    if (_peer_stats_path.empty()) return;
+    if (_peer_stats->version() == _stored_peer_stats_version) return;
+    _stored_peer_stats_version = _peer_stats->version();
+
+    // Keep storing even if the client is stopped meanwhile.
+    TRACK_SPAWN_AFTER_STOP(get_executor(), ([
+        exec = get_executor(),
+        path = _peer_stats_path,
+        data = _peer_stats->dump()
+    ] (asio::yield_context yield) {
+        Cancel cancel;
+        sys::error_code ec;
+
+        util::file_io::check_or_create_directory(path.parent_path(), ec);
+
+        boost::optional<util::atomic_file> file;
+        if (!ec) file = util::atomic_file::make(exec, path, ec);
+        if (!ec) util::file_io::write(file->lowest_layer(), asio::buffer(data), cancel, yield[ec]);
+        if (!ec) file->commit(ec);
+
+        if (ec) _ERROR("Failed to store peer statistics; ec=", ec);
+    }));
 }
 
 Bep5Client::~Bep5Client()
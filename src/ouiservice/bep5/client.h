@@ -3,6 +3,7 @@
 #include <boost/asio/ip/udp.hpp>
 #include <boost/asio/ssl.hpp>
 #include <asio_utp/udp_multiplexer.hpp>
+#include <boost/filesystem/path.hpp>
 
 #include "../../ouiservice.h"
 #include <random>
@@ -15,6 +16,10 @@ namespace bittorrent {
 
 namespace ouiservice {
 
+namespace bep5 {
+    class PeerStats;
+}
+
 class Bep5Client : public OuiServiceImplementationClient
 {
 public:
@@ -37,15 +42,19 @@ private:
     };
 
 public:
+    // Connection statistics of peers (used to choose which ones to try first)
+    // are loaded from and stored to `peer_stats_path` unless it is empty.
     Bep5Client( std::shared_ptr<bittorrent::MainlineDht>
               , std::string injector_swarm_name
               , asio::ssl::context*
+              , fs::path peer_stats_path = {}
               , Target targets = helpers | injectors);
 
     Bep5Client( std::shared_ptr<bittorrent::MainlineDht>
               , std::string injector_swarm_name
               , std::string helpers_swarm_name
               , asio::ssl::context*
+              , fs::path peer_stats_path = {}
               , Target targets = helpers | injectors);
 
     void start(asio::yield_context) override;
@@ -62,7 +71,10 @@ private:
     void status_loop(asio::yield_context);
     std::vector<Candidate> get_peers(Target);
 
-    GenericStream connect_single(AbstractClient&, bool tls, Cancel&, asio::yield_context);
+    GenericStream connect_single(const Candidate&, bool tls, Cancel&, asio::yield_context);
+
+    void load_peer_stats(Cancel&, asio::yield_context);
+    void store_peer_stats();
 
 private:
     std::shared_ptr<bittorrent::MainlineDht> _dht;
@@ -82,7 +94,10 @@ private:
 
     static const bool _log_debug = false;  // for development testing only
 
-    boost::optional<asio::ip::udp::endpoint> _last_working_ep;
+    // Shared with coroutines which may outlive the client.
+    std::shared_ptr<bep5::PeerStats> _peer_stats;
+    fs::path _peer_stats_path;
+    uint64_t _stored_peer_stats_version = 0;
 
     Target _default_targets;
 };
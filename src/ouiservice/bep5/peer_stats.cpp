@@ -0,0 +1,207 @@
+#include "peer_stats.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "../../parse/endpoint.h"
+#include "../../util/str.h"
+
+using namespace std;
+using namespace ouinet;
+using namespace ouiservice::bep5;
+
+using Entry = PeerStats::Entry;
+
+// Weight of new samples in smoothed values.
+static const float alpha = 0.25;
+// What we assume of peers we know nothing about.
+static const float prior_connect_ms = 1000;
+static const float prior_success = 0.5;
+// Peers failing more often than this are not waited for.
+static const float reliable_success = 0.5;
+// Margin over the expected time before trying the next peer.
+static const float patience_factor = 1.5;
+static const auto min_patience = chrono::milliseconds(100);
+static const auto max_patience = chrono::milliseconds(3000);
+
+static
+float to_ms(PeerStats::Clock::duration d)
+{
+    return chrono::duration<float, milli>(d).count();
+}
+
+static
+void smooth(float& avg, float sample)
+{
+    avg += alpha * (sample - avg);
+}
+
+static
+float expected_ms(const Entry& e)
+{
+    // A TLS handshake takes a couple of round trips,
+    // about as much as getting a connection over uTP.
+    auto handshake_ms = e.handshake_ms < 0 ? e.connect_ms : e.handshake_ms;
+    return e.connect_ms + handshake_ms;
+}
+
+// Expected number of failed attempts before a successful one is
+// `(1 - success) / success`, and each of them wastes about this much.
+static const float failure_ms = 5000;
+
+static
+float cost(const Entry& e)
+{
+    auto success = max(e.success, 0.01f);
+    return expected_ms(e) + failure_ms * (1 - success) / success;
+}
+
+PeerStats::PeerStats(size_t capacity)
+    : _capacity(max<size_t>(capacity, 1))
+{}
+
+Entry& PeerStats::entry(const Endpoint& ep)
+{
+    auto i = _entries.find(ep);
+    if (i != _entries.end()) return i->second;
+
+    if (_entries.size() >= _capacity) {
+        auto oldest = min_element( _entries.begin(), _entries.end()
+                                 , [] (auto& a, auto& b) {
+                                       return a.second.updated < b.second.updated;
+                                   });
+        _entries.erase(oldest);
+    }
+
+    return _entries[ep] = Entry{-1, -1, prior_success, 0};
+}
+
+void PeerStats::on_success( const Endpoint& ep
+                          , Clock::duration connect
+                          , boost::optional<Clock::duration> handshake)
+{
+    auto& e = entry(ep);
+
+    if (e.connect_ms < 0) e.connect_ms = to_ms(connect);
+    else smooth(e.connect_ms, to_ms(connect));
+
+    if (handshake) {
+        if (e.handshake_ms < 0) e.handshake_ms = to_ms(*handshake);
+        else smooth(e.handshake_ms, to_ms(*handshake));
+    }
+
+    smooth(e.success, 1);
+    e.updated = time(nullptr);
+    ++_version;
+}
+
+void PeerStats::on_failure(const Endpoint& ep)
+{
+    auto& e = entry(ep);
+    smooth(e.success, 0);
+    e.updated = time(nullptr);
+    ++_version;
+}
+
+const Entry* PeerStats::find(const Endpoint& ep) const
+{
+    auto i = _entries.find(ep);
+    if (i == _entries.end()) return nullptr;
+    return &i->second;
+}
+
+float PeerStats::cost(const Endpoint& ep) const
+{
+    auto e = find(ep);
+
+    if (!e || e->connect_ms < 0) {
+        // Never connected, only its success rate may be known.
+        Entry prior{prior_connect_ms, -1, e ? e->success : prior_success, 0};
+        return ::cost(prior);
+    }
+
+    return ::cost(*e);
+}
+
+boost::optional<PeerStats::Clock::duration>
+PeerStats::patience(const Endpoint& ep) const
+{
+    auto e = find(ep);
+    if (!e || e->connect_ms < 0 || e->success < reliable_success)
+        return boost::none;
+
+    auto d = chrono::duration_cast<Clock::duration>
+        (chrono::duration<float, milli>(expected_ms(*e) * patience_factor));
+    return max<Clock::duration>(min_patience, min<Clock::duration>(d, max_patience));
+}
+
+// Endpoints are written as `ADDR:PORT` or `[ADDR6]:PORT`.
+static
+boost::optional<asio::ip::udp::endpoint>
+parse_endpoint(boost::string_view s)
+{
+    if (s.empty() || s[0] != '[') return parse::endpoint<asio::ip::udp>(s);
+
+    auto end = s.find("]:");
+    if (end == s.npos) return boost::none;
+    auto addr = s.substr(1, end - 1).to_string();
+    return parse::endpoint<asio::ip::udp>(addr + s.substr(end + 1).to_string());
+}
+
+static
+boost::optional<double> parse_number(boost::string_view s)
+{
+    auto str = s.to_string();
+    char* end = nullptr;
+    auto v = strtod(str.c_str(), &end);
+    if (str.empty() || *end != '\0') return boost::none;
+    return v;
+}
+
+void PeerStats::load(boost::string_view data)
+{
+    auto now = time(nullptr);
+
+    while (!data.empty()) {
+        auto pos = data.find('\n');
+        auto line = data.substr(0, pos);
+        data = (pos == data.npos) ? boost::string_view() : data.substr(pos + 1);
+
+        // ENDPOINT,CONNECT_MS,HANDSHAKE_MS,SUCCESS,UPDATED
+        boost::string_view fields[5];
+        size_t n = 0;
+        for (; n < 5 && !line.empty(); ++n) {
+            auto comma = line.find(',');
+            fields[n] = line.substr(0, comma);
+            line = (comma == line.npos) ? boost::string_view() : line.substr(comma + 1);
+        }
+        if (n != 5 || !line.empty()) continue;
+
+        auto ep = parse_endpoint(fields[0]);
+        auto connect_ms = parse_number(fields[1]);
+        auto handshake_ms = parse_number(fields[2]);
+        auto success = parse_number(fields[3]);
+        auto updated = parse_number(fields[4]);
+
+        if (!ep || !connect_ms || !handshake_ms || !success || !updated) continue;
+        if (*success < 0 || *success > 1) continue;
+        if (now - time_t(*updated) > max_age) continue;
+
+        auto i = _entries.find(*ep);
+        if (i != _entries.end() && i->second.updated >= time_t(*updated)) continue;
+
+        auto& e = entry(*ep);
+        e = Entry{float(*connect_ms), float(*handshake_ms), float(*success), time_t(*updated)};
+    }
+}
+
+string PeerStats::dump() const
+{
+    string ret;
+    for (auto& p : _entries) {
+        auto& e = p.second;
+        ret += util::str( p.first, ',', e.connect_ms, ',', e.handshake_ms
+                        , ',', e.success, ',', e.updated, '\n');
+    }
+    return ret;
+}
@@ -0,0 +1,86 @@
+// Connection statistics for the peers of `Bep5Client` (injectors and bridges).
+//
+// For every peer we keep smoothed averages of the time it takes
+// to get a connection to it and to complete the TLS handshake over it,
+// along with a smoothed success rate.  These are used to choose
+// which peers to try first and how long to wait for each of them
+// before also trying the next ones.
+//
+// Statistics can be dumped to and loaded from a simple text format
+// so that they survive restarts.
+
+#pragma once
+
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <string>
+
+#include <boost/asio/ip/udp.hpp>
+#include <boost/optional.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include "../../namespaces.h"
+
+namespace ouinet { namespace ouiservice { namespace bep5 {
+
+class PeerStats {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Endpoint = asio::ip::udp::endpoint;
+
+    struct Entry {
+        float connect_ms;    // time to establish a connection
+        float handshake_ms;  // time of the TLS handshake, negative if unknown
+        float success;       // rate of successful attempts, in [0, 1]
+        std::time_t updated; // seconds since the epoch
+    };
+
+    static const size_t default_capacity = 500;
+    // Statistics older than this are not loaded.
+    static const std::time_t max_age = 30 * 24 * 3600;
+
+public:
+    PeerStats(size_t capacity = default_capacity);
+
+    // `handshake` is none if no TLS handshake was attempted.
+    void on_success( const Endpoint&
+                   , Clock::duration connect
+                   , boost::optional<Clock::duration> handshake = boost::none);
+
+    // Do not report attempts which were cancelled by the caller.
+    void on_failure(const Endpoint&);
+
+    const Entry* find(const Endpoint&) const;
+
+    // Expected time in milliseconds until a usable connection
+    // is obtained from the peer, accounting for failed attempts.
+    // Lower is better, and unknown peers get a middling cost.
+    float cost(const Endpoint&) const;
+
+    // How long to wait for a connection to the peer
+    // before also trying the next one,
+    // or none if the peer is not known to work reliably.
+    boost::optional<Clock::duration> patience(const Endpoint&) const;
+
+    size_t size() const { return _entries.size(); }
+
+    // Increased on every change, to tell whether statistics need storing.
+    uint64_t version() const { return _version; }
+
+    // Merge statistics from the text produced by `dump`,
+    // ignoring malformed and expired entries.
+    // This does not change the version.
+    void load(boost::string_view);
+    std::string dump() const;
+
+private:
+    Entry& entry(const Endpoint&);
+
+private:
+    size_t _capacity;
+    std::map<Endpoint, Entry> _entries;
+    uint64_t _version = 0;
+};
+
+}}} // namespaces
@@ -10,6 +10,7 @@
 #include "liblampshade.h"
 #include "../../logger.h"
 #include "../../or_throw.h"
+#include "../../util/spawn.h"
 #include "../../util/str.h"
 
 namespace ouinet {
@@ -250,7 +251,7 @@ class LampshadeStream
             });
         }
 
-        asio::spawn(_ex, [
+        util::spawn(_ex, [
             this,
             buffer,
             callback = std::move(callback)
@@ -293,7 +294,7 @@ class LampshadeStream
             });
         }
 
-        asio::spawn(_ex, [
+        util::spawn(_ex, [
             this,
             buffer,
             callback = std::move(callback)
@@ -1,6 +1,7 @@
 #include "dispatcher-process.h"
 #include "../../or_throw.h"
 #include "../../util/condition_variable.h"
+#include "../../util/spawn.h"
 
 #include <boost/asio/steady_timer.hpp>
 #include <boost/process.hpp>
@@ -151,7 +152,7 @@ void DispatcherProcess::start_process(
         timeout_timer.cancel();
     });
 
-    asio::spawn(_ioc, [
+    util::spawn(_ioc, [
         this,
         standard_output = std::move(standard_output),
         initialization
@@ -257,7 +258,7 @@ void DispatcherProcess::stop_process()
     auto& ioc = _ioc;
     _stop_signal();
 
-    asio::spawn(_ioc, [
+    util::spawn(_ioc, [
         &ioc,
         process = std::move(process),
         standard_input = std::move(standard_input),
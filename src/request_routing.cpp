@@ -1,5 +1,16 @@
 #include "request_routing.h"
 
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/container/small_vector.hpp>
+#include <boost/regex.hpp>
+
 using namespace ouinet;
 
 using Request = http::request<http::string_body>;
@@ -7,154 +18,432 @@ using Request = http::request<http::string_body>;
 //------------------------------------------------------------------------------
 namespace ouinet {
 
-namespace reqexpr {
-
-class ReqExpr {
-    public:
-        ReqExpr() = default;
-        virtual ~ReqExpr() = default;
-        ReqExpr(ReqExpr&&) = default;
-        ReqExpr& operator=(ReqExpr&&) = default;
-        ReqExpr(const ReqExpr&) = default;
-        ReqExpr& operator=(const ReqExpr&) = default;
-
-        virtual bool match(const http::request<http::string_body>&) const = 0;
-};
+namespace request_route {
 
-class RegexReqExpr : public ReqExpr {  // can match a request field against a regular expression
-    private:
-        const field_getter get_field;
-        const boost::regex regexp;
+//------------------------------------------------------------------------------
+namespace {
 
-    public:
-        RegexReqExpr(const field_getter& gf, const boost::regex& rx)
-            : get_field(gf), regexp(rx) { };
+using Request = http::request<http::string_body>;
+using Index = uint32_t;
 
-        bool match(const http::request<http::string_body>& req) const override {
-            return boost::regex_match(get_field(req).to_string(), regexp);
-        }
+enum class CondKind {
+    host, domain, subdomain,
+    url_prefix, url_exact,
+    method, header,
+    host_rx, url_rx, header_rx,
 };
 
-class TrueReqExpr : public ReqExpr {  // matches all requests
-    public:
-        bool match(const http::request<http::string_body>& req) const override {
-            return true;
-        }
+struct Condition {
+    CondKind kind;
+    bool negated = false;
+    std::string name;  // of the header
+    std::string value;  // lower case for hosts and headers (unless case-sensitive)
+    bool case_sensitive = false;  // only for headers
+    std::vector<std::string> methods;
+    boost::regex rx;
 };
 
-class FalseReqExpr : public ReqExpr {  // matches no request
-    public:
-        bool match(const http::request<http::string_body>& req) const override {
-            return false;
-        }
+struct Rule {
+    // Excluding the one kept in a trie, if any.
+    std::vector<Condition> conditions;
+    Config config;
 };
 
-class NotReqExpr : public ReqExpr {  // negates match of subexpr
-    private:
-        const std::shared_ptr<ReqExpr> child;
-
-    public:
-        NotReqExpr(const std::shared_ptr<ReqExpr> sub)
-            : child(sub) { }
-
-        bool match(const http::request<http::string_body>& req) const override {
-            return !(child->match(req));
-        }
+// Values of the request used by conditions, computed once.
+struct Fields {
+    std::string host;  // lower case, without port
+    std::string_view url;  // target without scheme
 };
 
-class AndReqExpr : public ReqExpr {  // a shortcircuit logical AND of two subexprs
-    private:
-        const std::shared_ptr<ReqExpr> left, right;
-
-    public:
-        AndReqExpr(const std::shared_ptr<ReqExpr> left_, const std::shared_ptr<ReqExpr> right_)
-            : left(left_), right(right_) { }
-
-        bool match(const http::request<http::string_body>& req) const override {
-            if (left->match(req))
-              return right->match(req);
-            return false;
-        }
+// Host names are walked label by label, starting with the top-level domain.
+struct HostNode {
+    std::map<std::string, Index, std::less<>> children;
+    std::vector<Index> exact;  // rules for this very name
+    std::vector<Index> subdomains;  // rules for names below this one
 };
 
-class OrReqExpr : public ReqExpr {  // a shortcircuit logical OR of two subexprs
-    private:
-        const std::shared_ptr<ReqExpr> left, right;
+struct UrlNode {
+    std::vector<std::pair<char, Index>> children;  // sorted by character
+    std::vector<Index> prefix;  // rules for targets starting here
+    std::vector<Index> exact;  // rules for targets ending here
+};
 
-    public:
-        OrReqExpr(const std::shared_ptr<ReqExpr> left_, const std::shared_ptr<ReqExpr> right_)
-            : left(left_), right(right_) { }
+using Candidates = boost::container::small_vector<Index, 16>;
 
-        bool match(const http::request<http::string_body>& req) const override {
-            if (left->match(req))
-                return true;
-            return right->match(req);
-        }
-};
+std::string_view to_sv(beast::string_view s) { return {s.data(), s.size()}; }
 
-bool
-reqex::match(const http::request<http::string_body>& req) const {
-    return impl->match(req);
+std::string_view hostname(std::string_view host)
+{
+    if (!host.empty() && host.front() == '[') {  // bracketed IPv6
+        auto end = host.find(']');
+        return end == host.npos ? host.substr(1) : host.substr(1, end - 1);
+    }
+    auto colon = host.find(':');
+    if (colon != host.npos && colon == host.rfind(':'))
+        return host.substr(0, colon);
+    return host;
 }
 
-reqex
-true_()
+std::string_view strip_scheme(std::string_view target)
 {
-    return reqex(std::make_shared<TrueReqExpr>());
+    for (std::string_view scheme : {"http://", "https://"}) {
+        if (target.size() >= scheme.size()
+            && boost::iequals(target.substr(0, scheme.size()), scheme))
+            return target.substr(scheme.size());
+    }
+    return target;
 }
 
-reqex
-false_()
+bool is_subdomain(std::string_view host, const std::string& domain)
 {
-    return reqex(std::make_shared<FalseReqExpr>());
+    return host.size() > domain.size() + 1
+        && host.substr(host.size() - domain.size()) == domain
+        && host[host.size() - domain.size() - 1] == '.';
 }
 
-reqex
-from_regex(const field_getter& gf, const boost::regex& rx)
+bool holds(const Condition& c, const Request& req, const Fields& f)
 {
-    return reqex(std::make_shared<RegexReqExpr>(gf, rx));
+    bool r = false;
+
+    switch (c.kind) {
+    case CondKind::host:
+        r = f.host == c.value;
+        break;
+    case CondKind::domain:
+        r = f.host == c.value || is_subdomain(f.host, c.value);
+        break;
+    case CondKind::subdomain:
+        r = is_subdomain(f.host, c.value);
+        break;
+    case CondKind::url_prefix:
+        r = f.url.substr(0, c.value.size()) == c.value;
+        break;
+    case CondKind::url_exact:
+        r = f.url == c.value;
+        break;
+    case CondKind::method: {
+        auto m = to_sv(req.method_string());
+        r = std::find(c.methods.begin(), c.methods.end(), m) != c.methods.end();
+        break;
+    }
+    case CondKind::header:
+        r = c.case_sensitive ? to_sv(req[c.name]) == c.value
+                             : boost::iequals(to_sv(req[c.name]), c.value);
+        break;
+    case CondKind::host_rx:
+        r = boost::regex_match(f.host.begin(), f.host.end(), c.rx);
+        break;
+    case CondKind::url_rx:
+        r = boost::regex_match(f.url.begin(), f.url.end(), c.rx);
+        break;
+    case CondKind::header_rx: {
+        auto v = req[c.name];
+        r = boost::regex_match(v.begin(), v.end(), c.rx);
+        break;
+    }
+    }
+
+    return r != c.negated;
 }
 
-reqex
-from_regex(const field_getter& gf, const std::string& rx)
+Condition parse_condition(std::string tok)
 {
-    return from_regex(gf, boost::regex(rx));
+    Condition c;
+
+    if (!tok.empty() && tok[0] == '!') {
+        c.negated = true;
+        tok.erase(0, 1);
+    }
+
+    std::string key;
+
+    if (boost::istarts_with(tok, "header:")) {
+        tok.erase(0, 7);
+        key = "header";
+    }
+
+    auto op_pos = tok.find_first_of("=~");
+    if (op_pos == std::string::npos || op_pos == 0)
+        throw std::invalid_argument("Invalid condition: " + tok);
+
+    auto op = tok[op_pos];
+    auto value_pos = op_pos + 1;
+    // A doubled operator asks for case-sensitive matching.
+    if (value_pos < tok.size() && tok[value_pos] == op) {
+        c.case_sensitive = true;
+        ++value_pos;
+    }
+    auto value = tok.substr(value_pos);
+    if (key.empty()) key = tok.substr(0, op_pos);
+    else c.name = tok.substr(0, op_pos);
+
+    if (c.case_sensitive && key != "header")
+        throw std::invalid_argument("Case-sensitive matching is only for headers: " + tok);
+
+    auto icase = boost::regex::normal | boost::regex::icase;
+
+    if (key == "host" && op == '=') {
+        c.kind = CondKind::host;
+        c.value = boost::algorithm::to_lower_copy(value);
+    } else if (key == "host") {
+        c.kind = CondKind::host_rx;
+        c.rx = boost::regex(value, icase);
+    } else if (key == "domain" && op == '=') {
+        c.kind = CondKind::domain;
+        if (!value.empty() && value[0] == '.') {
+            c.kind = CondKind::subdomain;
+            value.erase(0, 1);
+        }
+        if (value.empty()) throw std::invalid_argument("Empty domain in condition");
+        c.value = boost::algorithm::to_lower_copy(value);
+    } else if (key == "url" && op == '=') {
+        c.kind = CondKind::url_exact;
+        if (!value.empty() && value.back() == '*') {
+            c.kind = CondKind::url_prefix;
+            value.pop_back();
+        }
+        c.value = value;
+    } else if (key == "url") {
+        c.kind = CondKind::url_rx;
+        c.rx = boost::regex(value);
+    } else if (key == "method" && op == '=') {
+        c.kind = CondKind::method;
+        std::istringstream ss(value);
+        for (std::string m; std::getline(ss, m, ',');)
+            c.methods.push_back(m);
+    } else if (key == "header" && op == '=') {
+        c.kind = CondKind::header;
+        c.value = c.case_sensitive ? value : boost::algorithm::to_lower_copy(value);
+    } else if (key == "header") {
+        c.kind = CondKind::header_rx;
+        c.rx = c.case_sensitive ? boost::regex(value) : boost::regex(value, icase);
+    } else {
+        throw std::invalid_argument("Invalid condition: " + tok);
+    }
+
+    return c;
 }
 
-reqex
-operator!(const reqex& sub)
+fresh_channel parse_channel(const std::string& s)
 {
-    return reqex(std::make_shared<NotReqExpr>(sub.impl));
+    if (s == "origin") return fresh_channel::origin;
+    if (s == "proxy") return fresh_channel::proxy;
+    if (s == "injector_or_dcache" || s == "injector") return fresh_channel::injector_or_dcache;
+    if (s == "_front_end") return fresh_channel::_front_end;
+    throw std::invalid_argument("Invalid channel: " + s);
 }
 
-reqex
-operator&&(const reqex& left, const reqex& right)
+} // anonymous namespace
+
+struct Router::Impl {
+    std::vector<Rule> rules;
+    std::vector<HostNode> host_nodes{1};  // the first one is the root
+    std::vector<UrlNode> url_nodes{1};
+    std::vector<Index> unindexed;  // rules to always check
+
+    std::vector<Index>& host_slot(const Condition& c)
+    {
+        Index n = 0;
+        auto& name = c.value;
+
+        for (size_t end = name.size();;) {
+            auto dot = end == 0 ? std::string::npos : name.rfind('.', end - 1);
+            auto begin = dot == std::string::npos ? 0 : dot + 1;
+            auto label = name.substr(begin, end - begin);
+
+            auto i = host_nodes[n].children.find(label);
+            if (i == host_nodes[n].children.end()) {
+                Index child = host_nodes.size();
+                host_nodes.emplace_back();
+                host_nodes[n].children.emplace(label, child);
+                n = child;
+            } else {
+                n = i->second;
+            }
+
+            if (dot == std::string::npos) break;
+            end = dot;
+        }
+
+        return c.kind == CondKind::subdomain ? host_nodes[n].subdomains
+                                             : host_nodes[n].exact;
+    }
+
+    std::vector<Index>& url_slot(const Condition& c)
+    {
+        Index n = 0;
+
+        for (char ch : c.value) {
+            auto& cs = url_nodes[n].children;
+            auto i = std::lower_bound( cs.begin(), cs.end(), ch
+                                     , [] (auto& p, char ch) { return p.first < ch; });
+            if (i == cs.end() || i->first != ch) {
+                Index child = url_nodes.size();
+                cs.insert(i, {ch, child});
+                url_nodes.emplace_back();  // invalidates `cs`
+                n = child;
+            } else {
+                n = i->second;
+            }
+        }
+
+        return c.kind == CondKind::url_prefix ? url_nodes[n].prefix
+                                              : url_nodes[n].exact;
+    }
+
+    void add(std::vector<Condition> conditions, Config config)
+    {
+        Index index = rules.size();
+
+        auto is_key = [] (const Condition& c, std::initializer_list<CondKind> kinds) {
+            return !c.negated && std::find(kinds.begin(), kinds.end(), c.kind) != kinds.end();
+        };
+
+        auto key = std::find_if(conditions.begin(), conditions.end(), [&] (auto& c) {
+            return is_key(c, {CondKind::host, CondKind::domain, CondKind::subdomain});
+        });
+        if (key == conditions.end())
+            key = std::find_if(conditions.begin(), conditions.end(), [&] (auto& c) {
+                return is_key(c, {CondKind::url_prefix, CondKind::url_exact});
+            });
+
+        if (key == conditions.end()) {
+            unindexed.push_back(index);
+        } else if (key->kind == CondKind::url_prefix || key->kind == CondKind::url_exact) {
+            url_slot(*key).push_back(index);
+            conditions.erase(key);
+        } else {
+            host_slot(*key).push_back(index);
+            // Domains include the name itself.
+            if (key->kind == CondKind::domain) {
+                key->kind = CondKind::subdomain;
+                host_slot(*key).push_back(index);
+            }
+            conditions.erase(key);
+        }
+
+        rules.push_back(Rule{std::move(conditions), std::move(config)});
+    }
+
+    void host_candidates(std::string_view host, Candidates& out) const
+    {
+        Index n = 0;
+
+        for (size_t end = host.size(); end > 0;) {
+            auto dot = host.rfind('.', end - 1);
+            auto begin = dot == host.npos ? 0 : dot + 1;
+
+            auto& children = host_nodes[n].children;
+            auto i = children.find(host.substr(begin, end - begin));
+            if (i == children.end()) return;
+            n = i->second;
+
+            auto& node = host_nodes[n];
+            if (dot == host.npos) {
+                out.insert(out.end(), node.exact.begin(), node.exact.end());
+                return;
+            }
+            out.insert(out.end(), node.subdomains.begin(), node.subdomains.end());
+            end = dot;
+        }
+    }
+
+    void url_candidates(std::string_view url, Candidates& out) const
+    {
+        Index n = 0;
+
+        for (size_t i = 0;; ++i) {
+            auto& node = url_nodes[n];
+            out.insert(out.end(), node.prefix.begin(), node.prefix.end());
+
+            if (i == url.size()) {
+                out.insert(out.end(), node.exact.begin(), node.exact.end());
+                return;
+            }
+
+            auto& cs = node.children;
+            auto c = std::lower_bound( cs.begin(), cs.end(), url[i]
+                                     , [] (auto& p, char ch) { return p.first < ch; });
+            if (c == cs.end() || c->first != url[i]) return;
+            n = c->second;
+        }
+    }
+};
+
+Router::Router() : _impl(std::make_unique<Impl>()) {}
+Router::~Router() = default;
+Router::Router(Router&&) = default;
+Router& Router::operator=(Router&&) = default;
+
+void Router::add_rule(const std::string& line)
 {
-    return reqex(std::make_shared<AndReqExpr>(left.impl, right.impl));
+    std::istringstream ss(line);
+    std::vector<std::string> tokens;
+    for (std::string t; ss >> t;) tokens.push_back(std::move(t));
+
+    if (tokens.empty() || tokens[0][0] == '#') return;
+
+    auto arrow = std::find(tokens.begin(), tokens.end(), "=>");
+    if (arrow == tokens.end())
+        throw std::invalid_argument("Missing \"=>\" in rule");
+
+    std::vector<Condition> conditions;
+    for (auto t = tokens.begin(); t != arrow; ++t)
+        conditions.push_back(parse_condition(*t));
+
+    Config config;
+    for (auto t = std::next(arrow); t != tokens.end(); ++t)
+        config.fresh_channels.push_back(parse_channel(*t));
+
+    _impl->add(std::move(conditions), std::move(config));
 }
 
-reqex
-operator||(const reqex& left, const reqex& right)
+void Router::add_rules(std::istream& is, const std::string& source)
 {
-    return reqex(std::make_shared<OrReqExpr>(left.impl, right.impl));
+    size_t lineno = 0;
+    for (std::string line; std::getline(is, line);) {
+        ++lineno;
+        try {
+            add_rule(line);
+        } catch (const std::exception& e) {
+            std::ostringstream ss;
+            ss << source << ":" << lineno << ": " << e.what();
+            throw std::invalid_argument(ss.str());
+        }
+    }
 }
 
-} // ouinet::reqexpr namespace
+size_t Router::size() const
+{
+    return _impl->rules.size();
+}
 
-//------------------------------------------------------------------------------
-namespace request_route {
 const Config&
-route_choose_config( const http::request<http::string_body>& req
-                   , const std::vector<std::pair<const reqexpr::reqex, const Config>>& matches
-                   , const Config& default_config )
+Router::choose(const Request& req, const Config& default_config) const
 {
-    // Delegate to a simple router
-    // with the channels associated with the matching expression (if any),
-    // or with `default_config` if none does.
-    for (auto mit = matches.begin(); mit != matches.end(); ++mit)
-        if (mit->first.match(req))
-            return mit->second;
+    auto& impl = *_impl;
+
+    Fields f;
+    auto host = hostname(to_sv(req[http::field::host]));
+    f.host.assign(host.begin(), host.end());
+    boost::algorithm::to_lower(f.host);
+    f.url = strip_scheme(to_sv(req.target()));
+
+    Candidates cands;
+    impl.host_candidates(f.host, cands);
+    impl.url_candidates(f.url, cands);
+    cands.insert(cands.end(), impl.unindexed.begin(), impl.unindexed.end());
+    std::sort(cands.begin(), cands.end());
+
+    for (auto i : cands) {
+        auto& rule = impl.rules[i];
+        bool match = std::all_of( rule.conditions.begin(), rule.conditions.end()
+                                , [&] (auto& c) { return holds(c, req, f); });
+        if (match) return rule.config;
+    }
+
     return default_config;
 }
+
 } // request_route namespace
 } // ouinet namespace
@@ -1,14 +1,13 @@
 #pragma once
 
-#include <functional>
-#include <utility>
-#include <vector>
+#include <istream>
+#include <memory>
+#include <string>
 #include <deque>
 
 #include <boost/asio/error.hpp>
 #include <boost/beast/core/string.hpp>
 #include <boost/beast/http.hpp>
-#include <boost/regex.hpp>
 
 #include "namespaces.h"
 #include "http_util.h"
@@ -56,64 +55,67 @@ struct Config {
     // If it was the Injector channel, the response may get cached.
     std::deque<fresh_channel> fresh_channels;
 };
-} // request_route namespace
 
-//------------------------------------------------------------------------------
-// Request expressions can tell whether they match a given request
-// (much like regular expressions match strings).
-namespace reqexpr {
-class ReqExpr;
-
-// The type of functions that retrieve a given field (as a string) from a request.
-using field_getter = std::function<beast::string_view (const http::request<http::string_body>&)>;
-
-class reqex {
-    friend reqex true_();
-    friend reqex false_();
-    friend reqex from_regex(const field_getter&, const boost::regex&);
-    friend reqex operator!(const reqex&);
-    friend reqex operator&&(const reqex&, const reqex&);
-    friend reqex operator||(const reqex&, const reqex&);
-
-    private:
-        const std::shared_ptr<ReqExpr> impl;
-        reqex(const std::shared_ptr<ReqExpr> impl_) : impl(impl_) { }
-
-    public:
-        // True when the request matches this expression.
-        bool match(const http::request<http::string_body>& req) const;
+// Routing rules compiled once for choosing the configuration of requests
+// in time proportional to the length of their host name and target,
+// instead of to the number of rules.
+//
+// Rules are given as text, one per line:
+//
+//     CONDITION [CONDITION...] => [CHANNEL...]
+//
+// A request matches a rule if all of its conditions hold,
+// and the channels of the first matching rule (in order of addition) are used.
+// No channels means that matching requests are not sent anywhere.
+// Empty lines and lines starting with `#` are ignored.
+//
+// Conditions (negated with a leading `!`):
+//
+//   - `host=NAME`: the host name (without port) is NAME
+//   - `domain=NAME`: the host name is NAME or any subdomain of it
+//   - `domain=.NAME`: the host name is a subdomain of NAME
+//   - `url=PREFIX*`: the target without `http://` or `https://`
+//     starts with PREFIX (or is exactly it, without the `*`)
+//   - `method=METHOD[,METHOD...]`: the method is one of those
+//   - `header:NAME=VALUE`: the header value is VALUE
+//     (missing headers have an empty value)
+//   - `host~REGEX`, `url~REGEX`, `header:NAME~REGEX`:
+//     the host name, target or header value matches the (anchored) regex
+//
+// Host names and header values are compared ignoring case,
+// unless the operator is doubled for a header (`header:NAME==VALUE`,
+// `header:NAME~~REGEX`) to compare its value exactly.
+//
+// The first non-negated `host` or `domain` condition of a rule
+// (or else its first non-negated `url` prefix) is kept in a trie,
+// so that only rules whose key matches the request are checked further.
+// Rules without such a condition (e.g. only with regular expressions)
+// are checked for every request, so keep them at a bare minimum.
+class Router {
+public:
+    Router();
+    ~Router();
+
+    Router(Router&&);
+    Router& operator=(Router&&);
+
+    // Throws `std::invalid_argument` on syntax errors.
+    void add_rule(const std::string& line);
+
+    // Add all rules in the given text (e.g. the contents of a file).
+    // Errors mention the given source name and line number.
+    void add_rules(std::istream&, const std::string& source = "rules");
+
+    size_t size() const;
+
+    // The configuration of the first matching rule, or else `default_config`.
+    const Config& choose( const http::request<http::string_body>&
+                        , const Config& default_config) const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
 };
-
-// Use the following functions to create request expressions,
-// then call the ``match()`` method of the resulting object
-// with the request that you want to check.
-
-// Always matches, regardless of request content.
-reqex true_();
-// Never matches, regardless of request content.
-reqex false_();
-// Only matches when the extracted field matches the given (anchored) regular expression.
-reqex from_regex(const field_getter&, const boost::regex&);
-reqex from_regex(const field_getter&, const std::string&);
-
-// Negates the matching of the given expression.
-reqex operator!(const reqex&);
-
-// Short-circuit AND and OR operations on the given expressions.
-reqex operator&&(const reqex&, const reqex&);
-reqex operator||(const reqex&, const reqex&);
-} // ouinet::reqexpr namespace
-
-
-//------------------------------------------------------------------------------
-namespace request_route {
-// Route the provided request according to the list of channels associated
-// with the first matching expression in the given list,
-// otherwise route it according to the given list of default channels.
-const Config&
-route_choose_config( const http::request<http::string_body>& req
-                   , const std::vector<std::pair<const reqexpr::reqex, const Config>>& matches
-                   , const Config& default_config );
 } // request_route namespace
 //------------------------------------------------------------------------------
 
@@ -0,0 +1,254 @@
+#include "resolver_cache.h"
+
+#include <algorithm>
+#include <map>
+
+#include "parse/number.h"
+#include "util.h"
+#include "util/condition_variable.h"
+#include "util/handler_tracker.h"
+#include "util/lru_cache.h"
+#include "util/watch_dog.h"
+#include "logger.h"
+
+using namespace std;
+using namespace ouinet;
+
+using Clock = ResolverCache::Clock;
+using Addresses = ResolverCache::Addresses;
+using TcpLookup = ResolverCache::TcpLookup;
+
+constexpr decltype(ResolverCache::default_ttl)   ResolverCache::default_ttl;
+constexpr decltype(ResolverCache::min_ttl)       ResolverCache::min_ttl;
+constexpr decltype(ResolverCache::max_ttl)       ResolverCache::max_ttl;
+constexpr decltype(ResolverCache::negative_ttl)  ResolverCache::negative_ttl;
+constexpr decltype(ResolverCache::query_timeout) ResolverCache::query_timeout;
+
+// Answers looked up at least this many times are refreshed in the background
+// when looked up again in the last part of their lifetime.
+static const unsigned prefetch_min_hits = 3;
+static const unsigned prefetch_lifetime_divisor = 10;  // i.e. the last 10%
+
+struct ResolverCache::Entry {
+    Addresses addresses;
+    sys::error_code ec;  // for failed resolutions
+    Clock::time_point added;
+    Clock::time_point expires;
+    unsigned hits = 0;
+};
+
+struct ResolverCache::PendingQuery {
+    ConditionVariable cv;
+    bool done = false;
+    Addresses addresses;
+    sys::error_code ec;
+
+    PendingQuery(const asio::executor& ex) : cv(ex) {}
+};
+
+struct ResolverCache::State {
+    asio::executor ex;
+    util::LruCache<string, Entry> entries;
+    map<string, shared_ptr<PendingQuery>> pending;
+    Cancel stopped;
+
+    State(const asio::executor& ex, size_t max_entries)
+        : ex(ex)
+        , entries(max_entries)
+    {}
+};
+
+static
+Clock::duration clamp_ttl(const boost::optional<Clock::duration>& ttl)
+{
+    if (!ttl) return ResolverCache::default_ttl;
+    return max<Clock::duration>( ResolverCache::min_ttl
+                               , min<Clock::duration>(*ttl, ResolverCache::max_ttl));
+}
+
+// Run the query for the given host in the background,
+// with all lookups of its `key` (including the current one, if any) waiting for it.
+/* static */
+shared_ptr<ResolverCache::PendingQuery>
+ResolverCache::start_query( const shared_ptr<State>& state
+                          , const string& key
+                          , const string& host
+                          , Query query)
+{
+    auto& pending = state->pending[key];
+    if (pending) return pending;  // already running
+    // The query may complete before spawning returns and remove `pending`.
+    auto p = pending = make_shared<PendingQuery>(state->ex);
+
+    TRACK_SPAWN(state->ex, ([
+        state, key, host, pq = p, query = move(query)
+    ] (asio::yield_context yield) {
+        Cancel cancel(state->stopped);
+        auto wd = watch_dog( state->ex, query_timeout
+                           , [&] { cancel(); });
+
+        sys::error_code ec;
+        auto answer = query(host, cancel, yield[ec]);
+        if (!ec && answer.addresses.empty()) ec = asio::error::host_not_found;
+        if (cancel) ec = asio::error::operation_aborted;
+
+        pq->done = true;
+        pq->addresses = move(answer.addresses);
+        pq->ec = ec;
+
+        state->pending.erase(key);
+
+        // Do not remember aborted queries, the next lookup shall retry.
+        if (ec != asio::error::operation_aborted) {
+            auto now = Clock::now();
+            Entry entry;
+            entry.ec = ec;
+            entry.addresses = pq->addresses;
+            entry.added = now;
+            entry.expires = now + ( ec ? Clock::duration(negative_ttl)
+                                       : clamp_ttl(answer.ttl));
+            if (auto old = state->entries.get(key)) entry.hits = old->hits;
+            state->entries.put(key, move(entry));
+        }
+
+        LOG_DEBUG("Resolver cache: query for ", host, " done; ec=", ec
+                 , " naddrs=", pq->addresses.size());
+        pq->cv.notify();
+    }));
+
+    return p;
+}
+
+ResolverCache::ResolverCache(const asio::executor& ex, size_t max_entries)
+    : _state(make_shared<State>(ex, max_entries))
+{}
+
+ResolverCache::~ResolverCache()
+{
+    stop();
+}
+
+void ResolverCache::stop()
+{
+    _state->stopped();
+}
+
+size_t ResolverCache::size() const
+{
+    return _state->entries.size();
+}
+
+metrics::CallbackGauges
+ResolverCache::export_metrics() const
+{
+    auto& r = metrics::registry();
+    metrics::CallbackGauges gs;
+    gs.push_back(r.callback_gauge( "ouinet_resolver_cache_entries"
+                                 , "Cached name resolutions", {}
+                                 , [this] { return size(); }));
+    gs.push_back(r.callback_gauge( "ouinet_resolver_pending_queries"
+                                 , "Ongoing name resolution queries", {}
+                                 , [state = _state] { return state->pending.size(); }));
+    return gs;
+}
+
+Addresses
+ResolverCache::resolve( const string& resolver
+                      , const string& host
+                      , const Query& query
+                      , Cancel& cancel
+                      , asio::yield_context yield)
+{
+    if (cancel || _state->stopped)
+        return or_throw<Addresses>(yield, asio::error::operation_aborted);
+
+    // Network addresses need no query.
+    {
+        sys::error_code e;
+        auto addr = asio::ip::make_address(host, e);
+        if (!e) return Addresses{move(addr)};
+    }
+
+    // Host names cannot contain spaces.
+    auto key = resolver + ' ' + host;
+    auto now = Clock::now();
+
+    static auto& hits = metrics::registry().counter
+        ("ouinet_resolver_lookups_total", "Name lookups", {{"result", "hit"}});
+    static auto& misses = metrics::registry().counter
+        ("ouinet_resolver_lookups_total", "Name lookups", {{"result", "miss"}});
+
+    if (auto entry = _state->entries.get(key)) {
+        if (entry->expires > now) {
+            hits.inc();
+            ++entry->hits;
+
+            // Refresh popular answers before they expire,
+            // so that later lookups do not need to wait for the query.
+            auto lifetime = entry->expires - entry->added;
+            if ( !entry->ec && entry->hits >= prefetch_min_hits
+               && entry->expires - now < lifetime / prefetch_lifetime_divisor) {
+                LOG_DEBUG("Resolver cache: refreshing ", host, " via ", resolver);
+                start_query(_state, key, host, query);
+            }
+
+            return or_throw(yield, entry->ec, entry->addresses);
+        }
+    }
+
+    misses.inc();
+    auto pq = start_query(_state, key, host, query);
+
+    sys::error_code ec;
+    if (!pq->done) pq->cv.wait(cancel, yield[ec]);
+    ec = compute_error_code(ec, cancel);
+    if (!ec) ec = pq->ec;
+
+    return or_throw(yield, ec, pq->addresses);
+}
+
+TcpLookup
+ResolverCache::resolve( const string& resolver
+                      , const string& host
+                      , const string& port
+                      , const Query& query
+                      , Cancel& cancel
+                      , asio::yield_context yield)
+{
+    using TcpEndpoint = TcpLookup::endpoint_type;
+
+    boost::string_view portsv(port);
+    auto portn_o = parse::number<unsigned short>(portsv);
+    if (!portn_o) return or_throw<TcpLookup>(yield, asio::error::invalid_argument);
+
+    sys::error_code ec;
+    auto addrs = resolve(resolver, host, query, cancel, yield[ec]);
+    if (ec) return or_throw<TcpLookup>(yield, ec);
+
+    vector<TcpEndpoint> eps;
+    eps.reserve(addrs.size());
+    for (auto& a : addrs) eps.emplace_back(a, *portn_o);
+
+    return TcpLookup::create(eps.begin(), eps.end(), host, port);
+}
+
+/* static */
+ResolverCache::Query
+ResolverCache::system_query(const asio::executor& ex)
+{
+    return [ex] (const string& host, Cancel& cancel, asio::yield_context yield) {
+        sys::error_code ec;
+        auto lookup = util::tcp_async_resolve(host, "0", ex, cancel, yield[ec]);
+        if (ec) return or_throw<Answer>(yield, ec);
+
+        Answer answer;
+        for (auto& r : lookup) {
+            auto addr = r.endpoint().address();
+            auto& as = answer.addresses;
+            // Avoid duplicates caused by different socket types or protocols.
+            if (find(as.begin(), as.end(), addr) == as.end())
+                as.push_back(move(addr));
+        }
+        return answer;
+    };
+}
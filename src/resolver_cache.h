@@ -0,0 +1,116 @@
+// Name resolution cache shared by origin connections.
+//
+// Answers are kept for as long as their TTLs allow (or a default time
+// if the query mechanism does not provide TTLs), failed resolutions are
+// also cached for a short time, concurrent lookups of the same name are
+// coalesced into a single query, and answers for names which are looked up
+// often are refreshed in the background shortly before they expire.
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/optional.hpp>
+
+#include "namespaces.h"
+#include "util/metrics.h"
+#include "util/signal.h"
+
+namespace ouinet {
+
+class ResolverCache {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Addresses = std::vector<asio::ip::address>;
+    using TcpLookup = asio::ip::tcp::resolver::results_type;
+
+    struct Answer {
+        Addresses addresses;
+        // How long the answer may be cached, if known.
+        boost::optional<Clock::duration> ttl;
+    };
+
+    // Performs the actual query for the given host name.
+    //
+    // Since the query may be shared with other lookups or run in the background
+    // (i.e. outlive the lookup which provided it),
+    // it should not refer to objects owned by the caller.
+    using Query = std::function<Answer(const std::string& host, Cancel&, asio::yield_context)>;
+
+    // Used for answers with no known TTL.
+    static constexpr auto default_ttl = std::chrono::minutes(1);
+    // Clamp TTLs to avoid re-querying too often or using very old answers.
+    static constexpr auto min_ttl = std::chrono::seconds(5);
+    static constexpr auto max_ttl = std::chrono::hours(1);
+    // How long failed resolutions are remembered.
+    static constexpr auto negative_ttl = std::chrono::seconds(10);
+    // Upper bound to the duration of a query.
+    static constexpr auto query_timeout = std::chrono::seconds(30);
+
+public:
+    ResolverCache(const asio::executor&, size_t max_entries = 1000);
+
+    ResolverCache(const ResolverCache&) = delete;
+    ResolverCache& operator=(const ResolverCache&) = delete;
+
+    ~ResolverCache();
+
+    // Get the addresses of the given host
+    // (from the cache, an ongoing query or the given `query`)
+    // as a lookup result for the given port.
+    //
+    // Answers are kept apart for each `resolver`
+    // (a name for the way `query` gets them, e.g. the system resolver or a DoH endpoint),
+    // since different resolvers may give different answers for the same host.
+    //
+    // Network addresses are returned as is, without querying.
+    TcpLookup resolve( const std::string& resolver
+                     , const std::string& host
+                     , const std::string& port
+                     , const Query&
+                     , Cancel&
+                     , asio::yield_context);
+
+    // Same as above, returning just the addresses.
+    Addresses resolve( const std::string& resolver
+                     , const std::string& host
+                     , const Query&
+                     , Cancel&
+                     , asio::yield_context);
+
+    // Cancel ongoing queries and stop refreshing answers.
+    void stop();
+
+    // Number of cached answers (including failed resolutions).
+    size_t size() const;
+
+    // Export statistics as metrics for as long as the result is kept.
+    metrics::CallbackGauges export_metrics() const;
+
+    // A query for `resolve` which uses the system resolver.
+    // It provides no TTLs.
+    static Query system_query(const asio::executor&);
+
+private:
+    struct Entry;
+    struct PendingQuery;
+    struct State;
+
+    static
+    std::shared_ptr<PendingQuery> start_query( const std::shared_ptr<State>&
+                                             , const std::string& key
+                                             , const std::string& host
+                                             , Query);
+
+private:
+    std::shared_ptr<State> _state;
+};
+
+} // ouinet namespace
@@ -48,6 +48,28 @@ DummyCertificate::DummyCertificate( CACertificate& ca_cert
     }
 }
 
+/* static */
+bool DummyCertificate::is_valid_pem( CACertificate& ca_cert
+                                   , const string& pem
+                                   , long min_validity)
+{
+    BIO* bio = BIO_new_mem_buf(pem.data(), pem.size());
+    if (!bio) return false;
+    X509* x = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+    BIO_free_all(bio);
+    if (!x) return false;
+
+    // The key of the CA contains the public part too.
+    bool valid = X509_verify(x, ca_cert.get_private_key()) == 1;
+
+    if (valid) {
+        time_t t = time(nullptr) + min_validity;
+        valid = X509_cmp_time(X509_get0_notAfter(x), &t) > 0;
+    }
+
+    X509_free(x);
+    return valid;
+}
 
 DummyCertificate::~DummyCertificate()
 {
@@ -24,6 +24,13 @@ public:
 
     const std::string& pem_certificate() const { return _pem_certificate; }
 
+    // Whether the given PEM certificate was signed by the CA
+    // and is still valid for at least `min_validity` seconds
+    // (e.g. to reuse a previously generated certificate).
+    static bool is_valid_pem( CACertificate&
+                            , const std::string& pem
+                            , long min_validity);
+
     ~DummyCertificate();
 
 private:
@@ -0,0 +1,413 @@
+#include "server_context_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include "ca_certificate.h"
+#include "dummy_certificate.h"
+#include "util.h"
+#include "../util/concurrent_async_queue.h"
+#include "../util/condition_variable.h"
+#include "../util/lru_cache.h"
+#include "../util/spawn.h"
+#include "../logger.h"
+#include "../or_throw.h"
+
+using namespace std;
+using namespace ouinet;
+
+using ContextPtr = ServerContextCache::ContextPtr;
+
+// Stored certificates are generated again if they expire sooner than this.
+static const long min_stored_validity = 30 * ssl::util::ONE_HOUR * 24;
+// Requests for new contexts waiting for the worker thread.
+static const size_t max_queued_builds = 1024;
+
+enum class Source { memory, store, generated };
+
+static
+metrics::Counter& contexts_counter(Source s)
+{
+    static const char* names[] = {"memory", "store", "generated"};
+    auto& r = metrics::registry();
+    return r.counter( "ouinet_mitm_contexts_total"
+                    , "TLS server contexts for intercepted connections by source"
+                    , {{"source", names[int(s)]}});
+}
+
+static
+string normalize_domain(string d)
+{
+    transform(d.begin(), d.end(), d.begin(), [] (unsigned char c) { return tolower(c); });
+    return d;
+}
+
+// Only simple host names are used as file names.
+static
+bool is_storable(const string& domain)
+{
+    if (domain.empty() || domain.size() > 253 || domain[0] == '.') return false;
+    return all_of(domain.begin(), domain.end(), [] (unsigned char c) {
+        return isalnum(c) || c == '.' || c == '-' || c == '_';
+    });
+}
+
+struct ServerContextCache::Pending {
+    ConditionVariable cv;
+    bool done = false;
+    ContextPtr context;
+    sys::error_code ec;
+
+    Pending(const asio::executor& ex) : cv(ex) {}
+};
+
+struct ServerContextCache::State {
+    asio::executor ex;
+    util::LruCache<string, ContextPtr> contexts;
+    map<string, shared_ptr<Pending>> pending;
+    Cancel stopped;
+
+    State(const asio::executor& ex, size_t max_contexts)
+        : ex(ex)
+        , contexts(max_contexts)
+    {}
+
+    // Called in the thread of `ex`.
+    void on_built(const string& domain, ContextPtr ctx, sys::error_code ec)
+    {
+        if (!ec && !stopped) contexts.put(domain, ctx);
+
+        auto i = pending.find(domain);
+        if (i == pending.end()) return;  // built ahead of time
+        auto p = move(i->second);
+        pending.erase(i);
+
+        p->done = true;
+        p->context = move(ctx);
+        p->ec = ec;
+        p->cv.notify();
+    }
+};
+
+// Owns the thread where certificates are signed and contexts are built.
+// It is the only user of the CA certificate for signing.
+class ServerContextCache::Worker {
+public:
+    using OnBuilt = function<void(string domain, ContextPtr, sys::error_code)>;
+
+    Worker( CACertificate& ca
+          , fs::path store_dir
+          , size_t max_stored
+          , size_t warm_up
+          , OnBuilt on_built)
+        : jobs(max_queued_builds)
+        , _ca(ca)
+        , _store_dir(max_stored ? move(store_dir) : fs::path())
+        , _max_stored(max_stored)
+        , _on_built(move(on_built))
+    {
+        _thread = thread([this, warm_up] {
+            util::spawn(_ctx, [this, warm_up] (asio::yield_context yield) {
+                run(warm_up, yield);
+            });
+            _ctx.run();
+        });
+    }
+
+    ~Worker() { stop(); }
+
+    void stop()
+    {
+        if (!_thread.joinable()) return;
+        // The signal may only be used from the worker thread.
+        asio::post(_ctx, [this] { _stopped(); });
+        _thread.join();
+    }
+
+    util::ConcurrentAsyncQueue<string> jobs;
+
+private:
+    void run(size_t warm_up, asio::yield_context yield)
+    {
+        if (!_store_dir.empty()) {
+            sys::error_code ec;
+            fs::create_directories(_store_dir, ec);
+            if (ec) {
+                LOG_WARN("MitM contexts: Failed to create certificate store; ec=", ec);
+                _store_dir.clear();
+            }
+        }
+
+        auto stored = prune_store(_max_stored);
+        stored.resize(min(warm_up, stored.size()));
+
+        for (auto& domain : stored) {
+            build(domain, false);
+            // Let stopping interrupt this.
+            asio::post(_ctx, yield);
+            if (_stopped) return;
+        }
+
+        // Stopping may happen even before this coroutine starts.
+        while (!_stopped) {
+            sys::error_code ec;
+            auto domain = jobs.async_pop(_stopped, yield[ec]);
+            if (ec) return;
+            build(domain, true);
+        }
+    }
+
+    fs::path store_path(const string& domain) const
+    {
+        if (_store_dir.empty() || !is_storable(domain)) return {};
+        return _store_dir / (domain + ".pem");
+    }
+
+    // Remove all but the `keep` most recently used certificates in the store,
+    // and return their domains, most recently used first.
+    vector<string> prune_store(size_t keep)
+    {
+        vector<pair<time_t, fs::path>> found;
+        if (_store_dir.empty()) return {};
+
+        sys::error_code ec;
+        for (fs::directory_iterator i(_store_dir, ec), end; !ec && i != end; i.increment(ec)) {
+            auto& path = i->path();
+            if (path.extension() != ".pem") continue;
+            sys::error_code ec_;
+            auto t = fs::last_write_time(path, ec_);
+            if (!ec_) found.emplace_back(t, path);
+        }
+
+        sort( found.begin(), found.end()
+            , [] (auto& a, auto& b) { return a.first > b.first; });
+
+        vector<string> ret;
+        for (size_t i = 0; i < found.size(); ++i) {
+            auto& path = found[i].second;
+            if (i < keep) {
+                ret.push_back(path.stem().string());
+                continue;
+            }
+            sys::error_code ec_;
+            fs::remove(path, ec_);
+        }
+
+        if (found.size() > keep)
+            LOG_DEBUG("MitM contexts: Removed old stored certificates: ", found.size() - keep);
+
+        _stored = ret.size();
+        return ret;
+    }
+
+    string load(const fs::path& path, bool touch) const
+    {
+        if (path.empty()) return {};
+
+        fs::ifstream f(path);
+        if (!f) return {};
+        ostringstream ss;
+        ss << f.rdbuf();
+        auto pem = ss.str();
+
+        if (!DummyCertificate::is_valid_pem(_ca, pem, min_stored_validity)) return {};
+
+        if (touch) {
+            sys::error_code ec;
+            fs::last_write_time(path, time(nullptr), ec);
+        }
+        return pem;
+    }
+
+    void store(const fs::path& path, const string& pem)
+    {
+        if (path.empty()) return;
+
+        sys::error_code ec;
+        bool is_new = !fs::exists(path, ec);
+
+        auto tmp = path;
+        tmp += ".tmp";
+        {
+            fs::ofstream f(tmp, ios::binary | ios::trunc);
+            f << pem;
+            if (!f.flush()) {
+                LOG_WARN("MitM contexts: Failed to store certificate: ", path);
+                return;
+            }
+        }
+        fs::rename(tmp, path, ec);
+        if (ec) {
+            LOG_WARN("MitM contexts: Failed to store certificate: ", path, "; ec=", ec);
+            return;
+        }
+
+        // Leave some room before pruning again, since it scans the whole store.
+        if (is_new && ++_stored > _max_stored)
+            prune_store(_max_stored - _max_stored / 8);
+    }
+
+    void build(const string& domain, bool touch)
+    {
+        auto path = store_path(domain);
+
+        ContextPtr ctx;
+        sys::error_code ec;
+
+        try {
+            auto pem = load(path, touch);
+            auto source = Source::store;
+
+            if (pem.empty()) {
+                DummyCertificate crt(_ca, domain);
+                pem = crt.pem_certificate();
+                store(path, pem);
+                source = Source::generated;
+            }
+
+            ctx = make_shared<asio::ssl::context>(ssl::util::get_server_context
+                ( pem + _ca.pem_certificate()
+                , _ca.pem_private_key()
+                , _ca.pem_dh_param()));
+
+            contexts_counter(source).inc();
+        } catch (const exception& e) {
+            LOG_ERROR("MitM contexts: Failed to build context for ", domain, ": ", e.what());
+            ec = asio::error::no_recovery;
+        }
+
+        _on_built(domain, move(ctx), ec);
+    }
+
+private:
+    CACertificate& _ca;
+    fs::path _store_dir;
+    size_t _max_stored;
+    size_t _stored = 0;  // certificates in the store
+    OnBuilt _on_built;
+    asio::io_context _ctx;
+    Cancel _stopped;
+    thread _thread;
+};
+
+ServerContextCache::ServerContextCache( const asio::executor& ex
+                                      , CACertificate& ca
+                                      , fs::path store_dir
+                                      , size_t max_contexts
+                                      , size_t warm_up
+                                      , size_t max_stored)
+    : _state(make_shared<State>(ex, max_contexts))
+{
+    auto on_built = [state = _state] (string domain, ContextPtr ctx, sys::error_code ec) {
+        // Called in the worker thread.
+        asio::post(state->ex, [ state
+                              , domain = move(domain)
+                              , ctx = move(ctx)
+                              , ec] {
+            state->on_built(domain, ctx, ec);
+        });
+    };
+
+    _worker = make_unique<Worker>(ca, move(store_dir), max_stored, warm_up, move(on_built));
+}
+
+ServerContextCache::~ServerContextCache()
+{
+    stop();
+}
+
+void ServerContextCache::stop()
+{
+    _worker->stop();
+
+    if (_state->stopped) return;
+    _state->stopped();
+
+    auto pending = move(_state->pending);
+    for (auto& p : pending) {
+        p.second->done = true;
+        p.second->ec = asio::error::operation_aborted;
+        p.second->cv.notify();
+    }
+}
+
+size_t ServerContextCache::size() const
+{
+    return _state->contexts.size();
+}
+
+metrics::CallbackGauges
+ServerContextCache::export_metrics() const
+{
+    auto& r = metrics::registry();
+    metrics::CallbackGauges gs;
+    gs.push_back(r.callback_gauge( "ouinet_mitm_context_cache_entries"
+                                 , "Ready TLS server contexts for intercepted connections", {}
+                                 , [this] { return size(); }));
+    gs.push_back(r.callback_gauge( "ouinet_mitm_pending_builds"
+                                 , "TLS server contexts being built", {}
+                                 , [state = _state] { return state->pending.size(); }));
+    return gs;
+}
+
+void ServerContextCache::prefetch(const string& base_domain)
+{
+    if (_state->stopped) return;
+
+    auto domain = normalize_domain(base_domain);
+    if (_state->contexts.exists(domain) || _state->pending.count(domain)) return;
+
+    // Do not wait if the worker is busy, this is just a hint.
+    if (!_worker->jobs.try_push(domain)) return;
+    _state->pending[domain] = make_shared<Pending>(_state->ex);
+}
+
+ContextPtr
+ServerContextCache::get( const string& base_domain
+                       , Cancel& cancel
+                       , asio::yield_context yield)
+{
+    if (cancel || _state->stopped)
+        return or_throw<ContextPtr>(yield, asio::error::operation_aborted);
+
+    auto domain = normalize_domain(base_domain);
+
+    if (auto ctx = _state->contexts.get(domain)) {
+        contexts_counter(Source::memory).inc();
+        return *ctx;
+    }
+
+    sys::error_code ec;
+    auto& pending = _state->pending[domain];
+    auto p = pending;
+
+    if (!p) {
+        p = pending = make_shared<Pending>(_state->ex);
+        // Other requests for the domain wait for this one,
+        // so only stopping the cache aborts queuing.
+        _worker->jobs.async_push(domain, _state->stopped, yield[ec]);
+        if (ec) {
+            _state->pending.erase(domain);
+            p->done = true;
+            p->ec = ec;
+            p->cv.notify();
+            return or_throw<ContextPtr>(yield, ec);
+        }
+    }
+
+    if (!p->done) p->cv.wait(cancel, yield[ec]);
+    ec = compute_error_code(ec, cancel);
+    if (!ec) ec = p->ec;
+
+    return or_throw(yield, ec, p->context);
+}
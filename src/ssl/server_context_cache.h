@@ -0,0 +1,87 @@
+// TLS server contexts for the interception (MitM) of HTTPS connections.
+//
+// Building a context for a domain means signing a dummy certificate for it
+// with the client's CA (only the first time ever, since certificates
+// are kept in an on-disk store), then parsing the certificate chain,
+// CA private key and DH parameters into a new `asio::ssl::context`.
+// All of that happens in a worker thread, and ready contexts are kept
+// in memory and shared by all connections to the same domain.
+//
+// Concurrent requests for the same domain wait for a single build,
+// and contexts for the most recently used domains in the store
+// are built ahead of time when the cache is created.
+// Only certificates for the most recently used domains are kept in the store.
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/filesystem.hpp>
+
+#include "../namespaces.h"
+#include "../util/metrics.h"
+#include "../util/signal.h"
+
+namespace ouinet {
+
+class CACertificate;
+
+class ServerContextCache {
+public:
+    using ContextPtr = std::shared_ptr<asio::ssl::context>;
+
+    static const size_t default_max_contexts = 256;
+    // How many stored domains to build contexts for on creation.
+    static const size_t default_warm_up = 32;
+    // How many certificates to keep in the store.
+    static const size_t default_max_stored = 4096;
+
+public:
+    // The CA certificate must outlive the cache,
+    // and it must not be used for signing by anybody else.
+    //
+    // If `store_dir` is empty or `max_stored` is zero,
+    // generated certificates are not stored.
+    ServerContextCache( const asio::executor&
+                      , CACertificate&
+                      , fs::path store_dir
+                      , size_t max_contexts = default_max_contexts
+                      , size_t warm_up = default_warm_up
+                      , size_t max_stored = default_max_stored);
+
+    ServerContextCache(const ServerContextCache&) = delete;
+    ServerContextCache& operator=(const ServerContextCache&) = delete;
+
+    ~ServerContextCache();
+
+    // Get a context for serving the given base domain
+    // (i.e. `example.com` for `*.example.com` and `example.com` itself).
+    ContextPtr get(const std::string& base_domain, Cancel&, asio::yield_context);
+
+    // Have the context for the given base domain built in the background
+    // if it is not already there, e.g. because it is likely to be needed soon.
+    void prefetch(const std::string& base_domain);
+
+    // Abort waiting requests and stop the worker thread.
+    void stop();
+
+    // Number of ready contexts.
+    size_t size() const;
+
+    // Export statistics as metrics for as long as the result is kept.
+    metrics::CallbackGauges export_metrics() const;
+
+private:
+    struct Pending;
+    struct State;
+    class Worker;
+
+private:
+    std::shared_ptr<State> _state;
+    std::unique_ptr<Worker> _worker;
+};
+
+} // ouinet namespace
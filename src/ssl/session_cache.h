@@ -0,0 +1,228 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include <openssl/ssl.h>
+
+#include <boost/asio/ssl/context.hpp>
+
+#include "../namespaces.h"
+#include "../util/lru_cache.h"
+#include "../util/metrics.h"
+
+
+namespace ouinet { namespace ssl { namespace util {
+
+// Client-side cache of TLS sessions (either session IDs or tickets)
+// for the resumption of later sessions with the same host,
+// which saves a round trip and most of the handshake computation.
+//
+// The cache is attached to (and owned by) an SSL context,
+// and `client_handshake` uses it for connections with that context.
+// Sessions are kept per key (the SNI host name unless another one is given,
+// e.g. the endpoint of a peer without a host name),
+// up to a maximum number of keys and for a limited time.
+//
+// TLS 1.3 tickets should not be used more than once (RFC8446#C.4),
+// so a few of them are kept per key,
+// and each one is only offered to a single handshake.
+class SessionCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        size_t resumed = 0;  // handshakes which resumed a cached session
+        size_t full = 0;  // handshakes which did not
+    };
+
+    static const size_t default_max_entries = 1000;
+    static const size_t max_sessions_per_key = 4;
+    static Clock::duration default_max_age() { return std::chrono::hours(1); }
+
+public:
+    // Create a cache for sessions of client connections using the context.
+    // Calling it again on the same context has no effect.
+    static void enable( asio::ssl::context&
+                      , size_t max_entries = default_max_entries
+                      , Clock::duration max_age = default_max_age());
+
+    // Return the cache attached to the context, or null if none.
+    static SessionCache* get(SSL_CTX*);
+    static SessionCache* get(asio::ssl::context& ctx) { return get(ctx.native_handle()); }
+
+    // Set a cached session (if any) for the given `key`
+    // to be resumed by the handshake of `ssl`,
+    // and keep new sessions of `ssl` under that key.
+    void offer(SSL* ssl, const std::string& key);
+
+    // Account for a completed handshake of `ssl`.
+    void on_handshake(SSL* ssl);
+
+    Stats stats() const { return _stats; }
+    size_t size() const { return _entries.size(); }
+
+    // Export statistics as metrics (labelled with the given `name`)
+    // for as long as the result is kept.
+    metrics::CallbackGauges export_metrics(const std::string& name) const;
+
+private:
+    SessionCache(size_t max_entries, Clock::duration max_age)
+        : _entries(max_entries)
+        , _max_age(max_age)
+    {}
+
+    struct Entry {
+        std::shared_ptr<SSL_SESSION> session;
+        Clock::time_point expires;
+    };
+
+    // Newest sessions first.
+    using Entries = std::deque<Entry>;
+
+    static int ex_data_index();
+    static int ssl_key_index();
+    static int on_new_session(SSL*, SSL_SESSION*);
+
+private:
+    ouinet::util::LruCache<std::string, Entries> _entries;
+    Clock::duration _max_age;
+    Stats _stats;
+};
+
+inline
+int SessionCache::ex_data_index()
+{
+    static const int index = ::SSL_CTX_get_ex_new_index
+        ( 0, nullptr, nullptr, nullptr
+        , [] (void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*) {
+              delete static_cast<SessionCache*>(ptr);
+          });
+    return index;
+}
+
+// The key of sessions of an `SSL` object, set by `offer`.
+inline
+int SessionCache::ssl_key_index()
+{
+    static const int index = ::SSL_get_ex_new_index
+        ( 0, nullptr, nullptr, nullptr
+        , [] (void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*) {
+              delete static_cast<std::string*>(ptr);
+          });
+    return index;
+}
+
+inline
+void SessionCache::enable( asio::ssl::context& ctx
+                         , size_t max_entries
+                         , Clock::duration max_age)
+{
+    auto ssl_ctx = ctx.native_handle();
+    if (get(ssl_ctx)) return;
+
+    ::SSL_CTX_set_ex_data( ssl_ctx, ex_data_index()
+                         , new SessionCache(max_entries, max_age));
+
+    // With TLS 1.3, tickets arrive after the handshake,
+    // so new sessions are collected via this callback.
+    ::SSL_CTX_set_session_cache_mode( ssl_ctx
+                                    , SSL_SESS_CACHE_CLIENT
+                                    | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    ::SSL_CTX_sess_set_new_cb(ssl_ctx, on_new_session);
+}
+
+inline
+SessionCache* SessionCache::get(SSL_CTX* ssl_ctx)
+{
+    return static_cast<SessionCache*>(::SSL_CTX_get_ex_data(ssl_ctx, ex_data_index()));
+}
+
+inline
+void SessionCache::offer(SSL* ssl, const std::string& key)
+{
+    delete static_cast<std::string*>(::SSL_get_ex_data(ssl, ssl_key_index()));
+    ::SSL_set_ex_data(ssl, ssl_key_index(), new std::string(key));
+
+    auto entries = _entries.get(key);
+    if (!entries) return;
+
+    auto now = Clock::now();
+
+    while (!entries->empty()) {
+        auto session = entries->front().session.get();
+
+        if (entries->front().expires <= now || !::SSL_SESSION_is_resumable(session)) {
+            entries->pop_front();
+            continue;
+        }
+
+        ::SSL_set_session(ssl, session);  // it keeps its own reference
+
+        // Unlike TLS 1.2 session IDs, tickets are single-use.
+        if (::SSL_SESSION_get_protocol_version(session) >= TLS1_3_VERSION)
+            entries->pop_front();
+        return;
+    }
+}
+
+inline
+void SessionCache::on_handshake(SSL* ssl)
+{
+    if (::SSL_session_reused(ssl)) ++_stats.resumed;
+    else                           ++_stats.full;
+}
+
+inline
+metrics::CallbackGauges SessionCache::export_metrics(const std::string& name) const
+{
+    auto& r = metrics::registry();
+    metrics::CallbackGauges gs;
+    gs.push_back(r.callback_counter( "ouinet_tls_handshakes_total"
+                                   , "Client TLS handshakes"
+                                   , {{"context", name}, {"session", "resumed"}}
+                                   , [this] { return _stats.resumed; }));
+    gs.push_back(r.callback_counter( "ouinet_tls_handshakes_total"
+                                   , "Client TLS handshakes"
+                                   , {{"context", name}, {"session", "full"}}
+                                   , [this] { return _stats.full; }));
+    gs.push_back(r.callback_gauge( "ouinet_tls_session_cache_entries"
+                                 , "Cached TLS sessions"
+                                 , {{"context", name}}
+                                 , [this] { return _entries.size(); }));
+    return gs;
+}
+
+/* static */
+inline
+int SessionCache::on_new_session(SSL* ssl, SSL_SESSION* session)
+{
+    auto cache = get(::SSL_get_SSL_CTX(ssl));
+    if (!cache) return 0;  // do not keep a reference
+
+    auto key = static_cast<const std::string*>(::SSL_get_ex_data(ssl, ssl_key_index()));
+    if (!key) return 0;  // not offered any session, so not keyed
+
+    // Do not keep sessions for longer than the server allows.
+    auto max_age = std::min<Clock::duration>
+        (cache->_max_age, std::chrono::seconds(::SSL_SESSION_get_timeout(session)));
+
+    // Keep a copy, since connections are closed without a TLS shutdown,
+    // which marks their sessions as not resumable.
+    auto copy = ::SSL_SESSION_dup(session);
+    if (!copy) return 0;
+
+    Entry entry;
+    entry.session = std::shared_ptr<SSL_SESSION>(copy, ::SSL_SESSION_free);
+    entry.expires = Clock::now() + max_age;
+
+    auto entries = cache->_entries.get(*key);
+    if (!entries) entries = cache->_entries.put(*key, Entries{});
+    entries->push_front(std::move(entry));
+    if (entries->size() > max_sessions_per_key) entries->pop_back();
+    return 0;  // we do not keep a reference to the original session
+}
+
+}}} // namespaces
@@ -11,6 +11,7 @@
 #include "../generic_stream.h"
 #include "../or_throw.h"
 #include "../util/signal.h"
+#include "session_cache.h"
 
 
 namespace ouinet { namespace ssl { namespace util {
@@ -49,12 +50,16 @@ static inline std::string read_bio(BIO* bio) {
 //
 // The verification is done for the given `host` name (if non-empty),
 // using SNI.  Verification against a valid CA is done in any case.
+//
+// If the context has a `SessionCache`, a previous session
+// with the same `session_key` is resumed if possible.
 template<class Stream>
 static inline
 ouinet::GenericStream
 client_handshake( Stream&& con
                 , boost::asio::ssl::context& ssl_context
                 , const std::string& host
+                , const std::string& session_key
                 , Signal<void()>& abort_signal
                 , boost::asio::yield_context yield)
 {
@@ -74,12 +79,18 @@ client_handshake( Stream&& con
     if (check_host && !::SSL_set_tlsext_host_name(ssl_sock->native_handle(), host.c_str()))
         ec = {static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category()};
 
+    auto session_cache = SessionCache::get(ssl_context);
+    if (!ec && session_cache)
+        session_cache->offer(ssl_sock->native_handle(), session_key);
+
     if (!ec) {
         auto slot = abort_signal.connect([&] { ssl_sock->next_layer().close(); });
         ssl_sock->async_handshake(ssl::stream_base::client, yield[ec]);
     }
     return_or_throw_on_error(yield, abort_signal, ec, GenericStream{});
 
+    if (session_cache) session_cache->on_handshake(ssl_sock->native_handle());
+
     static const auto ssl_shutter = [](ssl::stream<Stream>& s) {
         // Just close the underlying connection
         // (TLS has no message exchange for shutdown).
@@ -89,6 +100,20 @@ client_handshake( Stream&& con
     return GenericStream(move(ssl_sock), move(ssl_shutter));
 }
 
+// Same as above, with sessions kept per `host`.
+template<class Stream>
+static inline
+ouinet::GenericStream
+client_handshake( Stream&& con
+                , boost::asio::ssl::context& ssl_context
+                , const std::string& host
+                , Signal<void()>& abort_signal
+                , boost::asio::yield_context yield)
+{
+    return client_handshake( std::forward<Stream>(con), ssl_context
+                           , host, host, abort_signal, yield);
+}
+
 static inline
 boost::asio::ssl::context
 get_server_context( const std::string& cert_chain
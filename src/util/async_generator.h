@@ -54,7 +54,7 @@ public:
         , _shutdown_cancel(_lifetime_cancel)
         , _wc(ex)
     {
-        asio::spawn(ex, [ self = this
+        util::spawn(ex, [ self = this
                         , gen = std::move(gen)
                         , lifetime_cancel = _lifetime_cancel
                         , shutdown_cancel = _shutdown_cancel
@@ -2,6 +2,7 @@
 
 #include "../defer.h"
 #include "condition_variable.h"
+#include "spawn.h"
 
 namespace ouinet {
 
@@ -55,7 +56,7 @@ public:
         if (_self) return;
 
         AsyncJob* s = this;
-        asio::spawn(_ex, [s, job = std::move(job)]
+        util::spawn(_ex, [s, job = std::move(job)]
                          (asio::yield_context yield) {
             AsyncJob* self = s;
 
@@ -0,0 +1,249 @@
+#pragma once
+
+// A bounded queue which, unlike `AsyncQueue`, may be pushed to and popped
+// from coroutines (or plain threads) running on different threads,
+// e.g. to hand results of crypto or disk work back to the I/O thread.
+//
+// Elements are kept in a lock-free ring (`MpmcRing`).
+// Coroutines only lock a mutex when they need to wait
+// for the queue to become non-empty (or non-full),
+// and they are only woken up once per batch of pushes (or pops),
+// since waking up removes them from the list of waiters.
+//
+// `async_push` and `async_pop` behave like those of `AsyncQueue`,
+// though `async_push` waits when the queue is full instead of growing it.
+
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <queue>
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/optional.hpp>
+
+#include "../namespaces.h"
+#include "../or_throw.h"
+#include "mpmc_ring.h"
+#include "signal.h"
+
+namespace ouinet { namespace util {
+
+namespace concurrent_async_queue_detail {
+
+// Coroutines waiting on a condition which may change in other threads.
+class WaitList {
+private:
+    using Handler = std::function<void(sys::error_code)>;
+
+    struct Waiter {
+        Handler handler;
+        // Keeps the context of the waiting coroutine running, like other
+        // asynchronous operations do.
+        asio::executor_work_guard<asio::executor> work;
+        bool done = false;  // taken from the list to be woken up
+
+        Waiter(Handler h, asio::executor ex)
+            : handler(std::move(h)), work(std::move(ex)) {}
+
+        void post(sys::error_code ec)
+        {
+            asio::post(work.get_executor(), [h = std::move(handler), ec] { h(ec); });
+            work.reset();
+        }
+    };
+
+    using Waiters = std::list<std::shared_ptr<Waiter>>;
+
+public:
+    // The condition must be checked again after this returns
+    // (even without an error), as other waiters may have been faster.
+    // `recheck` is called after registering and,
+    // if it returns true, the wait finishes right away,
+    // so that notifications in between are not lost.
+    template<class Recheck>
+    void wait(Cancel& cancel, Recheck&& recheck, asio::yield_context yield)
+    {
+        if (cancel) return or_throw(yield, asio::error::operation_aborted);
+
+        asio::async_completion<asio::yield_context, void(sys::error_code)> init(yield);
+
+        // Get the executor before erasing the type of the handler.
+        asio::executor ex = asio::get_associated_executor(init.completion_handler);
+        auto w = std::make_shared<Waiter>(std::move(init.completion_handler), std::move(ex));
+
+        typename Waiters::iterator wi;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            wi = _waiters.insert(_waiters.end(), w);
+            _count.fetch_add(1);
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        auto wake_up = [&] (sys::error_code ec) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (w->done) return;  // already being woken up
+                w->done = true;
+                _waiters.erase(wi);
+                _count.fetch_sub(1);
+            }
+            w->post(ec);
+        };
+
+        if (recheck()) wake_up(sys::error_code());
+
+        auto slot = cancel.connect([&] { wake_up(asio::error::operation_aborted); });
+
+        init.result.get();
+    }
+
+    void notify_all(sys::error_code ec = {})
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // Cheap check so that producers and consumers which do not need
+        // to wake anybody up need not lock the mutex.
+        if (_count.load() == 0) return;
+
+        Waiters waiters;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            waiters.swap(_waiters);
+            _count.store(0);
+            for (auto& w : waiters) w->done = true;
+        }
+
+        for (auto& w : waiters) w->post(ec);
+    }
+
+private:
+    std::mutex _mutex;
+    Waiters _waiters;
+    std::atomic<size_t> _count{0};
+};
+
+} // concurrent_async_queue_detail namespace
+
+template<class T>
+class ConcurrentAsyncQueue {
+private:
+    using Item = std::pair<T, sys::error_code>;
+
+public:
+    // The capacity is rounded up to a power of two.
+    explicit ConcurrentAsyncQueue(size_t capacity)
+        : _ring(capacity)
+    {}
+
+    ConcurrentAsyncQueue(const ConcurrentAsyncQueue&) = delete;
+    ConcurrentAsyncQueue& operator=(const ConcurrentAsyncQueue&) = delete;
+
+    // Any waiting coroutines must be gone (e.g. cancelled) before this.
+    ~ConcurrentAsyncQueue()
+    {
+        _rx_waiters.notify_all(asio::error::operation_aborted);
+        _tx_waiters.notify_all(asio::error::operation_aborted);
+    }
+
+    // Returns false (leaving the value untouched) if the queue is full.
+    bool try_push(T& val, sys::error_code ec = {})
+    {
+        if (!_ring.try_emplace(std::move(val), ec)) return false;
+        _rx_waiters.notify_all();
+        return true;
+    }
+
+    boost::optional<T> try_pop()
+    {
+        auto item = _ring.try_pop();
+        if (!item) return boost::none;
+        _tx_waiters.notify_all();
+        return std::move(item->first);
+    }
+
+    void async_push(T val, Cancel cancel, asio::yield_context yield)
+    {
+        async_push(std::move(val), sys::error_code(), std::move(cancel), yield);
+    }
+
+    void async_push( T val
+                   , sys::error_code ec_
+                   , Cancel cancel
+                   , asio::yield_context yield)
+    {
+        sys::error_code ec;
+
+        while (!try_push(val, ec_)) {
+            _tx_waiters.wait(cancel, [&] { return _ring.can_push(); }, yield[ec]);
+            return_or_throw_on_error(yield, cancel, ec);
+        }
+    }
+
+    T async_pop(Cancel cancel, asio::yield_context yield)
+    {
+        sys::error_code ec;
+
+        boost::optional<Item> item;
+
+        while (!(item = _ring.try_pop())) {
+            _rx_waiters.wait(cancel, [&] { return _ring.can_pop(); }, yield[ec]);
+            return_or_throw_on_error(yield, cancel, ec, T{});
+        }
+
+        _tx_waiters.notify_all();
+
+        return or_throw<T>(yield, item->second, std::move(item->first));
+    }
+
+    // Wait for some elements, then pop all available ones
+    // (dropping those pushed with an error)
+    // and return how many were added to `out`.
+    size_t async_flush( std::queue<T>& out
+                      , Cancel cancel
+                      , asio::yield_context yield)
+    {
+        sys::error_code ec;
+
+        boost::optional<Item> item;
+
+        while (!(item = _ring.try_pop())) {
+            _rx_waiters.wait(cancel, [&] { return _ring.can_pop(); }, yield[ec]);
+            return_or_throw_on_error(yield, cancel, ec, 0);
+        }
+
+        size_t ret = 0;
+
+        do {
+            if (!item->second) {
+                ++ret;
+                out.push(std::move(item->first));
+            }
+        } while ((item = _ring.try_pop()));
+
+        _tx_waiters.notify_all();
+
+        return ret;
+    }
+
+    // Only approximate while other threads use the queue.
+    size_t size() const { return _ring.size(); }
+
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() >= capacity(); }
+    size_t capacity() const { return _ring.capacity(); }
+
+private:
+    MpmcRing<Item> _ring;
+    concurrent_async_queue_detail::WaitList _rx_waiters;  // consumers
+    concurrent_async_queue_detail::WaitList _tx_waiters;  // producers
+};
+
+}} // namespaces
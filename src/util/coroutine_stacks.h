@@ -0,0 +1,234 @@
+// Process-wide pool of stacks for the coroutines started with `util::spawn`.
+//
+// Stacks are mapped with a guard page below them (so that an overflow
+// crashes instead of silently corrupting the heap) and come in a few size
+// classes, so that each call site can choose how much stack it needs.
+// Released stacks are kept for reuse (up to a limit per class),
+// which saves the mapping of stacks
+// for short-lived coroutines like those serving connections.
+// Their pages are given back to the system meanwhile,
+// so that idle stacks do not keep memory.
+//
+// Live and pooled stacks are exported as metrics
+// and logged by `HandlerTracker` when the process stops.
+
+#pragma once
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <boost/coroutine/stack_context.hpp>
+#include <boost/coroutine/stack_traits.hpp>
+
+#include "metrics.h"
+
+namespace ouinet { namespace util {
+
+enum class StackSize {
+    small,   // simple loops which do not parse or log much
+    normal,  // the default of `asio::spawn`
+    large,   // request processing with deep call chains
+};
+
+class CoroutineStacks {
+public:
+    static constexpr size_t class_count = 3;
+    static constexpr size_t default_max_pooled = 16;
+
+    struct Stats {
+        size_t size;    // bytes of stack usable by coroutines
+        size_t live;    // stacks in use
+        size_t pooled;  // stacks kept for reuse
+    };
+
+    CoroutineStacks()
+    {
+        using traits = boost::coroutines::stack_traits;
+        auto normal = traits::default_size();
+        set_size(StackSize::small, normal / 2);
+        set_size(StackSize::normal, normal);
+        set_size(StackSize::large, normal * 2);
+
+        static const char* names[] = {"small", "normal", "large"};
+        auto& r = metrics::registry();
+        for (size_t i = 0; i < class_count; ++i) {
+            auto& c = _classes[i];
+            c.live_gauge = &r.gauge( "ouinet_coroutine_stacks"
+                                   , "Coroutine stacks in use or kept for reuse"
+                                   , {{"class", names[i]}, {"state", "live"}});
+            c.pooled_gauge = &r.gauge( "ouinet_coroutine_stacks"
+                                     , "Coroutine stacks in use or kept for reuse"
+                                     , {{"class", names[i]}, {"state", "pooled"}});
+        }
+    }
+
+    CoroutineStacks(const CoroutineStacks&) = delete;
+    CoroutineStacks& operator=(const CoroutineStacks&) = delete;
+
+    ~CoroutineStacks()
+    {
+        for (auto& c : _classes) {
+            for (auto sp : c.pool) unmap(sp, c.size);
+        }
+    }
+
+    // The size is rounded up to whole pages (and to the minimum supported).
+    // Pooled stacks of the previous size are released,
+    // and live ones are released when their coroutines finish.
+    void set_size(StackSize cls, size_t bytes)
+    {
+        using traits = boost::coroutines::stack_traits;
+        bytes = std::max(bytes, traits::minimum_size());
+        if (!traits::is_unbounded()) bytes = std::min(bytes, traits::maximum_size());
+        bytes = (bytes + page_size() - 1) / page_size() * page_size();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& c = get(cls);
+        if (c.size == bytes) return;
+        for (auto sp : c.pool) unmap(sp, c.size);
+        c.pool.clear();
+        c.size = bytes;
+        update_gauges(c);
+    }
+
+    // Maximum number of stacks of each class kept for reuse.
+    void set_max_pooled(size_t n)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _max_pooled = n;
+        for (auto& c : _classes) {
+            while (c.pool.size() > n) {
+                unmap(c.pool.back(), c.size);
+                c.pool.pop_back();
+            }
+            update_gauges(c);
+        }
+    }
+
+    Stats stats(StackSize cls) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& c = get(cls);
+        return {c.size, c.live, c.pool.size()};
+    }
+
+    void allocate(StackSize cls, boost::coroutines::stack_context& ctx)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& c = get(cls);
+
+        if (!c.pool.empty()) {
+            ctx.sp = c.pool.back();
+            c.pool.pop_back();
+        } else {
+            ctx.sp = map(c.size);
+        }
+
+        ctx.size = c.size;
+        ++c.live;
+        update_gauges(c);
+    }
+
+    void deallocate(StackSize cls, boost::coroutines::stack_context& ctx)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& c = get(cls);
+
+        --c.live;
+
+        if (ctx.size == c.size && c.pool.size() < _max_pooled) {
+            // Pages are mapped again (zeroed) when touched.
+            ::madvise(static_cast<char*>(ctx.sp) - ctx.size, ctx.size, MADV_DONTNEED);
+            c.pool.push_back(ctx.sp);
+        } else {
+            unmap(ctx.sp, ctx.size);
+        }
+
+        update_gauges(c);
+    }
+
+private:
+    struct Class {
+        size_t size = 0;
+        size_t live = 0;
+        std::vector<void*> pool;  // tops of stacks
+        metrics::Gauge* live_gauge = nullptr;
+        metrics::Gauge* pooled_gauge = nullptr;
+    };
+
+    static size_t page_size()
+    {
+        return boost::coroutines::stack_traits::page_size();
+    }
+
+    // Returns the top of the stack (it grows downwards),
+    // the guard page being right below its bottom.
+    static void* map(size_t size)
+    {
+        auto len = size + page_size();
+        auto base = ::mmap( nullptr, len, PROT_READ | PROT_WRITE
+                          , MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) throw std::bad_alloc();
+        if (::mprotect(base, page_size(), PROT_NONE) != 0) {
+            ::munmap(base, len);
+            throw std::bad_alloc();
+        }
+        return static_cast<char*>(base) + len;
+    }
+
+    static void unmap(void* sp, size_t size)
+    {
+        auto len = size + page_size();
+        ::munmap(static_cast<char*>(sp) - len, len);
+    }
+
+    Class& get(StackSize cls) { return _classes[static_cast<size_t>(cls)]; }
+    const Class& get(StackSize cls) const { return _classes[static_cast<size_t>(cls)]; }
+
+    static void update_gauges(Class& c)
+    {
+        if (!c.live_gauge) return;
+        c.live_gauge->set(c.live);
+        c.pooled_gauge->set(c.pool.size());
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::array<Class, class_count> _classes;
+    size_t _max_pooled = default_max_pooled;
+};
+
+// The stacks for the whole process.
+inline
+CoroutineStacks& coroutine_stacks()
+{
+    static CoroutineStacks s;
+    return s;
+}
+
+// Allocator of stacks of the given class, for Boost.Coroutine.
+class PooledStackAllocator {
+public:
+    explicit PooledStackAllocator(StackSize cls) : _class(cls) {}
+
+    void allocate(boost::coroutines::stack_context& ctx, size_t /* size */)
+    {
+        coroutine_stacks().allocate(_class, ctx);
+    }
+
+    void deallocate(boost::coroutines::stack_context& ctx)
+    {
+        coroutine_stacks().deallocate(_class, ctx);
+    }
+
+private:
+    StackSize _class;
+};
+
+}} // namespaces
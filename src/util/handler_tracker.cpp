@@ -1,8 +1,14 @@
 #include "handler_tracker.h"
 #include "logger.h"
+#include "coroutine_stacks.h"
+#include "metrics.h"
+#include <algorithm>
+#include <iomanip>
+#include <map>
 #include <mutex>
 #include <thread>
 #include <chrono>
+#include <unordered_map>
 
 namespace ouinet {
 
@@ -15,6 +21,43 @@ enum State : unsigned {
     done = 2
 };
 
+static void log_coroutine_stacks()
+{
+    using util::StackSize;
+    static const std::pair<StackSize, const char*> classes[] = {
+        {StackSize::small, "small"}, {StackSize::normal, "normal"}, {StackSize::large, "large"}
+    };
+
+    for (auto& c : classes) {
+        auto s = util::coroutine_stacks().stats(c.first);
+        if (s.live == 0 && s.pooled == 0) continue;
+        LOG_DEBUG("HandlerTracker: ", c.second, " coroutine stacks of ", s.size
+                 , " bytes: ", s.live, " live, ", s.pooled, " pooled");
+    }
+}
+
+// Handlers of the same call site may have different name pointers
+// (e.g. when started from a header included by several translation units),
+// so sites are found by name pointer first, then by name.
+struct HandlerTracker::Site {
+    size_t live = 0;
+    uint64_t finished = 0;
+    metrics::Gauge* live_gauge;
+    metrics::Histogram* lifetimes;
+
+    explicit Site(const std::string& name)
+    {
+        auto& r = metrics::registry();
+        live_gauge = &r.gauge( "ouinet_handlers_live"
+                             , "Tracked handlers and coroutines still running"
+                             , {{"site", name}});
+        lifetimes = &r.histogram( "ouinet_handler_lifetime_seconds"
+                                , "Lifetime of tracked handlers and coroutines"
+                                , {{"site", name}}
+                                , {.01, .1, 1, 10, 60, 600, 3600});
+    }
+};
+
 struct HandlerTracker::GlobalState {
     std::mutex mutex;
     std::thread thread;
@@ -22,12 +65,31 @@ struct HandlerTracker::GlobalState {
     List list;
     bool _keep_going = true;
 
+    std::map<std::string, Site> sites;
+    std::unordered_map<const char*, Site*> sites_by_ptr;
+
+    // Sites keep references to metrics, so make sure that they outlive us.
+    GlobalState() { metrics::registry(); }
+
+    // Must be called with the mutex locked.
+    Site& site(const char* name) {
+        auto i = sites_by_ptr.find(name);
+        if (i != sites_by_ptr.end()) return *i->second;
+
+        auto j = sites.find(name);
+        if (j == sites.end()) j = sites.emplace(name, Site(name)).first;
+        sites_by_ptr.emplace(name, &j->second);
+        return j->second;
+    }
+
     bool keep_going() {
         lock_guard guard(mutex);
         return _keep_going;
     }
 
     void stop() {
+        log_coroutine_stacks();
+
         {
             lock_guard guard(mutex);
             state = State::stopped;
@@ -90,12 +152,16 @@ struct HandlerTracker::GlobalState {
 
 HandlerTracker::HandlerTracker(const char* name, bool after_stop)
     : _name(name)
+    , _start(Clock::now())
 {
     auto& g = global_state();
     lock_guard guard(g.mutex);
 
     _entry.self = this;
 
+    _site = &g.site(name);
+    _site->live_gauge->set(++_site->live);
+
     if (g.state >= State::stopped) {
         if (!after_stop) {
             LOG_WARN("HandlerTracker: new coro started in stopped process");
@@ -112,6 +178,12 @@ HandlerTracker::~HandlerTracker() {
     auto& g = global_state();
     lock_guard guard(g.mutex);
 
+    _entry.unlink();
+
+    _site->live_gauge->set(--_site->live);
+    ++_site->finished;
+    _site->lifetimes->observe(Clock::now() - _start);
+
     if (g.state >= State::stopped) {
         if (g.state == State::stopped) {
             LOG_DEBUG("HandlerTracker: stopped ", _name);
@@ -127,6 +199,50 @@ void HandlerTracker::stopped()
     global_state().stop();
 }
 
+/* static */
+std::vector<HandlerTracker::SiteCensus> HandlerTracker::census()
+{
+    auto& g = global_state();
+    lock_guard guard(g.mutex);
+
+    auto now = Clock::now();
+
+    std::vector<SiteCensus> ret;
+    std::map<const Site*, size_t> index;
+
+    for (auto& ns : g.sites) {
+        index[&ns.second] = ret.size();
+        ret.push_back({ns.first, ns.second.live, ns.second.finished, {}});
+    }
+
+    for (auto& e : g.list) {
+        auto& c = ret[index[e.self->_site]];
+        c.oldest_age = std::max(c.oldest_age, now - e.self->_start);
+    }
+
+    std::stable_sort(ret.begin(), ret.end(), [] (auto& a, auto& b) {
+        return a.oldest_age > b.oldest_age;
+    });
+
+    return ret;
+}
+
+/* static */
+void HandlerTracker::write_census(std::ostream& os)
+{
+    os << std::setw(8) << "LIVE" << ' '
+       << std::setw(10) << "FINISHED" << ' '
+       << std::setw(12) << "OLDEST (s)" << "  SITE\n";
+
+    for (auto& c : census()) {
+        os << std::setw(8) << c.live << ' '
+           << std::setw(10) << c.finished << ' '
+           << std::setw(12) << std::fixed << std::setprecision(3)
+           << duration_cast<duration<double>>(c.oldest_age).count()
+           << "  " << c.name << '\n';
+    }
+}
+
 /* static */
 HandlerTracker::GlobalState& HandlerTracker::global_state() {
     static GlobalState s;
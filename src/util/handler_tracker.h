@@ -1,21 +1,44 @@
 #pragma once
 
 #include <boost/intrusive/list.hpp>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
 #include <logger.h>
+#include "spawn.h"
 
 namespace ouinet {
 
 class HandlerTracker final {
+public:
+    using Clock = std::chrono::steady_clock;
+
 private:
     using Hook = boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>;
     struct Entry : Hook { HandlerTracker* self; };
     using List = boost::intrusive::list<Entry, boost::intrusive::constant_time_size<false>>;
 
     struct GlobalState;
+    struct Site;
 
 public:
+    // Tracked handlers started at the same call site.
+    struct SiteCensus {
+        std::string name;
+        size_t live;                // handlers still running
+        uint64_t finished;          // handlers done since the process started
+        Clock::duration oldest_age; // of the oldest live handler, if any
+    };
+
     static void stopped();
 
+    // Call sites with live or finished handlers, oldest live handlers first.
+    static std::vector<SiteCensus> census();
+
+    // Write the census as a plain text table.
+    static void write_census(std::ostream&);
+
     HandlerTracker(const char* name, bool after_stop = false);
 
     const char* name() const { return _name; }
@@ -27,6 +50,8 @@ private:
 
 private:
     const char* _name;
+    Site* _site;
+    Clock::time_point _start;
     Entry _entry;
 };
 
@@ -44,7 +69,7 @@ private:
     HandlerTracker handler_tracker_instance(OUINET_DETAIL_HANDLER_TRACKER_LOCATION_STRING(), false)
 
 #define TRACK_SPAWN(exec, body, ...)\
-    asio::spawn(exec, [b = body] (asio::yield_context yield) mutable {\
+    ::ouinet::util::spawn(exec, [b = body] (asio::yield_context yield) mutable {\
         TRACK_HANDLER();\
         try {\
             b(yield);\
@@ -55,7 +80,7 @@ private:
     }, ##__VA_ARGS__)
 
 #define TRACK_SPAWN_AFTER_STOP(exec, body, ...)\
-    asio::spawn(exec, [b = body] (asio::yield_context yield) mutable {\
+    ::ouinet::util::spawn(exec, [b = body] (asio::yield_context yield) mutable {\
         TRACK_HANDLER_AFTER_STOP();\
         try {\
             b(yield);\
@@ -1,38 +1,72 @@
 #pragma once
 
-#include <unordered_map>
-#include <list>
+// Least recently used cache of key-value pairs.
+//
+// Entries live in a single contiguous array, linked into a recency list
+// by their indices, and are found through an open addressing hash table
+// (linear probing with backward shift deletion) which only holds
+// entry indices and hash bits.  This avoids the separate heap nodes
+// and pointer chasing of a `std::list` plus an associative container.
+//
+// Erasing an entry moves the last one of the array into its place,
+// so pointers to values are only valid until the cache is next modified.
+//
+// `ShardedLruCache` below splits entries among several independently
+// locked caches for use from several threads.
+
+#include <algorithm>
+#include <cassert>
 #include <cstddef>
-#include <stdexcept>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <boost/optional.hpp>
 
 namespace ouinet { namespace util {
 
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
 class LruCache {
 private:
     using KeyVal = std::pair<Key, Value>;
-    using ListIter = typename std::list<KeyVal>::iterator;
-    using Map = std::unordered_map<Key, ListIter>;
-    using MapIter = typename Map::const_iterator;
+    using Index = uint32_t;
+
+    static constexpr Index nil = std::numeric_limits<Index>::max();
 
+    struct Node {
+        KeyVal kv;
+        uint32_t hash;
+        Index prev;  // more recently used
+        Index next;  // less recently used
+    };
+
+    struct Slot {
+        Index node = nil;
+        uint32_t hash = 0;
+    };
 
 public:
+    // Iterates from the most to the least recently used entry.
     class const_iterator {
         friend class LruCache;
-        MapIter i;
+        const LruCache* c;
+        Index i;
     public:
-        const_iterator(MapIter i) : i(i) {}
-        const KeyVal& operator*() const { return *i->second; }
-        const KeyVal* operator->() const { return &*i->second; }
+        const_iterator(const LruCache* c, Index i) : c(c), i(i) {}
+        const KeyVal& operator*() const { return c->_nodes[i].kv; }
+        const KeyVal* operator->() const { return &c->_nodes[i].kv; }
 
         const_iterator& operator++() {
-            ++i;
+            i = c->_nodes[i].next;
             return *this;
         }
 
         const_iterator operator++(int) {
-            const_iterator ret{i};
-            ++i;
+            const_iterator ret{c, i};
+            i = c->_nodes[i].next;
             return ret;
         }
 
@@ -54,78 +88,259 @@ public:
         // when `key` is a reference to the key already in the cache.
         // E.g. cache.put(i->key, "new value");
 
-        auto it = _map.find(key);
+        if (_slots.empty()) grow_if_needed();
 
-        _list.push_front(KeyVal(key, std::move(value)));
+        auto h = hash(key);
+        auto s = find_slot(key, h);
 
-        if (it != _map.end()) {
-            _list.erase(it->second);
-            it->second = _list.begin();
-        }
-        else {
-            _map[key] = _list.begin();
+        if (_slots[s].node != nil) {
+            auto i = _slots[s].node;
+            _nodes[i].kv.second = std::move(value);
+            move_to_front(i);
+            return &_nodes[i].kv.second;
         }
 
-        if (_map.size() > _max_size) {
-            auto last = _list.end();
-            last--;
-            _map.erase(last->first);
-            _list.pop_back();
+        if (grow_if_needed()) s = find_slot(key, h);
+
+        Index i = _nodes.size();
+        _nodes.push_back(Node{KeyVal(key, std::move(value)), h, nil, nil});
+        _slots[s] = Slot{i, h};
+        link_front(i);
+
+        if (_nodes.size() > _max_size) {
+            auto last = _tail;
+            if (last == i) {
+                remove(i);
+                return nullptr;
+            }
+            // The new entry is the last one in the array,
+            // so it takes the place of the removed one.
+            remove(last);
+            i = last;
         }
 
-        return &_list.begin()->second;
+        return &_nodes[i].kv.second;
     }
 
     Value* get(const Key& key) {
-        auto it = _map.find(key);
+        auto i = find_node(key);
 
-        if (it == _map.end()) return nullptr;
+        if (i == nil) return nullptr;
 
-        _list.splice(_list.begin(), _list, it->second);
+        move_to_front(i);
 
-        assert(it->second == _list.begin());
+        assert(_head == i);
 
-        return &it->second->second;
+        return &_nodes[i].kv.second;
     }
 
     bool exists(const Key& key) const {
-        return _map.count(key) != 0;
+        return find_node(key) != nil;
+    }
+
+    // Does not change the order of entries.
+    const_iterator find(const Key& key) const {
+        return const_iterator{this, find_node(key)};
     }
 
     size_t size() const {
-        return _map.size();
+        return _nodes.size();
     }
 
-    bool empty() const { return _map.empty(); }
+    bool empty() const { return _nodes.empty(); }
 
-    // TODO: Currently the returned iterator is not
-    // ordered by usage.
     const_iterator begin() const {
-        return const_iterator{_map.begin()};
+        return const_iterator{this, _head};
     }
 
-    // TODO: Currently the returned iterator is not
-    // ordered by usage.
     const_iterator end() const {
-        return const_iterator{_map.end()};
+        return const_iterator{this, nil};
     }
 
     const_iterator erase(const_iterator i) {
-        auto j = i;
-        ++j;
-        _list.erase(i.i->second);
-        _map.erase(i.i);
-        return j;
+        auto next = _nodes[i.i].next;
+        Index last = _nodes.size() - 1;
+        remove(i.i);
+        if (next == last) next = i.i;  // moved into the erased place
+        return const_iterator{this, next};
     }
 
     void move_to_front(const_iterator i) {
-        _list.splice(_list.begin(), _list, i.i->second);
+        move_to_front(i.i);
     }
 
 private:
-    std::list<KeyVal> _list;
-    std::unordered_map<Key, ListIter> _map;
+    uint32_t hash(const Key& key) const {
+        // Mix the bits, since standard hashes of integers are the identity.
+        uint64_t h = _hash(key);
+        return (h * 0x9e3779b97f4a7c15ull) >> 32;
+    }
+
+    size_t mask() const { return _slots.size() - 1; }
+
+    // The slot with the key or else the empty one where it would go.
+    size_t find_slot(const Key& key, uint32_t h) const {
+        for (size_t s = h & mask();; s = (s + 1) & mask()) {
+            auto& slot = _slots[s];
+            if (slot.node == nil) return s;
+            if (slot.hash == h && _nodes[slot.node].kv.first == key) return s;
+        }
+    }
+
+    Index find_node(const Key& key) const {
+        if (_slots.empty()) return nil;
+        return _slots[find_slot(key, hash(key))].node;
+    }
+
+    size_t slot_of(Index i) const {
+        for (size_t s = _nodes[i].hash & mask();; s = (s + 1) & mask()) {
+            if (_slots[s].node == i) return s;
+        }
+    }
+
+    // Keep the table at most half full.
+    bool grow_if_needed() {
+        if ((_nodes.size() + 1) * 2 <= _slots.size()) return false;
+
+        std::vector<Slot> slots(std::max<size_t>(16, _slots.size() * 2));
+        auto m = slots.size() - 1;
+
+        for (Index i = 0; i < _nodes.size(); ++i) {
+            auto h = _nodes[i].hash;
+            auto s = h & m;
+            while (slots[s].node != nil) s = (s + 1) & m;
+            slots[s] = Slot{i, h};
+        }
+
+        _slots = std::move(slots);
+        return true;
+    }
+
+    void link_front(Index i) {
+        auto& n = _nodes[i];
+        n.prev = nil;
+        n.next = _head;
+        if (_head != nil) _nodes[_head].prev = i;
+        _head = i;
+        if (_tail == nil) _tail = i;
+    }
+
+    void unlink(Index i) {
+        auto& n = _nodes[i];
+        if (n.prev != nil) _nodes[n.prev].next = n.next; else _head = n.next;
+        if (n.next != nil) _nodes[n.next].prev = n.prev; else _tail = n.prev;
+    }
+
+    void move_to_front(Index i) {
+        if (_head == i) return;
+        unlink(i);
+        link_front(i);
+    }
+
+    void remove(Index i) {
+        unlink(i);
+
+        // Backward shift deletion: move later entries of the probe sequence
+        // into the hole unless that would put them before their ideal slot.
+        auto hole = slot_of(i);
+        for (auto s = (hole + 1) & mask(); _slots[s].node != nil; s = (s + 1) & mask()) {
+            auto ideal = _slots[s].hash & mask();
+            if (((s - ideal) & mask()) >= ((s - hole) & mask())) {
+                _slots[hole] = _slots[s];
+                hole = s;
+            }
+        }
+        _slots[hole] = Slot{};
+
+        // Keep the array contiguous.
+        Index last = _nodes.size() - 1;
+        if (i != last) {
+            _slots[slot_of(last)].node = i;
+            _nodes[i] = std::move(_nodes[last]);
+            auto& n = _nodes[i];
+            if (n.prev != nil) _nodes[n.prev].next = i; else _head = i;
+            if (n.next != nil) _nodes[n.next].prev = i; else _tail = i;
+        }
+        _nodes.pop_back();
+    }
+
+private:
+    std::vector<Node> _nodes;
+    std::vector<Slot> _slots;  // size is zero or a power of two
+    Index _head = nil;
+    Index _tail = nil;
     size_t _max_size;
+    Hash _hash;
+};
+
+// Several LRU caches with a share of the maximum size each,
+// every one of them protected by its own mutex.
+// Values are returned by copy since other threads may evict them.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ShardedLruCache {
+public:
+    ShardedLruCache(size_t max_size, size_t shard_count = 16)
+    {
+        auto per_shard = (max_size + shard_count - 1) / shard_count;
+        _shards.reserve(shard_count);
+        for (size_t i = 0; i < shard_count; ++i)
+            _shards.emplace_back(new Shard(per_shard));
+    }
+
+    void put(const Key& key, Value value) {
+        auto& s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.cache.put(key, std::move(value));
+    }
+
+    boost::optional<Value> get(const Key& key) {
+        auto& s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto v = s.cache.get(key);
+        if (!v) return boost::none;
+        return *v;
+    }
+
+    bool erase(const Key& key) {
+        auto& s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto i = s.cache.find(key);
+        if (i == s.cache.end()) return false;
+        s.cache.erase(i);
+        return true;
+    }
+
+    bool exists(const Key& key) const {
+        auto& s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        return s.cache.exists(key);
+    }
+
+    size_t size() const {
+        size_t ret = 0;
+        for (auto& s : _shards) {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            ret += s->cache.size();
+        }
+        return ret;
+    }
+
+private:
+    struct Shard {
+        mutable std::mutex mutex;
+        LruCache<Key, Value, Hash> cache;
+
+        explicit Shard(size_t max_size) : cache(max_size) {}
+    };
+
+    Shard& shard(const Key& key) const {
+        // Use other bits than those picking slots within the shard.
+        uint64_t h = Hash()(key);
+        return *_shards[((h * 0xff51afd7ed558ccdull) >> 40) % _shards.size()];
+    }
+
+private:
+    std::vector<std::unique_ptr<Shard>> _shards;
 };
 
 }} // namespaces
@@ -0,0 +1,311 @@
+// Process-wide counters, gauges and histograms
+// which can be exported in the Prometheus text format
+// (see <https://prometheus.io/docs/instrumenting/exposition_formats/>).
+//
+// Metrics are created on first use and live as long as the process,
+// so references to them may be kept.
+//
+//     static auto& reqs = metrics::registry().counter("x_requests_total", "Requests");
+//     reqs.inc();
+//
+// Gauges whose value is kept elsewhere can be computed on export
+// for as long as the object returned by `callback_gauge` is alive.
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ouinet { namespace metrics {
+
+using Labels = std::map<std::string, std::string>;
+
+class Counter {
+public:
+    void inc(uint64_t n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> _value{0};
+};
+
+class Gauge {
+public:
+    void set(double v) { _value.store(v, std::memory_order_relaxed); }
+    double value() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> _value{0};
+};
+
+class Histogram {
+public:
+    // Upper bounds of buckets, in increasing order.
+    using Bounds = std::vector<double>;
+
+    // In seconds, from 1 ms to 1 min.
+    static Bounds latency_bounds() {
+        return {.001, .0025, .005, .01, .025, .05, .1, .25, .5, 1, 2.5, 5, 10, 30, 60};
+    }
+
+    explicit Histogram(Bounds bounds)
+        : _bounds(std::move(bounds))
+        , _counts(new std::atomic<uint64_t>[_bounds.size() + 1])
+    {
+        for (size_t i = 0; i <= _bounds.size(); ++i) _counts[i] = 0;
+    }
+
+    void observe(double v) {
+        size_t i = 0;
+        while (i < _bounds.size() && v > _bounds[i]) ++i;
+        _counts[i].fetch_add(1, std::memory_order_relaxed);
+
+        auto sum = _sum.load(std::memory_order_relaxed);
+        while (!_sum.compare_exchange_weak(sum, sum + v, std::memory_order_relaxed));
+    }
+
+    template<class Rep, class Period>
+    void observe(std::chrono::duration<Rep, Period> d) {
+        observe(std::chrono::duration<double>(d).count());
+    }
+
+    const Bounds& bounds() const { return _bounds; }
+    // Observations in the given bucket (the last one being above all bounds).
+    uint64_t bucket_count(size_t i) const { return _counts[i].load(std::memory_order_relaxed); }
+    double sum() const { return _sum.load(std::memory_order_relaxed); }
+
+private:
+    Bounds _bounds;
+    std::unique_ptr<std::atomic<uint64_t>[]> _counts;
+    std::atomic<double> _sum{0};
+};
+
+class Registry;
+
+// Removes its callback gauge (or counter) from the registry on destruction.
+class CallbackGauge {
+public:
+    CallbackGauge() = default;
+    CallbackGauge(Registry* r, std::string name, uint64_t id)
+        : _registry(r), _name(std::move(name)), _id(id) {}
+
+    CallbackGauge(const CallbackGauge&) = delete;
+    CallbackGauge& operator=(const CallbackGauge&) = delete;
+
+    CallbackGauge(CallbackGauge&& other) { *this = std::move(other); }
+    CallbackGauge& operator=(CallbackGauge&&);
+
+    ~CallbackGauge() { reset(); }
+
+    void reset();
+
+private:
+    Registry* _registry = nullptr;
+    std::string _name;
+    uint64_t _id = 0;
+};
+
+using CallbackGauges = std::vector<CallbackGauge>;
+
+class Registry {
+public:
+    Counter& counter( const std::string& name, const std::string& help
+                    , const Labels& labels = {})
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& ptr = family(name, help, Type::counter).counters[labels];
+        if (!ptr) ptr = std::make_unique<Counter>();
+        return *ptr;
+    }
+
+    Gauge& gauge( const std::string& name, const std::string& help
+                , const Labels& labels = {})
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& ptr = family(name, help, Type::gauge).gauges[labels];
+        if (!ptr) ptr = std::make_unique<Gauge>();
+        return *ptr;
+    }
+
+    Histogram& histogram( const std::string& name, const std::string& help
+                        , const Labels& labels = {}
+                        , Histogram::Bounds bounds = Histogram::latency_bounds())
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& ptr = family(name, help, Type::histogram).histograms[labels];
+        if (!ptr) ptr = std::make_unique<Histogram>(std::move(bounds));
+        return *ptr;
+    }
+
+    // The function is called on export (with the registry locked,
+    // so it must not use the registry).
+    CallbackGauge callback_gauge( const std::string& name, const std::string& help
+                                , const Labels& labels
+                                , std::function<double()> f)
+    {
+        return add_callback(name, help, Type::gauge, labels, std::move(f));
+    }
+
+    // Same as above, for a counter kept elsewhere.
+    CallbackGauge callback_counter( const std::string& name, const std::string& help
+                                  , const Labels& labels
+                                  , std::function<double()> f)
+    {
+        return add_callback(name, help, Type::counter, labels, std::move(f));
+    }
+
+    // Write all metrics in the Prometheus text format.
+    void write(std::ostream& os) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        // Avoid rounding large values (e.g. histogram sums).
+        auto precision = os.precision(std::numeric_limits<double>::max_digits10);
+
+        for (auto& nf : _families) {
+            auto& name = nf.first;
+            auto& f = nf.second;
+
+            if (f.counters.empty() && f.gauges.empty()
+                && f.histograms.empty() && f.callbacks.empty()) continue;
+
+            os << "# HELP " << name << ' ' << f.help << '\n';
+            os << "# TYPE " << name << ' ' << type_name(f.type) << '\n';
+
+            for (auto& lc : f.counters)
+                os << name << labels_text(lc.first) << ' ' << lc.second->value() << '\n';
+            for (auto& lg : f.gauges)
+                os << name << labels_text(lg.first) << ' ' << lg.second->value() << '\n';
+            for (auto& ic : f.callbacks)
+                os << name << labels_text(ic.second.first) << ' ' << ic.second.second() << '\n';
+
+            for (auto& lh : f.histograms) {
+                auto& h = *lh.second;
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i <= h.bounds().size(); ++i) {
+                    cumulative += h.bucket_count(i);
+                    auto labels = lh.first;
+                    std::ostringstream le;
+                    if (i < h.bounds().size()) le << h.bounds()[i];
+                    else le << "+Inf";
+                    labels["le"] = le.str();
+                    os << name << "_bucket" << labels_text(labels) << ' ' << cumulative << '\n';
+                }
+                os << name << "_sum" << labels_text(lh.first) << ' ' << h.sum() << '\n';
+                os << name << "_count" << labels_text(lh.first) << ' ' << cumulative << '\n';
+            }
+        }
+
+        os.precision(precision);
+    }
+
+private:
+    friend class CallbackGauge;
+
+    enum class Type { counter, gauge, histogram };
+
+    struct Family {
+        std::string help;
+        Type type;
+        std::map<Labels, std::unique_ptr<Counter>> counters;
+        std::map<Labels, std::unique_ptr<Gauge>> gauges;
+        std::map<Labels, std::unique_ptr<Histogram>> histograms;
+        std::map<uint64_t, std::pair<Labels, std::function<double()>>> callbacks;
+    };
+
+    Family& family(const std::string& name, const std::string& help, Type type)
+    {
+        auto i = _families.find(name);
+        if (i == _families.end())
+            i = _families.emplace(name, Family{help, type, {}, {}, {}, {}}).first;
+        assert(i->second.type == type);
+        return i->second;
+    }
+
+    CallbackGauge add_callback( const std::string& name, const std::string& help
+                              , Type type, const Labels& labels
+                              , std::function<double()> f)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto id = ++_last_callback_id;
+        family(name, help, type).callbacks[id] = {labels, std::move(f)};
+        return CallbackGauge(this, name, id);
+    }
+
+    void remove_callback(const std::string& name, uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto i = _families.find(name);
+        if (i != _families.end()) i->second.callbacks.erase(id);
+    }
+
+    static const char* type_name(Type t) {
+        switch (t) {
+            case Type::counter:   return "counter";
+            case Type::gauge:     return "gauge";
+            case Type::histogram: return "histogram";
+        }
+        return "untyped";
+    }
+
+    static std::string labels_text(const Labels& labels) {
+        if (labels.empty()) return "";
+        std::string s = "{";
+        for (auto& kv : labels) {
+            if (s.size() > 1) s += ',';
+            s += kv.first + "=\"";
+            for (auto c : kv.second) {
+                if (c == '\\' || c == '"') s += '\\';
+                if (c == '\n') { s += "\\n"; continue; }
+                s += c;
+            }
+            s += '"';
+        }
+        return s + "}";
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::map<std::string, Family> _families;
+    uint64_t _last_callback_id = 0;
+};
+
+inline
+CallbackGauge& CallbackGauge::operator=(CallbackGauge&& other)
+{
+    reset();
+    _registry = other._registry;
+    _name = std::move(other._name);
+    _id = other._id;
+    other._registry = nullptr;
+    return *this;
+}
+
+inline
+void CallbackGauge::reset()
+{
+    if (!_registry) return;
+    _registry->remove_callback(_name, _id);
+    _registry = nullptr;
+}
+
+// The registry of metrics for the whole process.
+inline
+Registry& registry()
+{
+    static Registry r;
+    return r;
+}
+
+}} // namespaces
@@ -0,0 +1,131 @@
+#pragma once
+
+// A bounded lock-free queue for several producers and consumers
+// (after Dmitry Vyukov's bounded MPMC queue):
+// each cell has a sequence number telling whether it is ready
+// for pushing or popping at a given position.
+//
+// Pushing and popping never block,
+// they just fail if the ring is full or empty.
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+namespace ouinet { namespace util {
+
+template<class T>
+class MpmcRing {
+public:
+    // The capacity is rounded up to a power of two.
+    explicit MpmcRing(size_t capacity)
+        : _cells(round_up(capacity))
+        , _mask(_cells.size() - 1)
+    {
+        for (size_t i = 0; i < _cells.size(); ++i)
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MpmcRing(const MpmcRing&) = delete;
+    MpmcRing& operator=(const MpmcRing&) = delete;
+
+    // Returns false if the ring is full.
+    // The element is only constructed from the arguments on success,
+    // so values passed as rvalue references are left untouched otherwise.
+    template<class... Args>
+    bool try_emplace(Args&&... args)
+    {
+        auto pos = _enqueue_pos.load(std::memory_order_relaxed);
+
+        for (;;) {
+            auto& cell = _cells[pos & _mask];
+            auto seq = cell.sequence.load(std::memory_order_acquire);
+            auto diff = intptr_t(seq) - intptr_t(pos);
+
+            if (diff == 0) {
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value.emplace(std::forward<Args>(args)...);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // full
+            } else {
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_push(T&& value) { return try_emplace(std::move(value)); }
+
+    // Returns none if the ring is empty.
+    boost::optional<T> try_pop()
+    {
+        auto pos = _dequeue_pos.load(std::memory_order_relaxed);
+
+        for (;;) {
+            auto& cell = _cells[pos & _mask];
+            auto seq = cell.sequence.load(std::memory_order_acquire);
+            auto diff = intptr_t(seq) - intptr_t(pos + 1);
+
+            if (diff == 0) {
+                if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    boost::optional<T> ret(std::move(*cell.value));
+                    cell.value = boost::none;
+                    cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+                    return ret;
+                }
+            } else if (diff < 0) {
+                return boost::none;  // empty
+            } else {
+                pos = _dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Whether the next push or pop would succeed (if nobody else is faster).
+    bool can_push() const
+    {
+        auto pos = _enqueue_pos.load();
+        return _cells[pos & _mask].sequence.load() == pos;
+    }
+
+    bool can_pop() const
+    {
+        auto pos = _dequeue_pos.load();
+        return _cells[pos & _mask].sequence.load() == pos + 1;
+    }
+
+    // Only approximate while other threads use the ring.
+    size_t size() const
+    {
+        auto tail = _enqueue_pos.load(std::memory_order_seq_cst);
+        auto head = _dequeue_pos.load(std::memory_order_seq_cst);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const { return _mask + 1; }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> sequence;
+        boost::optional<T> value;
+    };
+
+    static size_t round_up(size_t capacity)
+    {
+        size_t n = 2;
+        while (n < capacity) n *= 2;
+        return n;
+    }
+
+private:
+    std::vector<Cell> _cells;
+    size_t _mask;
+    alignas(64) std::atomic<size_t> _enqueue_pos{0};
+    alignas(64) std::atomic<size_t> _dequeue_pos{0};
+};
+
+}} // namespaces
@@ -1,7 +1,7 @@
 #pragma once
 
-#include <list>
 #include <cstddef>
+#include <map>
 #include <stdexcept>
 #include <boost/filesystem.hpp>
 #include <boost/asio/spawn.hpp>
@@ -14,6 +14,7 @@
 #include "file_io.h"
 #include "scheduler.h"
 #include "bytes.h"
+#include "lru_cache.h"
 
 namespace ouinet { namespace util {
 
@@ -32,13 +33,9 @@ private:
     class Element;
 
     using Key = std::string;
-    using KeyVal = std::pair<Key, std::shared_ptr<Element>>;
 
-    using List = std::list<KeyVal>;
-    using ListIter = typename List::iterator;
-
-    using Map = std::map<Key, ListIter>;
-    using MapIter = typename Map::iterator;
+    using Map = LruCache<Key, std::shared_ptr<Element>>;
+    using MapIter = typename Map::const_iterator;
 
 public:
     class iterator {
@@ -104,7 +101,7 @@ public:
     iterator find(const std::string& key);
 
     bool exists(const std::string& key) const {
-        return _map.count(key) != 0;
+        return _map.exists(key);
     }
 
     size_t size() const {
@@ -113,20 +110,17 @@ public:
 
     bool empty() const { return _map.empty(); }
 
-    // TODO: Currently the returned iterator is not
-    // ordered by usage.
+    // From the most to the least recently used entry.
     iterator begin() {
         return iterator(_map.begin());
     }
 
-    // TODO: Currently the returned iterator is not
-    // ordered by usage.
     iterator end() {
         return iterator(_map.end());
     }
 
     void move_to_front(iterator i) {
-        _list.splice(_list.begin(), _list, i.i->second);
+        _map.move_to_front(i.i);
     }
 
     const boost::filesystem::path& dir() const {
@@ -141,9 +135,7 @@ private:
 private:
     asio::executor _ex;
     boost::filesystem::path _dir;
-    List _list;
     Map _map;
-    size_t _max_size;
 };
 
 template<class Value>
@@ -347,10 +339,8 @@ PersistentLruCache<Value>::load( const asio::executor& ex
     for (auto p : elements) {
         auto e = p.second;
 
-        auto map_i = lru->_map.find(e->key());
-        assert(map_i == lru->_map.end());
-        lru->_list.push_front({e->key(), e});
-        lru->_map[e->key()] = lru->_list.begin();
+        assert(!lru->_map.exists(e->key()));
+        lru->_map.put(e->key(), e);
     }
 
     return lru;
@@ -363,7 +353,7 @@ PersistentLruCache<Value>::PersistentLruCache( const asio::executor& ex
                                              , size_t max_size)
     : _ex(ex)
     , _dir(std::move(dir))
-    , _max_size(max_size)
+    , _map(max_size)
 {
 }
 
@@ -374,36 +364,17 @@ void PersistentLruCache<Value>::insert( std::string key
                                       , Cancel& cancel
                                       , asio::yield_context yield)
 {
-    auto it = _map.find(key);
-
     std::shared_ptr<Element> e;
 
-    if (it != _map.end()) {
-        e = it->second->second;
+    if (auto old = _map.get(key)) {
+        e = *old;
     } else {
         // TODO: Value is set twice, here and at the end of this fn
         e = std::make_shared<Element>(_ex, key, path_from_key(key), value);
+        // The new entry may be evicted right away if the cache holds nothing.
+        if (!_map.put(key, e)) return;
     }
 
-    _list.push_front({key, e});
-
-    if (it != _map.end()) {
-        _list.erase(it->second);
-        it->second = _list.begin();
-    }
-    else {
-        it = _map.insert({key, _list.begin()}).first;
-    }
-
-    if (_map.size() > _max_size) {
-        auto last = prev(_list.end());
-        if (last->first == it->first) e = nullptr;
-        _map.erase(last->first);
-        _list.pop_back();
-    }
-
-    if (!e) return;
-
     sys::error_code ec;
     auto slot = e->lock(cancel, yield[ec]);
     if (ec) return or_throw(yield, ec);
@@ -420,9 +391,7 @@ PersistentLruCache<Value>::find(const std::string& key)
     if (it == _map.end()) return it;
 
     // Move it to the front
-    auto list_it = it->second;
-    _list.splice(_list.begin(), _list, list_it);
-    assert(list_it == _list.begin());
+    _map.move_to_front(it);
 
     return it;
 }
@@ -439,7 +408,7 @@ inline
 const Value&
 PersistentLruCache<Value>::iterator::value() const
 {
-    return i->second->second->value();
+    return i->second->value();
 }
 
 template<class Value>
@@ -455,14 +424,14 @@ inline
 asio::posix::stream_descriptor
 PersistentLruCache<Value>::iterator::open(sys::error_code& ec) const
 {
-    return i->second->second->open_value(ec);
+    return i->second->open_value(ec);
 }
 
 template<class Value>
 inline
 PersistentLruCache<Value>::~PersistentLruCache()
 {
-    for (auto& kv : _list) {
+    for (auto& kv : _map) {
         kv.second->keep_file_on_destruct();
     }
 }
@@ -5,6 +5,7 @@
 #include <boost/optional.hpp>
 #include <chrono>
 #include "condition_variable.h"
+#include "spawn.h"
 
 namespace ouinet { namespace util {
 
@@ -192,7 +193,7 @@ void UdpServerReachabilityAnalysis::start(const asio::executor& executor, const
      * Listen to incoming datagrams. Track active connections using ConnectionTracker.
      * When receiving a datagram not in the tracker, judge Reachable.
      */
-    asio::spawn(executor, [state = _state] (asio::yield_context yield) {
+    util::spawn(executor, [state = _state] (asio::yield_context yield) {
         bool running = true;
         auto connection = state->on_destroy.connect([&running, state = state.get()] {
             running = false;
@@ -259,7 +260,7 @@ void UdpServerReachabilityAnalysis::start(const asio::executor& executor, const
     /*
      * Wait for (last_unsolicited_traffic) + (expiracy time), then downgrade judgement.
      */
-    asio::spawn(executor, [state = _state, executor] (asio::yield_context yield) {
+    util::spawn(executor, [state = _state, executor] (asio::yield_context yield) {
         ConditionVariable reachable_condition(executor);
         asio::steady_timer timer(executor);
         bool running = true;
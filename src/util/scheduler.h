@@ -97,6 +97,8 @@ public:
     }
 
     size_t max_running_jobs() const { return _max_running_jobs; }
+    // Jobs already running are not affected if the limit is lowered.
+    void set_max_running_jobs(size_t);
 
     size_t slot_count() const { return _slots.size(); }
     size_t waiter_count() const { return _waiters.size(); }
@@ -171,6 +173,21 @@ Scheduler::Slot Scheduler::wait_for_slot( Cancel& cancel
     return slot;
 }
 
+inline
+void Scheduler::set_max_running_jobs(size_t max_running_jobs)
+{
+    _max_running_jobs = max_running_jobs;
+
+    size_t free_slots = _slots.size() < _max_running_jobs
+                      ? _max_running_jobs - _slots.size()
+                      : 0;
+
+    for (auto& waiter : _waiters) {
+        if (free_slots-- == 0) break;
+        waiter.cv.notify();
+    }
+}
+
 inline
 Scheduler::Slot::~Slot() {
     if (scheduler) scheduler->release_slot(*this);
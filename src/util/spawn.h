@@ -0,0 +1,118 @@
+// Like `asio::spawn`, but with the coroutine stack taken
+// from the pool in `coroutine_stacks.h`, of the given size class.
+//
+// `asio::spawn` only takes the size of the stack
+// and always allocates a new one from the heap,
+// so this mirrors its implementation (`asio::detail::spawn_helper`)
+// to be able to give Boost.Coroutine our own stack allocator.
+
+#pragma once
+
+#include <memory>
+#include <type_traits>
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/strand.hpp>
+
+#include "../namespaces.h"
+#include "coroutine_stacks.h"
+
+namespace ouinet { namespace util {
+
+namespace detail {
+
+template<class Handler, class Function>
+struct SpawnData {
+    using Yield = asio::basic_yield_context<Handler>;
+
+    std::weak_ptr<typename Yield::callee_type> coro;
+    Handler handler;
+    bool call_handler;
+    Function function;
+};
+
+template<class Handler, class Function>
+struct SpawnHelper {
+    using Data = SpawnData<Handler, Function>;
+    using Yield = typename Data::Yield;
+
+    using executor_type = typename asio::associated_executor<Handler>::type;
+
+    executor_type get_executor() const
+    {
+        return asio::get_associated_executor(data->handler);
+    }
+
+    void operator()()
+    {
+        using callee_type = typename Yield::callee_type;
+
+        auto entry_point = [data = data] (typename Yield::caller_type& ca) {
+#if !defined(BOOST_COROUTINES_UNIDIRECT) && !defined(BOOST_COROUTINES_V2)
+            ca(); // Yield until coroutine pointer has been initialised.
+#endif
+            const Yield yield(data->coro, ca, data->handler);
+            (data->function)(yield);
+            if (data->call_handler) (data->handler)();
+        };
+
+        auto coro = std::make_shared<callee_type>
+            ( std::move(entry_point)
+            , boost::coroutines::attributes(coroutine_stacks().stats(stack_size).size)
+            , PooledStackAllocator(stack_size));
+
+        data->coro = coro;
+        (*coro)();
+    }
+
+    std::shared_ptr<Data> data;
+    StackSize stack_size;
+};
+
+inline void default_spawn_handler() {}
+
+template<class Handler, class Function>
+void spawn(Handler&& h, bool call_handler, Function&& f, StackSize stack_size)
+{
+    using H = std::decay_t<Handler>;
+    using F = std::decay_t<Function>;
+
+    auto data = std::make_shared<SpawnData<H, F>>
+        (SpawnData<H, F>{{}, std::forward<Handler>(h), call_handler, std::forward<Function>(f)});
+
+    asio::dispatch(SpawnHelper<H, F>{std::move(data), stack_size});
+}
+
+} // detail namespace
+
+// Start a coroutine in the given execution context or executor
+// (within a strand of it, as `asio::spawn` does).
+template<class ExecutorOrContext, class Function>
+void spawn( ExecutorOrContext&& exec
+          , Function&& f
+          , StackSize stack_size = StackSize::normal)
+{
+    using E = std::decay_t<ExecutorOrContext>;
+
+    if constexpr (std::is_convertible<E&, asio::execution_context&>::value) {
+        util::spawn(exec.get_executor(), std::forward<Function>(f), stack_size);
+    } else {
+        detail::spawn( asio::bind_executor( asio::strand<E>(exec)
+                                          , &detail::default_spawn_handler)
+                     , true, std::forward<Function>(f), stack_size);
+    }
+}
+
+// Start a coroutine in the same strand as the given one.
+template<class Handler, class Function>
+void spawn( asio::basic_yield_context<Handler> yield
+          , Function&& f
+          , StackSize stack_size = StackSize::normal)
+{
+    Handler h(yield.handler_);
+    detail::spawn(std::move(h), false, std::forward<Function>(f), stack_size);
+}
+
+}} // namespaces
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+namespace ouinet { namespace util {
+
+/*
+ * A hierarchical timing wheel of keys, each of them due at some time.
+ *
+ * Scheduling and cancelling keys take constant time regardless of how many
+ * keys there are, and so does getting the due keys (amortized, since keys
+ * scheduled far ahead are moved down through the wheel levels a few times).
+ *
+ * Times are rounded up to `tick`, and keys due at the same tick
+ * are returned roughly in the order they were scheduled.
+ *
+ * Usage:
+ *
+ *     TimingWheel<std::string> w(std::chrono::seconds(1));
+ *     w.schedule("foo", Clock::now() + std::chrono::minutes(20));
+ *     // ...
+ *     for (auto& key : w.expire(Clock::now())) { ... }
+ *     auto next = w.next_event();  // when to call `expire` again
+ */
+template<class Key, class Hash = std::hash<Key>>
+class TimingWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    static const unsigned slot_bits = 6;
+    static const uint64_t slot_count = 1 << slot_bits;
+    static const uint64_t slot_mask = slot_count - 1;
+    static const unsigned level_count = 4;
+    // Keys due later than this many ticks are kept in the last level
+    // until they get closer.
+    static const uint64_t max_ticks = uint64_t(1) << (slot_bits * level_count);
+
+    using Slot = std::list<Key>;
+
+    struct Node {
+        uint64_t due;  // tick
+        unsigned level;
+        uint64_t slot;
+        typename Slot::iterator pos;
+    };
+
+public:
+    TimingWheel(Clock::duration tick, Clock::time_point start = Clock::now())
+        : _tick(tick)
+        , _origin(start)
+    {}
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    // Schedule the key to be due at the given time,
+    // replacing any previous schedule for it.
+    // Keys in the past are due on the next call to `expire`.
+    void schedule(const Key& key, Clock::time_point when)
+    {
+        cancel(key);
+
+        auto due = to_tick(when);
+        if (due >= _current) return insert(key, due);
+
+        Node n{_current - 1, level_count, 0, {}};
+        n.pos = _overdue.insert(_overdue.end(), key);
+        _nodes[key] = n;
+    }
+
+    // Return true if the key was scheduled.
+    bool cancel(const Key& key)
+    {
+        auto i = _nodes.find(key);
+        if (i == _nodes.end()) return false;
+        auto& n = i->second;
+        slot_of(n).erase(n.pos);
+        _nodes.erase(i);
+        return true;
+    }
+
+    bool contains(const Key& key) const { return _nodes.count(key) != 0; }
+
+    size_t size() const { return _nodes.size(); }
+    bool empty() const { return _nodes.empty(); }
+
+    boost::optional<Clock::time_point> due_time(const Key& key) const
+    {
+        auto i = _nodes.find(key);
+        if (i == _nodes.end()) return boost::none;
+        return to_time(i->second.due);
+    }
+
+    // Remove and return keys due by the given time, earliest first.
+    std::vector<Key> expire(Clock::time_point now)
+    {
+        std::vector<Key> ret;
+
+        for (auto& key : _overdue) {
+            ret.push_back(key);
+            _nodes.erase(key);
+        }
+        _overdue.clear();
+
+        auto end = to_tick_floor(now) + 1;
+
+        while (_current < end) {
+            if (_nodes.empty()) {
+                _current = end;
+                break;
+            }
+
+            if ((_current & slot_mask) == 0) cascade(1);
+
+            auto& slot = _levels[0][_current & slot_mask];
+            for (auto& key : slot) {
+                ret.push_back(key);
+                _nodes.erase(key);
+            }
+            slot.clear();
+
+            ++_current;
+        }
+
+        return ret;
+    }
+
+    // The time when some key may be due, or keys may need to be moved
+    // down the wheel (so `expire` should be called then).
+    boost::optional<Clock::time_point> next_event() const
+    {
+        if (_nodes.empty()) return boost::none;
+        if (!_overdue.empty()) return to_time(_current - 1);
+
+        // Keys may be moved down to the first level at the start of its turn.
+        if ((_current & slot_mask) == 0) return to_time(_current);
+
+        // Until the next cascade, only the first level may have due keys.
+        auto next_cascade = (_current | slot_mask) + 1;
+        for (auto t = _current; t < next_cascade; ++t) {
+            if (!_levels[0][t & slot_mask].empty()) return to_time(t);
+        }
+        return to_time(next_cascade);
+    }
+
+private:
+    Slot& slot_of(const Node& n)
+    {
+        if (n.level == level_count) return _overdue;
+        return _levels[n.level][n.slot];
+    }
+
+    void insert(const Key& key, uint64_t due)
+    {
+        auto delta = due - _current;
+        unsigned level = 0;
+        while (level + 1 < level_count && delta >= (uint64_t(1) << (slot_bits * (level + 1))))
+            ++level;
+
+        // Too far ahead: park it in the last slot reachable,
+        // it will be moved down when that slot is cascaded.
+        auto slot_due = (delta < max_ticks) ? due : _current + max_ticks - 1;
+
+        Node n{due, level, (slot_due >> (slot_bits * level)) & slot_mask, {}};
+        auto& slot = slot_of(n);
+        n.pos = slot.insert(slot.end(), key);
+        _nodes[key] = n;
+    }
+
+    // Move keys in the current slot of the given level to lower levels,
+    // after doing the same for the next level if its slot changes too.
+    void cascade(unsigned level)
+    {
+        if (level >= level_count) return;
+
+        auto index = (_current >> (slot_bits * level)) & slot_mask;
+        if (index == 0) cascade(level + 1);
+
+        auto& slot = _levels[level][index];
+        Slot keys;
+        keys.splice(keys.end(), slot);
+
+        for (auto& key : keys) {
+            auto due = _nodes[key].due;
+            _nodes.erase(key);
+            insert(key, std::max(due, _current));
+        }
+    }
+
+    uint64_t to_tick(Clock::time_point t) const
+    {
+        if (t <= _origin) return 0;
+        return (t - _origin + _tick - Clock::duration(1)) / _tick;  // round up
+    }
+
+    uint64_t to_tick_floor(Clock::time_point t) const
+    {
+        if (t <= _origin) return 0;
+        return (t - _origin) / _tick;
+    }
+
+    Clock::time_point to_time(uint64_t tick) const
+    {
+        return _origin + tick * _tick;
+    }
+
+private:
+    Clock::duration _tick;
+    Clock::time_point _origin;
+    uint64_t _current = 0;  // first tick not expired yet
+    std::array<std::array<Slot, slot_count>, level_count> _levels;
+    Slot _overdue;  // scheduled for ticks already expired
+    std::unordered_map<Key, Node, Hash> _nodes;
+};
+
+}} // namespaces
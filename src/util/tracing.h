@@ -0,0 +1,246 @@
+// Recording of the time spent in the tagged operations of a request
+// (see `Yield::start_trace`), so that slow requests can be examined
+// without enabling debug logging.
+//
+// Each trace is a tree of spans (name, start, duration, error)
+// rooted at the request.
+// When the whole tree is done, the trace is kept in a ring of recent traces
+// if it took long enough, and the ring can be exported
+// in the Chrome trace event format
+// (see <https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU>),
+// which can be loaded in `chrome://tracing` or <https://ui.perfetto.dev/>.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "../namespaces.h"
+
+namespace ouinet { namespace tracing {
+
+using Clock = std::chrono::steady_clock;
+
+struct Span {
+    std::string name;
+    Clock::time_point start;
+    Clock::duration duration;
+    size_t parent;  // index of parent span (the root is its own parent)
+    sys::error_code ec;
+};
+
+class Trace {
+public:
+    explicit Trace(std::string name)
+    {
+        _spans.push_back({std::move(name), Clock::now(), {}, 0, {}});
+    }
+
+    Trace(const Trace&) = delete;
+    Trace& operator=(const Trace&) = delete;
+
+    // Submits the trace to the tracer.
+    ~Trace();
+
+    // The root span has index 0.
+    size_t begin_span(size_t parent, std::string name)
+    {
+        _spans.push_back({std::move(name), Clock::now(), {}, parent, {}});
+        return _spans.size() - 1;
+    }
+
+    void end_span(size_t span, const sys::error_code& ec)
+    {
+        auto& s = _spans[span];
+        s.duration = Clock::now() - s.start;
+        s.ec = ec;
+    }
+
+private:
+    std::vector<Span> _spans;
+};
+
+class Tracer {
+public:
+    // Keep up to `capacity` traces which took at least `min_duration`.
+    // A null capacity disables tracing (the default).
+    void enable(size_t capacity, Clock::duration min_duration = {})
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _capacity = capacity;
+        _min_duration = min_duration;
+        while (_traces.size() > _capacity) _traces.pop_front();
+    }
+
+    bool is_enabled() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _capacity > 0;
+    }
+
+    // Return null if tracing is disabled.
+    std::shared_ptr<Trace> start(std::string name)
+    {
+        if (!is_enabled()) return nullptr;
+        return std::make_shared<Trace>(std::move(name));
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _traces.size();
+    }
+
+    // Write kept traces as a JSON object in the Chrome trace event format.
+    void write_chrome_trace(std::ostream&) const;
+
+private:
+    friend class Trace;
+
+    struct Finished {
+        uint64_t id;
+        std::vector<Span> spans;
+    };
+
+    void finish(std::vector<Span> spans)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_capacity == 0 || spans.front().duration < _min_duration) return;
+        _traces.push_back({_next_id++, std::move(spans)});
+        if (_traces.size() > _capacity) _traces.pop_front();
+    }
+
+    static void write_json_string(std::ostream&, const std::string&);
+    static std::vector<size_t> assign_lanes(const std::vector<Span>&);
+
+private:
+    mutable std::mutex _mutex;
+    size_t _capacity = 0;
+    Clock::duration _min_duration{};
+    std::deque<Finished> _traces;
+    uint64_t _next_id = 1;
+};
+
+// The tracer for the whole process.
+inline
+Tracer& tracer()
+{
+    static Tracer t;
+    return t;
+}
+
+inline
+Trace::~Trace()
+{
+    tracer().finish(std::move(_spans));
+}
+
+// Concurrent operations of a request (e.g. fetch jobs) overlap,
+// but spans in a track of the viewer must be properly nested.
+// Put each span in the track of its parent if it fits there,
+// otherwise in another one.
+/* static */
+inline
+std::vector<size_t> Tracer::assign_lanes(const std::vector<Span>& spans)
+{
+    std::vector<size_t> lanes(spans.size(), 0);
+    // Spans still open at the current time, per lane.
+    std::vector<std::vector<Clock::time_point>> open_ends;
+
+    std::vector<size_t> order(spans.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&] (size_t a, size_t b) {
+        return spans[a].start < spans[b].start;
+    });
+
+    auto fits = [&] (size_t lane, const Span& s) {
+        auto& ends = open_ends[lane];
+        while (!ends.empty() && ends.back() <= s.start) ends.pop_back();
+        return ends.empty() || ends.back() >= s.start + s.duration;
+    };
+
+    for (auto i : order) {
+        auto& s = spans[i];
+        size_t lane = lanes[s.parent];
+
+        if (i == 0) {
+            open_ends.emplace_back();
+        } else if (!fits(lane, s)) {
+            for (lane = 0; lane < open_ends.size(); ++lane)
+                if (fits(lane, s)) break;
+            if (lane == open_ends.size()) open_ends.emplace_back();
+        }
+
+        lanes[i] = lane;
+        open_ends[lane].push_back(s.start + s.duration);
+    }
+
+    return lanes;
+}
+
+/* static */
+inline
+void Tracer::write_json_string(std::ostream& os, const std::string& s)
+{
+    static const char hex[] = "0123456789abcdef";
+    os << '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') os << '\\' << c;
+        else if (c < 0x20) os << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+        else os << c;
+    }
+    os << '"';
+}
+
+inline
+void Tracer::write_chrome_trace(std::ostream& os) const
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto us = [] (Clock::duration d) { return duration_cast<microseconds>(d).count(); };
+
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    bool first = true;
+    auto sep = [&] { if (!first) os << ','; first = false; };
+
+    // Each trace is shown as a process, with concurrent operations as threads.
+    for (auto& t : _traces) {
+        sep();
+        os << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << t.id
+           << ",\"args\":{\"name\":";
+        write_json_string(os, t.spans.front().name);
+        os << "}}";
+
+        auto lanes = assign_lanes(t.spans);
+
+        for (size_t i = 0; i < t.spans.size(); ++i) {
+            auto& s = t.spans[i];
+            sep();
+            os << "{\"ph\":\"X\",\"cat\":\"ouinet\",\"name\":";
+            write_json_string(os, s.name);
+            os << ",\"pid\":" << t.id << ",\"tid\":" << lanes[i]
+               << ",\"ts\":" << us(s.start.time_since_epoch())
+               << ",\"dur\":" << us(s.duration);
+            if (s.ec) {
+                os << ",\"args\":{\"ec\":";
+                write_json_string(os, s.ec.message());
+                os << '}';
+            }
+            os << '}';
+        }
+    }
+
+    os << "]}";
+}
+
+}} // namespaces
@@ -238,7 +238,7 @@ public:
     void start(const asio::executor& ex, Duration d, OnTimeout on_timeout) {
         stop();
 
-        asio::spawn(ex, [self_ = this, ex, d, on_timeout = std::move(on_timeout)]
+        util::spawn(ex, [self_ = this, ex, d, on_timeout = std::move(on_timeout)]
                          (asio::yield_context yield) mutable {
             TRACK_HANDLER();
             State state(self_, Clock::now() + d, ex);
@@ -261,7 +261,7 @@ public:
             }
 
             on_timeout();
-        });
+        }, util::StackSize::small);
     }
 
     Clock::duration stop()
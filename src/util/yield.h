@@ -5,6 +5,8 @@
 #include "../util/str.h"
 #include "../logger.h"
 #include "../or_throw.h"
+#include "spawn.h"
+#include "tracing.h"
 #include <boost/intrusive/list.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/steady_timer.hpp>
@@ -77,6 +79,8 @@ private:
         , _tag(parent.tag())
         , _parent(&parent)
         , _start_time(Clock::now())
+        , _trace(parent._trace)
+        , _span(parent._span)
     {
         parent._children.push_back(*this);
     }
@@ -90,22 +94,43 @@ public:
         , _parent(&y)
         , _timeout_state(std::move(y._timeout_state))
         , _start_time(y._start_time)
+        , _trace(y._trace)
+        , _span(y._span)
+        , _owns_span(y._owns_span)
     {
         if (_timeout_state) {
             _timeout_state->self = this;
         }
 
+        y._owns_span = false;
+
         y._children.push_back(*this);
     }
 
     Yield tag(std::string t)
     {
         Yield ret(*this);
+        if (_trace) {
+            ret._span = _trace->begin_span(_span, t);
+            ret._owns_span = true;
+        }
         ret._tag = tag() + "/" + t;
         ret.start_timing();
         return ret;
     }
 
+    // Record the time spent in operations tagged from now on
+    // (and their errors, when reported via `yield[ec]`),
+    // if tracing is enabled (see `tracing::Tracer`).
+    // The trace is done when this and all derived instances are.
+    void start_trace(std::string name)
+    {
+        assert(!_trace);
+        _trace = tracing::tracer().start(std::move(name));
+        _span = 0;
+        _owns_span = bool(_trace);
+    }
+
     const std::string& tag() const
     {
         if (_tag.empty()) {
@@ -155,6 +180,10 @@ public:
 
     ~Yield()
     {
+        if (_owns_span) {
+            _trace->end_span(_span, _asio_yield.ec_ ? *_asio_yield.ec_ : sys::error_code());
+        }
+
         if (_children.empty()) {
             stop_timing();
         }
@@ -216,6 +245,9 @@ private:
     std::shared_ptr<TimeoutState> _timeout_state;
     List _children;
     Clock::time_point _start_time;
+    std::shared_ptr<tracing::Trace> _trace;
+    size_t _span = 0;
+    bool _owns_span = false;
 };
 
 inline
@@ -239,7 +271,7 @@ void Yield::start_timing()
 
     _timeout_state = std::make_shared<TimeoutState>(_ex, this);
 
-    asio::spawn(_ex
+    util::spawn(_ex
                , [ ts = _timeout_state, timeout]
                  (asio::yield_context yield) {
 
@@ -269,7 +301,8 @@ void Yield::start_timing()
 
                 notify(Clock::now() - ts->self->_start_time);
             }
-        });
+        }
+               , util::StackSize::small);
 }
 
 template<class... Args>
@@ -0,0 +1,366 @@
+// Benchmarks of the signing, storage and verification of cached responses.
+//
+// Usage: bench-cache [--min-time SECONDS] [--filter SUBSTRING] [SIZE...]
+//
+// Sizes of the synthetic response bodies may have a `K` or `M` suffix
+// (e.g. `64K`, `100M`).
+// Each benchmark is repeated for at least the given time,
+// and its results are printed to the standard output as a JSON object per line
+// with the following members:
+//
+//   - `benchmark`: name of the benchmark
+//   - `size`: size of the response body in bytes
+//   - `iterations`: number of times that the benchmark was run
+//   - `ns_per_op`: average duration of each run, in nanoseconds
+//   - `bytes_per_second`: body bytes processed per second
+//   - `allocs_per_op`: average number of heap allocations per run
+//   - `alloc_bytes_per_op`: average number of heap allocated bytes per run
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/filesystem.hpp>
+
+#include <cache/http_sign.h>
+#include <cache/http_store.h>
+#include <cache/chain_hasher.h>
+#include <cache/hash_list.h>
+#include <constants.h>
+#include <generic_stream.h>
+#include <response_reader.h>
+#include <util/crypto.h>
+#include <util/hash.h>
+#include <util/str.h>
+#include <util/temp_dir.h>
+
+#include <namespaces.h>
+
+using namespace std;
+using namespace ouinet;
+
+//// Allocation counting
+
+static atomic<uint64_t> alloc_count{0};
+static atomic<uint64_t> alloc_bytes{0};
+
+void* operator new(size_t size)
+{
+    alloc_count.fetch_add(1, memory_order_relaxed);
+    alloc_bytes.fetch_add(size, memory_order_relaxed);
+    if (auto p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+//// In-memory streams
+
+// Reads come from the given data, writes are appended to the given output
+// (if any, otherwise discarded).
+class MemoryStream {
+public:
+    using executor_type = asio::executor;
+
+    MemoryStream( const asio::executor& ex
+                , shared_ptr<const string> in
+                , shared_ptr<string> out = nullptr)
+        : _ex(ex), _in(move(in)), _out(move(out))
+    {}
+
+    executor_type get_executor() { return _ex; }
+
+    template<class Buffers, class Handler>
+    void async_read_some(const Buffers& bufs, Handler&& h)
+    {
+        sys::error_code ec;
+        size_t n = 0;
+        if (!_in || _pos == _in->size()) {
+            ec = asio::error::eof;
+        } else {
+            n = asio::buffer_copy(bufs, asio::buffer(*_in) + _pos);
+            _pos += n;
+        }
+        asio::post(_ex, [h = forward<Handler>(h), ec, n] () mutable { h(ec, n); });
+    }
+
+    template<class Buffers, class Handler>
+    void async_write_some(const Buffers& bufs, Handler&& h)
+    {
+        auto n = asio::buffer_size(bufs);
+        if (_out) {
+            auto pos = _out->size();
+            _out->resize(pos + n);
+            asio::buffer_copy(asio::buffer(&(*_out)[pos], n), bufs);
+        }
+        asio::post(_ex, [h = forward<Handler>(h), n] () mutable { h(sys::error_code(), n); });
+    }
+
+    bool is_open() const { return _open; }
+    void close() { _open = false; }
+
+private:
+    asio::executor _ex;
+    shared_ptr<const string> _in;
+    shared_ptr<string> _out;
+    size_t _pos = 0;
+    bool _open = true;
+};
+
+static
+GenericStream memory_stream( const asio::executor& ex
+                           , shared_ptr<const string> in
+                           , shared_ptr<string> out = nullptr)
+{
+    return GenericStream(MemoryStream(ex, move(in), move(out)));
+}
+
+//// Synthetic responses
+
+static const string inj_id = "d6076384-2295-462b-a047-fe2c9274e58d";
+static const chrono::seconds::rep inj_ts = 1516048310;
+
+static
+http::request_header<> request_header()
+{
+    http::request_header<> rqh;
+    rqh.method(http::verb::get);
+    rqh.target("https://example.com/foo");
+    rqh.version(11);
+    rqh.set(http::field::host, "example.com");
+    return rqh;
+}
+
+static
+string origin_response(size_t body_size)
+{
+    string body(body_size, '\0');
+    for (size_t i = 0; i < body_size; ++i) body[i] = 'a' + (i * 7919 % 26);
+    return util::str( "HTTP/1.1 200 OK\r\n"
+                      "Date: Mon, 15 Jan 2018 20:31:50 GMT\r\n"
+                      "Server: Apache\r\n"
+                      "Content-Type: application/octet-stream\r\n"
+                      "Content-Length: ", body_size, "\r\n"
+                      "\r\n"
+                    , body);
+}
+
+// Read all parts from the reader, optionally writing them to the stream.
+static
+void drain( http_response::AbstractReader& rd, GenericStream* out
+          , Cancel& cancel, asio::yield_context yield)
+{
+    while (auto part = rd.async_read_part(cancel, yield)) {
+        if (out) part->async_write(*out, cancel, yield);
+    }
+}
+
+//// Benchmark runner
+
+struct Options {
+    chrono::duration<double> min_time{0.5};
+    string filter;
+    vector<size_t> sizes;
+};
+
+struct Result {
+    uint64_t iterations = 0;
+    chrono::steady_clock::duration elapsed{};
+    uint64_t allocs = 0;
+    uint64_t alloc_bytes = 0;
+};
+
+static
+void report(const string& name, size_t size, const Result& r)
+{
+    auto secs = chrono::duration<double>(r.elapsed).count();
+    cout << "{\"benchmark\":\"" << name << "\""
+         << ",\"size\":" << size
+         << ",\"iterations\":" << r.iterations
+         << ",\"ns_per_op\":" << uint64_t(secs * 1e9 / r.iterations)
+         << ",\"bytes_per_second\":" << uint64_t(size * r.iterations / secs)
+         << ",\"allocs_per_op\":" << r.allocs / r.iterations
+         << ",\"alloc_bytes_per_op\":" << r.alloc_bytes / r.iterations
+         << "}" << endl;
+}
+
+// Run `op` repeatedly, only measuring time and allocations within it.
+// `setup` is run before each iteration and not measured.
+template<class Setup, class Op>
+static
+void run( const Options& opts, const string& name, size_t size
+        , Setup&& setup, Op&& op)
+{
+    if (name.find(opts.filter) == string::npos) return;
+
+    Result r;
+    do {
+        setup();
+        auto a0 = alloc_count.load(), b0 = alloc_bytes.load();
+        auto t0 = chrono::steady_clock::now();
+        op();
+        r.elapsed += chrono::steady_clock::now() - t0;
+        r.allocs += alloc_count.load() - a0;
+        r.alloc_bytes += alloc_bytes.load() - b0;
+        ++r.iterations;
+    } while (r.elapsed < opts.min_time);
+
+    report(name, size, r);
+}
+
+template<class Op>
+static
+void run(const Options& opts, const string& name, size_t size, Op&& op)
+{
+    run(opts, name, size, [] {}, forward<Op>(op));
+}
+
+//// Benchmarks
+
+static
+void bench_size( const Options& opts, size_t size
+               , const asio::executor& ex, asio::yield_context yield)
+{
+    Cancel cancel;
+    auto sk = util::Ed25519PrivateKey::generate();
+    auto pk = sk.public_key();
+
+    auto origin = make_shared<const string>(origin_response(size));
+
+    // Keep a signed response to be used by later benchmarks.
+    auto signed_ = make_shared<string>();
+    {
+        cache::SigningReader rd( memory_stream(ex, origin), request_header()
+                               , inj_id, inj_ts, sk);
+        auto out = memory_stream(ex, nullptr, signed_);
+        drain(rd, &out, cancel, yield);
+    }
+
+    run(opts, "sign", size, [&] {
+        cache::SigningReader rd( memory_stream(ex, origin), request_header()
+                               , inj_id, inj_ts, sk);
+        drain(rd, nullptr, cancel, yield);
+    });
+
+    run(opts, "verify", size, [&] {
+        cache::VerifyingReader rd(memory_stream(ex, signed_), pk);
+        drain(rd, nullptr, cancel, yield);
+    });
+
+    sys::error_code ec;
+    auto tmp = util::temp_dir::make(fs::temp_directory_path(), "bench-cache-%%%%-%%%%", ec);
+    if (!tmp) throw sys::system_error(ec);
+    tmp->keep_on_close(false);
+    auto store_dir = tmp->path() / "store";
+    auto stored_dir = tmp->path() / "stored";
+
+    run(opts, "http_store", size, [&] {
+        fs::remove_all(store_dir);
+        fs::create_directory(store_dir);
+    }, [&] {
+        http_response::Reader rd(memory_stream(ex, signed_));
+        cache::http_store(rd, store_dir, ex, cancel, yield);
+    });
+
+    {
+        fs::create_directory(stored_dir);
+        http_response::Reader rd(memory_stream(ex, signed_));
+        cache::http_store(rd, stored_dir, ex, cancel, yield);
+    }
+
+    run(opts, "http_store_reader", size, [&] {
+        auto rd = cache::http_store_reader(stored_dir, ex, ec);
+        if (ec) throw sys::system_error(ec);
+        drain(*rd, nullptr, cancel, yield);
+    });
+
+    // The middle half of the body.
+    run(opts, "http_store_range_reader", size / 2, [&] {
+        if (size < 4) return;
+        auto rd = cache::http_store_range_reader
+            (stored_dir, ex, size / 4, size / 4 + size / 2 - 1, ec);
+        if (ec) throw sys::system_error(ec);
+        drain(*rd, nullptr, cancel, yield);
+    });
+
+    run(opts, "hash_list_load", size, [&] {
+        cache::http_store_load_hash_list(stored_dir, ex, cancel, yield);
+    });
+
+    auto hash_list = cache::http_store_load_hash_list(stored_dir, ex, cancel, yield);
+    run(opts, "hash_list_verify", size, [&] {
+        if (!hash_list.verify()) throw runtime_error("Hash list verification failed");
+    });
+
+    // Data hashing, chaining and signing of blocks, as done by the injector.
+    boost::string_view body(*origin);
+    body = body.substr(body.size() - size);
+    run(opts, "chain_hash", size, [&] {
+        cache::ChainHasher hasher;
+        for (size_t off = 0; off < size; off += http_::response_data_block) {
+            auto block = body.substr(off, http_::response_data_block);
+            hasher.calculate_block( block.size(), util::SHA512::digest(block)
+                                  , cache::ChainHasher::Signer{inj_id, sk});
+        }
+    });
+}
+
+static
+size_t parse_size(const string& s)
+{
+    size_t mult = 1;
+    auto num = s;
+    if (!s.empty() && (s.back() == 'K' || s.back() == 'k')) mult = 1024;
+    if (!s.empty() && (s.back() == 'M' || s.back() == 'm')) mult = 1024 * 1024;
+    if (mult != 1) num.pop_back();
+    return stoull(num) * mult;
+}
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--min-time" && i + 1 < argc) {
+            opts.min_time = chrono::duration<double>(stod(argv[++i]));
+        } else if (arg == "--filter" && i + 1 < argc) {
+            opts.filter = argv[++i];
+        } else if (arg == "--help" || arg[0] == '-') {
+            cerr << "Usage: " << argv[0]
+                 << " [--min-time SECONDS] [--filter SUBSTRING] [SIZE...]" << endl;
+            return arg == "--help" ? 0 : 1;
+        } else {
+            opts.sizes.push_back(parse_size(arg));
+        }
+    }
+
+    if (opts.sizes.empty())
+        opts.sizes = {1 << 10, 64 << 10, 1 << 20, 16 << 20, 100 << 20};
+
+    asio::io_context ctx;
+    int ret = 0;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        try {
+            for (auto size : opts.sizes)
+                bench_size(opts, size, ctx.get_executor(), yield);
+        } catch (const exception& e) {
+            cerr << "Benchmark failed: " << e.what() << endl;
+            ret = 1;
+        }
+    });
+
+    ctx.run();
+    return ret;
+}
@@ -0,0 +1,424 @@
+// Benchmark of DHT lookups in a simulated network of in-process nodes
+// (see `sim_udp_network.h`), so that routing and lookup changes
+// can be evaluated offline and reproducibly.
+//
+// Usage: bench-dht [--nodes N] [--lookups N] [--latency MIN_MS:MAX_MS]
+//                  [--loss PROBABILITY] [--churn FRACTION] [--seed N]
+//                  [--filter SUBSTRING]
+//
+// The network is grown by starting nodes in waves of doubling size,
+// each node bootstrapping off a random node which is already running.
+// With churn, the given fraction of nodes (other than the ones doing lookups)
+// is offline at any time, and a different random set is chosen every second.
+//
+// Each operation is run with random targets from random nodes,
+// and its results are printed to the standard output as a JSON object
+// with the following members:
+//
+//   - `benchmark`: name of the operation
+//   - `runs`: number of times that it was run
+//   - `success_ratio`: ratio of runs which found the announced or stored
+//     item (or any nodes for `find_closest_nodes`)
+//   - `hops_mean`, `hops_max`: depth of the lookup, i.e. the length of the
+//     longest chain of replying nodes where each one was learned about
+//     from the reply of the previous one
+//   - `messages_mean`: datagrams sent and received by the node doing
+//     the lookup
+//   - `ms_mean`, `ms_p50`, `ms_p95`: wall time of the operation
+//
+// Times are real: latency is simulated with timers,
+// so a run takes about as long as it would on a real network.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/asio/spawn.hpp>
+
+#include <bittorrent/dht.h>
+#include <bittorrent/udp_multiplexer.h>
+#include <bittorrent/node_contact.h>
+#include <async_sleep.h>
+#include <logger.h>
+#include <util/crypto.h>
+#include <util/wait_condition.h>
+
+#include "sim_udp_network.h"
+
+#include <namespaces.h>
+
+using namespace std;
+using namespace ouinet;
+using namespace ouinet::bittorrent;
+using namespace ouinet::bittorrent::dht;
+using udp = asio::ip::udp;
+using Clock = chrono::steady_clock;
+
+struct Options {
+    size_t nodes = 1000;
+    size_t lookups = 20;
+    SimUdpNetwork::Config net;
+    double churn = 0;
+    string filter;
+};
+
+//// Lookup measurement
+
+// Observes the datagrams sent and received by a node during an operation.
+class Probe {
+public:
+    Probe(SimUdpNetwork& net, udp::endpoint origin)
+        : _net(net), _origin(origin)
+    {
+        _net.observe([this] (auto& from, auto& to, auto data) {
+            if (from == _origin) on_query(to);
+            else if (to == _origin) on_reply(from, data);
+        });
+        _sent0 = _net.sent_from(_origin);
+    }
+
+    ~Probe() { _net.observe(nullptr); }
+
+    size_t hops() const { return _hops; }
+    size_t messages() const { return _net.sent_from(_origin) - _sent0 + _received; }
+
+private:
+    void on_query(const udp::endpoint& to)
+    {
+        // Nodes not learned about from a reply come from our routing table.
+        _depth.insert({to, 1});
+    }
+
+    void on_reply(const udp::endpoint& from, boost::string_view data)
+    {
+        ++_received;
+
+        auto d = _depth.find(from);
+        if (d == _depth.end()) return;
+
+        auto msg = bencoding_decode(data);
+        if (!msg || !msg->as_map()) return;
+        auto& m = *msg->as_map();
+        if (!(m["y"] == "r") || !m["r"].as_map()) return;
+
+        auto depth = d->second;
+        _hops = max(_hops, depth);
+
+        auto nodes = (*m["r"].as_map())["nodes"].as_string_view();
+        if (!nodes) return;
+
+        vector<NodeContact> contacts;
+        NodeContact::decode_compact_v4(*nodes, contacts);
+
+        for (auto& c : contacts) {
+            auto p = _depth.insert({c.endpoint, depth + 1});
+            if (!p.second) p.first->second = min(p.first->second, depth + 1);
+        }
+    }
+
+private:
+    SimUdpNetwork& _net;
+    udp::endpoint _origin;
+    map<udp::endpoint, size_t> _depth;
+    size_t _hops = 0;
+    size_t _sent0 = 0;
+    size_t _received = 0;
+};
+
+struct Run {
+    bool success;
+    size_t hops;
+    size_t messages;
+    double ms;
+};
+
+static
+void report(const string& name, vector<Run> runs)
+{
+    if (runs.empty()) return;
+
+    double success = 0, hops = 0, messages = 0, ms = 0;
+    size_t hops_max = 0;
+
+    for (auto& r : runs) {
+        success += r.success;
+        hops += r.hops;
+        hops_max = max(hops_max, r.hops);
+        messages += r.messages;
+        ms += r.ms;
+    }
+
+    sort(runs.begin(), runs.end(), [] (auto& a, auto& b) { return a.ms < b.ms; });
+    // Nearest-rank percentile.
+    auto percentile = [&] (double p) {
+        return runs[max<size_t>(1, size_t(ceil(p * runs.size()))) - 1].ms;
+    };
+
+    auto n = runs.size();
+    cout << "{\"benchmark\":\"" << name << "\""
+         << ",\"runs\":" << n
+         << ",\"success_ratio\":" << success / n
+         << ",\"hops_mean\":" << hops / n
+         << ",\"hops_max\":" << hops_max
+         << ",\"messages_mean\":" << messages / n
+         << ",\"ms_mean\":" << ms / n
+         << ",\"ms_p50\":" << percentile(0.5)
+         << ",\"ms_p95\":" << percentile(0.95)
+         << "}" << endl;
+}
+
+// Run `op` from the given node, `op` returns whether it was successful.
+template<class Op>
+static
+Run measure(SimUdpNetwork& net, DhtNode& node, Op&& op)
+{
+    Probe probe(net, node.local_endpoint());
+    auto t0 = Clock::now();
+    bool success = op();
+    auto ms = chrono::duration<double, milli>(Clock::now() - t0).count();
+    return {success, probe.hops(), probe.messages(), ms};
+}
+
+//// Simulated network
+
+class Swarm {
+public:
+    Swarm(const asio::executor& ex, const Options& opts)
+        : _ex(ex), _opts(opts), _net(ex, opts.net)
+    {}
+
+    SimUdpNetwork& network() { return _net; }
+    std::mt19937& rng() { return _net.rng(); }
+
+    // Distinct public addresses, so that nodes get distinct BEP 42 IDs.
+    static udp::endpoint endpoint(size_t i)
+    {
+        return {asio::ip::address_v4(0x01000000 + uint32_t(i)), 6881};
+    }
+
+    void start(asio::yield_context yield)
+    {
+        // The first two nodes bootstrap off each other.
+        size_t started = 0;
+
+        for (size_t wave = 2; started < _opts.nodes; wave *= 2) {
+            auto end = min(started + wave, _opts.nodes);
+            WaitCondition wc(_ex);
+
+            for (size_t i = started; i < end; ++i) {
+                auto bs = started ? pick(started) : endpoint(1 - i);
+                _nodes.push_back(make_unique<DhtNode>(_ex, fs::path(), set<bootstrap::Address>{bs.address()}));
+                _nodes.back()->use_default_bootstraps(false);
+
+                asio::spawn(_ex, [&, i, lock = wc.lock()] (asio::yield_context yield) {
+                    auto m = make_unique<UdpMultiplexer>(_net.bind(endpoint(i)));
+                    sys::error_code ec;
+                    _nodes[i]->start(move(m), yield[ec]);
+                    if (ec) cerr << "Node " << i << " failed to start: " << ec.message() << endl;
+                });
+            }
+
+            wc.wait(yield);
+            started = end;
+            cerr << "Started " << started << " nodes" << endl;
+        }
+    }
+
+    // Keep the given fraction of nodes (but the active ones) offline.
+    void churn(asio::yield_context yield)
+    {
+        while (!_cancel) {
+            for (size_t i = 0; i < _nodes.size(); ++i) {
+                bool online = _active.count(i)
+                           || !bernoulli_distribution(_opts.churn)(rng());
+                _net.set_online(endpoint(i), online);
+            }
+
+            sys::error_code ec;
+            async_sleep(_ex, chrono::seconds(1), _cancel, yield[ec]);
+        }
+    }
+
+    // Pick a random node among the first `n` ones and mark it as active.
+    size_t pick_active(size_t n)
+    {
+        size_t i;
+        do i = uniform_int_distribution<size_t>(0, n - 1)(rng());
+        while (_active.count(i));
+        _active.insert(i);
+        _net.set_online(endpoint(i), true);
+        return i;
+    }
+
+    void release(size_t i) { _active.erase(i); }
+
+    DhtNode& node(size_t i) { return *_nodes[i]; }
+    size_t size() const { return _nodes.size(); }
+
+    NodeID random_id()
+    {
+        string s(NodeID::size, '\0');
+        for (auto& c : s) c = char(uniform_int_distribution<int>(0, 255)(rng()));
+        return NodeID::from_bytestring(s);
+    }
+
+    void stop()
+    {
+        _cancel();
+        _nodes.clear();
+    }
+
+private:
+    udp::endpoint pick(size_t n)
+    {
+        return endpoint(uniform_int_distribution<size_t>(0, n - 1)(rng()));
+    }
+
+private:
+    asio::executor _ex;
+    const Options& _opts;
+    SimUdpNetwork _net;
+    vector<unique_ptr<DhtNode>> _nodes;
+    set<size_t> _active;
+    Cancel _cancel;
+};
+
+//// Benchmarks
+
+static
+void bench(const Options& opts, Swarm& swarm, asio::yield_context yield)
+{
+    auto& net = swarm.network();
+    Cancel cancel;
+    sys::error_code ec;
+
+    auto enabled = [&] (const string& name) {
+        return name.find(opts.filter) != string::npos;
+    };
+
+    vector<Run> find_runs, announce_runs, get_peers_runs, get_mutable_runs;
+
+    for (size_t l = 0; l < opts.lookups; ++l) {
+        auto a = swarm.pick_active(swarm.size());
+        auto b = swarm.pick_active(swarm.size());
+        auto& na = swarm.node(a);
+        auto& nb = swarm.node(b);
+
+        if (enabled("find_closest_nodes")) {
+            auto target = swarm.random_id();
+            find_runs.push_back(measure(net, na, [&] {
+                return !na.find_closest_nodes(target, cancel, yield[ec]).empty();
+            }));
+        }
+
+        if (enabled("tracker_announce") || enabled("tracker_get_peers")) {
+            auto infohash = swarm.random_id();
+            announce_runs.push_back(measure(net, na, [&] {
+                na.tracker_announce(infohash, boost::none, cancel, yield[ec]);
+                return !ec;
+            }));
+            get_peers_runs.push_back(measure(net, nb, [&] {
+                auto peers = nb.tracker_get_peers(infohash, cancel, yield[ec]);
+                return peers.count(na.wan_endpoint()) > 0;
+            }));
+        }
+
+        if (enabled("data_get_mutable")) {
+            auto sk = util::Ed25519PrivateKey::generate();
+            auto salt = util::str("bench-", l);
+            auto item = MutableDataItem::sign(string("value"), 1, salt, sk);
+            na.data_put_mutable(item, cancel, yield[ec]);
+            get_mutable_runs.push_back(measure(net, nb, [&] {
+                auto got = nb.data_get_mutable(sk.public_key(), salt, cancel, yield[ec]);
+                return got && got->value.as_string() == item.value.as_string();
+            }));
+        }
+
+        swarm.release(a);
+        swarm.release(b);
+    }
+
+    // Nothing is reported for operations which were not run.
+    report("find_closest_nodes", move(find_runs));
+    report("tracker_announce", move(announce_runs));
+    report("tracker_get_peers", move(get_peers_runs));
+    report("data_get_mutable", move(get_mutable_runs));
+}
+
+static
+chrono::milliseconds parse_ms(const string& s)
+{
+    return chrono::milliseconds(stoll(s));
+}
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--nodes" && has_value) {
+            opts.nodes = max<size_t>(2, stoull(argv[++i]));
+        } else if (arg == "--lookups" && has_value) {
+            opts.lookups = stoull(argv[++i]);
+        } else if (arg == "--latency" && has_value) {
+            string v = argv[++i];
+            auto colon = v.find(':');
+            opts.net.min_latency = parse_ms(v.substr(0, colon));
+            opts.net.max_latency = colon == string::npos
+                                 ? opts.net.min_latency
+                                 : parse_ms(v.substr(colon + 1));
+        } else if (arg == "--loss" && has_value) {
+            opts.net.loss = stod(argv[++i]);
+        } else if (arg == "--churn" && has_value) {
+            opts.churn = stod(argv[++i]);
+        } else if (arg == "--seed" && has_value) {
+            opts.net.seed = stoul(argv[++i]);
+        } else if (arg == "--filter" && has_value) {
+            opts.filter = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0]
+                 << " [--nodes N] [--lookups N] [--latency MIN_MS:MAX_MS]"
+                    " [--loss PROBABILITY] [--churn FRACTION] [--seed N]"
+                    " [--filter SUBSTRING]" << endl;
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    // Node IDs get a random byte from `rand` (see `NodeID::generate`).
+    srand(opts.net.seed);
+    logger.set_threshold(WARN);
+
+    asio::io_context ctx;
+    Swarm swarm(ctx.get_executor(), opts);
+    int ret = 0;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        try {
+            swarm.start(yield);
+
+            if (opts.churn > 0) {
+                asio::spawn(ctx, [&] (asio::yield_context yield) {
+                    swarm.churn(yield);
+                });
+            }
+
+            bench(opts, swarm, yield);
+        } catch (const exception& e) {
+            cerr << "Benchmark failed: " << e.what() << endl;
+            ret = 1;
+        }
+        swarm.stop();
+    });
+
+    ctx.run();
+    return ret;
+}
@@ -0,0 +1,261 @@
+// Benchmarks of `util::LruCache` against the containers it replaced
+// (a `std::list` of entries indexed by a `std::unordered_map`,
+// or by a `std::map` as in the former `PersistentLruCache`).
+//
+// Usage: bench-lru [--min-time SECONDS] [--filter SUBSTRING] [ENTRIES...]
+//
+// Numbers of entries may have a `K` or `M` suffix (e.g. `1K`, `1M`).
+// Each cache is filled up to that many entries and then exercised
+// with string keys like those of the caches in the client.
+// Results are printed to the standard output as a JSON object per line
+// with the following members:
+//
+//   - `benchmark`: name of the benchmark (operation and container)
+//   - `entries`: maximum number of entries in the cache
+//   - `iterations`: number of operations run
+//   - `ns_per_op`: average duration of each operation, in nanoseconds
+//   - `allocs_per_op`: average number of heap allocations per operation
+//   - `bytes_per_entry`: heap bytes allocated by the full cache per entry
+//     (only for the `fill` benchmarks)
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <util/lru_cache.h>
+
+using namespace std;
+using namespace ouinet;
+
+//// Allocation counting
+
+static atomic<uint64_t> alloc_count{0};
+static atomic<uint64_t> alloc_bytes{0};
+
+void* operator new(size_t size)
+{
+    alloc_count.fetch_add(1, memory_order_relaxed);
+    alloc_bytes.fetch_add(size, memory_order_relaxed);
+    if (auto p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+//// Former containers
+
+template<class Key, class Value, class Map>
+class ListLruCache {
+private:
+    using KeyVal = std::pair<Key, Value>;
+    using List = std::list<KeyVal>;
+
+public:
+    ListLruCache(size_t max_size) : _max_size(max_size) {}
+
+    Value* put(const Key& key, Value value) {
+        auto it = _map.find(key);
+
+        _list.push_front(KeyVal(key, std::move(value)));
+
+        if (it != _map.end()) {
+            _list.erase(it->second);
+            it->second = _list.begin();
+        }
+        else {
+            _map[key] = _list.begin();
+        }
+
+        if (_map.size() > _max_size) {
+            auto last = _list.end();
+            last--;
+            _map.erase(last->first);
+            _list.pop_back();
+        }
+
+        return &_list.begin()->second;
+    }
+
+    Value* get(const Key& key) {
+        auto it = _map.find(key);
+        if (it == _map.end()) return nullptr;
+        _list.splice(_list.begin(), _list, it->second);
+        return &it->second->second;
+    }
+
+private:
+    List _list;
+    Map _map;
+    size_t _max_size;
+};
+
+template<class Value>
+using HashListLru = ListLruCache< string, Value
+                                , unordered_map<string, typename list<pair<string, Value>>::iterator>>;
+
+template<class Value>
+using TreeListLru = ListLruCache< string, Value
+                                , map<string, typename list<pair<string, Value>>::iterator>>;
+
+//// Benchmark runner
+
+struct Options {
+    chrono::duration<double> min_time{0.5};
+    string filter;
+    vector<size_t> sizes;
+};
+
+static
+string make_key(size_t i)
+{
+    // Similar to swarm names and host names.
+    return "ed25519:1234567890abcdef/v6/uri/https://example.com/" + to_string(i);
+}
+
+struct Result {
+    uint64_t iterations = 0;
+    chrono::steady_clock::duration elapsed{};
+    uint64_t allocs = 0;
+};
+
+static
+void report(const string& name, size_t size, const Result& r, uint64_t bytes_per_entry = 0)
+{
+    auto secs = chrono::duration<double>(r.elapsed).count();
+    cout << "{\"benchmark\":\"" << name << "\""
+         << ",\"entries\":" << size
+         << ",\"iterations\":" << r.iterations
+         << ",\"ns_per_op\":" << secs * 1e9 / r.iterations
+         << ",\"allocs_per_op\":" << double(r.allocs) / r.iterations;
+    if (bytes_per_entry) cout << ",\"bytes_per_entry\":" << bytes_per_entry;
+    cout << "}" << endl;
+}
+
+template<class Cache>
+static
+void bench(const Options& opts, const string& cname, size_t size, const vector<string>& keys)
+{
+    auto selected = [&] (const string& name) {
+        return name.find(opts.filter) != string::npos;
+    };
+
+    // Fill the cache, measuring the memory used by it.
+    string name = "fill/" + cname;
+    Result fill;
+    uint64_t bytes_per_entry = 0;
+    Cache* cache = nullptr;
+    do {
+        delete cache;
+        auto a0 = alloc_count.load(), b0 = alloc_bytes.load();
+        auto t0 = chrono::steady_clock::now();
+        cache = new Cache(size);
+        for (size_t i = 0; i < size; ++i) cache->put(keys[i], i);
+        fill.elapsed += chrono::steady_clock::now() - t0;
+        fill.allocs += alloc_count.load() - a0;
+        fill.iterations += size;
+        // This includes the copies of keys, the same for all containers.
+        bytes_per_entry = (alloc_bytes.load() - b0) / size;
+    } while (fill.elapsed < opts.min_time && selected(name));
+    if (selected(name)) report(name, size, fill, bytes_per_entry);
+
+    mt19937 rng(1);
+
+    // Look up present keys in random order.
+    name = "get_hit/" + cname;
+    if (selected(name)) {
+        uniform_int_distribution<size_t> pick(0, size - 1);
+        vector<size_t> order(4096);
+        for (auto& i : order) i = pick(rng);
+
+        Result r;
+        do {
+            auto a0 = alloc_count.load();
+            auto t0 = chrono::steady_clock::now();
+            for (auto i : order) if (!cache->get(keys[i])) abort();
+            r.elapsed += chrono::steady_clock::now() - t0;
+            r.allocs += alloc_count.load() - a0;
+            r.iterations += order.size();
+        } while (r.elapsed < opts.min_time);
+        report(name, size, r);
+    }
+
+    // Popular keys hit, the rest miss and are put in place of the oldest ones.
+    name = "mixed/" + cname;
+    if (selected(name)) {
+        // Twice as many keys as entries, most lookups going to a few of them.
+        exponential_distribution<double> pick(8.0 / keys.size());
+        vector<size_t> order(4096);
+        for (auto& i : order) i = min<size_t>(pick(rng), keys.size() - 1);
+
+        Result r;
+        do {
+            auto a0 = alloc_count.load();
+            auto t0 = chrono::steady_clock::now();
+            for (auto i : order) if (!cache->get(keys[i])) cache->put(keys[i], i);
+            r.elapsed += chrono::steady_clock::now() - t0;
+            r.allocs += alloc_count.load() - a0;
+            r.iterations += order.size();
+        } while (r.elapsed < opts.min_time);
+        report(name, size, r);
+    }
+
+    delete cache;
+}
+
+static
+size_t parse_size(const string& s)
+{
+    size_t mult = 1;
+    auto num = s;
+    if (!s.empty() && (s.back() == 'K' || s.back() == 'k')) mult = 1000;
+    if (!s.empty() && (s.back() == 'M' || s.back() == 'm')) mult = 1000 * 1000;
+    if (mult != 1) num.pop_back();
+    return stoull(num) * mult;
+}
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--min-time" && i + 1 < argc) {
+            opts.min_time = chrono::duration<double>(stod(argv[++i]));
+        } else if (arg == "--filter" && i + 1 < argc) {
+            opts.filter = argv[++i];
+        } else if (arg == "--help" || arg[0] == '-') {
+            cerr << "Usage: " << argv[0]
+                 << " [--min-time SECONDS] [--filter SUBSTRING] [ENTRIES...]" << endl;
+            return arg == "--help" ? 0 : 1;
+        } else {
+            opts.sizes.push_back(parse_size(arg));
+        }
+    }
+
+    if (opts.sizes.empty())
+        opts.sizes = {1000, 10000, 100000, 1000000};
+
+    for (auto size : opts.sizes) {
+        vector<string> keys;
+        keys.reserve(2 * size);
+        for (size_t i = 0; i < 2 * size; ++i) keys.push_back(make_key(i));
+
+        bench<util::LruCache<string, size_t>>(opts, "flat", size, keys);
+        bench<HashListLru<size_t>>(opts, "list+unordered_map", size, keys);
+        bench<TreeListLru<size_t>>(opts, "list+map", size, keys);
+    }
+
+    return 0;
+}
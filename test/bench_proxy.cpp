@@ -0,0 +1,496 @@
+// Load test of a client and injector pair running on the local host.
+//
+// Usage: bench-proxy [--client PATH] [--injector PATH]
+//                    [--origin-address ADDR] [--origin-latency MS]
+//                    [--connections N] [--requests N] [--size SIZE]...
+//
+// An in-process fake origin HTTP server serves cacheable objects
+// of the given sizes (with an optional `K` or `M` suffix)
+// after the given latency.
+// The injector and the client are run as child processes
+// with fresh repositories, the client reaching the injector over TCP
+// on the loopback interface.
+// Since the injector refuses to fetch from loopback addresses,
+// the origin listens on a non-loopback local address
+// (by default that of the interface with the default route).
+//
+// For each size, the given number of requests are sent through the HTTP proxy
+// of the client over the given number of concurrent keep-alive connections,
+// first for new objects (cache misses, fetched via the injector),
+// then for the same objects again (cache hits, served by the client).
+// The results of each workload are printed to the standard output
+// as a JSON object per line with the following members:
+//
+//   - `benchmark`: `cache_miss` or `cache_hit`
+//   - `size`: size of object bodies in bytes
+//   - `requests`, `errors`: number of sent requests and failed ones
+//   - `requests_per_second`, `bytes_per_second`: throughput
+//   - `ms_p50`, `ms_p99`: latency of requests
+//   - `client_cpu_ms_per_request`, `injector_cpu_ms_per_request`:
+//     CPU time (user and system) used by each process
+//   - `client_max_rss_kb`, `injector_max_rss_kb`:
+//     memory high-water mark of each process so far
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/process.hpp>
+
+#include <util/crypto.h>
+#include <util/str.h>
+#include <util/temp_dir.h>
+#include <util/wait_condition.h>
+
+#include <namespaces.h>
+
+using namespace std;
+using namespace ouinet;
+using tcp = asio::ip::tcp;
+using Clock = chrono::steady_clock;
+namespace bp = boost::process;
+
+#ifndef OUINET_CLIENT_PATH
+#define OUINET_CLIENT_PATH "client"
+#endif
+#ifndef OUINET_INJECTOR_PATH
+#define OUINET_INJECTOR_PATH "injector"
+#endif
+
+struct Options {
+    string client = OUINET_CLIENT_PATH;
+    string injector = OUINET_INJECTOR_PATH;
+    asio::ip::address origin_address;
+    chrono::milliseconds origin_latency{0};
+    size_t connections = 16;
+    size_t requests = 1000;
+    vector<size_t> sizes;
+    chrono::seconds startup_timeout{60};
+};
+
+//// Fake origin
+
+// Serves `/<size>/<name>` with a cacheable body of the given size.
+class FakeOrigin {
+public:
+    FakeOrigin(const asio::executor& ex, const Options& opts)
+        : _ex(ex), _opts(opts), _acceptor(ex, tcp::endpoint(opts.origin_address, 0))
+    {
+        asio::spawn(_ex, [this] (asio::yield_context yield) {
+            while (true) {
+                sys::error_code ec;
+                tcp::socket s(_ex);
+                _acceptor.async_accept(s, yield[ec]);
+                if (ec) return;
+                asio::spawn(_ex, [this, s = move(s)] (asio::yield_context yield) mutable {
+                    serve(s, yield);
+                });
+            }
+        });
+    }
+
+    tcp::endpoint endpoint() const { return _acceptor.local_endpoint(); }
+
+    void stop() { _acceptor.close(); }
+
+private:
+    static string http_date()
+    {
+        char buf[64];
+        auto t = time(nullptr);
+        tm gmt;
+        gmtime_r(&t, &gmt);
+        strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+        return buf;
+    }
+
+    const string& body(size_t size)
+    {
+        auto& b = _bodies[size];
+        if (b.size() != size) {
+            b.resize(size);
+            for (size_t i = 0; i < size; ++i) b[i] = 'a' + (i * 7919 % 26);
+        }
+        return b;
+    }
+
+    void serve(tcp::socket& s, asio::yield_context yield)
+    {
+        beast::flat_buffer buf;
+        asio::steady_timer timer(_ex);
+
+        while (true) {
+            sys::error_code ec;
+            http::request<http::empty_body> rq;
+            http::async_read(s, buf, rq, yield[ec]);
+            if (ec) return;
+
+            if (_opts.origin_latency.count()) {
+                timer.expires_after(_opts.origin_latency);
+                timer.async_wait(yield[ec]);
+            }
+
+            size_t size = 0;
+            auto target = rq.target().to_string();
+            if (target.size() > 1) size = strtoull(target.c_str() + 1, nullptr, 10);
+
+            http::response<http::string_body> rs{http::status::ok, rq.version()};
+            rs.set(http::field::server, "bench-proxy");
+            rs.set(http::field::date, http_date());
+            rs.set(http::field::cache_control, "public, max-age=3600");
+            rs.set(http::field::content_type, "application/octet-stream");
+            rs.body() = body(size);
+            rs.keep_alive(rq.keep_alive());
+            rs.prepare_payload();
+
+            http::async_write(s, rs, yield[ec]);
+            if (ec || !rq.keep_alive()) return;
+        }
+    }
+
+private:
+    asio::executor _ex;
+    const Options& _opts;
+    tcp::acceptor _acceptor;
+    map<size_t, string> _bodies;
+};
+
+//// Child processes
+
+class Process {
+public:
+    Process(const string& path, const vector<string>& args)
+        : _child(path, bp::args(args), bp::std_out > bp::null)
+    {}
+
+    ~Process()
+    {
+        if (!_child.running()) return;
+        ::kill(_child.id(), SIGTERM);
+        _child.wait_for(chrono::seconds(10));
+        if (_child.running()) _child.terminate();
+    }
+
+    bool running() { return _child.running(); }
+
+    // User and system CPU time used so far.
+    chrono::milliseconds cpu_time() const
+    {
+        ifstream f(util::str("/proc/", _child.id(), "/stat"));
+        string line;
+        getline(f, line);
+        // Skip the command name, which may contain spaces.
+        istringstream ss(line.substr(line.rfind(')') + 2));
+        string field;
+        unsigned long utime = 0, stime = 0;
+        for (int i = 3; i <= 15 && ss >> field; ++i) {
+            if (i == 14) utime = stoul(field);
+            if (i == 15) stime = stoul(field);
+        }
+        return chrono::milliseconds((utime + stime) * 1000 / ::sysconf(_SC_CLK_TCK));
+    }
+
+    // Peak resident set size so far.
+    size_t max_rss_kb() const
+    {
+        ifstream f(util::str("/proc/", _child.id(), "/status"));
+        string line;
+        while (getline(f, line)) {
+            if (line.compare(0, 6, "VmHWM:") == 0) return stoull(line.substr(6));
+        }
+        return 0;
+    }
+
+private:
+    bp::child _child;
+};
+
+static
+unsigned short free_tcp_port(const asio::executor& ex)
+{
+    tcp::acceptor a(ex, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    return a.local_endpoint().port();
+}
+
+static
+void make_repo(const fs::path& dir, const string& conf_file)
+{
+    fs::create_directories(dir);
+    ofstream((dir / conf_file).string());
+}
+
+//// Load
+
+struct Result {
+    size_t requests = 0;
+    size_t errors = 0;
+    size_t bytes = 0;
+    vector<double> ms;
+    chrono::duration<double> elapsed{};
+};
+
+// Send `requests` GET requests for `target(i)` through the proxy
+// over `connections` concurrent connections.
+template<class Target>
+static
+Result load( const asio::executor& ex
+           , const tcp::endpoint& proxy
+           , size_t connections, size_t requests
+           , Target&& target
+           , asio::yield_context yield)
+{
+    Result r;
+    size_t next = 0;
+    WaitCondition wc(ex);
+    auto t0 = Clock::now();
+
+    for (size_t c = 0; c < connections; ++c) {
+        asio::spawn(ex, [&, lock = wc.lock()] (asio::yield_context yield) {
+            tcp::socket s(ex);
+            beast::flat_buffer buf;
+
+            while (next < requests) {
+                auto i = next++;
+                sys::error_code ec;
+
+                if (!s.is_open()) s.async_connect(proxy, yield[ec]);
+
+                auto url = target(i);
+                http::request<http::empty_body> rq{http::verb::get, url, 11};
+                rq.set(http::field::host, url.substr(url.find("//") + 2, url.find('/', 7) - 7));
+                rq.set(http::field::user_agent, "Mozilla/5.0 (X11; Linux x86_64; rv:78.0) Gecko/20100101 Firefox/78.0");
+                rq.set(http::field::accept, "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8");
+                rq.set(http::field::accept_language, "en-US,en;q=0.5");
+                rq.keep_alive(true);
+
+                auto rt0 = Clock::now();
+                http::response_parser<http::string_body> rp;
+                rp.body_limit(numeric_limits<uint64_t>::max());
+                if (!ec) http::async_write(s, rq, yield[ec]);
+                if (!ec) http::async_read(s, buf, rp, yield[ec]);
+                r.ms.push_back(chrono::duration<double, milli>(Clock::now() - rt0).count());
+
+                ++r.requests;
+                if (ec || rp.get().result() != http::status::ok) {
+                    ++r.errors;
+                    s.close(ec);
+                    buf.consume(buf.size());
+                    continue;
+                }
+                r.bytes += rp.get().body().size();
+                if (!rp.get().keep_alive()) s.close(ec);
+            }
+        });
+    }
+
+    wc.wait(yield);
+    r.elapsed = Clock::now() - t0;
+    return r;
+}
+
+static
+void report( const string& name, size_t size, Result r
+           , chrono::milliseconds client_cpu, chrono::milliseconds injector_cpu
+           , const Process& client, const Process& injector)
+{
+    sort(r.ms.begin(), r.ms.end());
+    // Nearest-rank percentile.
+    auto percentile = [&] (double p) {
+        if (r.ms.empty()) return 0.;
+        return r.ms[max<size_t>(1, size_t(ceil(p * r.ms.size()))) - 1];
+    };
+
+    auto secs = r.elapsed.count();
+    auto n = max<size_t>(1, r.requests);
+    cout << "{\"benchmark\":\"" << name << "\""
+         << ",\"size\":" << size
+         << ",\"requests\":" << r.requests
+         << ",\"errors\":" << r.errors
+         << ",\"requests_per_second\":" << r.requests / secs
+         << ",\"bytes_per_second\":" << uint64_t(r.bytes / secs)
+         << ",\"ms_p50\":" << percentile(0.5)
+         << ",\"ms_p99\":" << percentile(0.99)
+         << ",\"client_cpu_ms_per_request\":" << double(client_cpu.count()) / n
+         << ",\"injector_cpu_ms_per_request\":" << double(injector_cpu.count()) / n
+         << ",\"client_max_rss_kb\":" << client.max_rss_kb()
+         << ",\"injector_max_rss_kb\":" << injector.max_rss_kb()
+         << "}" << endl;
+}
+
+//// Benchmark
+
+static
+void bench(const Options& opts, asio::io_context& ctx, asio::yield_context yield)
+{
+    auto ex = ctx.get_executor();
+    FakeOrigin origin(ex, opts);
+
+    sys::error_code ec;
+    auto tmp = util::temp_dir::make(fs::temp_directory_path(), "bench-proxy-%%%%-%%%%", ec);
+    if (!tmp) throw sys::system_error(ec);
+    tmp->keep_on_close(false);
+
+    auto key = util::Ed25519PrivateKey::generate();
+    auto injector_ep = tcp::endpoint(asio::ip::address_v4::loopback(), free_tcp_port(ex));
+    auto proxy_ep = tcp::endpoint(asio::ip::address_v4::loopback(), free_tcp_port(ex));
+    auto front_end_ep = tcp::endpoint(asio::ip::address_v4::loopback(), free_tcp_port(ex));
+
+    auto injector_repo = tmp->path() / "injector";
+    auto client_repo = tmp->path() / "client";
+    make_repo(injector_repo, "ouinet-injector.conf");
+    make_repo(client_repo, "ouinet-client.conf");
+
+    Process injector(opts.injector, { "--repo", injector_repo.string()
+                                    , "--log-level", "ERROR"
+                                    , "--listen-on-tcp", util::str(injector_ep)
+                                    , "--ed25519-private-key", util::str(key) });
+
+    Process client(opts.client, { "--repo", client_repo.string()
+                                , "--log-level", "ERROR"
+                                , "--listen-on-tcp", util::str(proxy_ep)
+                                , "--front-end-ep", util::str(front_end_ep)
+                                , "--injector-ep", util::str("tcp:", injector_ep)
+                                , "--cache-type", "bep5-http"
+                                , "--cache-http-public-key", util::str(key.public_key())
+                                , "--disable-origin-access"
+                                , "--disable-proxy-access" });
+
+    auto origin_url = util::str("http://", origin.endpoint(), "/");
+
+    // Wait for the injector to be reachable through the client.
+    {
+        asio::steady_timer timer(ex);
+        auto deadline = Clock::now() + opts.startup_timeout;
+        for (size_t attempt = 0;; ++attempt) {
+            if (!client.running() || !injector.running())
+                throw runtime_error("Client or injector exited");
+            auto r = load(ex, proxy_ep, 1, 1, [&] (size_t) {
+                return util::str(origin_url, "0/warmup-", attempt);
+            }, yield);
+            if (r.errors == 0) break;
+            if (Clock::now() > deadline)
+                throw runtime_error("Timed out waiting for the client and injector");
+            timer.expires_after(chrono::milliseconds(500));
+            timer.async_wait(yield);
+        }
+    }
+
+    for (auto size : opts.sizes) {
+        auto target = [&] (size_t i) { return util::str(origin_url, size, "/object-", i); };
+
+        for (auto name : {"cache_miss", "cache_hit"}) {
+            auto client_cpu = client.cpu_time();
+            auto injector_cpu = injector.cpu_time();
+
+            auto r = load(ex, proxy_ep, opts.connections, opts.requests, target, yield);
+
+            report( name, size, move(r)
+                  , client.cpu_time() - client_cpu
+                  , injector.cpu_time() - injector_cpu
+                  , client, injector);
+
+            // Let the client finish storing responses.
+            asio::steady_timer timer(ex);
+            timer.expires_after(chrono::seconds(1));
+            timer.async_wait(yield);
+        }
+    }
+
+    origin.stop();
+}
+
+// The local address used to reach the Internet.
+static
+asio::ip::address default_address(asio::io_context& ctx)
+{
+    // Connecting a UDP socket sends nothing.
+    asio::ip::udp::socket s(ctx, asio::ip::udp::v4());
+    s.connect({asio::ip::make_address("192.0.2.1"), 9});
+    return s.local_endpoint().address();
+}
+
+static
+size_t parse_size(const string& s)
+{
+    size_t mult = 1;
+    auto num = s;
+    if (!s.empty() && (s.back() == 'K' || s.back() == 'k')) mult = 1024;
+    if (!s.empty() && (s.back() == 'M' || s.back() == 'm')) mult = 1024 * 1024;
+    if (mult != 1) num.pop_back();
+    return stoull(num) * mult;
+}
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--client" && has_value) {
+            opts.client = argv[++i];
+        } else if (arg == "--injector" && has_value) {
+            opts.injector = argv[++i];
+        } else if (arg == "--origin-address" && has_value) {
+            opts.origin_address = asio::ip::make_address(argv[++i]);
+        } else if (arg == "--origin-latency" && has_value) {
+            opts.origin_latency = chrono::milliseconds(stoll(argv[++i]));
+        } else if (arg == "--connections" && has_value) {
+            opts.connections = max<size_t>(1, stoull(argv[++i]));
+        } else if (arg == "--requests" && has_value) {
+            opts.requests = stoull(argv[++i]);
+        } else if (arg == "--size" && has_value) {
+            opts.sizes.push_back(parse_size(argv[++i]));
+        } else {
+            cerr << "Usage: " << argv[0]
+                 << " [--client PATH] [--injector PATH]"
+                    " [--origin-address ADDR] [--origin-latency MS]"
+                    " [--connections N] [--requests N] [--size SIZE]..." << endl;
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    if (opts.sizes.empty()) opts.sizes = {1 << 10, 64 << 10, 1 << 20};
+
+    util::crypto_init();
+
+    asio::io_context ctx;
+    int ret = 0;
+
+    try {
+        if (opts.origin_address.is_unspecified())
+            opts.origin_address = default_address(ctx);
+    } catch (const exception& e) {
+        cerr << "No usable origin address, use --origin-address: " << e.what() << endl;
+        return 1;
+    }
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        try {
+            bench(opts, ctx, yield);
+        } catch (const exception& e) {
+            cerr << "Benchmark failed: " << e.what() << endl;
+            ret = 1;
+        }
+    });
+
+    ctx.run();
+    return ret;
+}
@@ -0,0 +1,222 @@
+// In-process simulated network of UDP endpoints,
+// to run many DHT nodes (see `DhtNode::start`) in a single process.
+//
+// Datagrams between endpoints are delayed by a random latency
+// and may be randomly dropped.
+// Endpoints can be taken offline and back online to simulate churn,
+// and all datagrams can be observed as they are delivered.
+// Random choices come from a generator with the given seed,
+// so runs are reproducible as long as coroutines are scheduled
+// in the same order.
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include <namespaces.h>
+#include <or_throw.h>
+#include <util/condition_variable.h>
+
+namespace ouinet { namespace bittorrent {
+
+class SimUdpNetwork {
+public:
+    using udp = asio::ip::udp;
+
+    struct Config {
+        std::chrono::milliseconds min_latency{10};
+        std::chrono::milliseconds max_latency{100};
+        double loss = 0;  // probability of dropping a datagram
+        uint32_t seed = 0;
+    };
+
+    struct Stats {
+        size_t sent = 0;
+        size_t delivered = 0;
+        size_t dropped = 0;
+    };
+
+    using Observer = std::function<void( const udp::endpoint& from
+                                       , const udp::endpoint& to
+                                       , boost::string_view data)>;
+
+private:
+    struct Datagram {
+        udp::endpoint from;
+        std::string data;
+    };
+
+    struct Port {
+        udp::endpoint endpoint;
+        std::deque<Datagram> queue;
+        ConditionVariable arrived;
+        bool open = true;
+        bool online = true;
+        size_t sent = 0;
+
+        Port(const asio::executor& ex, udp::endpoint ep)
+            : endpoint(ep), arrived(ex) {}
+    };
+
+public:
+    // A socket bound to an endpoint of the network,
+    // to be given to `UdpMultiplexer`.
+    class Socket {
+    public:
+        asio::executor get_executor() { return _net->_ex; }
+        udp::endpoint local_endpoint() const { return _port->endpoint; }
+        bool is_open() const { return _port->open; }
+
+        void close(sys::error_code&)
+        {
+            if (!_port->open) return;
+            _port->open = false;
+            _net->_ports.erase(_port->endpoint);
+            _port->arrived.notify();
+        }
+
+        size_t async_send_to( asio::const_buffer b
+                            , const udp::endpoint& to
+                            , asio::yield_context yield)
+        {
+            if (!_port->open) return or_throw<size_t>(yield, asio::error::bad_descriptor);
+            _net->send(*_port, to, std::string(static_cast<const char*>(b.data()), b.size()));
+            return b.size();
+        }
+
+        size_t async_receive_from( asio::mutable_buffer b
+                                 , udp::endpoint& from
+                                 , asio::yield_context yield)
+        {
+            // This object may be gone when the wait is over.
+            auto port = _port;
+
+            while (port->open && port->queue.empty()) {
+                sys::error_code ec;
+                port->arrived.wait(yield[ec]);
+            }
+
+            if (!port->open) {
+                return or_throw<size_t>(yield, asio::error::operation_aborted);
+            }
+
+            auto d = std::move(port->queue.front());
+            port->queue.pop_front();
+            from = d.from;
+            return asio::buffer_copy(b, asio::buffer(d.data));
+        }
+
+    private:
+        friend class SimUdpNetwork;
+
+        Socket(SimUdpNetwork* net, std::shared_ptr<Port> port)
+            : _net(net), _port(std::move(port)) {}
+
+        SimUdpNetwork* _net;
+        std::shared_ptr<Port> _port;
+    };
+
+public:
+    SimUdpNetwork(const asio::executor& ex, Config cfg)
+        : _ex(ex), _cfg(cfg), _rng(cfg.seed)
+    {}
+
+    SimUdpNetwork(const SimUdpNetwork&) = delete;
+
+    // The endpoint must not be already bound.
+    Socket bind(const udp::endpoint& ep)
+    {
+        auto port = std::make_shared<Port>(_ex, ep);
+        _ports[ep] = port;
+        return Socket(this, std::move(port));
+    }
+
+    // Datagrams from or to an offline endpoint are dropped.
+    void set_online(const udp::endpoint& ep, bool online)
+    {
+        auto i = _ports.find(ep);
+        if (i != _ports.end()) i->second->online = online;
+    }
+
+    bool is_online(const udp::endpoint& ep) const
+    {
+        auto i = _ports.find(ep);
+        return i != _ports.end() && i->second->online;
+    }
+
+    // Number of datagrams sent from the given endpoint.
+    size_t sent_from(const udp::endpoint& ep) const
+    {
+        auto i = _ports.find(ep);
+        return i == _ports.end() ? 0 : i->second->sent;
+    }
+
+    void observe(Observer o) { _observer = std::move(o); }
+
+    const Stats& stats() const { return _stats; }
+
+    std::mt19937& rng() { return _rng; }
+
+private:
+    void send(Port& from, const udp::endpoint& to, std::string data)
+    {
+        ++_stats.sent;
+        ++from.sent;
+
+        if (!from.online || std::bernoulli_distribution(_cfg.loss)(_rng)) {
+            ++_stats.dropped;
+            return;
+        }
+
+        std::uniform_int_distribution<int64_t>
+            latency(_cfg.min_latency.count(), _cfg.max_latency.count());
+
+        auto timer = std::make_shared<asio::steady_timer>(_ex);
+        timer->expires_after(std::chrono::milliseconds(latency(_rng)));
+        timer->async_wait([ this, timer, from = from.endpoint, to
+                          , data = std::move(data)
+                          ] (const sys::error_code&) mutable {
+            deliver(from, to, std::move(data));
+        });
+    }
+
+    void deliver(const udp::endpoint& from, const udp::endpoint& to, std::string data)
+    {
+        auto i = _ports.find(to);
+
+        if (i == _ports.end() || !i->second->online) {
+            ++_stats.dropped;
+            return;
+        }
+
+        ++_stats.delivered;
+        if (_observer) _observer(from, to, data);
+
+        auto& port = *i->second;
+        port.queue.push_back({from, std::move(data)});
+        port.arrived.notify();
+    }
+
+private:
+    asio::executor _ex;
+    Config _cfg;
+    std::mt19937 _rng;
+    std::map<udp::endpoint, std::shared_ptr<Port>> _ports;
+    Observer _observer;
+    Stats _stats;
+};
+
+}} // namespaces
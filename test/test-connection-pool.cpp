@@ -7,6 +7,7 @@
 #include <boost/asio/steady_timer.hpp>
 #include <boost/asio/write.hpp>
 #include <chrono>
+#include <list>
 
 using namespace ouinet;
 
@@ -155,4 +156,116 @@ BOOST_AUTO_TEST_CASE(test_behavior)
     ios.run();
 }
 
+BOOST_AUTO_TEST_CASE(test_limits)
+{
+    asio::io_service ios;
+
+    asio::ip::tcp::acceptor server(ios, asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"), 0));
+    auto server_ep = server.local_endpoint();
+    std::list<asio::ip::tcp::socket> server_connections;
+
+    asio::spawn(ios, [&] (asio::yield_context yield) {
+        for (int i = 0; i < 3; ++i) {
+            server_connections.emplace_back(ios);
+            server.async_accept(server_connections.back(), yield);
+        }
+    });
+
+    asio::spawn(ios, [&] (asio::yield_context yield) {
+        ConnectionPool<bool> pool;
+        pool.max_size(2);
+        pool.idle_timeout(std::chrono::milliseconds(200));
+
+        for (int i = 0; i < 3; ++i) {
+            asio::ip::tcp::socket connection(ios);
+            connection.async_connect(server_ep, yield);
+            pool.push_back(pool.wrap(GenericStream{std::move(connection)}));
+        }
+
+        BOOST_CHECK_EQUAL(pool.size(), 2u);
+        BOOST_CHECK_EQUAL(pool.evicted_count(), 1u);
+
+        {
+            // Taking a connection out of the pool stops its idle timeout.
+            auto connection = pool.pop_front();
+            BOOST_CHECK(connection.is_open());
+
+            asio::steady_timer timer(ios);
+            timer.expires_from_now(std::chrono::milliseconds(400));
+            timer.async_wait(yield);
+
+            BOOST_CHECK(connection.is_open());
+            BOOST_CHECK(pool.empty());
+            BOOST_CHECK_EQUAL(pool.expired_count(), 1u);
+
+            connection.auto_add_back_to_pool(false);
+        }
+
+        server_connections.clear();
+    });
+
+    ios.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_shared_limits)
+{
+    asio::io_service ios;
+
+    asio::ip::tcp::acceptor server(ios, asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"), 0));
+    auto server_ep = server.local_endpoint();
+    std::list<asio::ip::tcp::socket> server_connections;
+
+    asio::spawn(ios, [&] (asio::yield_context yield) {
+        for (int i = 0; i < 4; ++i) {
+            server_connections.emplace_back(ios);
+            server.async_accept(server_connections.back(), yield);
+        }
+    });
+
+    asio::spawn(ios, [&] (asio::yield_context yield) {
+        auto shared = std::make_shared<ConnectionPool<bool>::SharedIdle>(2);
+        ConnectionPool<bool> pool1, pool2;
+        pool1.shared_idle(shared);
+        pool2.shared_idle(shared);
+
+        auto connect = [&] (ConnectionPool<bool>& pool) {
+            asio::ip::tcp::socket connection(ios);
+            connection.async_connect(server_ep, yield);
+            pool.push_back(pool.wrap(GenericStream{std::move(connection)}));
+        };
+
+        connect(pool1);
+        connect(pool2);
+        BOOST_CHECK_EQUAL(shared->size(), 2u);
+
+        // The connection idle for longer is closed, whatever its pool.
+        connect(pool2);
+        BOOST_CHECK_EQUAL(shared->size(), 2u);
+        BOOST_CHECK(pool1.empty());
+        BOOST_CHECK_EQUAL(pool1.evicted_count(), 1u);
+        BOOST_CHECK_EQUAL(pool2.size(), 2u);
+
+        {
+            // Connections out of their pool do not count.
+            auto connection = pool2.pop_front();
+            BOOST_CHECK_EQUAL(shared->size(), 1u);
+
+            connect(pool1);
+            BOOST_CHECK_EQUAL(shared->size(), 2u);
+            BOOST_CHECK_EQUAL(pool2.evicted_count(), 0u);
+
+            // Going back to its pool evicts the oldest one.
+        }
+
+        BOOST_CHECK_EQUAL(shared->size(), 2u);
+        BOOST_CHECK_EQUAL(pool2.evicted_count(), 1u);
+        BOOST_CHECK_EQUAL(pool1.size(), 1u);
+        BOOST_CHECK_EQUAL(pool2.size(), 1u);
+
+        server_connections.clear();
+    });
+
+    ios.run();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -395,4 +395,32 @@ BOOST_AUTO_TEST_CASE(test_three_buckets_add_to_end) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(test_retransmission_timeout) {
+    using namespace std::chrono_literals;
+
+    NodeID my_id = NodeID::Range::max().random_id();
+    RoutingTable rt(my_id, [] (NodeContact) {});
+
+    NodeContact known{ .id = from_bitstr("1"), .endpoint = endpoint("192.0.2.1", 1) };
+    NodeContact unknown{ .id = from_bitstr("0"), .endpoint = endpoint("192.0.2.2", 2) };
+
+    rt.try_add_node(known, true);
+    BOOST_REQUIRE(!rt.retransmission_timeout(known));
+
+    rt.add_rtt_sample(known, 100ms);
+    rt.add_rtt_sample(unknown, 100ms);
+    BOOST_REQUIRE(!rt.retransmission_timeout(unknown));
+
+    // First sample: 100ms + 4 * 50ms
+    BOOST_REQUIRE(*rt.retransmission_timeout(known) == 300ms);
+
+    // Steady replies make the timeout approach the round trip time.
+    for (int i = 0; i < 50; ++i) rt.add_rtt_sample(known, 100ms);
+    BOOST_REQUIRE(*rt.retransmission_timeout(known) < 110ms);
+
+    // Jitter makes it grow.
+    rt.add_rtt_sample(known, 500ms);
+    BOOST_REQUIRE(*rt.retransmission_timeout(known) > 400ms);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,132 @@
+#define BOOST_TEST_MODULE bep5_peer_stats
+#include <boost/test/included/unit_test.hpp>
+
+#include <namespaces.h>
+#include <ouiservice/bep5/peer_stats.h>
+#include <util/str.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_bep5_peer_stats)
+
+using namespace std;
+using namespace ouinet;
+using ouiservice::bep5::PeerStats;
+
+using Endpoint = PeerStats::Endpoint;
+using Duration = PeerStats::Clock::duration;
+static Duration operator""_ms(unsigned long long n) { return chrono::milliseconds(n); }
+
+static
+Endpoint ep(const char* addr, unsigned short port)
+{
+    return {asio::ip::make_address(addr), port};
+}
+
+BOOST_AUTO_TEST_CASE(test_ranking) {
+    PeerStats stats;
+
+    auto fast = ep("192.0.2.1", 1000);
+    auto slow = ep("192.0.2.2", 1000);
+    auto dead = ep("192.0.2.3", 1000);
+    auto unknown = ep("192.0.2.4", 1000);
+
+    for (int i = 0; i < 5; ++i) {
+        stats.on_success(fast, 100_ms, 100_ms);
+        stats.on_success(slow, 2000_ms, 2000_ms);
+        stats.on_failure(dead);
+    }
+
+    BOOST_REQUIRE_EQUAL(stats.size(), 3u);
+    // Slow peers which work are better than unknown ones.
+    BOOST_REQUIRE_LT(stats.cost(fast), stats.cost(slow));
+    BOOST_REQUIRE_LT(stats.cost(slow), stats.cost(unknown));
+    BOOST_REQUIRE_LT(stats.cost(unknown), stats.cost(dead));
+
+    // Only peers known to work are waited for.
+    BOOST_REQUIRE(stats.patience(fast));
+    BOOST_REQUIRE(stats.patience(slow));
+    BOOST_REQUIRE(!stats.patience(dead));
+    BOOST_REQUIRE(!stats.patience(unknown));
+    BOOST_REQUIRE(*stats.patience(fast) < *stats.patience(slow));
+    BOOST_REQUIRE(*stats.patience(slow) <= 3000_ms);
+
+    // A peer which stops working falls behind.
+    for (int i = 0; i < 5; ++i) stats.on_failure(fast);
+    BOOST_REQUIRE_LT(stats.cost(slow), stats.cost(fast));
+    BOOST_REQUIRE(!stats.patience(fast));
+}
+
+BOOST_AUTO_TEST_CASE(test_smoothing) {
+    PeerStats stats;
+    auto peer = ep("192.0.2.1", 1000);
+
+    stats.on_success(peer, 400_ms);
+    BOOST_REQUIRE_CLOSE(stats.find(peer)->connect_ms, 400, 0.1);
+    BOOST_REQUIRE_LT(stats.find(peer)->handshake_ms, 0);
+
+    // A single outlier does not ruin the average.
+    stats.on_success(peer, 4000_ms, 100_ms);
+    auto e = stats.find(peer);
+    BOOST_REQUIRE_GT(e->connect_ms, 400);
+    BOOST_REQUIRE_LT(e->connect_ms, 2000);
+    BOOST_REQUIRE_CLOSE(e->handshake_ms, 100, 0.1);
+    BOOST_REQUIRE_GT(e->success, 0.5);
+    BOOST_REQUIRE_LE(e->success, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_capacity) {
+    PeerStats stats(10);
+
+    for (unsigned short p = 1; p <= 20; ++p)
+        stats.on_success(ep("192.0.2.1", p), 100_ms);
+
+    BOOST_REQUIRE_EQUAL(stats.size(), 10u);
+}
+
+BOOST_AUTO_TEST_CASE(test_dump_and_load) {
+    PeerStats stats;
+
+    auto v4 = ep("192.0.2.1", 1000);
+    auto v6 = ep("2001:db8::1", 2000);
+
+    stats.on_success(v4, 150_ms, 250_ms);
+    stats.on_failure(v6);
+
+    auto version = stats.version();
+    BOOST_REQUIRE_GT(version, 0u);
+
+    auto now = time(nullptr);
+    auto data = stats.dump()
+              + "garbage\n"
+              + "192.0.2.2:1000,1,2,3,4\n"  // bad success rate
+              + util::str("192.0.2.3:1000,100,100,1,", now - PeerStats::max_age - 60, '\n')
+              + util::str("192.0.2.4:1000,100,-1,0.75,", now);  // no trailing newline
+
+    PeerStats loaded;
+    loaded.load(data);
+
+    BOOST_REQUIRE_EQUAL(loaded.size(), 3u);
+    BOOST_REQUIRE_EQUAL(loaded.version(), 0u);
+
+    auto e4 = loaded.find(v4);
+    BOOST_REQUIRE(e4);
+    BOOST_REQUIRE_CLOSE(e4->connect_ms, 150, 0.1);
+    BOOST_REQUIRE_CLOSE(e4->handshake_ms, 250, 0.1);
+    BOOST_REQUIRE_EQUAL(e4->updated, stats.find(v4)->updated);
+
+    auto e6 = loaded.find(v6);
+    BOOST_REQUIRE(e6);
+    BOOST_REQUIRE_LT(e6->connect_ms, 0);
+    BOOST_REQUIRE_CLOSE(e6->success, stats.find(v6)->success, 0.1);
+
+    BOOST_REQUIRE(!loaded.find(ep("192.0.2.2", 1000)));
+    BOOST_REQUIRE(!loaded.find(ep("192.0.2.3", 1000)));
+    BOOST_REQUIRE(loaded.find(ep("192.0.2.4", 1000)));
+
+    // Newer local statistics are kept.
+    loaded.on_success(v4, 1000_ms);
+    auto connect_ms = loaded.find(v4)->connect_ms;
+    loaded.load(stats.dump());
+    BOOST_REQUIRE_CLOSE(loaded.find(v4)->connect_ms, connect_ms, 0.1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,7 @@
 #define private public
 #include <bittorrent/node_id.h>
 #include <bittorrent/dht.h>
+#include <bittorrent/dht_storage.h>
 #include <bittorrent/code.h>
 #include <util/hash.h>
 
@@ -170,4 +171,92 @@ BOOST_AUTO_TEST_CASE(test_bep_44)
     BOOST_REQUIRE_EQUAL(push_get_count, success_count);
 }
 
+BOOST_AUTO_TEST_CASE(test_packed_endpoint)
+{
+    using dht::detail::PackedEndpoint;
+
+    for (auto addr : {"192.0.2.1", "2001:db8::1", "::ffff:192.0.2.1"}) {
+        asio::ip::tcp::endpoint ep(asio::ip::make_address(addr), 6881);
+        auto unpacked = PackedEndpoint(ep).unpack();
+        BOOST_REQUIRE_EQUAL(unpacked.port(), 6881);
+        BOOST_REQUIRE_EQUAL(unpacked.address().is_v4(), ep.address().is_v4()
+                                                     || ep.address().to_v6().is_v4_mapped());
+    }
+
+    asio::ip::tcp::endpoint ep(asio::ip::make_address("192.0.2.1"), 6881);
+    BOOST_REQUIRE(PackedEndpoint(ep).unpack() == ep);
+    BOOST_REQUIRE_EQUAL(sizeof(PackedEndpoint), 18u);
+}
+
+BOOST_AUTO_TEST_CASE(test_tracker_limits)
+{
+    using asio::ip::tcp;
+
+    asio::io_context ctx;
+
+    dht::Tracker::Config cfg;
+    cfg.max_swarms = 2;
+    cfg.max_peers_per_swarm = 3;
+    cfg.max_peers = 5;
+    dht::Tracker tracker(ctx.get_executor(), cfg);
+
+    auto peer = [] (unsigned short port) {
+        return tcp::endpoint(asio::ip::make_address("192.0.2.1"), port);
+    };
+
+    auto s1 = util::sha1_digest("swarm1");
+    auto s2 = util::sha1_digest("swarm2");
+    auto s3 = util::sha1_digest("swarm3");
+
+    for (unsigned short p = 1; p <= 4; ++p) tracker.add_peer(s1, peer(p));
+    tracker.add_peer(s1, peer(4));  // already there
+
+    // The least recently seen peer was replaced.
+    auto peers = tracker.list_peers(s1, 10);
+    BOOST_REQUIRE_EQUAL(peers.size(), 3u);
+    BOOST_REQUIRE(find(peers.begin(), peers.end(), peer(1)) == peers.end());
+    BOOST_REQUIRE_EQUAL(tracker.list_peers(s1, 2).size(), 2u);
+
+    for (unsigned short p = 1; p <= 3; ++p) tracker.add_peer(s2, peer(p));
+    tracker.add_peer(s3, peer(1));
+
+    BOOST_REQUIRE_EQUAL(tracker.swarm_count(), 2u);
+    BOOST_REQUIRE_EQUAL(tracker.peer_count(), 5u);
+    BOOST_REQUIRE_EQUAL(tracker.list_peers(s2, 10).size(), 2u);
+    BOOST_REQUIRE(tracker.list_peers(s3, 10).empty());
+
+    // Nothing expires before its time.
+    auto now = Clock::now();
+    tracker.expire(now + chrono::minutes(5));
+    BOOST_REQUIRE_EQUAL(tracker.peer_count(), 5u);
+
+    auto validity = chrono::seconds(dht::Tracker::ANNOUNCE_VALIDITY_SECONDS);
+    tracker.expire(now + validity + chrono::minutes(5));
+    BOOST_REQUIRE_EQUAL(tracker.swarm_count(), 0u);
+    BOOST_REQUIRE_EQUAL(tracker.peer_count(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_data_store_limits)
+{
+    asio::io_context ctx;
+
+    dht::DataStore::Config cfg;
+    cfg.max_items = 2;
+    dht::DataStore store(ctx.get_executor(), cfg);
+
+    store.put_immutable(BencodedValue(string("one")));
+    store.put_immutable(BencodedValue(string("two")));
+    store.put_immutable(BencodedValue(string("three")));
+
+    BOOST_REQUIRE_EQUAL(store.immutable_count(), 2u);
+    BOOST_REQUIRE(store.get_immutable(dht::DataStore::immutable_get_id(string("one"))));
+    BOOST_REQUIRE(!store.get_immutable(dht::DataStore::immutable_get_id(string("three"))));
+
+    auto validity = chrono::seconds(dht::DataStore::PUT_VALIDITY_SECONDS);
+    store.expire(Clock::now() + validity / 2);
+    BOOST_REQUIRE_EQUAL(store.immutable_count(), 2u);
+    store.expire(Clock::now() + validity + chrono::minutes(5));
+    BOOST_REQUIRE_EQUAL(store.immutable_count(), 0u);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -571,4 +571,72 @@ BOOST_AUTO_TEST_CASE(test_req_no_cache_fresh_origin_ok)
     BOOST_CHECK_EQUAL(origin_check, 1u);
 }
 
+BOOST_AUTO_TEST_CASE(test_stale_while_revalidate)
+{
+    asio::io_context ctx;
+    CacheControl cc(ctx, "test");
+
+    unsigned origin_check = 0;
+    std::vector<string> revalidated;
+
+    cc.fetch_stored = [&](auto rq, auto&, auto&, auto y) {
+        Response rs{http::status::ok, rq.version()};
+        rs.set(http::field::etag, "\"123\"");
+
+        if (rq.target() == "swr")
+            rs.set(http::field::cache_control, "max-age=60, stale-while-revalidate=120");
+        else if (rq.target() == "sie")
+            rs.set(http::field::cache_control, "max-age=60, stale-if-error=120");
+        else if (rq.target() == "swr-too-old")
+            rs.set(http::field::cache_control, "max-age=60, stale-while-revalidate=30");
+        else
+            BOOST_ERROR("Unexpected target: " + rq.target().to_string());
+
+        return make_entry(ctx, current_time() - seconds(120), rs, y);
+    };
+
+    cc.fetch_fresh = [&](auto rq, auto ce, auto&, auto y) {
+        origin_check++;
+        BOOST_CHECK(ce);
+        return make_session(ctx, {http::status::not_modified, rq.version()}, y);
+    };
+
+    cc.revalidate_in_background = [&](Request rq, const string& group) {
+        BOOST_CHECK_EQUAL(group, *dht_group);
+        BOOST_CHECK_EQUAL(get(rq, http::field::if_none_match).value_or(""), "\"123\"");
+        revalidated.push_back(rq.target().to_string());
+    };
+
+    auto fetch = [&](const char* target, Yield yield) {
+        Request req{http::verb::get, target, 11};
+        Cancel cancel;
+        sys::error_code fresh_ec, cache_ec;
+        auto s = cc.fetch(req, dht_group, fresh_ec, cache_ec, cancel, yield);
+        BOOST_REQUIRE(!cache_ec);
+        return s.response_header().result();
+    };
+
+    run_spawned(ctx, [&](auto yield) {
+            // Within the revalidation period, served from cache right away.
+            BOOST_CHECK_EQUAL(fetch("swr", yield), http::status::ok);
+            BOOST_CHECK_EQUAL(origin_check, 0u);
+
+            // Beyond the revalidation period, revalidated in the foreground.
+            BOOST_CHECK_EQUAL(fetch("swr-too-old", yield), http::status::ok);
+            BOOST_CHECK_EQUAL(origin_check, 1u);
+
+            // Usable on errors, but only served right away if enabled.
+            BOOST_CHECK_EQUAL(fetch("sie", yield), http::status::ok);
+            BOOST_CHECK_EQUAL(origin_check, 2u);
+
+            cc.serve_stale(true);
+            BOOST_CHECK_EQUAL(fetch("sie", yield), http::status::ok);
+            BOOST_CHECK_EQUAL(origin_check, 2u);
+        });
+
+    BOOST_REQUIRE_EQUAL(revalidated.size(), 2u);
+    BOOST_CHECK_EQUAL(revalidated[0], "swr");
+    BOOST_CHECK_EQUAL(revalidated[1], "sie");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,143 @@
+#define BOOST_TEST_MODULE concurrent_async_queue
+#include <boost/test/included/unit_test.hpp>
+
+#include <thread>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <namespaces.h>
+#include <util/concurrent_async_queue.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_concurrent_async_queue)
+
+using namespace std;
+using namespace ouinet;
+using util::ConcurrentAsyncQueue;
+
+BOOST_AUTO_TEST_CASE(test_capacity) {
+    ConcurrentAsyncQueue<int> q(5);
+
+    BOOST_REQUIRE_EQUAL(q.capacity(), 8u);
+    BOOST_REQUIRE(q.empty());
+
+    for (int i = 0; i < 8; ++i) {
+        BOOST_REQUIRE(q.try_push(i));
+    }
+
+    int extra = 8;
+    BOOST_REQUIRE(q.full());
+    BOOST_REQUIRE(!q.try_push(extra));
+
+    for (int i = 0; i < 8; ++i) {
+        auto v = q.try_pop();
+        BOOST_REQUIRE(v);
+        BOOST_REQUIRE_EQUAL(*v, i);
+    }
+
+    BOOST_REQUIRE(!q.try_pop());
+}
+
+BOOST_AUTO_TEST_CASE(test_cross_thread) {
+    const int producers = 4;
+    const int per_producer = 10000;
+
+    asio::io_context ctx;
+    ConcurrentAsyncQueue<int> q(16);
+
+    vector<int> received(producers, 0);
+    bool in_order = true;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        for (int n = 0; n < producers * per_producer; ++n) {
+            int v = q.async_pop(cancel, yield);
+            auto& r = received[v / per_producer];
+            // Elements from the same producer keep their order.
+            if (v % per_producer != r) in_order = false;
+            ++r;
+        }
+    });
+
+    // Each producer runs coroutines in its own thread and context,
+    // and its pushes wait while the small queue is full.
+    vector<thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            asio::io_context pctx;
+            asio::spawn(pctx, [&] (asio::yield_context yield) {
+                Cancel cancel;
+                for (int i = 0; i < per_producer; ++i) {
+                    q.async_push(p * per_producer + i, cancel, yield);
+                }
+            });
+            pctx.run();
+        });
+    }
+
+    ctx.run();
+    for (auto& t : threads) t.join();
+
+    BOOST_REQUIRE(in_order);
+    for (auto r : received) BOOST_REQUIRE_EQUAL(r, per_producer);
+    BOOST_REQUIRE(q.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_cancel_pop) {
+    asio::io_context ctx;
+    ConcurrentAsyncQueue<int> q(4);
+
+    Cancel cancel;
+    sys::error_code pop_ec;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        q.async_pop(cancel, yield[pop_ec]);
+    });
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        asio::steady_timer t(ctx);
+        t.expires_after(chrono::milliseconds(10));
+        t.async_wait(yield);
+        cancel();
+    });
+
+    ctx.run();
+
+    BOOST_REQUIRE_EQUAL(pop_ec, asio::error::operation_aborted);
+}
+
+BOOST_AUTO_TEST_CASE(test_flush_and_errors) {
+    asio::io_context ctx;
+    ConcurrentAsyncQueue<int> q(8);
+
+    thread producer([&] {
+        asio::io_context pctx;
+        asio::spawn(pctx, [&] (asio::yield_context yield) {
+            Cancel cancel;
+            q.async_push(1, cancel, yield);
+            q.async_push(2, asio::error::eof, cancel, yield);
+            q.async_push(3, cancel, yield);
+        });
+        pctx.run();
+    });
+    producer.join();
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        std::queue<int> out;
+
+        // Elements pushed with an error are dropped.
+        BOOST_REQUIRE_EQUAL(q.async_flush(out, cancel, yield), 2u);
+        BOOST_REQUIRE_EQUAL(out.front(), 1);
+        BOOST_REQUIRE_EQUAL(out.back(), 3);
+        BOOST_REQUIRE(q.empty());
+
+        sys::error_code ec;
+        q.async_push(4, asio::error::eof, cancel, yield);
+        q.async_pop(cancel, yield[ec]);
+        BOOST_REQUIRE_EQUAL(ec, asio::error::eof);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
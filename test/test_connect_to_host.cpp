@@ -0,0 +1,76 @@
+#define BOOST_TEST_MODULE connect_to_host
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio/spawn.hpp>
+#include <namespaces.h>
+#include <connect_to_host.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_connect_to_host)
+
+using namespace std;
+using namespace ouinet;
+
+using tcp = asio::ip::tcp;
+using TcpLookup = tcp::resolver::results_type;
+
+static
+TcpLookup make_lookup(const vector<tcp::endpoint>& eps)
+{
+    return TcpLookup::create(eps.begin(), eps.end(), "localhost", "");
+}
+
+BOOST_AUTO_TEST_CASE(test_skip_failing_endpoints) {
+    asio::io_context ctx;
+    auto exec = ctx.get_executor();
+
+    tcp::acceptor acceptor(ctx, tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    auto good_ep = acceptor.local_endpoint();
+
+    // Get a port with nothing listening on it.
+    tcp::endpoint bad_ep;
+    {
+        tcp::acceptor a(ctx, tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+        bad_ep = a.local_endpoint();
+    }
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        tcp::socket s(ctx);
+        acceptor.async_accept(s, yield);
+    });
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        sys::error_code ec;
+        auto s = connect_to_host( make_lookup({bad_ep, bad_ep, good_ep})
+                                , exec, cancel, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(s.remote_endpoint(), good_ep);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_all_endpoints_fail) {
+    asio::io_context ctx;
+    auto exec = ctx.get_executor();
+
+    tcp::endpoint bad_ep;
+    {
+        tcp::acceptor a(ctx, tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+        bad_ep = a.local_endpoint();
+    }
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        sys::error_code ec;
+        connect_to_host(make_lookup({bad_ep}), exec, cancel, yield[ec]);
+        BOOST_REQUIRE(ec);
+
+        connect_to_host(make_lookup({}), exec, cancel, yield[ec]);
+        BOOST_REQUIRE_EQUAL(ec, asio::error::host_not_found);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
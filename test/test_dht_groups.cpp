@@ -0,0 +1,187 @@
+#define BOOST_TEST_MODULE dht_groups
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <cache/dht_groups.h>
+#include <defer.h>
+#include <namespaces.h>
+#include <util/bytes.h>
+#include <util/hash.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_dht_groups)
+
+using namespace std;
+using namespace ouinet;
+
+using Items = set<string>;
+
+static
+fs::path make_test_dir()
+{
+    return fs::temp_directory_path()
+         / fs::unique_path("ouinet-dht-groups-test-%%%%-%%%%");
+}
+
+static
+void write_file(const fs::path& p, const string& content)
+{
+    fs::ofstream f(p, ios::binary);
+    f << content;
+}
+
+static
+size_t log_size(const fs::path& dir)
+{
+    return fs::file_size(dir / "groups.log");
+}
+
+template<class F>
+static
+void run(F&& f)
+{
+    asio::io_context ctx;
+    asio::spawn(ctx, [&] (asio::yield_context yield) { f(ctx.get_executor(), yield); });
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_add_remove_reload) {
+    auto dir = make_test_dir();
+    auto on_exit = defer([&] { fs::remove_all(dir); });
+
+    run([&] (asio::executor ex, asio::yield_context yield) {
+        Cancel cancel;
+        sys::error_code ec;
+
+        {
+            auto groups = load_dht_groups(dir, ex, cancel, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            groups->add("g1", "a", cancel, yield[ec]);
+            groups->add("g1", "b", cancel, yield[ec]);
+            groups->add("g2", "b", cancel, yield[ec]);
+            groups->add("g3", "c\nwith newline", cancel, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            BOOST_REQUIRE(groups->remove("b") == set<string>{"g2"});
+            groups->remove_group("g3");
+            groups->remove("not-there");
+
+            BOOST_REQUIRE(groups->groups() == set<string>{"g1"});
+        }
+
+        // Only the log file is used.
+        BOOST_REQUIRE_EQUAL(distance(fs::directory_iterator(dir), {}), 1);
+
+        auto groups = load_dht_groups(dir, ex, cancel, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE(groups->groups() == set<string>{"g1"});
+        BOOST_REQUIRE(groups->items("g1") == Items{"a"});
+        BOOST_REQUIRE(groups->items("g2").empty());
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_truncated_log) {
+    auto dir = make_test_dir();
+    auto on_exit = defer([&] { fs::remove_all(dir); });
+
+    run([&] (asio::executor ex, asio::yield_context yield) {
+        Cancel cancel;
+        sys::error_code ec;
+
+        {
+            auto groups = load_dht_groups(dir, ex, cancel, yield[ec]);
+            groups->add("g1", "a", cancel, yield[ec]);
+            groups->add("g1", "b", cancel, yield[ec]);
+            BOOST_REQUIRE(!ec);
+        }
+
+        // Like a crash in the middle of writing a record.
+        fs::resize_file(dir / "groups.log", log_size(dir) - 3);
+
+        {
+            auto groups = load_dht_groups(dir, ex, cancel, yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(groups->items("g1") == Items{"a"});
+
+            // The log was rewritten, so new records are not lost.
+            groups->add("g1", "c", cancel, yield[ec]);
+            BOOST_REQUIRE(!ec);
+        }
+
+        auto groups = load_dht_groups(dir, ex, cancel, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE(groups->items("g1") == (Items{"a", "c"}));
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_compaction) {
+    auto dir = make_test_dir();
+    auto on_exit = defer([&] { fs::remove_all(dir); });
+
+    run([&] (asio::executor ex, asio::yield_context yield) {
+        Cancel cancel;
+        sys::error_code ec;
+
+        auto groups = load_dht_groups(dir, ex, cancel, yield[ec]);
+        BOOST_REQUIRE(!ec);
+
+        groups->add("g1", "kept", cancel, yield[ec]);
+
+        for (int i = 0; i < 5000; ++i) {
+            groups->add("g2", "item", cancel, yield[ec]);
+            BOOST_REQUIRE(!ec);
+            groups->remove("item");
+        }
+
+        // The log does not keep growing with removed items.
+        BOOST_REQUIRE_LT(log_size(dir), 50000u);
+
+        auto loaded = load_dht_groups(dir, ex, cancel, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE(loaded->groups() == set<string>{"g1"});
+        BOOST_REQUIRE(loaded->items("g1") == Items{"kept"});
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_migrate_directories) {
+    auto dir = make_test_dir();
+    auto on_exit = defer([&] { fs::remove_all(dir); });
+
+    auto hex = [] (const string& s) { return util::bytes::to_hex(util::sha1_digest(s)); };
+
+    // Groups as stored by previous versions.
+    auto group_dir = dir / hex("old-group");
+    fs::create_directories(group_dir / "items");
+    write_file(group_dir / "group_name", "old-group");
+    write_file(group_dir / "items" / hex("x"), "x");
+    write_file(group_dir / "items" / hex("y"), "y");
+
+    run([&] (asio::executor ex, asio::yield_context yield) {
+        Cancel cancel;
+        sys::error_code ec;
+
+        {
+            // Static groups are only read.
+            auto groups = load_static_dht_groups(dir, ex, cancel, yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(groups->items("old-group") == (Items{"x", "y"}));
+            BOOST_REQUIRE(fs::exists(group_dir));
+        }
+
+        {
+            auto groups = load_dht_groups(dir, ex, cancel, yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(groups->items("old-group") == (Items{"x", "y"}));
+            BOOST_REQUIRE(!fs::exists(group_dir));
+        }
+
+        auto groups = load_dht_groups(dir, ex, cancel, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE(groups->items("old-group") == (Items{"x", "y"}));
+    });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
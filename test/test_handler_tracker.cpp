@@ -0,0 +1,77 @@
+#define BOOST_TEST_MODULE handler_tracker
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio/steady_timer.hpp>
+#include <sstream>
+#include <namespaces.h>
+#include <util/handler_tracker.h>
+#include <util/metrics.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_handler_tracker)
+
+using namespace std;
+using namespace ouinet;
+
+static
+HandlerTracker::SiteCensus find_site(const string& name)
+{
+    for (auto& c : HandlerTracker::census()) {
+        if (c.name == name) return c;
+    }
+    return {"", 0, 0, {}};
+}
+
+BOOST_AUTO_TEST_CASE(test_census) {
+    asio::io_context ctx;
+
+    string sleeper_site, quick_site;
+    bool checked = false;
+
+    for (int i = 0; i < 3; ++i) {
+        TRACK_SPAWN(ctx, ([&] (asio::yield_context yield) {
+            asio::steady_timer t(ctx);
+            t.expires_after(chrono::milliseconds(100));
+            t.async_wait(yield);
+        }));
+    }
+
+    TRACK_SPAWN(ctx, ([&] (asio::yield_context yield) {
+        asio::steady_timer t(ctx);
+        t.expires_after(chrono::milliseconds(50));
+        t.async_wait(yield);
+
+        // The sleepers started first, so they are listed first.
+        auto census = HandlerTracker::census();
+        BOOST_REQUIRE(census.size() >= 2);
+        sleeper_site = census[0].name;
+        quick_site = census[1].name;
+
+        BOOST_REQUIRE_EQUAL(census[0].live, 3u);
+        BOOST_REQUIRE(census[0].oldest_age >= chrono::milliseconds(50));
+        BOOST_REQUIRE_EQUAL(census[1].live, 1u);
+        checked = true;
+    }));
+
+    ctx.run();
+
+    BOOST_REQUIRE(checked);
+    BOOST_REQUIRE(sleeper_site != quick_site);
+
+    auto sleepers = find_site(sleeper_site);
+    BOOST_REQUIRE_EQUAL(sleepers.live, 0u);
+    BOOST_REQUIRE_EQUAL(sleepers.finished, 3u);
+    BOOST_REQUIRE(sleepers.oldest_age == HandlerTracker::Clock::duration(0));
+
+    ostringstream table;
+    HandlerTracker::write_census(table);
+    BOOST_REQUIRE(table.str().find(sleeper_site) != string::npos);
+
+    ostringstream metrics_text;
+    metrics::registry().write(metrics_text);
+    BOOST_REQUIRE(metrics_text.str().find
+            ("ouinet_handlers_live{site=\"" + sleeper_site + "\"} 0") != string::npos);
+    BOOST_REQUIRE(metrics_text.str().find
+            ("ouinet_handler_lifetime_seconds_count{site=\"" + sleeper_site + "\"} 3") != string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
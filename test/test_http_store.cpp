@@ -3,6 +3,7 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include <array>
+#include <limits>
 #include <sstream>
 #include <string>
 
@@ -10,9 +11,13 @@
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
 
+#include <cache/exact_range_reader.h>
 #include <cache/http_sign.h>
 #include <cache/http_store.h>
+#include <cache/local_prefix.h>
+#include <cache/multi_peer_reader_error.h>
 #include <cache/chain_hasher.h>
 #include <defer.h>
 #include <response_part.h>
@@ -940,6 +945,217 @@ BOOST_AUTO_TEST_CASE(test_read_response_partial_off) {
     });
 }
 
+BOOST_AUTO_TEST_CASE(test_read_response_partial_open) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        store_response(tmpdir, true, ctx, yield);
+
+        Cancel c;
+        sys::error_code e;
+        auto store_rr = cache::http_store_range_reader
+            ( tmpdir, ctx.get_executor()
+            , http_::response_data_block + 1, std::numeric_limits<size_t>::max()  // "N-"
+            , e);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(store_rr);
+        auto store_s = Session::create(std::move(store_rr), false, c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_CHECK_EQUAL( store_s.response_header()[http::field::content_range]
+                         , "bytes 65536-131075/131076");
+    });
+}
+
+BOOST_DATA_TEST_CASE( test_read_response_exact_range
+                    , boost::unit_test::data::make(block_ranges), firstb_lastb) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        store_response(tmpdir, true, ctx, yield);
+
+        // Request from middle first block to middle last block (see above).
+        unsigned first_block, last_block;
+        tie(first_block, last_block) = firstb_lastb;
+        size_t first = (first_block * http_::response_data_block) + rs_block_data[first_block].size() / 2;
+        size_t last = (last_block * http_::response_data_block) + rs_block_data[last_block].size() / 2;
+
+        Cancel c;
+        sys::error_code e;
+        auto store_rr = cache::http_store_range_reader
+            (tmpdir, ctx.get_executor(), first, last, e);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(store_rr);
+        auto exact_rr = std::make_unique<cache::ExactRangeReader>
+            (std::move(store_rr), first, last);
+        auto exact_s = Session::create(std::move(exact_rr), false, c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+
+        // Head.
+        auto& head = exact_s.response_header();
+        BOOST_CHECK_EQUAL(head.result(), http::status::partial_content);
+        BOOST_CHECK(head[http_::response_original_http_status].empty());
+        BOOST_CHECK_EQUAL( head[http::field::content_range]
+                         , util::str("bytes ", first, '-', last, "/131076"));
+
+        // The session gives the head again.
+        auto part = exact_s.async_read_part(c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(part);
+        BOOST_REQUIRE(part->is_head());
+
+        // Chunks without extensions and with just the requested data,
+        // then an empty trailer.
+        std::string body;
+        bool last_chunk = false;
+        for (bool done = false; !done; ) {
+            part = exact_s.async_read_part(c, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            BOOST_REQUIRE(part);
+            if (auto ch = part->as_chunk_hdr()) {
+                BOOST_CHECK(!last_chunk);
+                BOOST_CHECK_EQUAL(ch->exts, "");
+                last_chunk = (ch->size == 0);
+            } else if (auto cb = part->as_chunk_body()) {
+                BOOST_CHECK(!last_chunk);
+                body.append(cb->cbegin(), cb->cend());
+            } else {
+                BOOST_REQUIRE(part->is_trailer());
+                BOOST_CHECK_EQUAL(*(part->as_trailer()), rrs_trailer);
+                done = true;
+            }
+        }
+        BOOST_CHECK(last_chunk);
+        BOOST_CHECK_EQUAL(body, rs_body_complete.substr(first, last - first + 1));
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_read_response_exact_range_open) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    run_spawned(ctx, [&] (auto yield) {
+        store_response(tmpdir, true, ctx, yield);
+
+        size_t first = http_::response_data_block + 1;
+        size_t last = std::numeric_limits<size_t>::max();  // "N-"
+
+        Cancel c;
+        sys::error_code e;
+        auto store_rr = cache::http_store_range_reader
+            (tmpdir, ctx.get_executor(), first, last, e);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_REQUIRE(store_rr);
+        auto exact_rr = std::make_unique<cache::ExactRangeReader>
+            (std::move(store_rr), first, last);
+        auto exact_s = Session::create(std::move(exact_rr), false, c, yield[e]);
+        BOOST_CHECK_EQUAL(e.message(), "Success");
+        BOOST_CHECK_EQUAL( exact_s.response_header()[http::field::content_range]
+                         , "bytes 65537-131075/131076");
+    });
+}
+
+// Block arithmetic for ranges, with `first` and `last` bytes of the range
+// and the resulting first block and end block.
+using range_blocks = std::tuple<size_t, size_t, size_t, size_t>;
+static const range_blocks hash_list_ranges[] = {
+    {0, 0, 0, 1},  // first byte
+    {0, 65535, 0, 1},  // whole first block
+    {65535, 65536, 0, 2},  // across blocks
+    {32768, 131075, 0, 3},  // up to last byte
+    {65536, std::numeric_limits<size_t>::max(), 1, 3},  // open range
+    {131075, 131075, 2, 3},  // last byte
+    {131072, 42'000'000, 2, 3},  // beyond last byte
+};
+
+BOOST_AUTO_TEST_CASE(test_hash_list_range) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    auto exec = ctx.get_executor();
+    Cancel cancel;
+
+    run_spawned(ctx, [&] (auto yield) {
+        store_response(tmpdir, true, ctx, yield);
+        cache::HashList hl = cache::http_store_load_hash_list(tmpdir, exec, cancel, yield);
+        BOOST_REQUIRE_EQUAL(hl.blocks.size(), 3);
+
+        for (auto& r : hash_list_ranges) {
+            sys::error_code e;
+            auto blocks = hl.blocks_for_range(get<0>(r), get<1>(r), e);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            BOOST_CHECK_EQUAL(blocks.first, get<2>(r));
+            BOOST_CHECK_EQUAL(blocks.second, get<3>(r));
+        }
+
+        {
+            sys::error_code e;
+            hl.blocks_for_range(131076, 131076, e);  // beyond data
+            BOOST_CHECK_EQUAL(e, sys::errc::invalid_seek);
+        }
+        {
+            sys::error_code e;
+            hl.blocks_for_range(2, 1, e);  // inverted
+            BOOST_CHECK_EQUAL(e, sys::errc::invalid_seek);
+        }
+
+        // The chain hash of the previous block is needed
+        // to verify the first block of a range.
+        BOOST_CHECK(!hl.prev_chained_digest(0));
+        for (size_t b = 1; b < hl.blocks.size(); ++b) {
+            auto d = hl.prev_chained_digest(b);
+            BOOST_REQUIRE(d);
+            BOOST_CHECK(*d == rs_block_chash_raw(b));
+        }
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_hash_list_range_incomplete) {
+    auto tmpdir = fs::unique_path();
+    auto rmdir = defer([&tmpdir] {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+    });
+
+    fs::create_directory(tmpdir);
+
+    asio::io_context ctx;
+    auto exec = ctx.get_executor();
+    Cancel cancel;
+
+    run_spawned(ctx, [&] (auto yield) {
+        store_response(tmpdir, false, ctx, yield);
+        cache::HashList hl = cache::http_store_load_hash_list(tmpdir, exec, cancel, yield);
+
+        // Without data size, ranges cannot be checked.
+        sys::error_code e;
+        hl.blocks_for_range(0, 0, e);
+        BOOST_CHECK_EQUAL(e, sys::errc::bad_message);
+    });
+}
+
 BOOST_DATA_TEST_CASE(test_hash_list, boost::unit_test::data::make(true_false), complete) {
     auto tmpdir = fs::unique_path();
     auto rmdir = defer([&tmpdir] {
@@ -960,5 +1176,131 @@ BOOST_DATA_TEST_CASE(test_hash_list, boost::unit_test::data::make(true_false), c
     });
 }
 
+// Stored incomplete response (with two blocks) to be resumed,
+// and the hash list of the complete response as chosen from peers.
+struct LocalPrefixFixture {
+    fs::path tmpdir = fs::unique_path();
+    fs::path refdir = fs::unique_path();
+    cache::HashList reference;
+
+    LocalPrefixFixture() {
+        fs::create_directory(tmpdir);
+        fs::create_directory(refdir);
+    }
+
+    ~LocalPrefixFixture() {
+        sys::error_code ec;
+        fs::remove_all(tmpdir, ec);
+        fs::remove_all(refdir, ec);
+    }
+
+    std::unique_ptr<cache::LocalPrefix>
+    store(asio::io_context& ctx, Cancel& c, asio::yield_context yield) {
+        auto exec = ctx.get_executor();
+        store_response(tmpdir, false, ctx, yield);
+        store_response(refdir, true, ctx, yield);
+        reference = cache::http_store_load_hash_list(refdir, exec, c, yield);
+
+        auto hl = cache::http_store_load_hash_list(tmpdir, exec, c, yield);
+        BOOST_REQUIRE_EQUAL(hl.blocks.size(), 2);
+        auto last = hl.blocks.size() * hl.signed_head.block_size() - 1;
+        sys::error_code e;
+        auto rr = cache::http_store_range_reader(tmpdir, exec, 0, last, e);
+        BOOST_REQUIRE_EQUAL(e.message(), "Success");
+        return std::make_unique<cache::LocalPrefix>(std::move(hl), std::move(rr));
+    }
+};
+
+BOOST_AUTO_TEST_CASE(test_local_prefix) {
+    LocalPrefixFixture f;
+    asio::io_context ctx;
+    Cancel c;
+
+    run_spawned(ctx, [&] (auto yield) {
+        auto lp = f.store(ctx, c, yield);
+
+        auto n = lp->matching_blocks(f.reference);
+        BOOST_REQUIRE_EQUAL(n, 2);
+        lp->block_count = n;
+
+        // Blocks can only be read in order.
+        {
+            sys::error_code e;
+            lp->read_block(1, f.reference, c, yield[e]);
+            BOOST_CHECK_EQUAL(e, asio::error::invalid_argument);
+        }
+
+        for (size_t b = 0; b < n; ++b) {
+            BOOST_CHECK(!lp->exhausted());
+            sys::error_code e;
+            auto block = lp->read_block(b, f.reference, c, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+            BOOST_CHECK_EQUAL( string(block.chunk_body.cbegin(), block.chunk_body.cend())
+                             , rs_block_data[b]);
+            BOOST_CHECK_EQUAL(block.chunk_hdr.size, rs_block_data[b].size());
+            // Signature of this block, for it to be verified as sent from peers.
+            BOOST_CHECK_EQUAL(block.chunk_hdr.exts, rs_chunk_ext[b + 1]);
+        }
+
+        // The rest should be fetched from peers.
+        BOOST_CHECK(lp->exhausted());
+        sys::error_code e;
+        lp->read_block(n, f.reference, c, yield[e]);
+        BOOST_CHECK_EQUAL(e, asio::error::invalid_argument);
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_local_prefix_mismatch) {
+    LocalPrefixFixture f;
+    asio::io_context ctx;
+    Cancel c;
+
+    run_spawned(ctx, [&] (auto yield) {
+        auto lp = f.store(ctx, c, yield);
+
+        // The response chosen from peers differs from the stored one
+        // at some data block.
+        auto reference = f.reference;
+        reference.blocks[1].data_hash = rs_block_dhash_raw[2];
+        BOOST_CHECK_EQUAL(lp->matching_blocks(reference), 1);
+
+        reference.blocks[0].data_hash = rs_block_dhash_raw[2];
+        BOOST_CHECK_EQUAL(lp->matching_blocks(reference), 0);
+
+        lp->block_count = lp->matching_blocks(reference);
+        BOOST_CHECK(lp->exhausted());
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_local_prefix_corrupted) {
+    LocalPrefixFixture f;
+    asio::io_context ctx;
+    Cancel c;
+
+    run_spawned(ctx, [&] (auto yield) {
+        auto lp = f.store(ctx, c, yield);
+        lp->block_count = lp->matching_blocks(f.reference);
+        BOOST_REQUIRE_EQUAL(lp->block_count, 2);
+
+        // Corrupt the second stored block after its hash was recorded.
+        {
+            fs::fstream body(f.tmpdir / "body", ios::in | ios::out | ios::binary);
+            body.seekp(http_::response_data_block);
+            body.put('!');
+        }
+
+        {
+            sys::error_code e;
+            lp->read_block(0, f.reference, c, yield[e]);
+            BOOST_CHECK_EQUAL(e.message(), "Success");
+        }
+
+        // The block is not used, so that it gets fetched from peers.
+        sys::error_code e;
+        lp->read_block(1, f.reference, c, yield[e]);
+        BOOST_CHECK(e == cache::MultiPeerReaderErrc::inconsistent_hash);
+        BOOST_CHECK(!lp->exhausted());
+    });
+}
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,8 @@
 #define BOOST_TEST_MODULE blocker
 #include <boost/test/included/unit_test.hpp>
 
+#include <limits>
+
 #include <boost/beast/http/message.hpp>
 #include <boost/beast/http/empty_body.hpp>
 
@@ -37,5 +39,22 @@ BOOST_AUTO_TEST_CASE(test_filter_fields) {
     BOOST_REQUIRE(filt_rq[http::field::referer] == "");
 }
 
+BOOST_AUTO_TEST_CASE(test_parse_request_byte_range) {
+    using ouinet::util::HttpRequestByteRange;
+
+    auto rs = HttpRequestByteRange::parse("bytes=0-99, 200-");
+    BOOST_REQUIRE(rs);
+    BOOST_REQUIRE_EQUAL(rs->size(), 2u);
+    BOOST_REQUIRE_EQUAL((*rs)[0].first, 0u);
+    BOOST_REQUIRE_EQUAL((*rs)[0].last, 99u);
+    // Open range.
+    BOOST_REQUIRE_EQUAL((*rs)[1].first, 200u);
+    BOOST_REQUIRE_EQUAL((*rs)[1].last, std::numeric_limits<size_t>::max());
+
+    // Suffix ranges are not supported.
+    BOOST_REQUIRE(!HttpRequestByteRange::parse("bytes=-100"));
+    BOOST_REQUIRE(!HttpRequestByteRange::parse("bytes=1-x"));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
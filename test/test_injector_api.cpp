@@ -0,0 +1,86 @@
+#define BOOST_TEST_MODULE injector_api
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio/spawn.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http.hpp>
+
+#include <authenticate.h>
+#include <injector_api.h>
+#include <namespaces.h>
+#include "connected_pair.h"
+
+BOOST_AUTO_TEST_SUITE(ouinet_injector_api)
+
+using namespace std;
+using namespace ouinet;
+
+using Request = injector_api::Request;
+using Response = http::response<http::string_body>;
+
+static const string credentials = "test:123";
+
+// Have the injector answer the request and return its response.
+static Response serve(asio::io_context& ctx, Request rq, asio::yield_context yield) {
+    asio::ip::tcp::socket user_s(ctx), injector_s(ctx);
+    tie(user_s, injector_s) = util::connected_pair(ctx, yield);
+
+    GenericStream injector_con(move(injector_s));
+    sys::error_code ec;
+    injector_api::handle_request_to_this( rq, injector_con, credentials
+                                        , Yield(ctx, yield)[ec]);
+    BOOST_CHECK_EQUAL(ec.message(), "Success");
+
+    Response rs;
+    beast::flat_buffer buffer;
+    http::async_read(user_s, buffer, rs, yield[ec]);
+    BOOST_REQUIRE_EQUAL(ec.message(), "Success");
+    return rs;
+}
+
+static Request get(const string& target) {
+    Request rq{http::verb::get, target, 11};
+    rq.set(http::field::host, "injector.example");
+    return rq;
+}
+
+BOOST_AUTO_TEST_CASE(test_is_request_to_this) {
+    BOOST_CHECK(injector_api::is_request_to_this(get("/metrics")));
+    BOOST_CHECK(!injector_api::is_request_to_this(get("http://example.com/metrics")));
+}
+
+BOOST_AUTO_TEST_CASE(test_diagnostics_need_auth) {
+    asio::io_context ctx;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        for (auto target : {"/metrics", "/handlers.txt"}) {
+            auto rs = serve(ctx, get(target), yield);
+            BOOST_CHECK_EQUAL(rs.result(), http::status::proxy_authentication_required);
+            BOOST_CHECK(rs[http::field::proxy_authenticate].starts_with("Basic"));
+
+            rs = serve(ctx, authorize(get(target), "test:bad"), yield);
+            BOOST_CHECK_EQUAL(rs.result(), http::status::proxy_authentication_required);
+
+            rs = serve(ctx, authorize(get(target), credentials), yield);
+            BOOST_CHECK_EQUAL(rs.result(), http::status::ok);
+        }
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_api_ok_needs_no_auth) {
+    asio::io_context ctx;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        auto rs = serve(ctx, get("/api/ok"), yield);
+        BOOST_CHECK_EQUAL(rs.result(), http::status::ok);
+
+        rs = serve(ctx, get("/unknown"), yield);
+        BOOST_CHECK_EQUAL(rs.result(), http::status::not_found);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
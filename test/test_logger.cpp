@@ -1,8 +1,13 @@
 #define BOOST_TEST_MODULE logger_tester
 #include <boost/test/included/unit_test.hpp>
 
+#include <chrono>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
+
+#include <boost/filesystem.hpp>
 
 #include "namespaces.h"
 #include "logger.h"
@@ -44,4 +49,60 @@ BOOST_AUTO_TEST_CASE(test_generate_node_id)
     LOG_DEBUG("This should not make it out from the default logger with the macro");
 }
 
+BOOST_AUTO_TEST_CASE(test_async)
+{
+    auto path = fs::temp_directory_path() / fs::unique_path();
+
+    Logger log(DEBUG);
+    log.log_to_file(path.string());
+    log.enable_async(16);  // so that some messages are dropped
+
+    static const int count = 1000;
+    for (int i = 0; i < count; ++i)
+        log.debug(util::str("Async message ", i));
+
+    auto dropped = log.dropped_count();
+    log.disable_async();  // waits for pending messages
+
+    std::ostringstream ss;
+    log.copy_log_file(ss);
+    log.log_to_file("");  // removes the file
+
+    auto content = ss.str();
+    size_t written = 0;
+    for (auto pos = content.find("Async message "); pos != string::npos
+        ; pos = content.find("Async message ", pos + 1))
+        ++written;
+
+    BOOST_REQUIRE_EQUAL(written + dropped, size_t(count));
+    if (dropped > 0)
+        BOOST_REQUIRE(content.find("Dropped ") != string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_async_wake_up)
+{
+    auto path = fs::temp_directory_path() / fs::unique_path();
+
+    Logger log(DEBUG);
+    log.log_to_file(path.string());
+    log.enable_async();
+
+    // Let the writer wait for messages, then check that it gets woken up.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    log.debug("Wake up");
+
+    bool written = false;
+    for (int i = 0; i < 100 && !written; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::ostringstream ss;
+        log.copy_log_file(ss);
+        written = ss.str().find("Wake up") != string::npos;
+    }
+
+    log.disable_async();
+    log.log_to_file("");  // removes the file
+
+    BOOST_REQUIRE(written);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
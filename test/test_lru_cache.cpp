@@ -0,0 +1,150 @@
+#define BOOST_TEST_MODULE lru_cache
+#include <boost/test/included/unit_test.hpp>
+
+#include <atomic>
+#include <list>
+#include <random>
+#include <string>
+#include <thread>
+#include <util/lru_cache.h>
+
+BOOST_AUTO_TEST_SUITE(lru_cache)
+
+using namespace std;
+using namespace ouinet::util;
+
+BOOST_AUTO_TEST_CASE(test_basic)
+{
+    LruCache<string, int> lru(2);
+
+    BOOST_REQUIRE(lru.empty());
+    BOOST_REQUIRE(!lru.get("a"));
+
+    BOOST_REQUIRE_EQUAL(*lru.put("a", 1), 1);
+    BOOST_REQUIRE_EQUAL(*lru.put("b", 2), 2);
+    BOOST_REQUIRE_EQUAL(*lru.get("a"), 1);  // "b" is now the oldest
+
+    lru.put("c", 3);
+    BOOST_REQUIRE_EQUAL(lru.size(), 2u);
+    BOOST_REQUIRE(!lru.exists("b"));
+    BOOST_REQUIRE(lru.exists("a"));
+
+    // Replacing a value with its own key.
+    auto i = lru.find("a");
+    lru.put(i->first, 10);
+    BOOST_REQUIRE_EQUAL(*lru.get("a"), 10);
+    BOOST_REQUIRE_EQUAL(lru.size(), 2u);
+
+    // Iteration goes from most to least recently used.
+    vector<string> keys;
+    for (auto& kv : lru) keys.push_back(kv.first);
+    BOOST_REQUIRE((keys == vector<string>{"a", "c"}));
+
+    lru.move_to_front(lru.find("c"));
+    BOOST_REQUIRE_EQUAL(lru.begin()->first, "c");
+
+    auto j = lru.erase(lru.begin());
+    BOOST_REQUIRE_EQUAL(j->first, "a");
+    BOOST_REQUIRE(++j == lru.end());
+    BOOST_REQUIRE_EQUAL(lru.size(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_zero_size)
+{
+    LruCache<int, int> lru(0);
+    BOOST_REQUIRE(!lru.put(1, 1));
+    BOOST_REQUIRE(lru.empty());
+}
+
+// Compare against a simple list in random operations,
+// with few distinct keys so that probe sequences collide and wrap around.
+BOOST_AUTO_TEST_CASE(test_against_list)
+{
+    const size_t max_size = 50;
+    LruCache<int, int> lru(max_size);
+    list<pair<int, int>> ref;  // most recently used first
+
+    auto ref_find = [&] (int k) {
+        return find_if(ref.begin(), ref.end(), [k] (auto& kv) { return kv.first == k; });
+    };
+
+    mt19937 rng(42);
+    uniform_int_distribution<int> key(0, 120), op(0, 9);
+
+    for (int n = 0; n < 200000; ++n) {
+        int k = key(rng);
+        auto r = ref_find(k);
+
+        switch (op(rng)) {
+            case 0: case 1: case 2: case 3: {
+                lru.put(k, n);
+                if (r != ref.end()) ref.erase(r);
+                ref.push_front({k, n});
+                if (ref.size() > max_size) ref.pop_back();
+                break;
+            }
+            case 4: case 5: case 6: case 7: {
+                auto v = lru.get(k);
+                BOOST_REQUIRE_EQUAL(bool(v), r != ref.end());
+                if (v) {
+                    BOOST_REQUIRE_EQUAL(*v, r->second);
+                    ref.splice(ref.begin(), ref, r);
+                }
+                break;
+            }
+            default: {
+                auto i = lru.find(k);
+                BOOST_REQUIRE_EQUAL(i != lru.end(), r != ref.end());
+                if (r != ref.end()) {
+                    auto next = lru.erase(i);
+                    auto ref_next = ref.erase(r);
+                    BOOST_REQUIRE_EQUAL(next == lru.end(), ref_next == ref.end());
+                    if (ref_next != ref.end())
+                        BOOST_REQUIRE_EQUAL(next->first, ref_next->first);
+                }
+            }
+        }
+
+        if (n % 1000 == 0) {
+            BOOST_REQUIRE_EQUAL(lru.size(), ref.size());
+            auto r = ref.begin();
+            for (auto& kv : lru) {
+                BOOST_REQUIRE_EQUAL(kv.first, r->first);
+                BOOST_REQUIRE_EQUAL(kv.second, r->second);
+                ++r;
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_sharded)
+{
+    ShardedLruCache<int, int> lru(4000, 8);
+
+    // Boost.Test assertions are not thread-safe.
+    atomic<int> misses{0};
+
+    vector<thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&lru, &misses, t] {
+            for (int i = 0; i < 1000; ++i) {
+                lru.put(t * 1000 + i, i);
+                auto v = lru.get(t * 1000 + i);
+                if (!v || *v != i) ++misses;
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    BOOST_REQUIRE_EQUAL(misses, 0);
+    // Shards may be unevenly filled.
+    BOOST_REQUIRE(lru.size() <= 4000u);
+    BOOST_REQUIRE(lru.size() > 3000u);
+
+    lru.put(12345, 1);
+    BOOST_REQUIRE(lru.erase(12345));
+    BOOST_REQUIRE(!lru.exists(12345));
+    BOOST_REQUIRE(!lru.erase(12345));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,87 @@
+#define BOOST_TEST_MODULE metrics
+#include <boost/test/included/unit_test.hpp>
+
+#include <sstream>
+#include <util/metrics.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_metrics)
+
+using namespace std;
+using namespace ouinet;
+
+static
+string to_text(const metrics::Registry& r)
+{
+    ostringstream ss;
+    r.write(ss);
+    return ss.str();
+}
+
+static
+bool contains(const string& s, const string& line)
+{
+    return s.find(line + "\n") != string::npos;
+}
+
+BOOST_AUTO_TEST_CASE(test_counters_and_gauges) {
+    metrics::Registry r;
+
+    r.counter("reqs_total", "Requests", {{"result", "ok"}}).inc(2);
+    r.counter("reqs_total", "Requests", {{"result", "ok"}}).inc();
+    r.counter("reqs_total", "Requests", {{"result", "a\"b"}}).inc();
+    r.gauge("temp", "Temperature").set(1.5);
+
+    auto text = to_text(r);
+    BOOST_REQUIRE(contains(text, "# HELP reqs_total Requests"));
+    BOOST_REQUIRE(contains(text, "# TYPE reqs_total counter"));
+    BOOST_REQUIRE(contains(text, "reqs_total{result=\"ok\"} 3"));
+    BOOST_REQUIRE(contains(text, "reqs_total{result=\"a\\\"b\"} 1"));
+    BOOST_REQUIRE(contains(text, "# TYPE temp gauge"));
+    BOOST_REQUIRE(contains(text, "temp 1.5"));
+}
+
+BOOST_AUTO_TEST_CASE(test_histogram) {
+    metrics::Registry r;
+
+    auto& h = r.histogram("lat", "Latency", {}, {1, 2});
+    h.observe(0.5);
+    h.observe(1.5);
+    h.observe(std::chrono::seconds(3));
+
+    auto text = to_text(r);
+    BOOST_REQUIRE(contains(text, "# TYPE lat histogram"));
+    BOOST_REQUIRE(contains(text, "lat_bucket{le=\"1\"} 1"));
+    BOOST_REQUIRE(contains(text, "lat_bucket{le=\"2\"} 2"));
+    BOOST_REQUIRE(contains(text, "lat_bucket{le=\"+Inf\"} 3"));
+    BOOST_REQUIRE(contains(text, "lat_sum 5"));
+    BOOST_REQUIRE(contains(text, "lat_count 3"));
+}
+
+BOOST_AUTO_TEST_CASE(test_large_values) {
+    metrics::Registry r;
+
+    r.counter("bytes_total", "Bytes").inc(12345678901);
+    r.gauge("big", "Big").set(12345678.25);
+    r.histogram("dur", "Duration", {}, {1}).observe(12345678.5);
+
+    // Values are not rounded.
+    auto text = to_text(r);
+    BOOST_REQUIRE(contains(text, "bytes_total 12345678901"));
+    BOOST_REQUIRE(contains(text, "big 12345678.25"));
+    BOOST_REQUIRE(contains(text, "dur_sum 12345678.5"));
+}
+
+BOOST_AUTO_TEST_CASE(test_callback_gauge) {
+    metrics::Registry r;
+
+    size_t value = 7;
+    {
+        auto g = r.callback_gauge("size", "Size", {}, [&] { return value; });
+        BOOST_REQUIRE(contains(to_text(r), "size 7"));
+        value = 8;
+        BOOST_REQUIRE(contains(to_text(r), "size 8"));
+    }
+    BOOST_REQUIRE_EQUAL(to_text(r).find("size"), string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,129 @@
+#define BOOST_TEST_MODULE peer_lookup_refresher
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio/io_context.hpp>
+#include <namespaces.h>
+#include <cache/peer_lookup_refresher.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_peer_lookup_refresher)
+
+using namespace std;
+using namespace ouinet;
+using namespace std::chrono_literals;
+
+struct FakeLookup {
+    using Clock = chrono::steady_clock;
+
+    string name;
+    Clock::time_point fresh;
+    bool running = false;
+    size_t refreshes = 0;
+
+    const string& swarm_name() const { return name; }
+    Clock::time_point fresh_until() const { return fresh; }
+    bool is_running() const { return running; }
+    void refresh() { running = true; ++refreshes; }
+
+    // Like a lookup job completing.
+    void complete(Clock::time_point now) { running = false; fresh = now + 5min; }
+};
+
+using Refresher = cache::PeerLookupRefresher<FakeLookup>;
+using Clock = Refresher::Clock;
+
+static
+shared_ptr<FakeLookup> lookup(string name)
+{
+    auto l = make_shared<FakeLookup>();
+    l->name = move(name);
+    return l;
+}
+
+BOOST_AUTO_TEST_CASE(test_popular_only) {
+    asio::io_context ctx;
+    Refresher::Config cfg;
+    cfg.max_refreshed = 2;
+    Refresher r(ctx.get_executor(), cfg);
+
+    auto now = Clock::now();
+    auto a = lookup("a"), b = lookup("b"), c = lookup("c"), once = lookup("once");
+
+    for (int i = 0; i < 5; ++i) r.requested(a, now);
+    for (int i = 0; i < 4; ++i) r.requested(b, now);
+    for (int i = 0; i < 3; ++i) r.requested(c, now);
+    r.requested(once, now);
+
+    BOOST_REQUIRE_EQUAL(r.size(), 4u);
+    BOOST_REQUIRE_EQUAL(r.find("a"), a);
+    BOOST_REQUIRE(!r.find("z"));
+
+    // Only the two most requested groups are refreshed.
+    BOOST_REQUIRE_EQUAL(r.refresh_due(now), 2u);
+    BOOST_REQUIRE(a->running && b->running);
+    BOOST_REQUIRE(!c->running && !once->running);
+
+    // Running or fresh lookups are left alone.
+    a->complete(now);
+    BOOST_REQUIRE_EQUAL(r.refresh_due(now + 30s), 0u);
+
+    // Until they are about to expire.
+    BOOST_REQUIRE_EQUAL(r.refresh_due(now + 3min + 30s), 1u);
+    BOOST_REQUIRE_EQUAL(a->refreshes, 2u);
+    BOOST_REQUIRE_EQUAL(b->refreshes, 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_budget) {
+    asio::io_context ctx;
+    Refresher::Config cfg;
+    cfg.refreshes_per_minute = 2;
+    cfg.max_burst = 3;
+    Refresher r(ctx.get_executor(), cfg);
+
+    auto now = Clock::now();
+    vector<shared_ptr<FakeLookup>> lookups;
+    for (int i = 0; i < 10; ++i) {
+        lookups.push_back(lookup("group" + to_string(i)));
+        for (int j = 0; j < 3; ++j) r.requested(lookups.back(), now);
+    }
+
+    BOOST_REQUIRE_EQUAL(r.refresh_due(now), 3u);
+    BOOST_REQUIRE_EQUAL(r.refresh_due(now), 0u);
+    BOOST_REQUIRE_EQUAL(r.refresh_due(now + 30s), 1u);
+    BOOST_REQUIRE_EQUAL(r.refresh_due(now + 90s), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(test_decay) {
+    asio::io_context ctx;
+    Refresher::Config cfg;
+    cfg.max_tracked = 3;
+    Refresher r(ctx.get_executor(), cfg);
+
+    auto now = Clock::now();
+    auto old = lookup("old");
+    for (int i = 0; i < 10; ++i) r.requested(old, now);
+
+    // Requests lose weight with time.
+    auto later = now + 3 * cfg.half_life;
+    auto recent = lookup("recent");
+    for (int i = 0; i < 3; ++i) r.requested(recent, later);
+
+    r.requested(lookup("x"), later);
+    r.requested(lookup("y"), later);
+
+    // The least requested is forgotten.
+    BOOST_REQUIRE_EQUAL(r.size(), 3u);
+    BOOST_REQUIRE(r.find("recent"));
+    BOOST_REQUIRE(r.find("old"));
+    BOOST_REQUIRE(r.find("y"));
+
+    // After decay, only `recent` has enough requests.
+    BOOST_REQUIRE_EQUAL(r.refresh_due(later + 1s), 1u);
+    BOOST_REQUIRE(recent->running);
+    BOOST_REQUIRE(!old->running);
+
+    // Groups not requested for long are forgotten.
+    r.refresh_due(later + 10 * cfg.half_life);
+    BOOST_REQUIRE_EQUAL(r.size(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
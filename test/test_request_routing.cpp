@@ -0,0 +1,169 @@
+#define BOOST_TEST_MODULE request_routing
+#include <boost/test/included/unit_test.hpp>
+
+#include <sstream>
+#include <namespaces.h>
+#include <request_routing.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_request_routing)
+
+using namespace std;
+using namespace ouinet;
+using namespace ouinet::request_route;
+
+using Request = http::request<http::string_body>;
+
+static
+Request make_request( const string& target
+                    , http::verb method = http::verb::get
+                    , const map<string, string>& headers = {})
+{
+    Request rq{method, target, 11};
+    // Like the client ensures.
+    auto hp = target.substr(target.find("://") + 3);
+    rq.set(http::field::host, hp.substr(0, hp.find('/')));
+    for (auto& h : headers) rq.set(h.first, h.second);
+    return rq;
+}
+
+static const Config default_config{{fresh_channel::origin, fresh_channel::injector_or_dcache}};
+
+// Channels chosen for the request, as a string.
+static
+string route(const Router& r, const Request& rq)
+{
+    auto& cfg = r.choose(rq, default_config);
+    if (&cfg == &default_config) return "default";
+    ostringstream ss;
+    for (auto ch : cfg.fresh_channels) ss << (ss.tellp() ? " " : "") << ch;
+    return ss.str();
+}
+
+static
+Router make_router(const string& text)
+{
+    Router r;
+    istringstream ss(text);
+    r.add_rules(ss);
+    return r;
+}
+
+BOOST_AUTO_TEST_CASE(test_hosts) {
+    auto r = make_router(R"(
+        # Comments and empty lines are ignored.
+
+        host=exact.example.com => proxy
+        domain=example.org => origin
+        domain=.sub.example.net => injector
+        host~(.+\.)?regex\.com => origin proxy
+    )");
+
+    BOOST_REQUIRE_EQUAL(r.size(), 4u);
+
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://exact.example.com/")), "proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://EXACT.example.com:8080/")), "proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://x.exact.example.com/")), "default");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/")), "default");
+
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.org/")), "origin");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("https://a.b.example.org/")), "origin");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("https://badexample.org/")), "default");
+
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://sub.example.net/")), "default");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://a.sub.example.net/")), "injector_or_dcache");
+
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://www.Regex.com/")), "origin proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://regex.community/")), "default");
+}
+
+BOOST_AUTO_TEST_CASE(test_urls) {
+    auto r = make_router(R"(
+        url=example.com/exact => proxy
+        url=example.com/static/* => injector
+        url~example\.com/.*\.php => origin
+    )");
+
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/exact")), "proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("https://example.com/exact")), "proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/exactly")), "default");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/static/")), "injector_or_dcache");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/static/a.css")), "injector_or_dcache");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/index.php")), "origin");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/")), "default");
+}
+
+BOOST_AUTO_TEST_CASE(test_order_and_conditions) {
+    auto r = make_router(R"(
+        !method=GET,HEAD => origin proxy
+        header:X-Private=true => origin proxy
+        !header:X-HTTP-Method-Override~~(|GET) => origin proxy
+        domain=example.com url=example.com/api/* => proxy
+        domain=example.com !host=www.example.com => origin
+        domain=example.com =>
+    )");
+
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/", http::verb::post)), "origin proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://other.com/", http::verb::head)), "default");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://other.com/", http::verb::get, {{"X-Private", "True"}})), "origin proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://other.com/", http::verb::get, {{"X-Private", "false"}})), "default");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://other.com/", http::verb::get, {{"X-HTTP-Method-Override", "POST"}})), "origin proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://other.com/", http::verb::get, {{"X-HTTP-Method-Override", "GET"}})), "default");
+    // Methods are case-sensitive.
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://other.com/", http::verb::get, {{"X-HTTP-Method-Override", "get"}})), "origin proxy");
+
+    // Earlier rules win even if indexed differently.
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/api/x")), "proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/api/x", http::verb::put)), "origin proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://a.example.com/")), "origin");
+    // No channels.
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://www.example.com/")), "");
+}
+
+BOOST_AUTO_TEST_CASE(test_header_case) {
+    auto r = make_router(R"(
+        header:X-A=yes => origin
+        header:X-B==yes => proxy
+        header:X-C~y.s => origin
+        header:X-D~~y.s => proxy
+    )");
+
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/", http::verb::get, {{"X-A", "YES"}})), "origin");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/", http::verb::get, {{"X-B", "yes"}})), "proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/", http::verb::get, {{"X-B", "YES"}})), "default");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/", http::verb::get, {{"X-C", "YES"}})), "origin");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/", http::verb::get, {{"X-D", "yes"}})), "proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://example.com/", http::verb::get, {{"X-D", "YES"}})), "default");
+
+    Router bad;
+    BOOST_REQUIRE_THROW(bad.add_rule("host==example.com => origin"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(test_many_rules) {
+    Router r;
+    for (int i = 0; i < 10000; ++i)
+        r.add_rule("domain=site" + to_string(i) + ".com => " + (i % 2 ? "proxy" : "origin"));
+
+    BOOST_REQUIRE_EQUAL(r.size(), 10000u);
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://www.site1234.com/")), "origin");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://site9999.com/")), "proxy");
+    BOOST_REQUIRE_EQUAL(route(r, make_request("http://site10000.com/")), "default");
+}
+
+BOOST_AUTO_TEST_CASE(test_errors) {
+    Router r;
+
+    BOOST_REQUIRE_THROW(r.add_rule("host=example.com"), invalid_argument);
+    BOOST_REQUIRE_THROW(r.add_rule("hots=example.com => origin"), invalid_argument);
+    BOOST_REQUIRE_THROW(r.add_rule("host=example.com => nowhere"), invalid_argument);
+    BOOST_REQUIRE_THROW(r.add_rule("domain=. => origin"), invalid_argument);
+
+    istringstream ss("domain=example.com => origin\n\nbad\n");
+    try {
+        r.add_rules(ss, "rules.txt");
+        BOOST_FAIL("No exception");
+    } catch (const invalid_argument& e) {
+        BOOST_REQUIRE(string(e.what()).find("rules.txt:3:") == 0);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
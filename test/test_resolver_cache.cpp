@@ -0,0 +1,170 @@
+#define BOOST_TEST_MODULE resolver_cache
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio/spawn.hpp>
+#include <namespaces.h>
+#include <resolver_cache.h>
+#include <async_sleep.h>
+#include <util/wait_condition.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_resolver_cache)
+
+using namespace std;
+using namespace ouinet;
+using namespace chrono_literals;
+
+using Answer = ResolverCache::Answer;
+using Query = ResolverCache::Query;
+
+BOOST_AUTO_TEST_CASE(test_coalesce_and_cache) {
+    asio::io_context ctx;
+    auto exec = ctx.get_executor();
+
+    ResolverCache rc(exec);
+    unsigned query_count = 0;
+
+    Query query = [&] (const string& host, Cancel& c, asio::yield_context y) {
+        ++query_count;
+        sys::error_code ec;
+        async_sleep(ctx, 50ms, c, y[ec]);
+        Answer answer;
+        answer.addresses.push_back(asio::ip::make_address("192.0.2.1"));
+        answer.ttl = 1h;
+        return or_throw(y, ec, move(answer));
+    };
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        WaitCondition wc(ctx);
+
+        for (int i = 0; i < 3; ++i)
+            asio::spawn(ctx, [&, lock = wc.lock()] (asio::yield_context y) {
+                Cancel cancel;
+                sys::error_code ec;
+                auto lookup = rc.resolve("test", "example.com", "80", query, cancel, y[ec]);
+                BOOST_REQUIRE(!ec);
+                BOOST_REQUIRE_EQUAL(lookup.size(), 1u);
+                BOOST_REQUIRE_EQUAL(lookup.begin()->endpoint().port(), 80);
+            });
+
+        wc.wait(yield);
+        BOOST_REQUIRE_EQUAL(query_count, 1u);
+
+        // Served from the cache.
+        Cancel cancel;
+        sys::error_code ec;
+        auto addrs = rc.resolve("test", "example.com", query, cancel, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(addrs.size(), 1u);
+        BOOST_REQUIRE_EQUAL(query_count, 1u);
+        BOOST_REQUIRE_EQUAL(rc.size(), 1u);
+
+        // Network addresses are not queried nor cached.
+        addrs = rc.resolve("test", "2001:db8::1", query, cancel, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(addrs.size(), 1u);
+        BOOST_REQUIRE_EQUAL(query_count, 1u);
+        BOOST_REQUIRE_EQUAL(rc.size(), 1u);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_negative_cache) {
+    asio::io_context ctx;
+    auto exec = ctx.get_executor();
+
+    ResolverCache rc(exec);
+    unsigned query_count = 0;
+
+    Query query = [&] (const string&, Cancel&, asio::yield_context y) {
+        ++query_count;
+        return or_throw<Answer>(y, asio::error::host_not_found);
+    };
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+
+        for (int i = 0; i < 2; ++i) {
+            sys::error_code ec;
+            rc.resolve("test", "nx.example.com", query, cancel, yield[ec]);
+            BOOST_REQUIRE_EQUAL(ec, asio::error::host_not_found);
+        }
+
+        BOOST_REQUIRE_EQUAL(query_count, 1u);
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_stop) {
+    asio::io_context ctx;
+    auto exec = ctx.get_executor();
+
+    ResolverCache rc(exec);
+
+    Query query = [&] (const string&, Cancel& c, asio::yield_context y) {
+        sys::error_code ec;
+        async_sleep(ctx, 10s, c, y[ec]);
+        return or_throw<Answer>(y, ec);
+    };
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        sys::error_code ec;
+        rc.resolve("test", "example.com", query, cancel, yield[ec]);
+        BOOST_REQUIRE_EQUAL(ec, asio::error::operation_aborted);
+        // Aborted queries are not remembered.
+        BOOST_REQUIRE_EQUAL(rc.size(), 0u);
+    });
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        async_sleep(ctx, 50ms, cancel, yield);
+        rc.stop();
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_CASE(test_per_resolver) {
+    asio::io_context ctx;
+    auto exec = ctx.get_executor();
+
+    ResolverCache rc(exec);
+
+    auto query_for = [&] (const char* addr) -> Query {
+        return [addr] (const string&, Cancel&, asio::yield_context) {
+            Answer answer;
+            answer.addresses.push_back(asio::ip::make_address(addr));
+            answer.ttl = 1h;
+            return answer;
+        };
+    };
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        sys::error_code ec;
+
+        // The same host gets different answers from different resolvers.
+        auto addrs = rc.resolve("doh", "example.com", query_for("192.0.2.1"), cancel, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(addrs.size(), 1u);
+        BOOST_CHECK_EQUAL(addrs[0], asio::ip::make_address("192.0.2.1"));
+
+        addrs = rc.resolve("system", "example.com", query_for("192.0.2.2"), cancel, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(addrs.size(), 1u);
+        BOOST_CHECK_EQUAL(addrs[0], asio::ip::make_address("192.0.2.2"));
+        BOOST_CHECK_EQUAL(rc.size(), 2u);
+
+        // Each is served from its own cached answer.
+        addrs = rc.resolve("doh", "example.com", query_for("192.0.2.3"), cancel, yield[ec]);
+        BOOST_REQUIRE(!ec);
+        BOOST_REQUIRE_EQUAL(addrs.size(), 1u);
+        BOOST_CHECK_EQUAL(addrs[0], asio::ip::make_address("192.0.2.1"));
+    });
+
+    ctx.run();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -92,5 +92,30 @@ BOOST_AUTO_TEST_CASE(test_scheduler_destroy_mid_run) {
     ctx.run();
 }
 
-BOOST_AUTO_TEST_SUITE_END()
+BOOST_AUTO_TEST_CASE(test_scheduler_raise_limit) {
+    asio::io_context ctx;
+
+    Scheduler scheduler(ctx, 1);
+    unsigned running = 0;
+
+    auto first_slot = scheduler.get_slot();
 
+    for (unsigned i = 0; i < 3; ++i) {
+        spawn(ctx, [&](auto yield) {
+            sys::error_code ec;
+            auto slot = scheduler.wait_for_slot(yield[ec]);
+            BOOST_REQUIRE(!ec);
+            ++running;
+        });
+    }
+
+    ctx.poll();
+    BOOST_REQUIRE_EQUAL(running, 0u);
+
+    // Waiting jobs start without any slot being released.
+    scheduler.set_max_running_jobs(3);
+    ctx.run();
+    BOOST_REQUIRE_EQUAL(running, 3u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
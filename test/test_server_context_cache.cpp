@@ -0,0 +1,219 @@
+#define BOOST_TEST_MODULE server_context_cache
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/ssl/rfc2818_verification.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <namespaces.h>
+#include <ssl/ca_certificate.h>
+#include <ssl/server_context_cache.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_server_context_cache)
+
+using namespace std;
+using namespace ouinet;
+
+using tcp = asio::ip::tcp;
+using ContextPtr = ServerContextCache::ContextPtr;
+
+struct TempDir {
+    fs::path path = fs::temp_directory_path() / fs::unique_path("ouinet-test-%%%%-%%%%");
+    ~TempDir() { fs::remove_all(path); }
+};
+
+static
+CACertificate& test_ca()
+{
+    // Generating the DH parameters is slow, so do it once.
+    static CACertificate ca("Test CA");
+    return ca;
+}
+
+static
+size_t stored_certificates(const fs::path& dir)
+{
+    size_t n = 0;
+    for (fs::directory_iterator i(dir), end; i != end; ++i)
+        if (i->path().extension() == ".pem") ++n;
+    return n;
+}
+
+BOOST_AUTO_TEST_CASE(test_coalesce_and_reuse) {
+    asio::io_context ctx;
+    TempDir store;
+
+    ServerContextCache cache(ctx.get_executor(), test_ca(), store.path);
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        ContextPtr c1, c2;
+        size_t done = 0;
+
+        // Concurrent requests for the same domain share the build.
+        for (auto c : {&c1, &c2}) {
+            asio::spawn(ctx, [&, c] (asio::yield_context yield) {
+                Cancel cancel;
+                *c = cache.get("Example.com", cancel, yield);
+                ++done;
+            });
+        }
+
+        asio::steady_timer t(ctx);
+        while (done < 2) {
+            t.expires_after(chrono::milliseconds(10));
+            t.async_wait(yield);
+        }
+
+        BOOST_REQUIRE(c1);
+        BOOST_REQUIRE_EQUAL(c1, c2);
+        BOOST_REQUIRE_EQUAL(cache.size(), 1u);
+
+        Cancel cancel;
+        BOOST_REQUIRE_EQUAL(cache.get("example.com", cancel, yield), c1);
+
+        cache.stop();
+    });
+
+    ctx.run();
+
+    BOOST_REQUIRE_EQUAL(stored_certificates(store.path), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_store_and_handshake) {
+    TempDir store;
+
+    {
+        asio::io_context ctx;
+        ServerContextCache cache(ctx.get_executor(), test_ca(), store.path);
+        asio::spawn(ctx, [&] (asio::yield_context yield) {
+            Cancel cancel;
+            cache.get("example.com", cancel, yield);
+            cache.stop();
+        });
+        ctx.run();
+    }
+
+    auto stored = fs::last_write_time(store.path / "example.com.pem");
+
+    asio::io_context ctx;
+
+    // Contexts for stored certificates are built on creation.
+    ServerContextCache cache(ctx.get_executor(), test_ca(), store.path);
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        asio::steady_timer t(ctx);
+        for (int i = 0; i < 500 && cache.size() == 0; ++i) {
+            t.expires_after(chrono::milliseconds(10));
+            t.async_wait(yield);
+        }
+        BOOST_REQUIRE_EQUAL(cache.size(), 1u);
+
+        Cancel cancel;
+        auto server_ctx = cache.get("example.com", cancel, yield);
+
+        tcp::acceptor acceptor(ctx, tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+
+        asio::spawn(ctx, [&] (asio::yield_context yield) {
+            tcp::socket s(ctx);
+            acceptor.async_accept(s, yield);
+            asio::ssl::stream<tcp::socket> ss(move(s), *server_ctx);
+            ss.async_handshake(asio::ssl::stream_base::server, yield);
+        });
+
+        // The client trusts the CA and checks the name of a subdomain.
+        asio::ssl::context client_ctx{asio::ssl::context::tls_client};
+        client_ctx.add_certificate_authority(asio::buffer(test_ca().pem_certificate()));
+        client_ctx.set_verify_mode(asio::ssl::verify_peer);
+
+        tcp::socket s(ctx);
+        s.async_connect(acceptor.local_endpoint(), yield);
+        asio::ssl::stream<tcp::socket> cs(move(s), client_ctx);
+        cs.set_verify_callback(asio::ssl::rfc2818_verification("www.example.com"));
+        cs.async_handshake(asio::ssl::stream_base::client, yield);
+
+        cache.stop();
+    });
+
+    ctx.run();
+
+    // The stored certificate was reused.
+    BOOST_REQUIRE_EQUAL(stored_certificates(store.path), 1u);
+    BOOST_REQUIRE(fs::last_write_time(store.path / "example.com.pem") >= stored);
+}
+
+BOOST_AUTO_TEST_CASE(test_other_ca) {
+    TempDir store;
+    fs::create_directories(store.path);
+
+    // A certificate signed by another CA is not used.
+    EndCertificate other("example.com");
+    fs::ofstream(store.path / "example.com.pem") << other.pem_certificate();
+
+    asio::io_context ctx;
+    ServerContextCache cache(ctx.get_executor(), test_ca(), store.path, 10, 0);
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        BOOST_REQUIRE(cache.get("example.com", cancel, yield));
+        cache.stop();
+    });
+
+    ctx.run();
+
+    fs::ifstream f(store.path / "example.com.pem");
+    ostringstream ss;
+    ss << f.rdbuf();
+    BOOST_REQUIRE(ss.str() != other.pem_certificate());
+}
+
+BOOST_AUTO_TEST_CASE(test_store_limit) {
+    TempDir store;
+    fs::create_directories(store.path);
+
+    // Only the most recently used certificates are kept on creation.
+    auto now = time(nullptr);
+    for (int i = 0; i < 5; ++i) {
+        auto path = store.path / ("old" + to_string(i) + ".com.pem");
+        fs::ofstream(path) << "dummy";
+        fs::last_write_time(path, now - 100 + i);
+    }
+
+    asio::io_context ctx;
+    ServerContextCache cache(ctx.get_executor(), test_ca(), store.path, 10, 0, 3);
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        Cancel cancel;
+        BOOST_REQUIRE(cache.get("example.com", cancel, yield));
+        cache.stop();
+    });
+
+    ctx.run();
+
+    // The new certificate made room by removing the oldest ones.
+    BOOST_REQUIRE(stored_certificates(store.path) <= 3u);
+    BOOST_REQUIRE(fs::exists(store.path / "example.com.pem"));
+    BOOST_REQUIRE(fs::exists(store.path / "old4.com.pem"));
+    BOOST_REQUIRE(!fs::exists(store.path / "old0.com.pem"));
+    BOOST_REQUIRE(!fs::exists(store.path / "old1.com.pem"));
+}
+
+BOOST_AUTO_TEST_CASE(test_stop) {
+    asio::io_context ctx;
+
+    ServerContextCache cache(ctx.get_executor(), test_ca(), fs::path());
+
+    sys::error_code ec;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        cache.stop();
+        Cancel cancel;
+        cache.get("example.com", cancel, yield[ec]);
+    });
+
+    ctx.run();
+
+    BOOST_REQUIRE_EQUAL(ec, asio::error::operation_aborted);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,122 @@
+#define BOOST_TEST_MODULE spawn
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio/steady_timer.hpp>
+#include <namespaces.h>
+#include <util/handler_tracker.h>
+#include <util/spawn.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_spawn)
+
+using namespace std;
+using namespace ouinet;
+using util::StackSize;
+
+static
+util::CoroutineStacks::Stats stats(StackSize s)
+{
+    return util::coroutine_stacks().stats(s);
+}
+
+BOOST_AUTO_TEST_CASE(test_size_classes) {
+    auto small = stats(StackSize::small).size;
+    auto normal = stats(StackSize::normal).size;
+    auto large = stats(StackSize::large).size;
+
+    BOOST_REQUIRE(small < normal);
+    BOOST_REQUIRE(normal < large);
+    BOOST_REQUIRE_EQUAL(normal % boost::coroutines::stack_traits::page_size(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_reuse) {
+    asio::io_context ctx;
+
+    size_t live_inside = 0;
+
+    util::spawn(ctx, [&] (asio::yield_context yield) {
+        live_inside = stats(StackSize::large).live;
+
+        // Stack usage near the size of the class must not touch the guard page.
+        volatile char buf[300 * 1000];
+        buf[0] = 1;
+        (void) buf[0];
+    }, StackSize::large);
+
+    ctx.run();
+
+    BOOST_REQUIRE_EQUAL(live_inside, 1u);
+    BOOST_REQUIRE_EQUAL(stats(StackSize::large).live, 0u);
+    BOOST_REQUIRE_EQUAL(stats(StackSize::large).pooled, 1u);
+
+    // Sequential coroutines keep reusing the pooled stack.
+    ctx.restart();
+    for (int i = 0; i < 10; ++i) {
+        util::spawn(ctx, [&] (asio::yield_context yield) {
+            BOOST_REQUIRE_EQUAL(stats(StackSize::large).pooled, 0u);
+        }, StackSize::large);
+        ctx.run();
+        ctx.restart();
+    }
+
+    BOOST_REQUIRE_EQUAL(stats(StackSize::large).pooled, 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent_and_max_pooled) {
+    asio::io_context ctx;
+
+    util::coroutine_stacks().set_max_pooled(3);
+
+    size_t max_live = 0;
+
+    for (int i = 0; i < 5; ++i) {
+        TRACK_SPAWN(ctx, ([&] (asio::yield_context yield) {
+            asio::steady_timer t(ctx);
+            t.expires_after(chrono::milliseconds(10));
+            t.async_wait(yield);
+            max_live = max(max_live, stats(StackSize::small).live);
+        }), StackSize::small);
+    }
+
+    ctx.run();
+
+    BOOST_REQUIRE_EQUAL(max_live, 5u);
+    BOOST_REQUIRE_EQUAL(stats(StackSize::small).live, 0u);
+    BOOST_REQUIRE_EQUAL(stats(StackSize::small).pooled, 3u);
+
+    util::coroutine_stacks().set_max_pooled(util::CoroutineStacks::default_max_pooled);
+}
+
+BOOST_AUTO_TEST_CASE(test_set_size) {
+    auto old = stats(StackSize::small).size;
+    util::coroutine_stacks().set_size(StackSize::small, old * 2);
+
+    BOOST_REQUIRE_EQUAL(stats(StackSize::small).size, old * 2);
+    // Pooled stacks of the old size are released.
+    BOOST_REQUIRE_EQUAL(stats(StackSize::small).pooled, 0u);
+
+    util::coroutine_stacks().set_size(StackSize::small, old);
+}
+
+BOOST_AUTO_TEST_CASE(test_spawn_from_yield) {
+    asio::io_context ctx;
+
+    bool child_done = false;
+    bool parent_done = false;
+
+    util::spawn(ctx, [&] (asio::yield_context yield) {
+        util::spawn(yield, [&] (asio::yield_context yield) {
+            asio::steady_timer t(ctx);
+            t.expires_after(chrono::milliseconds(10));
+            t.async_wait(yield);
+            child_done = true;
+        }, StackSize::small);
+        parent_done = true;
+    });
+
+    ctx.run();
+
+    BOOST_REQUIRE(parent_done);
+    BOOST_REQUIRE(child_done);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,185 @@
+#define BOOST_TEST_MODULE ssl_session_cache
+#include <boost/test/included/unit_test.hpp>
+
+#include <set>
+#include <vector>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/write.hpp>
+#include <namespaces.h>
+#include <ssl/ca_certificate.h>
+#include <ssl/util.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_ssl_session_cache)
+
+using namespace std;
+using namespace ouinet;
+
+using tcp = asio::ip::tcp;
+
+BOOST_AUTO_TEST_CASE(test_resumption) {
+    asio::io_context ctx;
+
+    EndCertificate cert("localhost");
+    auto server_ctx = ssl::util::get_server_context( cert.pem_certificate()
+                                                   , cert.pem_private_key()
+                                                   , cert.pem_dh_param());
+
+    // The certificate is self-signed, so trust it.
+    asio::ssl::context client_ctx{asio::ssl::context::tls_client};
+    client_ctx.add_certificate_authority(asio::buffer(cert.pem_certificate()));
+    client_ctx.set_verify_mode(asio::ssl::verify_peer);
+    ssl::util::SessionCache::enable(client_ctx);
+
+    auto cache = ssl::util::SessionCache::get(client_ctx);
+    BOOST_REQUIRE(cache);
+
+    tcp::acceptor acceptor(ctx, tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    auto server_ep = acceptor.local_endpoint();
+
+    static const int rounds = 3;
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        for (int i = 0; i < rounds; ++i) {
+            tcp::socket s(ctx);
+            acceptor.async_accept(s, yield);
+            asio::ssl::stream<tcp::socket> ss(move(s), server_ctx);
+            ss.async_handshake(asio::ssl::stream_base::server, yield);
+            // Exchange some data so that TLS 1.3 tickets get sent.
+            char c;
+            asio::async_read(ss, asio::buffer(&c, 1), yield);
+            asio::async_write(ss, asio::buffer(&c, 1), yield);
+        }
+    });
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        for (int i = 0; i < rounds; ++i) {
+            tcp::socket s(ctx);
+            s.async_connect(server_ep, yield);
+
+            Cancel cancel;
+            auto con = ssl::util::client_handshake( move(s), client_ctx
+                                                  , "localhost", cancel, yield);
+            char c = 'x';
+            asio::async_write(con, asio::buffer(&c, 1), yield);
+            asio::async_read(con, asio::buffer(&c, 1), yield);
+        }
+    });
+
+    ctx.run();
+
+    BOOST_REQUIRE_EQUAL(cache->size(), 1u);
+    BOOST_REQUIRE_EQUAL(cache->stats().full, 1u);
+    BOOST_REQUIRE_EQUAL(cache->stats().resumed, size_t(rounds - 1));
+}
+
+// Serve the given number of TLS connections,
+// exchanging a byte so that TLS 1.3 tickets get sent.
+static void serve( asio::io_context& ctx, tcp::acceptor& acceptor
+                 , asio::ssl::context& server_ctx, int rounds) {
+    asio::spawn(ctx, [&, rounds] (asio::yield_context yield) {
+        for (int i = 0; i < rounds; ++i) {
+            tcp::socket s(ctx);
+            acceptor.async_accept(s, yield);
+            asio::ssl::stream<tcp::socket> ss(move(s), server_ctx);
+            ss.async_handshake(asio::ssl::stream_base::server, yield);
+            char c;
+            asio::async_read(ss, asio::buffer(&c, 1), yield);
+            asio::async_write(ss, asio::buffer(&c, 1), yield);
+        }
+    });
+}
+
+BOOST_AUTO_TEST_CASE(test_session_keys) {
+    asio::io_context ctx;
+
+    EndCertificate cert("localhost");
+    auto server_ctx = ssl::util::get_server_context( cert.pem_certificate()
+                                                   , cert.pem_private_key()
+                                                   , cert.pem_dh_param());
+
+    // No host verification, like with injectors.
+    asio::ssl::context client_ctx{asio::ssl::context::tls_client};
+    ssl::util::SessionCache::enable(client_ctx);
+
+    auto cache = ssl::util::SessionCache::get(client_ctx);
+    BOOST_REQUIRE(cache);
+
+    tcp::acceptor acceptor(ctx, tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    auto server_ep = acceptor.local_endpoint();
+
+    // Sessions with one key are not resumed with another.
+    static const vector<string> keys = {"a", "b", "a"};
+    serve(ctx, acceptor, server_ctx, keys.size());
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        for (auto& key : keys) {
+            tcp::socket s(ctx);
+            s.async_connect(server_ep, yield);
+
+            Cancel cancel;
+            auto con = ssl::util::client_handshake( move(s), client_ctx
+                                                  , "", key, cancel, yield);
+            char c = 'x';
+            asio::async_write(con, asio::buffer(&c, 1), yield);
+            asio::async_read(con, asio::buffer(&c, 1), yield);
+        }
+    });
+
+    ctx.run();
+
+    BOOST_REQUIRE_EQUAL(cache->size(), 2u);
+    BOOST_REQUIRE_EQUAL(cache->stats().full, 2u);
+    BOOST_REQUIRE_EQUAL(cache->stats().resumed, 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_single_use_tickets) {
+    asio::io_context ctx;
+
+    EndCertificate cert("localhost");
+    auto server_ctx = ssl::util::get_server_context( cert.pem_certificate()
+                                                   , cert.pem_private_key()
+                                                   , cert.pem_dh_param());
+
+    asio::ssl::context client_ctx{asio::ssl::context::tls_client};
+    ssl::util::SessionCache::enable(client_ctx);
+
+    auto cache = ssl::util::SessionCache::get(client_ctx);
+    BOOST_REQUIRE(cache);
+
+    tcp::acceptor acceptor(ctx, tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    auto server_ep = acceptor.local_endpoint();
+
+    serve(ctx, acceptor, server_ctx, 1);
+
+    asio::spawn(ctx, [&] (asio::yield_context yield) {
+        tcp::socket s(ctx);
+        s.async_connect(server_ep, yield);
+
+        Cancel cancel;
+        auto con = ssl::util::client_handshake( move(s), client_ctx
+                                              , "", "a", cancel, yield);
+        char c = 'x';
+        asio::async_write(con, asio::buffer(&c, 1), yield);
+        asio::async_read(con, asio::buffer(&c, 1), yield);
+    });
+
+    ctx.run();
+
+    // Concurrent handshakes get different tickets, until none is left.
+    set<SSL_SESSION*> offered;
+    for (bool done = false; !done; ) {
+        auto ssl = ::SSL_new(client_ctx.native_handle());
+        cache->offer(ssl, "a");
+        auto session = ::SSL_get_session(ssl);
+        if (session) BOOST_CHECK(offered.insert(session).second);
+        done = !session;
+        ::SSL_free(ssl);
+        BOOST_REQUIRE(offered.size() <= ssl::util::SessionCache::max_sessions_per_key);
+    }
+    BOOST_CHECK(!offered.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,102 @@
+#define BOOST_TEST_MODULE timing_wheel
+#include <boost/test/included/unit_test.hpp>
+
+#include <map>
+#include <random>
+#include <namespaces.h>
+#include <util/timing_wheel.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_timing_wheel)
+
+using namespace std;
+using namespace ouinet;
+using namespace std::chrono_literals;
+
+using Wheel = util::TimingWheel<string>;
+using Clock = Wheel::Clock;
+
+BOOST_AUTO_TEST_CASE(test_order) {
+    auto start = Clock::now();
+    Wheel w(1s, start);
+
+    BOOST_REQUIRE(!w.next_event());
+
+    w.schedule("b", start + 10s);
+    w.schedule("a", start + 5s);
+    w.schedule("c", start + 10s);
+    w.schedule("now", start);
+
+    BOOST_REQUIRE_EQUAL(w.size(), 4u);
+    BOOST_REQUIRE(*w.next_event() == start);
+
+    BOOST_REQUIRE(w.expire(start) == vector<string>{"now"});
+    BOOST_REQUIRE(*w.next_event() == start + 5s);
+    BOOST_REQUIRE(w.expire(start + 4500ms).empty());
+    BOOST_REQUIRE(w.expire(start + 20s) == (vector<string>{"a", "b", "c"}));
+    BOOST_REQUIRE(w.empty());
+    BOOST_REQUIRE(!w.next_event());
+
+    // Past times are due right away.
+    w.schedule("late", start);
+    BOOST_REQUIRE(w.expire(start + 20s) == vector<string>{"late"});
+}
+
+BOOST_AUTO_TEST_CASE(test_reschedule_and_cancel) {
+    auto start = Clock::now();
+    Wheel w(1s, start);
+
+    w.schedule("a", start + 5s);
+    w.schedule("b", start + 2h);
+    w.schedule("a", start + 1h);
+
+    BOOST_REQUIRE_EQUAL(w.size(), 2u);
+    BOOST_REQUIRE(*w.due_time("a") == start + 1h);
+    BOOST_REQUIRE(w.expire(start + 30min).empty());
+
+    BOOST_REQUIRE(w.cancel("b"));
+    BOOST_REQUIRE(!w.cancel("b"));
+    BOOST_REQUIRE(!w.contains("b"));
+
+    BOOST_REQUIRE(w.expire(start + 1h) == vector<string>{"a"});
+    BOOST_REQUIRE(w.empty());
+}
+
+// Follow `next_event` like a user of the wheel would,
+// and check that every key expires at its time (and only once).
+BOOST_AUTO_TEST_CASE(test_random) {
+    auto start = Clock::now();
+    Wheel w(1s, start);
+
+    mt19937 rng(42);
+    map<string, Clock::time_point> due;
+
+    for (int i = 0; i < 5000; ++i) {
+        // Some beyond the range of all levels (~194 days).
+        auto secs = (i % 10 == 0) ? rng() % (400 * 24 * 3600) : rng() % 100000;
+        auto key = to_string(i);
+        due[key] = start + chrono::seconds(secs);
+        w.schedule(key, due[key]);
+    }
+
+    // Cancel a few.
+    for (int i = 1; i < 5000; i += 100) {
+        BOOST_REQUIRE(w.cancel(to_string(i)));
+        due.erase(to_string(i));
+    }
+
+    size_t expired = 0;
+    while (auto next = w.next_event()) {
+        for (auto& key : w.expire(*next)) {
+            BOOST_REQUIRE(due.count(key));
+            BOOST_REQUIRE(due[key] <= *next);
+            BOOST_REQUIRE(*next - due[key] < 1s);
+            due.erase(key);
+            ++expired;
+        }
+    }
+
+    BOOST_REQUIRE(due.empty());
+    BOOST_REQUIRE_EQUAL(expired, 5000u - 50u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
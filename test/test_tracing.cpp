@@ -0,0 +1,89 @@
+#define BOOST_TEST_MODULE tracing
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <sstream>
+#include <namespaces.h>
+#include <util/yield.h>
+
+BOOST_AUTO_TEST_SUITE(ouinet_tracing)
+
+using namespace std;
+using namespace ouinet;
+
+static
+string traces_json()
+{
+    ostringstream ss;
+    tracing::tracer().write_chrome_trace(ss);
+    return ss.str();
+}
+
+static
+void sleep(asio::io_context& ctx, chrono::milliseconds d, Yield yield)
+{
+    asio::steady_timer t(ctx);
+    t.expires_after(d);
+    yield.run([&] (auto y) { t.async_wait(y); });
+}
+
+BOOST_AUTO_TEST_CASE(test_spans) {
+    asio::io_context ctx;
+
+    tracing::tracer().enable(2);
+
+    asio::spawn(ctx, [&] (asio::yield_context yield_) {
+        Yield yield(ctx, yield_);
+        yield.start_trace("GET http://example.com/");
+
+        sys::error_code ec;
+        {
+            auto y = yield[ec].tag("fetch");
+            sleep(ctx, chrono::milliseconds(10), y.tag("connect"));
+            or_throw(y.tag("read_hdr"), asio::error::timed_out);
+        }
+        BOOST_REQUIRE_EQUAL(ec, asio::error::timed_out);
+    });
+
+    ctx.run();
+
+    BOOST_REQUIRE_EQUAL(tracing::tracer().size(), 1u);
+
+    auto json = traces_json();
+    BOOST_REQUIRE(json.find("\"name\":\"GET http://example.com/\"") != string::npos);
+    BOOST_REQUIRE(json.find("\"name\":\"fetch\"") != string::npos);
+    BOOST_REQUIRE(json.find("\"name\":\"connect\"") != string::npos);
+    BOOST_REQUIRE(json.find("\"name\":\"read_hdr\"") != string::npos);
+    BOOST_REQUIRE(json.find("\"ec\":\"" + sys::error_code(asio::error::timed_out).message())
+                  != string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_ring_and_min_duration) {
+    asio::io_context ctx;
+
+    tracing::tracer().enable(2, chrono::milliseconds(20));
+
+    asio::spawn(ctx, [&] (asio::yield_context yield_) {
+        for (int i = 0; i < 4; ++i) {
+            Yield yield(ctx, yield_);
+            yield.start_trace(util::str("slow", i));
+            sleep(ctx, chrono::milliseconds(25), yield.tag("wait"));
+        }
+        Yield yield(ctx, yield_);
+        yield.start_trace("fast");
+    });
+
+    ctx.run();
+
+    auto json = traces_json();
+    BOOST_REQUIRE_EQUAL(tracing::tracer().size(), 2u);
+    BOOST_REQUIRE(json.find("\"slow1\"") == string::npos);
+    BOOST_REQUIRE(json.find("\"slow3\"") != string::npos);
+    BOOST_REQUIRE(json.find("\"fast\"") == string::npos);
+
+    tracing::tracer().enable(0);
+    BOOST_REQUIRE_EQUAL(tracing::tracer().size(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()